@@ -0,0 +1,211 @@
+"""
+This module implements the host side of the windowed bulk transfer protocol, which is
+used to move large blobs (i.e. firmware images or file contents) to and from a device.
+See BulkPacketHandler.h for a description of the protocol.
+"""
+
+import logging
+import queue
+from typing import Callable, Tuple, Union
+
+from duino_bus.bus import IBus, RESPONSE_TIMEOUT_SEC, STREAM_END
+from duino_bus.packer import Packer
+from duino_bus.packet import ErrorCode, Packet
+from duino_bus.unpacker import Unpacker
+
+LOGGER = logging.getLogger(__name__)
+
+LITTLEFS_COMMAND_BASE = 0x40
+
+BULK_READ = LITTLEFS_COMMAND_BASE + 0x00  # Start a read (device to host)
+BULK_WRITE = LITTLEFS_COMMAND_BASE + 0x01  # Start a write (host to device)
+BULK_DATA = LITTLEFS_COMMAND_BASE + 0x02  # A chunk of data
+BULK_ACK = LITTLEFS_COMMAND_BASE + 0x03  # Acknowledgement
+
+BULK_STATUS_OK = 0  # The transfer was started
+BULK_STATUS_STRS = ['OK', 'NO_BLOB', 'BAD_OFFSET', 'BAD_REQUEST', 'TOO_SMALL']
+
+ACK_NAK = 0x01  # Resend the data starting at the offset
+ACK_ABORT = 0x02  # The transfer has been aborted
+
+RESUME_OFFSET = 0xFFFFFFFF  # Resumes the previous write to a blob
+END_OF_BLOB = 0xFFFFFFFF  # Reads up to the end of the blob
+
+DEFAULT_WINDOW = 8  # Number of chunks which can be outstanding
+MAX_RETRIES = 3  # Number of consecutive timeouts before a transfer is abandoned
+
+# Called with (offset, data) for each chunk which is read.
+ReadSink = Callable[[int, Union[bytes, bytearray]], None]
+
+# Called with (offset, length) to get the data for each chunk which is written.
+WriteSource = Callable[[int, int], Union[bytes, bytearray]]
+
+
+class BulkTransfer:
+    """Transfers blobs to and from a device which has a BulkPacketHandler."""
+
+    def __init__(self,
+                 bus: IBus,
+                 channel: Union[int, None] = None,
+                 window: int = DEFAULT_WINDOW,
+                 timeout: int = RESPONSE_TIMEOUT_SEC) -> None:
+        self.bus = bus
+        self.channel = channel
+        self.window = window
+        self.timeout = timeout
+
+    def make_packet(self, cmd: int) -> Packet:
+        """Creates a packet to send to the device, on the bulk channel."""
+        pkt = Packet(cmd)
+        pkt.set_channel(self.channel)
+        return pkt
+
+    def start(self, cmd: int, blob_id: int, offset: int,
+              end_offset: int) -> Tuple[int, int, int, int]:
+        """Sends a BULK_READ or BULK_WRITE command.
+           Returns the error, and the offset, end offset and chunk size from the response.
+        """
+        pkt = self.make_packet(cmd)
+        packer = Packer(pkt)
+        packer.pack_u8(blob_id)
+        packer.pack_u32(offset)
+        packer.pack_u32(end_offset)
+        packer.pack_u8(self.window)
+        err, rsp = self.bus.send_command_get_response(pkt, self.timeout)
+        if err != ErrorCode.NONE:
+            return (err, 0, 0, 0)
+        unpacker = Unpacker(rsp.get_data())
+        status = unpacker.unpack_u8()
+        offset = unpacker.unpack_u32()
+        end_offset = unpacker.unpack_u32()
+        chunk_size = unpacker.unpack_u16()
+        if status != BULK_STATUS_OK:
+            status_str = BULK_STATUS_STRS[status] if status < len(BULK_STATUS_STRS) else '???'
+            LOGGER.error(f'Bulk transfer of blob {blob_id} failed: {status_str}')
+            return (ErrorCode.BAD_STATE, offset, end_offset, chunk_size)
+        return (ErrorCode.NONE, offset, end_offset, chunk_size)
+
+    def send_ack(self, offset: int, flags: int) -> None:
+        """Acknowledges the data received by a read."""
+        pkt = self.make_packet(BULK_ACK)
+        packer = Packer(pkt)
+        packer.pack_u32(offset)
+        packer.pack_u8(flags)
+        self.bus.write_packet(pkt)
+
+    def read(self,
+             blob_id: int,
+             offset: int = 0,
+             end_offset: int = END_OF_BLOB,
+             sink: Union[ReadSink, None] = None) -> Tuple[int, bytearray]:
+        """Reads a blob from the device, starting at offset. If sink is provided, each chunk
+           is passed to it as it arrives, otherwise the data is returned.
+           An interrupted read can be resumed by passing in the number of bytes received.
+        """
+        err, offset, end_offset, _ = self.start(BULK_READ, blob_id, offset, end_offset)
+        data = bytearray()
+        if err != ErrorCode.NONE:
+            return (err, data)
+        num_unacked = 0
+        nak_sent = False
+        retries = 0
+        while True:
+            try:
+                pkt = self.bus.recv_queue.get(block=True, timeout=self.timeout)
+            except queue.Empty:
+                retries += 1
+                if retries > MAX_RETRIES:
+                    LOGGER.error(f'Timeout reading blob {blob_id} at offset {offset}')
+                    self.send_ack(offset, ACK_ABORT)
+                    return (ErrorCode.TIMEOUT, data)
+                self.send_ack(offset, ACK_NAK)
+                continue
+            cmd = pkt.get_command()
+            if cmd == STREAM_END:
+                break
+            if cmd != BULK_DATA:
+                LOGGER.warning(f'Unexpected packet 0x{cmd:02x} during bulk read')
+                continue
+            unpacker = Unpacker(pkt.get_data())
+            chunk_offset = unpacker.unpack_u32()
+            if chunk_offset != offset:
+                # Chunks which arrive out of order are dropped. Only the first one after a
+                # gap is NAK'd, since the rest of the window is probably already on its way.
+                if not nak_sent:
+                    nak_sent = True
+                    self.send_ack(offset, ACK_NAK)
+                continue
+            chunk = unpacker.unpack_data(pkt.get_data_len() - 4)
+            if sink is None:
+                data.extend(chunk)
+            else:
+                sink(offset, chunk)
+            offset += len(chunk)
+            num_unacked += 1
+            retries = 0
+            if nak_sent or offset == end_offset or num_unacked >= (self.window + 1) // 2:
+                self.send_ack(offset, 0)
+                num_unacked = 0
+                nak_sent = False
+        if offset != end_offset:
+            LOGGER.error(f'Bulk read of blob {blob_id} ended at {offset} rather than {end_offset}')
+            return (ErrorCode.TOO_SMALL, data)
+        return (ErrorCode.NONE, data)
+
+    def write(self,
+              blob_id: int,
+              source: Union[bytes, bytearray, WriteSource],
+              offset: int = 0,
+              end_offset: Union[int, None] = None) -> int:
+        """Writes a blob to the device, starting at offset. source is either the entire
+           blob, or a function which returns the data for each chunk (in which case
+           end_offset is required). Passing in RESUME_OFFSET resumes the previous write.
+        """
+        if isinstance(source, (bytes, bytearray)):
+            blob = source
+
+            def blob_source(chunk_offset: int, chunk_len: int) -> Union[bytes, bytearray]:
+                return blob[chunk_offset:chunk_offset + chunk_len]
+
+            source = blob_source
+            if end_offset is None:
+                end_offset = len(blob)
+        err, offset, end_offset, chunk_size = self.start(BULK_WRITE, blob_id, offset, end_offset)
+        if err != ErrorCode.NONE:
+            return err
+        acked_offset = offset
+        retries = 0
+        while acked_offset < end_offset:
+            while offset < end_offset and offset - acked_offset < self.window * chunk_size:
+                chunk_len = min(chunk_size, end_offset - offset)
+                pkt = self.make_packet(BULK_DATA)
+                packer = Packer(pkt)
+                packer.pack_u32(offset)
+                packer.pack_data(source(offset, chunk_len))
+                self.bus.write_packet(pkt)
+                offset += chunk_len
+            try:
+                pkt = self.bus.recv_queue.get(block=True, timeout=self.timeout)
+            except queue.Empty:
+                retries += 1
+                if retries > MAX_RETRIES:
+                    LOGGER.error(f'Timeout writing blob {blob_id} at offset {acked_offset}')
+                    return ErrorCode.TIMEOUT
+                # Go back to the last acknowledged offset.
+                offset = acked_offset
+                continue
+            if pkt.get_command() != BULK_ACK:
+                LOGGER.warning(f'Unexpected packet 0x{pkt.get_command():02x} during bulk write')
+                continue
+            unpacker = Unpacker(pkt.get_data())
+            ack_offset = unpacker.unpack_u32()
+            flags = unpacker.unpack_u8()
+            if flags & ACK_ABORT:
+                LOGGER.error(f'Bulk write of blob {blob_id} aborted at offset {ack_offset}')
+                return ErrorCode.BAD_STATE
+            if ack_offset > acked_offset:
+                acked_offset = ack_offset
+                retries = 0
+            if flags & ACK_NAK:
+                offset = ack_offset
+        return ErrorCode.NONE
@@ -7,8 +7,9 @@ import logging
 import queue
 import select
 import threading
-from typing import Tuple, Union
+from typing import Any, Callable, Dict, List, Tuple, Union
 
+from duino_bus.log_format import format_log
 from duino_bus.packet import ErrorCode, Packet
 from duino_bus.packet_decoder import PacketDecoder
 from duino_bus.packet_encoder import PacketEncoder
@@ -19,7 +20,68 @@ LOGGER = logging.getLogger(__name__)
 RESPONSE_TIMEOUT_SEC = 1  # Time to wait for responses.
 
 LOG = 0x03  # Log message
-EVENT = 0x04  # Event message
+BATCH = 0x06  # Runs several commands at once
+STREAM_END = 0x07  # End of a streamed response
+LOG_FORMAT = 0x08  # Binary log format string
+LOG_BINARY = 0x09  # Binary log message
+LOG_BATCH = 0x0A  # Several log messages
+LOG_TIMED = 0x0B  # Timestamped log message
+LOG_CONFIG = 0x0C  # Sets the log levels for each module
+EVENT = 0x0D  # Event messages
+EVENT_SUBSCRIBE = 0x0E  # Subscribes to events
+TELEMETRY_SUBSCRIBE = 0x0F  # Streams telemetry records
+TELEMETRY = 0x10  # Telemetry record
+STATS = 0x11  # Returns bus statistics
+LATENCY = 0x12  # Returns command latencies
+
+LOG_ALL_MODULES = 0xFF  # LOG_CONFIG module which configures all of the modules
+
+EVENT_UNSUBSCRIBE = 0xFFFF  # EVENT_SUBSCRIBE interval which unsubscribes from an event
+
+# Status returned for each event in the EVENT_SUBSCRIBE response
+EVENT_STATUS_OK = 0
+EVENT_STATUS_FULL = 1
+
+TELEMETRY_KEYFRAME = 0x01  # Set in TELEMETRY records whose values are absolute, not deltas
+
+STATS_RESET = 0x01  # STATS flag which resets the counters after they're read
+
+# Names of the counters in the STATS response (from duino_bus/BusStats.h).
+STATS_FIELDS = (
+    'rx_frames',
+    'rx_bytes',
+    'rx_crc_errors',
+    'rx_too_much_data',
+    'rx_too_small',
+    'rx_timeouts',
+    'rx_discarded',
+    'tx_frames',
+    'tx_bytes',
+    'tx_overhead',
+    'unhandled',
+)
+
+# Names of the values in a TELEMETRY record (the HEAP_INFO values, followed by the
+# STACK_INFO values, followed by the STATS counters).
+TELEMETRY_FIELDS = (
+    'heap_size',
+    'heap_allocated',
+    'heap_free',
+    'heap_largest_free',  # Upper bound, in bytes (the device reports the number of free bytes)
+    'heap_growth_potential',
+    'heap_high_water',
+    'stack_size',
+    'stack_used',
+    'stack_unused',
+) + STATS_FIELDS
+
+LATENCY_RESET = 0x01  # LATENCY flag which resets the histogram after it's read
+
+# Number of linear buckets in each power of 2 of a latency histogram
+# (from duino_bus/LatencyHistogram.h).
+LATENCY_SUB_BUCKETS = 4
+
+BATCH_MAX_LEN = 0xFF  # Maximum length of the data in a BATCH sub-command or response
 
 # Logging levels (from duino_log/src/duino_log/Log.h)
 LOG_LEVEL_NONE = 0
@@ -39,6 +101,18 @@ PYTHON_LOG_LEVEL = [
 ]
 
 
+def log_level_mask(level: int) -> int:
+    """Returns the LOG_CONFIG mask which enables the given level and the levels below it."""
+    return (1 << (level + 1)) - 2 if level > LOG_LEVEL_NONE else 0
+
+
+def latency_bucket_lower_bound(idx: int) -> int:
+    """Returns the smallest latency (in microseconds) stored in a LATENCY histogram bucket."""
+    if idx < LATENCY_SUB_BUCKETS:
+        return idx
+    return (LATENCY_SUB_BUCKETS + idx % LATENCY_SUB_BUCKETS) << (idx // LATENCY_SUB_BUCKETS - 1)
+
+
 class IBus:
     """Base class for abstracting access to various serial type devices."""
 
@@ -50,6 +124,14 @@ class IBus:
         self.fileno = -1
         self.thread = None
         self.recv_queue = queue.Queue()
+        self.log_formats = {}  # Format strings for binary log messages, indexed by ID
+        self.log_dropped = 0  # Number of log messages that the device has dropped
+        self.event_values = {}  # Latest value of each event, indexed by ID
+        # Called with the ID and value of each event which is received
+        self.event_callback: Union[Callable[[int, bytes], None], None] = None
+        self.telemetry: Union[List[int], None] = None  # Values from the latest TELEMETRY record
+        # Called with the values from each TELEMETRY record which is received
+        self.telemetry_callback: Union[Callable[[List[int]], None], None] = None
 
     def close(self) -> None:
         """Closed a previously opened bus."""
@@ -116,6 +198,172 @@ class IBus:
         self.decoder.set_debug(debug)
         self.encoder.set_debug(debug)
 
+    def set_framing(self, framing: int) -> None:
+        """Sets the framing (Packet.FRAMING_xxx) used to send and receive packets.
+           This needs to match the framing used by the device.
+        """
+        self.decoder.set_framing(framing)
+        self.encoder.set_framing(framing)
+
+    def set_crc_type(self, crc_type: int) -> None:
+        """Sets the type of CRC (Packet.CRC_xxx) used to protect packets.
+           This needs to match the type of CRC used by the device.
+        """
+        self.decoder.set_crc_type(crc_type)
+        self.encoder.set_crc_type(crc_type)
+
+    def set_addressing(self, addressed: bool) -> None:
+        """Enables or disables node addressing, for use on multi-drop buses.
+           When enabled, packets are sent to the node address stored in the packet (or
+           broadcast if the packet has no address), and responses from all nodes are accepted.
+        """
+        self.decoder.set_addressing(addressed)
+        self.encoder.set_addressing(addressed)
+
+    def set_channels(self, channels: bool) -> None:
+        """Enables or disables logical channels. This needs to match the device, which
+           enables logical channels when a channel is added to the bus. Packets without a
+           channel are sent on Packet.CHANNEL_CONTROL.
+        """
+        self.decoder.set_channels(channels)
+        self.encoder.set_channels(channels)
+
+    @staticmethod
+    def make_batch(cmd_pkts: List[Packet]) -> Packet:
+        """Combines several small commands into a single BATCH command."""
+        data = bytearray()
+        for cmd_pkt in cmd_pkts:
+            if cmd_pkt.get_data_len() > BATCH_MAX_LEN:
+                raise ValueError(f'BATCH sub-command has {cmd_pkt.get_data_len()} bytes of data')
+            data.append(cmd_pkt.get_command())
+            data.append(cmd_pkt.get_data_len())
+            data.extend(cmd_pkt.get_data())
+        return Packet(BATCH, data)
+
+    @staticmethod
+    def split_batch(rsp_pkt: Packet) -> List[Packet]:
+        """Splits a BATCH response into the responses for each sub-command.
+           Sub-commands which had no response (or weren't handled) have a command of 0.
+           If the device ran out of room, there will be fewer responses than sub-commands.
+        """
+        rsp_pkts = []
+        data = rsp_pkt.get_data()
+        idx = 0
+        while idx + 2 <= len(data):
+            cmd = data[idx]
+            data_len = data[idx + 1]
+            idx += 2
+            rsp_pkts.append(Packet(cmd, data[idx:idx + data_len]))
+            idx += data_len
+        return rsp_pkts
+
+    def send_batch(self,
+                   cmd_pkts: List[Packet],
+                   timeout: int = RESPONSE_TIMEOUT_SEC) -> Tuple[int, List[Packet]]:
+        """Sends several commands as a single BATCH command, and returns their responses."""
+        err, rsp_pkt = self.send_command_get_response(IBus.make_batch(cmd_pkts), timeout)
+        if err != ErrorCode.NONE:
+            return (err, [])
+        return (ErrorCode.NONE, IBus.split_batch(rsp_pkt))
+
+    def send_log_config(self,
+                        masks: List[Tuple[int, int]],
+                        timeout: int = RESPONSE_TIMEOUT_SEC) -> Tuple[int, List[int]]:
+        """Sets the log level masks for some modules. masks is a list of (module, mask)
+           tuples, which are applied in order. Returns the resulting mask for each module,
+           or for as many modules as fit in the device's response packet.
+        """
+        data = bytearray()
+        for module, mask in masks:
+            data.append(module)
+            data.append(mask)
+        err, rsp_pkt = self.send_command_get_response(Packet(LOG_CONFIG, data), timeout)
+        if err != ErrorCode.NONE:
+            return (err, [])
+        return (ErrorCode.NONE, list(rsp_pkt.get_data()))
+
+    def send_event_subscribe(self,
+                             intervals: List[Tuple[int, int]],
+                             timeout: int = RESPONSE_TIMEOUT_SEC) -> Tuple[int, List[int]]:
+        """Subscribes to some events. intervals is a list of (event ID, interval) tuples,
+           where the interval is the minimum number of milliseconds between sending the
+           event (or EVENT_UNSUBSCRIBE). Returns the status for each event.
+        """
+        data = bytearray()
+        for event_id, interval_ms in intervals:
+            data += event_id.to_bytes(2, 'little')
+            data += interval_ms.to_bytes(2, 'little')
+        err, rsp_pkt = self.send_command_get_response(Packet(EVENT_SUBSCRIBE, data), timeout)
+        if err != ErrorCode.NONE:
+            return (err, [])
+        return (ErrorCode.NONE, list(rsp_pkt.get_data()))
+
+    def send_telemetry_subscribe(self,
+                                 interval_ms: int,
+                                 timeout: int = RESPONSE_TIMEOUT_SEC) -> Tuple[int, int]:
+        """Asks the device to send a TELEMETRY record every interval_ms milliseconds
+           (0 stops them). Returns the number of values in each record.
+        """
+        self.telemetry = None
+        data = interval_ms.to_bytes(2, 'little')
+        err, rsp_pkt = self.send_command_get_response(Packet(TELEMETRY_SUBSCRIBE, data), timeout)
+        if err != ErrorCode.NONE:
+            return (err, 0)
+        return (ErrorCode.NONE, rsp_pkt.get_data()[2])
+
+    def send_stats(self,
+                   reset: bool = False,
+                   timeout: int = RESPONSE_TIMEOUT_SEC) -> Tuple[int, Dict[str, int]]:
+        """Reads the device's bus counters, optionally resetting them. Returns a dictionary
+           keyed by the names in STATS_FIELDS. Counters added by newer devices are keyed
+           by their index.
+        """
+        data = bytes([STATS_RESET if reset else 0])
+        err, rsp_pkt = self.send_command_get_response(Packet(STATS, data), timeout)
+        if err != ErrorCode.NONE:
+            return (err, {})
+        unpacker = Unpacker(rsp_pkt.get_data())
+        num_counters = unpacker.unpack_u8()
+        stats = {}
+        for idx in range(num_counters):
+            name = STATS_FIELDS[idx] if idx < len(STATS_FIELDS) else str(idx)
+            stats[name] = unpacker.unpack_varint()
+        return (ErrorCode.NONE, stats)
+
+    def send_latency_commands(self,
+                              timeout: int = RESPONSE_TIMEOUT_SEC) -> Tuple[int, List[int]]:
+        """Returns the commands which the device has recorded latencies for."""
+        err, rsp_pkt = self.send_command_get_response(Packet(LATENCY), timeout)
+        if err != ErrorCode.NONE:
+            return (err, [])
+        return (ErrorCode.NONE, list(rsp_pkt.get_data()))
+
+    def send_latency(self,
+                     command: int,
+                     reset: bool = False,
+                     timeout: int = RESPONSE_TIMEOUT_SEC) -> Tuple[int, Dict[str, Any]]:
+        """Reads the latency histogram for a command, optionally resetting it. Returns a
+           dictionary containing the count, the max_us and the buckets, which map the
+           lower bound of each bucket (in microseconds) to the number of latencies in it.
+           truncated is set if the device's response packet was too small for all of the
+           buckets, in which case the histogram wasn't reset.
+        """
+        data = bytes([command, LATENCY_RESET if reset else 0])
+        err, rsp_pkt = self.send_command_get_response(Packet(LATENCY, data), timeout)
+        if err != ErrorCode.NONE:
+            return (err, {})
+        unpacker = Unpacker(rsp_pkt.get_data())
+        unpacker.unpack_u8()
+        latency = {'count': unpacker.unpack_varint(), 'max_us': unpacker.unpack_varint()}
+        num_buckets = unpacker.unpack_u8()
+        buckets = {}
+        for _ in range(num_buckets):
+            idx = unpacker.unpack_u8()
+            buckets[latency_bucket_lower_bound(idx)] = unpacker.unpack_varint()
+        latency['buckets'] = buckets
+        latency['truncated'] = sum(buckets.values()) < latency['count']
+        return (ErrorCode.NONE, latency)
+
     def send_command_get_response(
             self,
             cmd_pkt: Packet,
@@ -136,6 +384,32 @@ class IBus:
             return (ErrorCode.TIMEOUT, None)
         return (ErrorCode.NONE, rsp_pkt)
 
+    def send_command_get_stream(
+            self,
+            cmd_pkt: Packet,
+            timeout: int = RESPONSE_TIMEOUT_SEC) -> Tuple[int, List[Packet]]:
+        """Sends a command whose response is streamed as several packets, and waits for
+           all of them to arrive. The timeout applies to each packet.
+        """
+        err, rsp_pkt = self.send_command_get_response(cmd_pkt, timeout)
+        rsp_pkts = []
+        while err == ErrorCode.NONE:
+            if rsp_pkt.get_command() == STREAM_END:
+                unpacker = Unpacker(rsp_pkt.get_data())
+                unpacker.unpack_u8()  # Command that was streamed
+                count = unpacker.unpack_u32()
+                if count != len(rsp_pkts):
+                    LOGGER.error(f'Stream had {count} packets but {len(rsp_pkts)} were received')
+                    return (ErrorCode.TOO_SMALL, rsp_pkts)
+                return (ErrorCode.NONE, rsp_pkts)
+            rsp_pkts.append(rsp_pkt)
+            try:
+                rsp_pkt = self.recv_queue.get(block=True, timeout=timeout)
+            except queue.Empty:
+                LOGGER.error('Timeout waiting for streamed response')
+                err = ErrorCode.TIMEOUT
+        return (err, rsp_pkts)
+
     def incoming_data_thread(self) -> None:
         """Process incoming data, automatically handling event messages."""
         poll = select.poll()
@@ -156,17 +430,88 @@ class IBus:
                         return
         LOGGER.debug('incoming_data_thread: exiting')
 
-    def process_packet(self, pkt: Packet) -> None:
-        """Processes a received packet."""
+    def log_message(self, level: int, msg: str, timestamp: Union[int, None] = None) -> None:
+        """Logs a message received from the device. The timestamp is in milliseconds."""
+        if timestamp is not None:
+            msg = f'[{timestamp / 1000:.3f}] {msg}'
+        if level >= len(PYTHON_LOG_LEVEL):
+            logging_level = logging.ERROR
+        else:
+            logging_level = PYTHON_LOG_LEVEL[level]
+        LOGGER.log(logging_level, msg)
+
+    def process_event(self, event_id: int, value: bytes) -> None:
+        """Processes an event received from the device."""
+        self.event_values[event_id] = value
+        if self.event_callback is not None:
+            self.event_callback(event_id, value)
+
+    def process_telemetry(self, pkt: Packet) -> None:
+        """Processes a TELEMETRY record, whose values are either absolute (for keyframes) or
+           changes from the previous record.
+        """
+        unpacker = Unpacker(pkt.get_data())
+        flags = unpacker.unpack_u8()
+        num_values = unpacker.unpack_u8()
+        if flags & TELEMETRY_KEYFRAME:
+            values = [unpacker.unpack_varint() for _ in range(num_values)]
+        elif self.telemetry is None or len(self.telemetry) != num_values:
+            # We missed the keyframe, so wait for the next one.
+            return
+        else:
+            values = [(prev + unpacker.unpack_signed_varint()) & 0xffffffff
+                      for prev in self.telemetry]
+        self.telemetry = values
+        if self.telemetry_callback is not None:
+            self.telemetry_callback(values)
+
+    def process_packet(self, pkt: Packet, timestamp: Union[int, None] = None) -> None:
+        """Processes a received packet. The timestamp comes from LOG_TIMED packets."""
         cmd = pkt.get_command()
         if cmd == LOG:
             unpacker = Unpacker(pkt.get_data())
             level = unpacker.unpack_u8()
-            msg = unpacker.unpack_str()
-            if level >= len(PYTHON_LOG_LEVEL):
-                logging_level = logging.ERROR
+            self.log_message(level, unpacker.unpack_str(), timestamp)
+        elif cmd == LOG_FORMAT:
+            unpacker = Unpacker(pkt.get_data())
+            fmt_id = unpacker.unpack_u16()
+            self.log_formats[fmt_id] = unpacker.unpack_str()
+        elif cmd == LOG_BINARY:
+            unpacker = Unpacker(pkt.get_data())
+            level = unpacker.unpack_u8()
+            fmt_id = unpacker.unpack_u16()
+            fmt = self.log_formats.get(fmt_id)
+            if fmt is None:
+                self.log_message(level, f'Binary log message with unknown format ID {fmt_id}',
+                                 timestamp)
             else:
-                logging_level = PYTHON_LOG_LEVEL[level]
-            LOGGER.log(logging_level, msg)
+                self.log_message(level, format_log(fmt, unpacker), timestamp)
+        elif cmd == LOG_BATCH:
+            unpacker = Unpacker(pkt.get_data())
+            num_dropped = unpacker.unpack_u32()
+            if num_dropped < self.log_dropped:
+                # The count went backwards, so the device was reset and has been counting
+                # from zero since then.
+                self.log_dropped = 0
+            if num_dropped != self.log_dropped:
+                LOGGER.warning('Device dropped %d log messages', num_dropped - self.log_dropped)
+                self.log_dropped = num_dropped
+            while unpacker.more_data():
+                log_cmd = unpacker.unpack_u8()
+                log_len = unpacker.unpack_u8()
+                self.process_packet(Packet(log_cmd, unpacker.unpack_data(log_len)))
+        elif cmd == LOG_TIMED:
+            unpacker = Unpacker(pkt.get_data())
+            log_timestamp = unpacker.unpack_u32()
+            log_cmd = unpacker.unpack_u8()
+            self.process_packet(Packet(log_cmd, pkt.get_data()[unpacker.idx:]), log_timestamp)
+        elif cmd == EVENT:
+            unpacker = Unpacker(pkt.get_data())
+            while unpacker.more_data():
+                event_id = unpacker.unpack_u16()
+                event_len = unpacker.unpack_u8()
+                self.process_event(event_id, bytes(unpacker.unpack_data(event_len)))
+        elif cmd == TELEMETRY:
+            self.process_telemetry(pkt)
         else:
             self.recv_queue.put(pkt)
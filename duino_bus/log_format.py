@@ -0,0 +1,72 @@
+"""
+This module formats binary log messages (LOG_BINARY packets) on the host.
+See BusLog.h for a description of how the arguments are encoded.
+"""
+
+import re
+import struct
+
+from duino_bus.unpacker import Unpacker
+
+# Matches a printf style conversion: flags, width, precision, length modifier and
+# conversion.
+CONVERSION_RE = re.compile(r'%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|j|z|t|L)?(.?)')
+
+WIDE_LENGTHS = ('l', 'll', 'j', 'z', 't')
+
+
+def unpack_int(unpacker: Unpacker, length: str, signed: bool) -> int:
+    """Unpacks an integer argument, and applies the length modifier to it."""
+    if length in WIDE_LENGTHS:
+        num_bits = 64
+    elif length == 'hh':
+        num_bits = 8
+    elif length == 'h':
+        num_bits = 16
+    else:
+        num_bits = 32
+    num_bytes = 8 if num_bits == 64 else 4
+    val = int.from_bytes(unpacker.unpack_data(num_bytes), 'little')
+    val &= (1 << num_bits) - 1
+    if signed and val & (1 << (num_bits - 1)):
+        val -= 1 << num_bits
+    return val
+
+
+def unpack_i32(unpacker: Unpacker) -> int:
+    """Unpacks a `*` width or precision."""
+    return unpack_int(unpacker, '', True)
+
+
+def format_log(fmt: str, unpacker: Unpacker) -> str:
+    """Formats a binary log message, using the arguments from unpacker."""
+
+    def convert(match: re.Match) -> str:
+        flags, width, precision, length, conv = match.groups()
+        if conv == '%':
+            return '%'
+        if width == '*':
+            width = str(unpack_i32(unpacker))
+        if precision == '*':
+            precision = str(unpack_i32(unpacker))
+        spec = '%' + flags + (width or '')
+        if precision is not None:
+            spec += '.' + precision
+        if conv in 'di':
+            return (spec + 'd') % unpack_int(unpacker, length, True)
+        if conv in 'uoxX':
+            return (spec + ('d' if conv == 'u' else conv)) % unpack_int(unpacker, length, False)
+        if conv == 'c':
+            return (spec + 'c') % chr(unpacker.unpack_u8())
+        if conv == 'p':
+            return (spec + 's') % hex(int.from_bytes(unpacker.unpack_data(8), 'little'))
+        if conv in 'eEfFgGaA':
+            val = struct.unpack('<d', unpacker.unpack_data(8))[0]
+            if conv in 'aA':
+                return (spec + 's') % val.hex()
+            return (spec + conv) % val
+        if conv == 's':
+            return (spec + 's') % unpacker.unpack_str()
+        return match.group(0)
+
+    return CONVERSION_RE.sub(convert, fmt)
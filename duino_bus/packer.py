@@ -2,7 +2,8 @@
 This modules implements a binary packer.
 """
 
-from typing import Union
+import struct
+from typing import Sequence, Union
 
 from duino_bus.packet import Packet
 
@@ -32,10 +33,32 @@ class Packer:
         self.data.append((data >> 16) & 0xff)
         self.data.append((data >> 24) & 0xff)
 
+    def pack_varint(self, data: int) -> None:
+        """Packs an unsigned integer as a varint: 7 bits per byte, least significant first,
+           with the top bit set on every byte except the last.
+        """
+        while data >= 0x80:
+            self.data.append((data & 0x7f) | 0x80)
+            data >>= 7
+        self.data.append(data)
+
+    def pack_signed_varint(self, data: int) -> None:
+        """Packs a signed 32-bit integer as a zigzag encoded varint."""
+        self.pack_varint(((data << 1) ^ (data >> 31)) & 0xffffffff)
+
     def pack_data(self, s: Union[bytes, bytearray]) -> None:
         """Packs arbitrary data into the binary data."""
         self.data.extend(s)
 
+    def pack_array(self, elem_fmt: str, values: Sequence[Union[int, float]]) -> None:
+        """Packs an array into the binary data.
+           elem_fmt is a struct format character (i.e. 'h' for int16) describing each element.
+           Arrays are encoded with a 16-bit element count followed by the elements, all
+           in little-endian order.
+        """
+        self.pack_u16(len(values))
+        self.pack_data(struct.pack(f'<{len(values)}{elem_fmt}', *values))
+
     def pack_str(self, s: Union[str, bytes, bytearray]) -> None:
         """Packs a string into the binary data.
            Strings are encoded with an 8-bit length, the string data and a terminating null.
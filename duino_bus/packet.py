@@ -42,6 +42,10 @@ class Packet:
     The first byte of each packet is the command.
     The last byte of the packet is an 8-bit CRC (crcmod.predefined.mkCrcFun('crc-8'))
     Each packet has data bytes between the command and the CRC.
+    Wider CRCs (or no CRC) can be selected per bus, and are stored in little-endian order.
+    On multi-drop buses a node address byte can follow the command (covered by the CRC).
+    When logical channels are enabled, a channel byte follows the command and node address
+    (also covered by the CRC).
     """
 
     END = 0xC0  # Start/End of Frame
@@ -49,6 +53,28 @@ class Packet:
     ESC_END = 0xDC  # Escape an END character
     ESC_ESC = 0xDD  # Escape an ESC character
 
+    COBS_DELIM = 0x00  # Start/End of a COBS frame
+    COBS_MAX_CODE = 0xFF  # Code for a run of 254 non-zero bytes
+
+    BROADCAST_ADDRESS = 0xFF  # Node address which is accepted by all nodes
+
+    # Well known logical channels (must match BusChannel)
+    CHANNEL_CONTROL = 0  # Commands and responses
+    CHANNEL_BULK = 1  # Bulk data transfers
+    CHANNEL_LOG = 2  # Log messages
+    CHANNEL_EVENT = 3  # Asynchronous events
+
+    # Framing used to delimit packets over the wire (must match Packet::Framing)
+    FRAMING_SLIP = 0  # SLIP encoding (the default)
+    FRAMING_COBS = 1  # COBS encoding, with frames delimited by 0x00
+    FRAMING_LENGTH = 2  # 16-bit little-endian length, followed by the packet bytes
+
+    # CRC used to protect packets (must match Packet::CrcType)
+    CRC_8 = 0  # 8-bit CRC (the default)
+    CRC_16 = 1  # CRC-16/CCITT
+    CRC_32C = 2  # CRC-32C (Castagnoli)
+    CRC_NONE = 3  # No CRC, for transports which are already reliable
+
     STATE_IDLE = 0  # Haven't started parsing a packet yet.
     STATE_PACKET = 1  # Parsing a packet
     STATE_ESCAPE = 2  # Parsing an escape
@@ -56,6 +82,12 @@ class Packet:
     MAX_DATA_LEN = 256
 
     CRC_FN = crcmod.predefined.mkCrcFun('crc-8')
+    CRC_FNS = {
+        CRC_8: CRC_FN,
+        CRC_16: crcmod.predefined.mkCrcFun('crc-ccitt-false'),
+        CRC_32C: crcmod.predefined.mkCrcFun('crc-32c'),
+    }
+    CRC_SIZES = {CRC_8: 1, CRC_16: 2, CRC_32C: 4, CRC_NONE: 0}
 
     def __init__(self,
                  cmd: Union[int, None] = None,
@@ -71,13 +103,20 @@ class Packet:
             if data is not None:
                 self.data.extend(data)
         self.crc = 0
+        self.crc_type = Packet.CRC_8
+        self.address: Union[int, None] = None
+        self.channel: Union[int, None] = None
 
     def dump(self, label: str) -> None:
         """
         Dumps the contents of a packet.
         """
         print(f'{label} Command: 0x{self.cmd:02x} ({str(self.cmd)}) Len: {len(self.data)} '
-              f'CRC: 0x{self.crc:02x}')
+              f'CRC: 0x{self.crc:0{self.crc_size() * 2}x}')
+        if self.address is not None:
+            print(f'{label} Address: 0x{self.address:02x}')
+        if self.channel is not None:
+            print(f'{label} Channel: {self.channel}')
         if len(self.data) > 0:
             dump_mem(self.data, label)
 
@@ -89,6 +128,31 @@ class Packet:
         """Sets the command in the packet."""
         self.cmd = cmd
 
+    def get_address(self) -> Union[int, None]:
+        """Returns the node address of the packet (None if the packet has no address)."""
+        return self.address
+
+    def set_address(self, address: Union[int, None]) -> None:
+        """Sets the node address of the packet (None removes the address)."""
+        self.address = address
+
+    def get_channel(self) -> Union[int, None]:
+        """Returns the logical channel of the packet (None if the packet has no channel)."""
+        return self.channel
+
+    def set_channel(self, channel: Union[int, None]) -> None:
+        """Sets the logical channel of the packet (None removes the channel)."""
+        self.channel = channel
+
+    def header_bytes(self) -> bytearray:
+        """Returns the command, node address and channel (if present) bytes."""
+        header = bytearray([self.cmd])
+        if self.address is not None:
+            header.append(self.address)
+        if self.channel is not None:
+            header.append(self.channel)
+        return header
+
     def get_data_len(self) -> int:
         """Returns the length of the data portion of the packet."""
         return len(self.data)
@@ -120,19 +184,38 @@ class Packet:
         """Returns the CRC from the packet."""
         return self.crc
 
+    def set_crc_type(self, crc_type: int) -> None:
+        """Sets the type of CRC (Packet.CRC_xxx) used by the packet."""
+        self.crc_type = crc_type
+
+    def crc_size(self) -> int:
+        """Returns the number of bytes occupied by the packet's CRC."""
+        return Packet.CRC_SIZES[self.crc_type]
+
     def calc_crc(self) -> int:
         """Calculates and returns the CRC using the command/packet data."""
-        crc = Packet.CRC_FN(self.cmd.to_bytes(1, 'little'), 0)
-        return Packet.CRC_FN(self.data, crc)
+        if self.crc_type == Packet.CRC_NONE:
+            return 0
+        return Packet.CRC_FNS[self.crc_type](self.header_bytes() + self.data)
 
     def calc_and_store_crc(self) -> None:
         """Calculates the CRC of the data and saves it in the packet."""
         self.crc = self.calc_crc()
 
+    def frame_bytes(self) -> bytearray:
+        """Returns the command, data and CRC bytes which make up a frame.
+           The CRC must have already been calculated.
+        """
+        frame = self.header_bytes()
+        frame.extend(self.data)
+        frame.extend(self.crc.to_bytes(self.crc_size(), 'little'))
+        return frame
+
     def extract_crc(self) -> int:
         """Used by the packet decoder, this function extracts the CRC from the
            end of the data and stores it in the CRC.
         """
-        self.crc = self.data[-1]
-        self.data = self.data[:-1]
+        crc_len = self.crc_size()
+        self.crc = int.from_bytes(self.data[len(self.data) - crc_len:], 'little')
+        self.data = self.data[:len(self.data) - crc_len]
         return self.crc
@@ -17,12 +17,65 @@ class PacketDecoder:
     STATE_IDLE = 0
     STATE_COMMAND = 1
     STATE_DATA = 2
+    STATE_LENGTH = 3
+    STATE_CODE = 4
+    STATE_SKIP = 5
+    STATE_HUNT = 6  # Discarding the remainder of a bad frame until a delimiter is seen
+    STATE_IGNORE = 7  # Ignoring the remainder of a frame addressed to another node
 
     def __init__(self, pkt: Packet) -> None:
         self.packet = pkt
         self.state = PacketDecoder.STATE_IDLE
         self.escape = False
         self.debug = False
+        self.framing = Packet.FRAMING_SLIP
+        self.crc_type = Packet.CRC_8
+        self.frame = bytearray()
+        self.remaining = 0
+        self.cobs_zero = False
+        self.discarded_bytes = 0
+        self.addressed = False
+        self.node_address = Packet.BROADCAST_ADDRESS
+        self.have_address = False
+        self.channels = False
+        self.have_channel = False
+
+    def set_framing(self, framing: int) -> None:
+        """Sets the framing used to decode packets."""
+        self.framing = framing
+        self.state = PacketDecoder.STATE_IDLE
+        self.escape = False
+
+    def set_crc_type(self, crc_type: int) -> None:
+        """Sets the type of CRC which decoded packets are expected to contain."""
+        self.crc_type = crc_type
+
+    def set_addressing(self,
+                       addressed: bool,
+                       node_address: int = Packet.BROADCAST_ADDRESS) -> None:
+        """Enables or disables node addressing. When enabled, a node address byte follows
+           the command, and frames addressed to other nodes are dropped. A node address of
+           Packet.BROADCAST_ADDRESS accepts all frames.
+        """
+        self.addressed = addressed
+        self.node_address = node_address
+
+    def set_channels(self, channels: bool) -> None:
+        """Enables or disables logical channels. When enabled, a channel byte follows the
+           command (and node address), and is stored in the packet's channel.
+        """
+        self.channels = channels
+
+    def accepts_address(self, address: int) -> bool:
+        """Determines if a frame with the indicated node address should be accepted."""
+        return address in (self.node_address, Packet.BROADCAST_ADDRESS) or \
+            self.node_address == Packet.BROADCAST_ADDRESS
+
+    def header_len(self) -> int:
+        """Returns the number of bytes in the frame header (command, node address and
+           channel).
+        """
+        return 1 + (1 if self.addressed else 0) + (1 if self.channels else 0)
 
     def set_debug(self, debug: bool) -> None:
         """Sets the debug flag which controls whether decoded packets get dumped."""
@@ -30,9 +83,14 @@ class PacketDecoder:
 
     def decode_byte(self, byte: int) -> int:
         """Runs a single byte through the packet decoder state machine."""
+        if self.framing == Packet.FRAMING_COBS:
+            return self.decode_cobs_byte(byte)
+        if self.framing == Packet.FRAMING_LENGTH:
+            return self.decode_length_byte(byte)
+
         # Since we need to escape for multiple states, it's easier to put
         # the escape logic here.
-        if self.state != PacketDecoder.STATE_IDLE:
+        if self.state in (PacketDecoder.STATE_COMMAND, PacketDecoder.STATE_DATA):
             if self.escape:
                 if byte == Packet.ESC_END:
                     byte = Packet.END
@@ -45,7 +103,8 @@ class PacketDecoder:
                     self.escape = True
                     return ErrorCode.NOT_DONE
 
-        if self.state == PacketDecoder.STATE_IDLE:
+        if self.state in (PacketDecoder.STATE_IDLE, PacketDecoder.STATE_HUNT,
+                          PacketDecoder.STATE_IGNORE):
             return self.decode_byte_idle(byte)
 
         if self.state == PacketDecoder.STATE_COMMAND:
@@ -57,9 +116,11 @@ class PacketDecoder:
         return ErrorCode.BAD_STATE
 
     def decode_byte_idle(self, byte: int) -> int:
-        """Handles the IDLE state."""
+        """Handles the IDLE, HUNT and IGNORE states."""
         if byte == Packet.END:
             self.state = PacketDecoder.STATE_COMMAND
+        elif self.state != PacketDecoder.STATE_IGNORE:
+            self.discarded_bytes += 1
         return ErrorCode.NOT_DONE
 
     def decode_byte_command(self, byte: int) -> int:
@@ -72,6 +133,10 @@ class PacketDecoder:
         self.escape = False
         self.packet.set_command(byte)
         self.packet.set_data(bytearray(0))
+        self.packet.set_address(None)
+        self.packet.set_channel(None)
+        self.have_address = not self.addressed
+        self.have_channel = not self.channels
         self.state = PacketDecoder.STATE_DATA
         return ErrorCode.NOT_DONE
 
@@ -79,10 +144,13 @@ class PacketDecoder:
         """Handles the DATA state."""
         if byte == Packet.END and not self.escape:
             self.state = PacketDecoder.STATE_IDLE
-            if self.packet.get_data_len() == 0:
-                # This means we got END CMD END which is too short
-                # since the minimum packet needs to include a CMD and
+            self.packet.set_crc_type(self.crc_type)
+            have_header = self.have_address and self.have_channel
+            if not have_header or self.packet.get_data_len() < self.packet.crc_size():
+                # This means we got END CMD END (or a truncated CRC) which is
+                # too short since the minimum packet needs to include a CMD and
                 # a CRC.
+                self.discarded_bytes += len(self.packet.header_bytes()) + self.packet.get_data_len()
                 self.state = PacketDecoder.STATE_COMMAND
                 return ErrorCode.TOO_SMALL
 
@@ -94,16 +162,144 @@ class PacketDecoder:
                 if self.debug:
                     self.packet.dump('Rcvd')
                 return ErrorCode.NONE
-            LOGGER.error('CRC Error: Received 0x%02x Expected 0x%02x', rcvd_crc, expected_crc)
+            width = self.packet.crc_size() * 2
+            LOGGER.error('CRC Error: Received 0x%0*x Expected 0x%0*x', width, rcvd_crc, width,
+                         expected_crc)
             if self.debug:
                 self.packet.dump('CRC ')
+            # The END which terminates the bad packet also starts the next one.
+            self.discarded_bytes += (len(self.packet.header_bytes()) + self.packet.get_data_len() +
+                                     self.packet.crc_size())
+            self.state = PacketDecoder.STATE_COMMAND
             return ErrorCode.CRC
 
         self.escape = False
+        if not self.have_address:
+            self.have_address = True
+            if not self.accepts_address(byte):
+                # The frame is for another node, so ignore the rest of it.
+                self.state = PacketDecoder.STATE_IGNORE
+                return ErrorCode.NOT_DONE
+            self.packet.set_address(byte)
+            return ErrorCode.NOT_DONE
+        if not self.have_channel:
+            self.have_channel = True
+            self.packet.set_channel(byte)
+            return ErrorCode.NOT_DONE
         if self.packet.get_data_len() >= Packet.MAX_DATA_LEN:
             if self.debug:
                 self.packet.dump('2Big')
-            print('Returning TOO_MUCH_DATA')
+            # Discard the rest of the packet, without producing more errors.
+            self.discarded_bytes += len(self.packet.header_bytes()) + self.packet.get_data_len() + 1
+            self.state = PacketDecoder.STATE_HUNT
             return ErrorCode.TOO_MUCH_DATA
         self.packet.append_byte(byte)
         return ErrorCode.NOT_DONE
+
+    def finish_frame(self, frame: bytearray) -> int:
+        """Converts a complete frame (command, data and CRC) into a packet."""
+        self.packet.set_crc_type(self.crc_type)
+        header_len = self.header_len()
+        if len(frame) < header_len + self.packet.crc_size():
+            return ErrorCode.TOO_SMALL
+        if self.addressed and not self.accepts_address(frame[1]):
+            # The frame is for another node, so ignore it.
+            return ErrorCode.NOT_DONE
+        self.packet.set_command(frame[0])
+        self.packet.set_address(frame[1] if self.addressed else None)
+        self.packet.set_channel(frame[header_len - 1] if self.channels else None)
+        self.packet.set_data(frame[header_len:])
+        rcvd_crc = self.packet.extract_crc()
+        expected_crc = self.packet.calc_crc()
+        if rcvd_crc == expected_crc:
+            if self.debug:
+                self.packet.dump('Rcvd')
+            return ErrorCode.NONE
+        width = self.packet.crc_size() * 2
+        LOGGER.error('CRC Error: Received 0x%0*x Expected 0x%0*x', width, rcvd_crc, width,
+                     expected_crc)
+        if self.debug:
+            self.packet.dump('CRC ')
+        return ErrorCode.CRC
+
+    def decode_cobs_byte(self, byte: int) -> int:
+        """Runs a single byte through the COBS decoder."""
+        if self.state == PacketDecoder.STATE_IDLE:
+            if byte == Packet.COBS_DELIM:
+                self.frame = bytearray()
+                self.cobs_zero = False
+                self.state = PacketDecoder.STATE_CODE
+            return ErrorCode.NOT_DONE
+
+        if byte == Packet.COBS_DELIM:
+            # The delimiter which ends this packet also starts the next one.
+            frame = self.frame
+            truncated = self.state != PacketDecoder.STATE_CODE
+            self.frame = bytearray()
+            self.cobs_zero = False
+            self.state = PacketDecoder.STATE_CODE
+            if truncated:
+                LOGGER.error('COBS packet truncated')
+                return ErrorCode.CRC
+            if len(frame) == 0:
+                # Back-to-back delimiters, which is an empty packet that we ignore.
+                return ErrorCode.NOT_DONE
+            return self.finish_frame(frame)
+
+        if self.state == PacketDecoder.STATE_CODE:
+            if self.cobs_zero:
+                self.frame.append(0)
+            self.remaining = byte - 1
+            self.cobs_zero = byte != Packet.COBS_MAX_CODE
+            if self.remaining > 0:
+                self.state = PacketDecoder.STATE_DATA
+        else:
+            self.frame.append(byte)
+            self.remaining -= 1
+            if self.remaining == 0:
+                self.state = PacketDecoder.STATE_CODE
+
+        if len(self.frame) > Packet.MAX_DATA_LEN + 1:
+            # Wait for the delimiter which starts the next packet.
+            self.state = PacketDecoder.STATE_IDLE
+            return ErrorCode.TOO_MUCH_DATA
+        return ErrorCode.NOT_DONE
+
+    def decode_length_byte(self, byte: int) -> int:
+        """Runs a single byte through the LENGTH decoder."""
+        if self.state == PacketDecoder.STATE_IDLE:
+            self.remaining = byte
+            self.state = PacketDecoder.STATE_LENGTH
+            return ErrorCode.NOT_DONE
+
+        if self.state == PacketDecoder.STATE_LENGTH:
+            self.remaining |= byte << 8
+            if self.remaining < self.header_len() + Packet.CRC_SIZES[self.crc_type]:
+                if self.remaining > 0:
+                    self.state = PacketDecoder.STATE_SKIP
+                else:
+                    self.state = PacketDecoder.STATE_IDLE
+                return ErrorCode.TOO_SMALL
+            if self.remaining - self.header_len() > Packet.MAX_DATA_LEN:
+                # The CRC is temporarily stored in the data, so it needs to fit too.
+                self.state = PacketDecoder.STATE_SKIP
+                return ErrorCode.TOO_MUCH_DATA
+            self.frame = bytearray()
+            self.state = PacketDecoder.STATE_DATA
+            return ErrorCode.NOT_DONE
+
+        if self.state == PacketDecoder.STATE_DATA:
+            self.frame.append(byte)
+            self.remaining -= 1
+            if self.remaining > 0:
+                return ErrorCode.NOT_DONE
+            self.state = PacketDecoder.STATE_IDLE
+            return self.finish_frame(self.frame)
+
+        if self.state == PacketDecoder.STATE_SKIP:
+            self.remaining -= 1
+            if self.remaining == 0:
+                self.state = PacketDecoder.STATE_IDLE
+            return ErrorCode.NOT_DONE
+
+        return ErrorCode.BAD_STATE
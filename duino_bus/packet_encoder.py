@@ -22,6 +22,35 @@ class PacketEncoder:
         self.encode_idx = 0
         self.escape_char = 0
         self.debug = False
+        self.framing = Packet.FRAMING_SLIP
+        self.crc_type = Packet.CRC_8
+        self.addressed = False
+        self.address = Packet.BROADCAST_ADDRESS
+        self.channels = False
+        self.encoded = bytearray()
+
+    def set_framing(self, framing: int) -> None:
+        """Sets the framing used to encode packets."""
+        self.framing = framing
+        self.state = PacketEncoder.STATE_IDLE
+
+    def set_crc_type(self, crc_type: int) -> None:
+        """Sets the type of CRC added to encoded packets."""
+        self.crc_type = crc_type
+
+    def set_addressing(self, addressed: bool, address: int = Packet.BROADCAST_ADDRESS) -> None:
+        """Enables or disables node addressing. When enabled, a node address byte is sent
+           after the command. Packets which don't have an address are sent to `address`.
+        """
+        self.addressed = addressed
+        self.address = address
+
+    def set_channels(self, channels: bool) -> None:
+        """Enables or disables logical channels. When enabled, a channel byte is sent after
+           the command (and node address). Packets which don't have a channel are sent on
+           Packet.CHANNEL_CONTROL.
+        """
+        self.channels = channels
 
     def set_debug(self, debug: bool) -> None:
         """Sets the debug flag which controls whether decoded packets get dumped."""
@@ -30,10 +59,49 @@ class PacketEncoder:
     def encode_start(self, pkt: Packet) -> None:
         """Resets the encoder to start encoding a packet."""
         self.packet = pkt
+        # The node address and channel are covered by the CRC, so they need to be set first.
+        if not self.addressed:
+            self.packet.set_address(None)
+        elif self.packet.get_address() is None:
+            self.packet.set_address(self.address)
+        if not self.channels:
+            self.packet.set_channel(None)
+        elif self.packet.get_channel() is None:
+            self.packet.set_channel(Packet.CHANNEL_CONTROL)
+        self.packet.set_crc_type(self.crc_type)
         self.packet.calc_and_store_crc()
         if self.debug:
             self.packet.dump('Sent')
         self.state = PacketEncoder.STATE_IDLE
+        if self.framing == Packet.FRAMING_COBS:
+            self.encoded = PacketEncoder.cobs_encode(self.packet.frame_bytes())
+        elif self.framing == Packet.FRAMING_LENGTH:
+            frame = self.packet.frame_bytes()
+            self.encoded = bytearray(len(frame).to_bytes(2, 'little'))
+            self.encoded.extend(frame)
+        self.encode_idx = 0
+
+    @staticmethod
+    def cobs_encode(frame: bytearray) -> bytearray:
+        """Returns the COBS encoded version of a frame, including delimiters."""
+        encoded = bytearray([Packet.COBS_DELIM])
+        idx = 0
+        while True:
+            run = 0
+            while (run < Packet.COBS_MAX_CODE - 1 and idx + run < len(frame)
+                   and frame[idx + run] != 0):
+                run += 1
+            code = run + 1
+            encoded.append(code)
+            encoded.extend(frame[idx:idx + run])
+            idx += run
+            if idx == len(frame):
+                break
+            if code != Packet.COBS_MAX_CODE:
+                # Skip over the zero, which is represented by the code byte.
+                idx += 1
+        encoded.append(Packet.COBS_DELIM)
+        return encoded
 
     def handle_escape(self, byte: int) -> Tuple[int, int]:
         """Helper function for encoding escape sequences."""
@@ -47,6 +115,14 @@ class PacketEncoder:
 
     def encode_byte(self) -> Tuple[int, int]:
         """Encodes the next byte of the packet."""
+        if self.framing != Packet.FRAMING_SLIP:
+            # COBS and LENGTH framing are encoded all at once by encode_start.
+            byte = self.encoded[self.encode_idx]
+            self.encode_idx += 1
+            if self.encode_idx < len(self.encoded):
+                return (ErrorCode.NOT_DONE, byte)
+            return (ErrorCode.NONE, byte)
+
         if self.state == PacketEncoder.STATE_IDLE:
             return self.encode_byte_idle()
 
@@ -74,12 +150,23 @@ class PacketEncoder:
 
     def encode_byte_data(self) -> Tuple[int, int]:
         """Handles the DATA state of the encoder."""
-        if self.encode_idx < self.packet.get_data_len():
-            self.state, byte = self.handle_escape(self.packet.get_data_byte(self.encode_idx))
+        data_idx = self.encode_idx
+        # The node address and channel (if present) are sent before the data.
+        header = self.packet.header_bytes()[1:]
+        if data_idx < len(header):
+            self.state, byte = self.handle_escape(header[data_idx])
+            self.encode_idx += 1
+            return (ErrorCode.NOT_DONE, byte)
+        data_idx -= len(header)
+        if data_idx < self.packet.get_data_len():
+            self.state, byte = self.handle_escape(self.packet.get_data_byte(data_idx))
             self.encode_idx += 1
             return (ErrorCode.NOT_DONE, byte)
-        if self.encode_idx == self.packet.get_data_len():
-            self.state, byte = self.handle_escape(self.packet.calc_crc())
+        crc_idx = data_idx - self.packet.get_data_len()
+        if crc_idx < self.packet.crc_size():
+            # The CRC is sent in little-endian order.
+            crc_byte = (self.packet.get_crc() >> (crc_idx * 8)) & 0xff
+            self.state, byte = self.handle_escape(crc_byte)
             self.encode_idx += 1
             return (ErrorCode.NOT_DONE, byte)
         self.state = PacketEncoder.STATE_IDLE
@@ -2,7 +2,8 @@
 This modules implements a binary unpacker.
 """
 
-from typing import Union
+import struct
+from typing import List, Union
 
 
 class Unpacker:
@@ -34,12 +35,40 @@ class Unpacker:
         self.idx += 4
         return val
 
+    def unpack_varint(self) -> int:
+        """Unpacks a varint (7 bits per byte, least significant first) from the binary data."""
+        val = 0
+        shift = 0
+        while True:
+            byte = self.unpack_u8()
+            val |= (byte & 0x7f) << shift
+            shift += 7
+            if byte & 0x80 == 0:
+                return val
+
+    def unpack_signed_varint(self) -> int:
+        """Unpacks a zigzag encoded varint from the binary data."""
+        val = self.unpack_varint()
+        return (val >> 1) ^ -(val & 1)
+
     def unpack_data(self, num_bytes: int) -> Union[bytes, bytearray]:
         """Packs arbitrary data into the binary data."""
         val = self.data[self.idx:self.idx + num_bytes]
         self.idx += num_bytes
         return val
 
+    def unpack_array(self, elem_fmt: str) -> List[Union[int, float]]:
+        """Unpacks an array from the binary data.
+           elem_fmt is a struct format character (i.e. 'h' for int16) describing each element.
+           Arrays are encoded with a 16-bit element count followed by the elements, all
+           in little-endian order.
+        """
+        count = self.unpack_u16()
+        fmt = f'<{count}{elem_fmt}'
+        val = struct.unpack_from(fmt, self.data, self.idx)
+        self.idx += struct.calcsize(fmt)
+        return list(val)
+
     def unpack_str(self) -> str:
         """Packs a string into the binary data.
            Strings are encoded with an 8-bit length, the string data and a terminating null.
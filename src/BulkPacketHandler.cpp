@@ -0,0 +1,248 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   BulkPacketHandler.cpp
+ *
+ *   @brief  Handles windowed bulk transfers of large blobs.
+ *
+ ****************************************************************************/
+
+#include "duino_bus/BulkPacketHandler.h"
+
+#include <algorithm>
+#include <cinttypes>
+
+#include "duino_bus/Packer.h"
+#include "duino_bus/Unpacker.h"
+#include "duino_log/Log.h"
+
+void BulkPacketHandler::addBlob(uint8_t id, IBulkBlob& blob) {
+    this->m_blobs.push_back({id, &blob});
+}
+
+char const* BulkPacketHandler::as_str(Packet::Command::Type cmd) const {
+    switch (cmd) {
+        case Command::BULK_READ:
+            return "BULK_READ";
+        case Command::BULK_WRITE:
+            return "BULK_WRITE";
+        case Command::BULK_DATA:
+            return "BULK_DATA";
+        case Command::BULK_ACK:
+            return "BULK_ACK";
+    }
+    return "???";
+}
+
+bool BulkPacketHandler::handlePacket(Packet const& cmd, Packet* rsp) {
+    switch (cmd.getCommand()) {
+        case Command::BULK_READ:
+        case Command::BULK_WRITE: {
+            this->handleStart(cmd, rsp);
+            return true;
+        }
+        case Command::BULK_DATA: {
+            this->handleData(cmd, rsp);
+            return true;
+        }
+        case Command::BULK_ACK: {
+            this->handleAck(cmd);
+            return true;
+        }
+    }
+    return false;
+}
+
+void BulkPacketHandler::handleStart(Packet const& cmd, Packet* rsp) {
+    bool isRead = cmd.getCommand() == Command::BULK_READ;
+    rsp->setCommand(cmd.getCommand());
+
+    // Starting a new transfer aborts the current one.
+    this->abort();
+
+    Unpacker unpacker(cmd);
+    uint8_t blobId = 0;
+    uint32_t offset = 0;
+    uint32_t endOffset = 0;
+    uint8_t window = 0;
+    IBulkBlob* blob = nullptr;
+    Status status = Status::OK;
+    if (!unpacker.unpackAll(&blobId, &offset, &endOffset, &window)) {
+        status = Status::BAD_REQUEST;
+    } else if ((blob = this->findBlob(blobId)) == nullptr) {
+        status = Status::NO_BLOB;
+    } else {
+        if (offset == RESUME_OFFSET) {
+            offset = (!isRead && blob == this->m_writeBlob) ? this->m_ackOffset : 0;
+        }
+        if (isRead) {
+            endOffset = std::min(endOffset, blob->getSize());
+        }
+        if (offset > endOffset || endOffset > blob->getSize()) {
+            status = Status::BAD_OFFSET;
+        }
+    }
+
+    // Data for reads is sent in our response packet, and data for writes arrives in the
+    // command packet, so the chunks are sized to fill those packets. Decoders keep the CRC
+    // in the packet data until the packet is complete, so there needs to be room for it.
+    size_t maxDataLen = isRead ? rsp->getMaxDataLength() : cmd.getMaxDataLength();
+    size_t overhead = DATA_HEADER_LEN + Packet::crcSize(cmd.getCrcType());
+    size_t chunkSize = 0;
+    if (maxDataLen <= overhead) {
+        status = (status == Status::OK) ? Status::TOO_SMALL : status;
+    } else {
+        chunkSize = std::min<size_t>(maxDataLen - overhead, UINT16_MAX);
+    }
+
+    Packer packer(rsp);
+    packer.packAll(
+        static_cast<uint8_t>(status), offset, endOffset, static_cast<uint16_t>(chunkSize));
+    if (status != Status::OK) {
+        Log::error(
+            "BULK transfer of blob %" PRIu8 " failed: %d", blobId, static_cast<int>(status));
+        return;
+    }
+
+    this->m_blob = blob;
+    this->m_writeBlob = isRead ? nullptr : blob;
+    this->m_endOffset = endOffset;
+    this->m_sendOffset = offset;
+    this->m_ackOffset = offset;
+    this->m_chunkSize = chunkSize;
+    this->m_window = std::max<size_t>(window, 1);
+    this->m_numUnacked = 0;
+    this->m_nakSent = false;
+    if (isRead) {
+        this->m_direction = Direction::READ;
+        this->m_bus->startStream(*this, cmd);
+    } else {
+        this->m_direction = Direction::WRITE;
+    }
+}
+
+void BulkPacketHandler::handleData(Packet const& cmd, Packet* rsp) {
+    Unpacker unpacker(cmd);
+    uint32_t offset;
+    if (this->m_direction != Direction::WRITE || !unpacker.unpack(&offset)) {
+        this->sendAck(ACK_ABORT, rsp);
+        return;
+    }
+
+    if (offset != this->m_ackOffset) {
+        // Chunks which arrive out of order are dropped. Only the first one after a gap is
+        // NAK'd, since the rest of the window is probably already on its way.
+        if (!this->m_nakSent) {
+            this->m_nakSent = true;
+            this->sendAck(ACK_NAK, rsp);
+        }
+        return;
+    }
+
+    size_t len = cmd.getDataLength() - DATA_HEADER_LEN;
+    if (len > this->m_endOffset - offset ||
+        !this->m_blob->write(offset, len, &cmd.getData()[DATA_HEADER_LEN])) {
+        Log::error("BULK write failed at offset %" PRIu32, offset);
+        this->m_direction = Direction::NONE;
+        this->sendAck(ACK_ABORT, rsp);
+        return;
+    }
+    bool recovered = this->m_nakSent;
+    this->m_ackOffset += len;
+    this->m_nakSent = false;
+    this->m_numUnacked++;
+
+    // Acknowledging after half a window is enough to keep the window open. The sender
+    // is waiting to hear about the chunk which fills a gap, so that's acknowledged now.
+    if (this->m_ackOffset == this->m_endOffset) {
+        this->m_direction = Direction::NONE;
+        this->sendAck(0, rsp);
+    } else if (recovered || this->m_numUnacked >= (this->m_window + 1) / 2) {
+        this->sendAck(0, rsp);
+    }
+}
+
+void BulkPacketHandler::handleAck(Packet const& cmd) {
+    Unpacker unpacker(cmd);
+    uint32_t offset;
+    uint8_t flags;
+    if (this->m_direction != Direction::READ || !unpacker.unpackAll(&offset, &flags)) {
+        return;
+    }
+    if ((flags & ACK_ABORT) != 0) {
+        this->abort();
+        return;
+    }
+    if (offset < this->m_ackOffset || offset > this->m_sendOffset) {
+        // A stale acknowledgement.
+        return;
+    }
+    this->m_ackOffset = offset;
+    if ((flags & ACK_NAK) != 0) {
+        this->m_sendOffset = offset;
+    }
+}
+
+void BulkPacketHandler::abort() {
+    if (this->m_direction == Direction::READ) {
+        // The host isn't expecting a STREAM_END for a read which was abandoned.
+        this->m_bus->cancelStream(*this);
+    }
+    this->m_direction = Direction::NONE;
+}
+
+void BulkPacketHandler::sendAck(uint8_t flags, Packet* rsp) {
+    rsp->setCommand(Command::BULK_ACK);
+    Packer packer(rsp);
+    packer.packAll(this->m_ackOffset, flags);
+    this->m_numUnacked = 0;
+}
+
+bool BulkPacketHandler::nextStreamPacket(Packet* rsp) {
+    if (this->m_direction != Direction::READ) {
+        return false;
+    }
+    if (this->m_ackOffset == this->m_endOffset) {
+        this->m_direction = Direction::NONE;
+        return false;
+    }
+    if (this->m_sendOffset == this->m_endOffset ||
+        this->m_sendOffset - this->m_ackOffset >= this->m_window * this->m_chunkSize) {
+        // The window is full, so we wait for an acknowledgement.
+        return true;
+    }
+
+    // The data is read from the blob directly into the response packet.
+    size_t len = std::min<size_t>(this->m_chunkSize, this->m_endOffset - this->m_sendOffset);
+    rsp->setCommand(Command::BULK_DATA);
+    Packer packer(rsp);
+    packer.pack(this->m_sendOffset);
+    auto reservation = packer.reserve(len);
+    if (!reservation.isValid() ||
+        !this->m_blob->read(this->m_sendOffset, len, reservation.data())) {
+        Log::error("BULK read failed at offset %" PRIu32, this->m_sendOffset);
+        this->m_direction = Direction::NONE;
+        rsp->setCommand(0);
+        rsp->setData(0, nullptr);
+        return false;
+    }
+    reservation.commit(len);
+    this->m_sendOffset += len;
+    return true;
+}
+
+IBulkBlob* BulkPacketHandler::findBlob(uint8_t id) const {
+    for (auto const& entry : this->m_blobs) {
+        if (entry.id == id) {
+            return entry.blob;
+        }
+    }
+    return nullptr;
+}
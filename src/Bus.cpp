@@ -15,65 +15,519 @@
  ****************************************************************************/
 
 #include "duino_bus/Bus.h"
+
+#include <cassert>
+#include <chrono>
+
+// Hosts and RTOSes have threads (older versions of gcc only tell libstdc++). Bare-metal
+// builds, like the Pico SDK, have neither thread_local nor std::this_thread.
+#if defined(__STDCPP_THREADS__) || defined(_GLIBCXX_HAS_GTHREADS)
+#define DUINO_BUS_HAS_THREADS 1
+#endif
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#elif defined(DUINO_BUS_HAS_THREADS)
+#include <thread>
+#elif defined(LIB_PICO_PLATFORM)
+#include "pico/platform.h"
+#endif
+
+#include "duino_bus/Dispatcher.h"
+#include "duino_bus/Packer.h"
 #include "duino_bus/PacketHandler.h"
 #include "duino_log/Log.h"
 
+#if defined(DUINO_BUS_HAS_THREADS)
+//! Bus being encoded by encodePacket on this thread.
+static thread_local IBus const* g_encodingBus = nullptr;
+#else
+//! Bus being encoded by encodePacket.
+static IBus const* g_encodingBus = nullptr;
+#endif
+
 IBus::IBus(Packet* cmdPacket, Packet* rspPacket, Packet* logPacket, Packet* evtPacket)
     : m_cmdPacket{cmdPacket},
       m_rspPacket{rspPacket},
       m_logPacket{logPacket},
       m_evtPacket{evtPacket},
       m_decoder{this, cmdPacket},
-      m_encoder{this} {};
+      m_encoder{this},
+      m_control{BusChannel::CONTROL, cmdPacket, rspPacket, CONTROL_QUEUE_LEN, m_controlQueue} {
+    this->m_control.setBus(this);
+    this->m_decoder.setStats(&this->m_stats);
+    this->m_encoder.setStats(&this->m_stats);
+};
+
+uint32_t IBus::getMillis() const {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    auto msec = std::chrono::duration_cast<std::chrono::milliseconds>(now);
+    return static_cast<uint32_t>(msec.count());
+}
+
+uint32_t IBus::getMicros() const {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    auto usec = std::chrono::duration_cast<std::chrono::microseconds>(now);
+    return static_cast<uint32_t>(usec.count());
+}
 
 Packet::Error IBus::processByte() {
     uint8_t byte;
-    if (!this->readByte(&byte)) {
-        return Error::NOT_DONE;
+    bool haveByte = this->readByte(&byte);
+    if (this->m_decoder.getTimeout() == 0) {
+        return haveByte ? this->m_decoder.decodeByte(byte) : Error::NOT_DONE;
     }
-    return this->m_decoder.decodeByte(byte);
+    uint32_t now = this->getMillis();
+    return haveByte ? this->m_decoder.decodeByte(byte, now) : this->m_decoder.checkTimeout(now);
 }
 
 Packet::Error IBus::writePacket(Packet* packet) {
+    // If this thread is encoding a packet on this bus (i.e. writeByte logged something),
+    // waiting for our packet to be written would wait forever.
+    assert(g_encodingBus != this);
+    if (g_encodingBus == this) {
+        return Error::BAD_STATE;
+    }
+
+    TxRequest request{packet};
+    this->sendPacket(request);
+    while (!request.isSent()) {
+        // Another thread is writing, and will write our packet. If it stops writing
+        // before then, we take over.
+#if defined(ARDUINO)
+        yield();
+#elif defined(DUINO_BUS_HAS_THREADS)
+        std::this_thread::yield();
+#elif defined(LIB_PICO_PLATFORM)
+        tight_loop_contents();
+#endif
+        this->serviceTxQueue();
+    }
+    return request.getError();
+}
+
+bool IBus::sendPacket(TxRequest& request) {
+    if (!this->m_txQueue.push(&request)) {
+        return false;
+    }
+    this->serviceTxQueue();
+    return true;
+}
+
+bool IBus::queuePacket(uint8_t channelId, Packet* packet) {
+    if (this->m_channels.empty()) {
+        this->writePacket(packet);
+        return true;
+    }
+    return this->queueChannel(channelId).queuePacket(packet);
+}
+
+bool IBus::canQueuePacket(uint8_t channelId, Packet const* packet) {
+    if (this->m_channels.empty()) {
+        return true;
+    }
+    BusChannel& channel = this->queueChannel(channelId);
+    return channel.getNumQueued() < channel.m_maxQueued && !this->isQueued(packet);
+}
+
+bool IBus::isQueued(Packet const* packet) {
+    for (size_t idx = 0; idx < this->m_channels.size() + 1; idx++) {
+        if (this->txChannel(idx).isQueued(packet)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool IBus::serviceTxQueue() {
+    bool written = false;
+    do {
+        bool writing = false;
+        if (!this->m_txWriting.compare_exchange_strong(
+                writing, true, std::memory_order_acquire, std::memory_order_relaxed)) {
+            // The thread which is writing will pick up our packets.
+            return written;
+        }
+        while (TxRequest* request = this->m_txQueue.pop()) {
+            request->m_err = this->encodePacket(request->m_packet);
+            request->m_queued.store(false, std::memory_order_release);
+            written = true;
+        }
+        this->m_txWriting.store(false, std::memory_order_release);
+
+        // A packet may have been queued after our last pop, but before we stopped writing,
+        // in which case the thread which queued it left it for us.
+    } while (this->m_txQueue.hasIncoming());
+    return written;
+}
+
+Packet::Error IBus::encodePacket(Packet* packet) {
+    IBus const* outerBus = g_encodingBus;
+    g_encodingBus = this;
     this->m_encoder.encodeStart(packet);
     uint8_t byte;
     Error err = Error::NOT_DONE;
     while (err == Error::NOT_DONE) {
         err = this->m_encoder.encodeByte(&byte);
+        if (err != Error::NOT_DONE && err != Error::NONE) {
+            break;
+        }
         this->writeByte(byte);
     }
     this->flush();
+    g_encodingBus = outerBus;
     return err;
 }
 
 void IBus::add(IPacketHandler& handler) {
-    handler.setBus(this);
-    this->m_handlers.push_back(&handler);
+    this->m_control.add(handler);
+}
+
+void IBus::addChannel(BusChannel& channel) {
+    channel.setBus(this);
+    this->m_channels.push_back(&channel);
+
+    // The decoder looks up the packet to decode into using the channel number.
+    if (this->m_rxPackets.size() <= channel.getId()) {
+        this->m_rxPackets.resize(channel.getId() + 1, nullptr);
+    }
+    this->m_rxPackets[BusChannel::CONTROL] = this->m_cmdPacket;
+    this->m_rxPackets[channel.getId()] = channel.getCommandPacket();
+    this->m_decoder.setChannels(this->m_rxPackets.size(), this->m_rxPackets.data());
+    this->m_encoder.setChannels(true);
+}
+
+BusChannel* IBus::getChannel(uint8_t id) {
+    if (id == BusChannel::CONTROL) {
+        return &this->m_control;
+    }
+    for (auto channel : this->m_channels) {
+        if (channel->getId() == id) {
+            return channel;
+        }
+    }
+    return nullptr;
+}
+
+bool IBus::serviceTx() {
+    size_t numChannels = this->m_channels.size() + 1;
+    bool streamed = this->serviceTxQueue();
+    if (this->m_dispatcher != nullptr) {
+        streamed = this->m_dispatcher->serviceResponses() || streamed;
+    }
+    bool pending = false;
+    for (size_t idx = 0; idx < numChannels; idx++) {
+        streamed = this->serviceStream(this->txChannel(idx)) || streamed;
+        pending = pending || this->txChannel(idx).getNumQueued() > 0;
+    }
+    if (!pending) {
+        // Without logical channels, streamed (and dispatched) packets are written
+        // immediately.
+        return streamed;
+    }
+
+    // Since at least one channel has a packet queued, and each visit to that channel adds
+    // to its credit, this loop will always find a packet to send.
+    while (true) {
+        BusChannel& channel = this->txChannel(this->m_txIdx);
+        Packet* packet = channel.peekPacket();
+        if (packet == nullptr) {
+            // Idle channels don't get to accumulate credit.
+            channel.m_deficit = 0;
+        } else {
+            if (!this->m_txCredited) {
+                channel.m_deficit += channel.m_quantum;
+                this->m_txCredited = true;
+            }
+            size_t cost = packet->getTotalDataLength() + 1;
+            if (cost <= channel.m_deficit) {
+                // We stay on this channel, since it may have enough credit left to send
+                // its next packet.
+                channel.m_deficit -= cost;
+                channel.popPacket();
+                this->writePacket(packet);
+                this->recordWritten(packet);
+                return true;
+            }
+        }
+        this->m_txIdx = (this->m_txIdx + 1) % numChannels;
+        this->m_txCredited = false;
+    }
 }
 
 bool IBus::handlePacket() {
-    this->m_rspPacket->setCommand(0);
-    this->m_rspPacket->setData(0, nullptr);
-    for (auto handler : this->m_handlers) {
-        if (handler->handlePacket(*this->m_cmdPacket, this->m_rspPacket)) {
-            if (this->m_rspPacket->getCommand() != 0) {
-                this->writePacket(this->m_rspPacket);
-            } else if (this->m_rspPacket->getDataLength() > 0) {
+    Packet* cmd = this->m_decoder.getPacket();
+    BusChannel* channel = cmd->hasChannel() ? this->getChannel(cmd->getChannel()) : nullptr;
+    return this->handlePacket(channel == nullptr ? this->m_control : *channel);
+}
+
+bool IBus::handlePacket(BusChannel& channel) {
+    Packet* cmd = channel.m_cmdPacket;
+    Packet* rsp = channel.m_rspPacket;
+
+    this->m_cmdStartUs = this->m_numLatency > 0 ? this->getMicros() : 0;
+    if (this->m_dispatcher != nullptr && this->m_dispatcher->submit(channel, *cmd)) {
+        return true;
+    }
+
+    // The response to the previous command may still be waiting to be sent.
+    while (channel.isQueued(rsp)) {
+        this->serviceTx();
+    }
+
+    // The command is saved, since in-place handlers swap the command packet's storage.
+    Packet::Command::Type command = cmd->getCommand();
+    uint32_t startUs = this->m_cmdStartUs;
+
+    // Responding to a broadcast would cause all of the nodes to respond at the same time.
+    bool isBroadcast = cmd->hasAddress() && cmd->getAddress() == Packet::BROADCAST_ADDRESS;
+    rsp->setCommand(0);
+    rsp->setData(0, nullptr);
+    rsp->clearAddress();
+    rsp->clearChannel();
+    this->m_rxChannel = &channel;
+    this->m_deferred = false;
+    bool inPlace = this->m_inPlace && cmd->getMaxDataLength() == rsp->getMaxDataLength();
+    for (auto handler : channel.m_handlers) {
+        bool handled =
+            inPlace ? handler->handlePacketInPlace(cmd, rsp) : handler->handlePacket(*cmd, rsp);
+        if (handled) {
+            bool responded = false;
+            if (isBroadcast) {
+                channel.m_streamHandler = nullptr;
+            } else if (rsp->getCommand() != 0) {
+                if (channel.isStreaming()) {
+                    // This is the first packet of the stream.
+                    channel.m_streamCount++;
+                }
+                this->sendResponse(channel);
+                this->timeResponse(command, startUs, rsp);
+                responded = true;
+            } else if (rsp->getTotalDataLength() > 0) {
                 Log::error("Packet data set, but no command");
             }
+            if (!responded && !this->m_deferred && this->m_numLatency > 0) {
+                // Deferred responses are timed by completeResponse.
+                this->recordLatency(command, this->getMicros() - startUs);
+            }
             return true;
         }
     }
-    Log::error("Unhandled command: 0x%02" PRIx8, this->m_cmdPacket->getCommand());
+    this->m_stats.unhandled.add();
+    Log::error("Unhandled command: 0x%02" PRIx8, cmd->getCommand());
     return false;
 }
 
-char const* IBus::as_str(Packet::Command::Type cmd) const {
-    for (auto handler : this->m_handlers) {
-        auto str = handler->as_str(cmd);
-        if (str != nullptr && *str != '?') {
-            return str;
+void IBus::startStream(IPacketHandler& handler, Packet const& cmd) {
+    BusChannel& channel = (this->m_rxChannel == nullptr) ? this->m_control : *this->m_rxChannel;
+    channel.m_streamHandler = &handler;
+    channel.m_streamCommand = cmd.getCommand();
+    channel.m_streamCount = 0;
+}
+
+void IBus::cancelStream(IPacketHandler& handler) {
+    for (size_t idx = 0; idx < this->m_channels.size() + 1; idx++) {
+        BusChannel& channel = this->txChannel(idx);
+        if (channel.m_streamHandler == &handler) {
+            channel.m_streamHandler = nullptr;
         }
     }
-    return "???";
+}
+
+bool IBus::serviceStream(BusChannel& channel) {
+    if (channel.m_streamHandler == nullptr) {
+        return false;
+    }
+    // The response packet is reused for each packet of the stream, so we wait until the
+    // previous packet has been sent, and there's somewhere to send the next one. Without
+    // logical channels, the packet is written immediately, so there needs to be room for
+    // all of it, otherwise writing it would block.
+    if (this->m_channels.empty()
+            ? !this->hasSpaceForPacket(channel.m_rspPacket->getMaxDataLength())
+            : channel.isQueued(channel.m_rspPacket) ||
+                  channel.getNumQueued() >= channel.m_maxQueued) {
+        return false;
+    }
+
+    Packet* rsp = channel.m_rspPacket;
+    rsp->setCommand(0);
+    rsp->setData(0, nullptr);
+    rsp->clearAddress();
+    rsp->clearChannel();
+    if (channel.m_streamHandler->nextStreamPacket(rsp)) {
+        if (rsp->getCommand() == 0) {
+            // The stream is paused.
+            return false;
+        }
+        channel.m_streamCount++;
+    } else {
+        channel.m_streamHandler = nullptr;
+        rsp->setCommand(Packet::Command::STREAM_END);
+        Packer packer(rsp);
+        packer.packAll(channel.m_streamCommand, channel.m_streamCount);
+    }
+    this->sendResponse(channel);
+    return true;
+}
+
+void IBus::sendResponse(BusChannel& channel) {
+    if (this->m_channels.empty()) {
+        this->writePacket(channel.m_rspPacket);
+        return;
+    }
+    while (!channel.queuePacket(channel.m_rspPacket)) {
+        this->serviceTx();
+    }
+}
+
+bool IBus::dispatchPacket(Packet const& cmd, Packet* rsp) {
+    BusChannel& channel = (this->m_rxChannel == nullptr) ? this->m_control : *this->m_rxChannel;
+    return this->dispatchPacket(channel, cmd, rsp);
+}
+
+bool IBus::dispatchPacket(BusChannel const& channel, Packet const& cmd, Packet* rsp) const {
+    for (auto handler : channel.m_handlers) {
+        if (handler->handlePacket(cmd, rsp)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void IBus::setPendingTable(size_t maxPending, PendingResponse* table) {
+    this->m_maxPending = maxPending;
+    this->m_pending = table;
+    for (size_t idx = 0; idx < maxPending; idx++) {
+        table[idx].inUse = false;
+    }
+}
+
+IBus::PendingToken IBus::deferResponse(Packet const& cmd) {
+    for (size_t idx = 0; idx < this->m_maxPending; idx++) {
+        PendingResponse& entry = this->m_pending[idx];
+        if (!entry.inUse) {
+            entry.command = cmd.getCommand();
+            entry.channel = (this->m_rxChannel == nullptr) ? BusChannel::CONTROL
+                                                           : this->m_rxChannel->getId();
+            entry.isBroadcast =
+                cmd.hasAddress() && cmd.getAddress() == Packet::BROADCAST_ADDRESS;
+            entry.inUse = true;
+            entry.startUs = this->m_cmdStartUs;
+            this->m_deferred = true;
+            return idx;
+        }
+    }
+    Log::error("Pending table full: 0x%02" PRIx8, cmd.getCommand());
+    return INVALID_PENDING_TOKEN;
+}
+
+bool IBus::completeResponse(PendingToken token, Packet* rsp) {
+    if (token >= this->m_maxPending || !this->m_pending[token].inUse) {
+        return false;
+    }
+    PendingResponse& entry = this->m_pending[token];
+    entry.inUse = false;
+    if (entry.isBroadcast) {
+        if (this->m_numLatency > 0) {
+            this->recordLatency(entry.command, this->getMicros() - entry.startUs);
+        }
+        return true;
+    }
+    rsp->setCommand(entry.command);
+    BusChannel* channel = this->getChannel(entry.channel);
+    if (this->m_channels.empty() || channel == nullptr) {
+        this->writePacket(rsp);
+    } else {
+        while (!channel->queuePacket(rsp)) {
+            this->serviceTx();
+        }
+    }
+    this->timeResponse(entry.command, entry.startUs, rsp);
+    return true;
+}
+
+size_t IBus::getNumPending() const {
+    size_t numPending = 0;
+    for (size_t idx = 0; idx < this->m_maxPending; idx++) {
+        if (this->m_pending[idx].inUse) {
+            numPending++;
+        }
+    }
+    return numPending;
+}
+
+void IBus::setLatencyTable(size_t numEntries, CommandLatency* table) {
+    this->m_numLatency = numEntries;
+    this->m_latency = table;
+    for (size_t idx = 0; idx < numEntries; idx++) {
+        table[idx].inUse = false;
+        table[idx].histogram.reset();
+    }
+    for (auto& timed : this->m_timed) {
+        timed.packet = nullptr;
+    }
+}
+
+LatencyHistogram* IBus::getLatency(Packet::Command::Type command) {
+    for (size_t idx = 0; idx < this->m_numLatency; idx++) {
+        CommandLatency& entry = this->m_latency[idx];
+        if (entry.inUse && entry.command == command) {
+            return &entry.histogram;
+        }
+    }
+    return nullptr;
+}
+
+void IBus::timeResponse(Packet::Command::Type command, uint32_t startUs, Packet const* rsp) {
+    if (this->m_numLatency == 0) {
+        return;
+    }
+    if (this->isQueued(rsp)) {
+        for (auto& timed : this->m_timed) {
+            if (timed.packet == nullptr) {
+                timed.packet = rsp;
+                timed.command = command;
+                timed.startUs = startUs;
+                return;
+            }
+        }
+        // Too many responses are being timed, so this one is timed until it was queued.
+    }
+    this->recordLatency(command, this->getMicros() - startUs);
+}
+
+void IBus::recordWritten(Packet const* packet) {
+    if (this->m_numLatency == 0) {
+        return;
+    }
+    for (auto& timed : this->m_timed) {
+        if (timed.packet == packet) {
+            timed.packet = nullptr;
+            this->recordLatency(timed.command, this->getMicros() - timed.startUs);
+            return;
+        }
+    }
+}
+
+void IBus::recordLatency(Packet::Command::Type command, uint32_t latencyUs) {
+    // Entries are never freed, so the first unused entry ends the search.
+    for (size_t idx = 0; idx < this->m_numLatency; idx++) {
+        CommandLatency& entry = this->m_latency[idx];
+        if (!entry.inUse) {
+            entry.command = command;
+            entry.inUse = true;
+        }
+        if (entry.command == command) {
+            entry.histogram.record(latencyUs);
+            return;
+        }
+    }
+}
+
+char const* IBus::as_str(Packet::Command::Type cmd) const {
+    auto str = this->m_control.as_str(cmd);
+    for (size_t idx = 0; idx < this->m_channels.size() && *str == '?'; idx++) {
+        str = this->m_channels[idx]->as_str(cmd);
+    }
+    return str;
 }
@@ -0,0 +1,87 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   BusChannel.cpp
+ *
+ *   @brief  A logical channel which is multiplexed over a bus.
+ *
+ ****************************************************************************/
+
+#include "duino_bus/BusChannel.h"
+
+#include <cassert>
+
+#include "duino_bus/PacketHandler.h"
+
+BusChannel::BusChannel(
+    uint8_t id,
+    Packet* cmdPacket,
+    Packet* rspPacket,
+    size_t maxQueued,
+    Packet** txQueue,
+    size_t quantum)
+    : m_id{id},
+      m_cmdPacket{cmdPacket},
+      m_rspPacket{rspPacket},
+      m_maxQueued{maxQueued},
+      m_txQueue{txQueue},
+      m_quantum{quantum} {
+    // With no credit, the scheduler would never send anything from this channel.
+    assert(quantum > 0);
+}
+
+void BusChannel::add(IPacketHandler& handler) {
+    handler.setBus(this->m_bus);
+    this->m_handlers.push_back(&handler);
+}
+
+bool BusChannel::queuePacket(Packet* packet) {
+    if (this->m_numQueued >= this->m_maxQueued) {
+        return false;
+    }
+    packet->setChannel(this->m_id);
+    size_t idx = (this->m_queueHead + this->m_numQueued) % this->m_maxQueued;
+    this->m_txQueue[idx] = packet;
+    this->m_numQueued++;
+    return true;
+}
+
+bool BusChannel::isQueued(Packet const* packet) const {
+    for (size_t i = 0; i < this->m_numQueued; i++) {
+        if (this->m_txQueue[(this->m_queueHead + i) % this->m_maxQueued] == packet) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void BusChannel::popPacket() {
+    if (this->m_numQueued > 0) {
+        this->m_queueHead = (this->m_queueHead + 1) % this->m_maxQueued;
+        this->m_numQueued--;
+    }
+}
+
+void BusChannel::setBus(IBus* bus) {
+    this->m_bus = bus;
+    for (auto handler : this->m_handlers) {
+        handler->setBus(bus);
+    }
+}
+
+char const* BusChannel::as_str(Packet::Command::Type cmd) const {
+    for (auto handler : this->m_handlers) {
+        auto str = handler->as_str(cmd);
+        if (str != nullptr && *str != '?') {
+            return str;
+        }
+    }
+    return "???";
+}
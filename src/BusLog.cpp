@@ -16,7 +16,12 @@
 
 #include "duino_bus/BusLog.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include "duino_bus/CorePacketHandler.h"
+#include "duino_bus/Packer.h"
+#include "duino_bus/Unpacker.h"
 #include "duino_log/ConsoleColor.h"
 #include "duino_util/Util.h"
 
@@ -38,18 +43,439 @@ size_t BusLog::log_char_to_packet(void* outParam, char ch) {
     return 0;
 }
 
-void BusLog::do_log(
-    Level level,      //!< Logging level associated with this message.
-    const char* fmt,  //!< Printf style format string
-    va_list args      //!< Arguments associated with format string.
+//! Length modifiers which change the size of integer arguments.
+enum class LengthModifier {
+    NONE,       //!< int
+    LONG,       //!< l
+    LONG_LONG,  //!< ll
+    INTMAX,     //!< j
+    SIZE,       //!< z
+    PTRDIFF,    //!< t
+};
+
+//! Helper which fetches a signed integer argument.
+//! @returns the argument, widened to 64 bits.
+static int64_t signedArg(
+    LengthModifier length,  //!< [in] Length modifier used with the conversion.
+    va_list& args           //!< [mod] Arguments associated with format string.
 ) {
-    Packet* log = this->m_bus->getLogPacket();
-    if (log == nullptr) {
-        // User didn't provide a log packet to the Bus constructor.
+    switch (length) {
+        case LengthModifier::NONE:
+            return va_arg(args, int);
+        case LengthModifier::LONG:
+            return va_arg(args, long);
+        case LengthModifier::LONG_LONG:
+            return va_arg(args, long long);
+        case LengthModifier::INTMAX:
+            return va_arg(args, intmax_t);
+        case LengthModifier::SIZE:
+            return static_cast<int64_t>(va_arg(args, size_t));
+        case LengthModifier::PTRDIFF:
+            return va_arg(args, ptrdiff_t);
+    }
+    return 0;
+}
+
+//! Helper which fetches an unsigned integer argument.
+//! @returns the argument, widened to 64 bits.
+static uint64_t unsignedArg(
+    LengthModifier length,  //!< [in] Length modifier used with the conversion.
+    va_list& args           //!< [mod] Arguments associated with format string.
+) {
+    switch (length) {
+        case LengthModifier::NONE:
+            return va_arg(args, unsigned int);
+        case LengthModifier::LONG:
+            return va_arg(args, unsigned long);
+        case LengthModifier::LONG_LONG:
+            return va_arg(args, unsigned long long);
+        case LengthModifier::INTMAX:
+            return va_arg(args, uintmax_t);
+        case LengthModifier::SIZE:
+            return va_arg(args, size_t);
+        case LengthModifier::PTRDIFF:
+            return static_cast<uint64_t>(va_arg(args, ptrdiff_t));
+    }
+    return 0;
+}
+
+BusLog::BusLog(IBus* bus) : Log(), m_bus{bus} {
+    for (auto& mask : this->m_levelMasks) {
+        mask.store(0xff, std::memory_order_relaxed);
+    }
+}
+
+void BusLog::setLevelMask(uint8_t module, uint8_t mask) {
+    if (module == ALL_MODULES) {
+        for (auto& levelMask : this->m_levelMasks) {
+            levelMask.store(mask, std::memory_order_relaxed);
+        }
+    } else if (module < MAX_MODULES) {
+        this->m_levelMasks[module].store(mask, std::memory_order_relaxed);
+    }
+}
+
+uint8_t BusLog::getLevelMask(uint8_t module) const {
+    if (module >= MAX_MODULES) {
+        return 0;
+    }
+    return this->m_levelMasks[module].load(std::memory_order_relaxed);
+}
+
+void BusLog::log(uint8_t module, Level level, const char* fmt, ...) {
+    if (!this->isEnabled(module, level)) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    this->logMessage(level, fmt, args);
+    va_end(args);
+}
+
+bool BusLog::handlePacket(Packet const& cmd, Packet* rsp) {
+    if (cmd.getCommand() != Command::LOG_CONFIG) {
+        return false;
+    }
+    this->handleLogConfig(cmd, rsp);
+    return true;
+}
+
+char const* BusLog::as_str(Packet::Command::Type cmd) const {
+    if (cmd == Command::LOG_CONFIG) {
+        return "LOG_CONFIG";
+    }
+    return "???";
+}
+
+void BusLog::handleLogConfig(Packet const& cmd, Packet* rsp) {
+    Unpacker unpacker(cmd);
+    uint8_t module;
+    uint8_t mask;
+    while (unpacker.unpackAll(&module, &mask)) {
+        this->setLevelMask(module, mask);
+    }
+
+    rsp->setCommand(Command::LOG_CONFIG);
+    Packer packer(rsp);
+    for (auto const& levelMask : this->m_levelMasks) {
+        if (!packer.pack(levelMask.load(std::memory_order_relaxed))) {
+            break;
+        }
+    }
+}
+
+void BusLog::setFormatTable(size_t numFormats, char const** formats) {
+    this->m_numFormats = std::min(numFormats, static_cast<size_t>(UINT16_MAX));
+    this->m_formats = formats;
+    this->resetFormats();
+}
+
+void BusLog::resetFormats() {
+    for (size_t idx = 0; idx < this->m_numFormats; idx++) {
+        this->m_formats[idx] = nullptr;
+    }
+}
+
+void BusLog::setBatchPacket(Packet* batch, uint32_t deadlineMs) {
+    this->m_batch = batch;
+    this->m_batchDeadlineMs = deadlineMs;
+    this->m_batchRequest.setPacket(batch);
+    this->m_batchSent = true;
+}
+
+void BusLog::service() {
+    if (this->m_ring != nullptr && this->m_bus->getLogPacket() != nullptr) {
+        this->serviceRing();
+    }
+    if (this->m_batch == nullptr || this->m_batchSent ||
+        this->m_batch->getDataLength() <= BATCH_DROPPED_LEN) {
         return;
     }
+    if (this->m_bus->getMillis() - this->m_batchStartMs >= this->m_batchDeadlineMs) {
+        this->flush();
+    }
+}
+
+bool BusLog::flush() {
+    if (this->m_batch == nullptr || this->m_batchSent ||
+        this->m_batch->getDataLength() <= BATCH_DROPPED_LEN) {
+        return true;
+    }
+    // Without logical channels, the batch is written immediately, so there needs to be
+    // room for all of it.
+    if (this->m_bus->hasChannels()
+            ? !this->m_bus->canQueuePacket(BusChannel::LOG, this->m_batch)
+            : !this->m_bus->hasSpaceForPacket(this->m_batch->getDataLength())) {
+        return false;
+    }
+    uint32_t numDropped = this->getNumDropped();
+    memcpy(this->m_batch->getData(), &numDropped, sizeof(numDropped));
+    this->m_batchSent = true;
+    if (this->m_bus->hasChannels()) {
+        this->m_bus->queuePacket(BusChannel::LOG, this->m_batch);
+    } else {
+        this->m_bus->sendPacket(this->m_batchRequest);
+    }
+    return true;
+}
+
+Packet* BusLog::getLogPacket() {
+    // With logical channels, the previous message may still be queued in the log packet.
+    Packet* log = this->m_bus->getLogPacket();
+    while (this->m_bus->isQueued(log)) {
+        this->m_bus->serviceTx();
+    }
+    return log;
+}
+
+bool BusLog::startBatch() {
+    if (!this->m_batchSent) {
+        return true;
+    }
+    if (!this->m_batchRequest.isSent() || this->m_bus->isQueued(this->m_batch)) {
+        // The previous batch is still waiting to be written.
+        return false;
+    }
+    this->m_batch->setCommand(Command::LOG_BATCH);
+    this->m_batch->setChannel(BusChannel::LOG);
+    this->m_batch->setData(0, nullptr);
+    this->m_batch->getWriteData(BATCH_DROPPED_LEN);
+    this->m_batchSent = false;
+    return true;
+}
+
+bool BusLog::sendMessage(Packet* log) {
+    if (this->m_batch == nullptr) {
+        while (!this->m_bus->queuePacket(BusChannel::LOG, log)) {
+            this->m_bus->serviceTx();
+        }
+        return true;
+    }
+
+    size_t recordLen = CorePacketHandler::BATCH_HEADER_LEN + log->getDataLength();
+    if (log->getDataLength() > UINT8_MAX || !this->startBatch()) {
+        this->m_numDropped++;
+        return false;
+    }
+    if (this->m_batch->getSpaceRemaining() < recordLen) {
+        // Make room by sending the batch. If it can't be sent right away, the message
+        // is dropped rather than waiting.
+        if (!this->flush() || !this->startBatch() ||
+            this->m_batch->getSpaceRemaining() < recordLen) {
+            this->m_numDropped++;
+            return false;
+        }
+    }
+    if (this->m_batch->getDataLength() <= BATCH_DROPPED_LEN) {
+        this->m_batchStartMs = this->m_bus->getMillis();
+    }
+    this->m_batch->appendByte(log->getCommand());
+    this->m_batch->appendByte(static_cast<uint8_t>(log->getDataLength()));
+    this->m_batch->appendData(log->getDataLength(), log->getData());
+    if (this->m_batchDeadlineMs == 0) {
+        this->flush();
+    }
+    return true;
+}
+
+bool BusLog::lookupFormat(char const* fmt, uint16_t* id) {
+    // The table is hashed on the address of the format string, so each message only costs
+    // a pointer comparison or two.
+    size_t start = (reinterpret_cast<uintptr_t>(fmt) >> 2) % this->m_numFormats;
+    size_t idx = start;
+    do {
+        if (this->m_formats[idx] == fmt) {
+            *id = static_cast<uint16_t>(idx);
+            return true;
+        }
+        if (this->m_formats[idx] == nullptr) {
+            break;
+        }
+        idx = (idx + 1) % this->m_numFormats;
+    } while (idx != start);
+    if (this->m_formats[idx] != nullptr) {
+        // The table is full.
+        return false;
+    }
+
+    // New format strings are sent to the host before they're used.
+    Packet* log = this->getLogPacket();
+    log->setCommand(Command::LOG_FORMAT);
+    log->setChannel(BusChannel::LOG);
+    log->setData(0, nullptr);
+    Packer packer{log};
+    uint16_t newId = static_cast<uint16_t>(idx);
+    if (strnlen(fmt, UINT8_MAX) >= UINT8_MAX || !packer.pack(newId) || !packer.pack(fmt)) {
+        return false;
+    }
+    if (!this->sendMessage(log)) {
+        return false;
+    }
+    this->m_formats[idx] = fmt;
+    *id = newId;
+    return true;
+}
+
+bool BusLog::packBinary(Packet* log, Level level, uint16_t id, const char* fmt, va_list& args) {
+    log->setCommand(Command::LOG_BINARY);
+    log->setChannel(BusChannel::LOG);
+    log->setData(0, nullptr);
+    Packer packer{log};
+    if (!packer.packAll(to_underlying(level), id)) {
+        return false;
+    }
+
+    // Walk through the conversions in the format string, to determine the type of each
+    // argument.
+    for (char const* s = fmt; *s != '\0'; s++) {
+        if (*s != '%') {
+            continue;
+        }
+        s++;
+        if (*s == '%') {
+            continue;
+        }
+        while (*s != '\0' && strchr("-+ #0", *s) != nullptr) {
+            s++;
+        }
+        if (*s == '*') {
+            if (!packer.pack(static_cast<int32_t>(va_arg(args, int)))) {
+                return false;
+            }
+            s++;
+        }
+        while (*s >= '0' && *s <= '9') {
+            s++;
+        }
+        int precision = -1;
+        if (*s == '.') {
+            s++;
+            if (*s == '*') {
+                precision = va_arg(args, int);
+                if (!packer.pack(static_cast<int32_t>(precision))) {
+                    return false;
+                }
+                s++;
+            } else {
+                precision = 0;
+                while (*s >= '0' && *s <= '9') {
+                    precision = precision * 10 + (*s - '0');
+                    s++;
+                }
+            }
+        }
 
+        // hh and h arguments are passed as an int, so they're treated like no modifier.
+        LengthModifier length = LengthModifier::NONE;
+        bool isWide = true;
+        switch (*s) {
+            case 'h': {
+                s += (s[1] == 'h') ? 2 : 1;
+                isWide = false;
+                break;
+            }
+            case 'l': {
+                length = (s[1] == 'l') ? LengthModifier::LONG_LONG : LengthModifier::LONG;
+                s += (s[1] == 'l') ? 2 : 1;
+                break;
+            }
+            case 'j': {
+                length = LengthModifier::INTMAX;
+                s++;
+                break;
+            }
+            case 'z': {
+                length = LengthModifier::SIZE;
+                s++;
+                break;
+            }
+            case 't': {
+                length = LengthModifier::PTRDIFF;
+                s++;
+                break;
+            }
+            default: {
+                isWide = false;
+                break;
+            }
+        }
+
+        bool packed = false;
+        switch (*s) {
+            case 'd':
+            case 'i': {
+                int64_t value = signedArg(length, args);
+                packed = isWide ? packer.pack(value) : packer.pack(static_cast<int32_t>(value));
+                break;
+            }
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X': {
+                uint64_t value = unsignedArg(length, args);
+                packed = isWide ? packer.pack(value) : packer.pack(static_cast<uint32_t>(value));
+                break;
+            }
+            case 'c': {
+                if (length != LengthModifier::NONE) {
+                    // Wide characters aren't supported.
+                    return false;
+                }
+                packed = packer.pack(static_cast<uint8_t>(va_arg(args, int)));
+                break;
+            }
+            case 'p': {
+                auto value = reinterpret_cast<uintptr_t>(va_arg(args, void*));
+                packed = packer.pack(static_cast<uint64_t>(value));
+                break;
+            }
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A': {
+                packed = packer.pack(va_arg(args, double));
+                break;
+            }
+            case 's': {
+                if (length != LengthModifier::NONE) {
+                    return false;
+                }
+                char const* str = va_arg(args, char const*);
+                if (str == nullptr) {
+                    str = "(null)";
+                }
+                size_t maxLen = UINT8_MAX - 1;
+                if (precision >= 0 && static_cast<size_t>(precision) < maxLen) {
+                    maxLen = precision;
+                }
+                uint8_t strLen = static_cast<uint8_t>(strnlen(str, maxLen));
+                if (log->getSpaceRemaining() >= strLen + 2u) {
+                    log->appendByte(strLen + 1);
+                    log->appendData(strLen, str);
+                    log->appendByte(0);
+                    packed = true;
+                }
+                break;
+            }
+            default: {
+                // %n, %L and anything else we don't recognize is formatted on the device.
+                return false;
+            }
+        }
+        if (!packed) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void BusLog::formatText(Packet* log, Level level, const char* fmt, va_list args) {
     log->setCommand(Command::LOG);
+    log->setChannel(BusChannel::LOG);
     log->setData(0, nullptr);
     log->appendByte(to_underlying(level));
 
@@ -59,10 +485,109 @@ void BusLog::do_log(
         .pkt = log,
         .bytes_written = 0,
     };
-    size_t bytes_written = vStrXPrintf(BusLog::log_char_to_packet, &param, fmt, args);
+    vStrXPrintf(BusLog::log_char_to_packet, &param, fmt, args);
     log->appendByte(0);
 
     *strLen = static_cast<uint8_t>(param.bytes_written + 1);
+}
+
+void BusLog::setLogRing(LogRing* ring) {
+    this->m_ring = ring;
+}
+
+void BusLog::serviceRing() {
+    LogRing::Entry entry;
+    while (this->m_ring->peek(&entry)) {
+        // The format ID is looked up here, rather than when the message was logged, since
+        // looking it up can modify the table and send a LOG_FORMAT packet.
+        uint16_t id = 0;
+        bool haveId = entry.format == nullptr || this->lookupFormat(entry.format, &id);
+
+        Packet* log = this->getLogPacket();
+        log->setCommand(Command::LOG_TIMED);
+        log->setChannel(BusChannel::LOG);
+        log->setData(0, nullptr);
+        Packer packer{log};
+        if (!packer.packAll(entry.timestamp, entry.command)) {
+            return;
+        }
+        size_t dataIdx = log->getDataLength();
+        if (!this->m_ring->pop(log)) {
+            continue;
+        }
+        if (entry.format != nullptr) {
+            if (haveId) {
+                memcpy(&log->getData()[dataIdx + 1], &id, sizeof(id));
+            } else {
+                // The format table is full, and the arguments can't be formatted here,
+                // so the best we can do is send the format string.
+                uint8_t level = log->getData()[dataIdx];
+                log->setData(0, nullptr);
+                packer.packAll(entry.timestamp, Command::LOG, level);
+                if (!packer.pack(entry.format)) {
+                    continue;
+                }
+            }
+        }
+        this->sendMessage(log);
+    }
+}
+
+void BusLog::do_log(
+    Level level,      //!< Logging level associated with this message.
+    const char* fmt,  //!< Printf style format string
+    va_list args      //!< Arguments associated with format string.
+) {
+    if (this->isEnabled(0, level)) {
+        this->logMessage(level, fmt, args);
+    }
+}
+
+void BusLog::logMessage(Level level, const char* fmt, va_list args) {
+    if (this->m_ring != nullptr) {
+        // do_log can be called from several contexts at once, so the message is built on
+        // the stack and added to the ring, rather than using the log packet.
+        uint8_t data[RING_MESSAGE_LEN];
+        Packet log{LEN(data), data};
+        char const* format = nullptr;
+        if (this->m_numFormats > 0) {
+            va_list binaryArgs;
+            va_copy(binaryArgs, args);
+            if (this->packBinary(&log, level, 0, fmt, binaryArgs)) {
+                format = fmt;
+            }
+            va_end(binaryArgs);
+        }
+        if (format == nullptr) {
+            this->formatText(&log, level, fmt, args);
+        }
+        this->m_ring->write(
+            this->m_bus->getMillis(), log.getCommand(), format, log.getDataLength(),
+            log.getData());
+        return;
+    }
+
+    if (this->m_bus->getLogPacket() == nullptr) {
+        // User didn't provide a log packet to the Bus constructor.
+        return;
+    }
+
+    uint16_t id;
+    bool haveId = this->m_numFormats > 0 && this->lookupFormat(fmt, &id);
+    Packet* log = this->getLogPacket();
+    if (haveId) {
+        // The arguments are copied, so that they can still be formatted on the device if
+        // the message can't be sent in binary.
+        va_list binaryArgs;
+        va_copy(binaryArgs, args);
+        bool packed = this->packBinary(log, level, id, fmt, binaryArgs);
+        va_end(binaryArgs);
+        if (packed) {
+            this->sendMessage(log);
+            return;
+        }
+    }
 
-    this->m_bus->writePacket(log);
+    this->formatText(log, level, fmt, args);
+    this->sendMessage(log);
 }
@@ -18,7 +18,13 @@
 
 #include <malloc.h>
 
+#include <cinttypes>
+#include <cstring>
+
+#include "duino_bus/HeapStats.h"
+#include "duino_bus/Packer.h"
 #include "duino_bus/Unpacker.h"
+#include "duino_log/Log.h"
 #include "duino_util/HeapMonitor.h"
 #include "duino_util/StackMonitor.h"
 
@@ -34,6 +40,32 @@ char const* CorePacketHandler::as_str(Packet::Command::Type cmd) const {
             return "STACK_INFO";
         case Command::HEAP_INFO:
             return "HEAP_INFO";
+        case Command::BATCH:
+            return "BATCH";
+        case Command::STREAM_END:
+            return "STREAM_END";
+        case Command::LOG_FORMAT:
+            return "LOG_FORMAT";
+        case Command::LOG_BINARY:
+            return "LOG_BINARY";
+        case Command::LOG_BATCH:
+            return "LOG_BATCH";
+        case Command::LOG_TIMED:
+            return "LOG_TIMED";
+        case Command::LOG_CONFIG:
+            return "LOG_CONFIG";
+        case Command::EVENT:
+            return "EVENT";
+        case Command::EVENT_SUBSCRIBE:
+            return "EVENT_SUBSCRIBE";
+        case Command::TELEMETRY_SUBSCRIBE:
+            return "TELEMETRY_SUBSCRIBE";
+        case Command::TELEMETRY:
+            return "TELEMETRY";
+        case Command::STATS:
+            return "STATS";
+        case Command::LATENCY:
+            return "LATENCY";
     }
     return "???";
 }
@@ -56,10 +88,142 @@ bool CorePacketHandler::handlePacket(Packet const& cmd, Packet* rsp) {
             this->handleHeapInfo(cmd, rsp);
             return true;
         }
+        case Command::BATCH: {
+            this->handleBatch(cmd, rsp);
+            return true;
+        }
+        case Command::TELEMETRY_SUBSCRIBE: {
+            this->handleTelemetrySubscribe(cmd, rsp);
+            return true;
+        }
+        case Command::STATS: {
+            this->handleStats(cmd, rsp);
+            return true;
+        }
+        case Command::LATENCY: {
+            this->handleLatency(cmd, rsp);
+            return true;
+        }
     }
     return false;
 }
 
+bool CorePacketHandler::handlePacketInPlace(Packet* cmd, Packet* rsp) {
+    if (cmd->getCommand() == Command::PING) {
+        // PING echoes the command data, so we send the command packet back as the
+        // response rather than copying the data.
+        rsp->swap(*cmd);
+        return true;
+    }
+    return this->handlePacket(*cmd, rsp);
+}
+
+bool CorePacketHandler::service() {
+    if (this->m_telemetryIntervalMs == 0 || this->m_bus == nullptr) {
+        return false;
+    }
+    // Records are only ever queued, since writing them synchronously would block whatever
+    // called service, so the bus needs an EVENT channel.
+    Packet* evt = this->m_bus->getEventPacket();
+    uint32_t now = this->m_bus->getMillis();
+    if (evt == nullptr || this->m_bus->getChannel(BusChannel::EVENT) == nullptr ||
+        now - this->m_telemetryLastMs < this->m_telemetryIntervalMs ||
+        !this->m_bus->isSpaceAvailable() || !this->m_bus->canQueuePacket(BusChannel::EVENT, evt)) {
+        return false;
+    }
+
+    uint32_t values[NUM_TELEMETRY_VALUES];
+    getHeapInfo(&values[0]);
+    getStackInfo(&values[NUM_HEAP_INFO_VALUES]);
+    this->m_bus->getStats().get(&values[NUM_HEAP_INFO_VALUES + NUM_STACK_INFO_VALUES]);
+
+    bool keyframe = this->m_telemetryCount == 0;
+    evt->setCommand(Command::TELEMETRY);
+    evt->setChannel(BusChannel::EVENT);
+    evt->setData(0, nullptr);
+    Packer packer(evt);
+    bool packed = packer.packAll(
+        static_cast<uint8_t>(keyframe ? TELEMETRY_KEYFRAME : 0),
+        static_cast<uint8_t>(NUM_TELEMETRY_VALUES));
+    for (size_t idx = 0; idx < NUM_TELEMETRY_VALUES && packed; idx++) {
+        if (keyframe) {
+            packed = packer.packVarint(values[idx]);
+        } else {
+            // Most values change slowly, so the deltas usually fit in a byte.
+            packed = packer.packSignedVarint(
+                static_cast<int32_t>(values[idx] - this->m_telemetry[idx]));
+        }
+    }
+    if (!packed) {
+        Log::error("TELEMETRY record doesn't fit in the event packet");
+        this->m_telemetryIntervalMs = 0;
+        return false;
+    }
+
+    memcpy(this->m_telemetry, values, sizeof(values));
+    this->m_telemetryLastMs = now;
+    this->m_telemetryCount = (this->m_telemetryCount + 1) % TELEMETRY_KEYFRAME_INTERVAL;
+    this->m_bus->queuePacket(BusChannel::EVENT, evt);
+    return true;
+}
+
+void CorePacketHandler::handleBatch(Packet const& cmd, Packet* rsp) {
+    rsp->setCommand(Command::BATCH);
+    uint8_t scratch[UINT8_MAX];
+
+    uint8_t const* data = cmd.getData();
+    size_t dataLen = cmd.getDataLength();
+    size_t offset = 0;
+    while (offset + BATCH_HEADER_LEN <= dataLen) {
+        Command::Type subCommand = data[offset];
+        size_t subLen = data[offset + 1];
+        offset += BATCH_HEADER_LEN;
+        if (offset + subLen > dataLen) {
+            Log::error("BATCH sub-command 0x%02" PRIx8 " truncated", subCommand);
+            break;
+        }
+
+        size_t space = rsp->getSpaceRemaining();
+        uint8_t* rspHeader = rsp->reserveData(space);
+        if (rspHeader == nullptr || space < BATCH_HEADER_LEN) {
+            Log::error("BATCH response full");
+            break;
+        }
+
+        // The sub-command and its response are views into the BATCH packets, so nothing
+        // gets copied. Handlers only get const access to the command.
+        Packet subCmd{subLen, const_cast<uint8_t*>(&data[offset])};
+        subCmd.setCommand(subCommand);
+        subCmd.getWriteData(subLen);
+        offset += subLen;
+
+        // Handlers don't check for room in the response, so once there isn't room for the
+        // largest sub-response, it's built in scratch and only copied over if it fits.
+        bool inPlace = space - BATCH_HEADER_LEN >= UINT8_MAX;
+        Packet subRsp{UINT8_MAX, inPlace ? &rspHeader[BATCH_HEADER_LEN] : scratch};
+        bool handled = subCommand != Command::BATCH &&
+                       this->m_bus->dispatchPacket(subCmd, &subRsp);
+        if (!handled) {
+            subRsp.setCommand(0);
+            subRsp.setData(0, nullptr);
+        }
+        bool fits = BATCH_HEADER_LEN + subRsp.getDataLength() <= space;
+        if (!fits) {
+            Log::error("BATCH response to 0x%02" PRIx8 " doesn't fit", subCommand);
+            subRsp.setCommand(0);
+            subRsp.setData(0, nullptr);
+        } else if (!inPlace) {
+            memcpy(&rspHeader[BATCH_HEADER_LEN], scratch, subRsp.getDataLength());
+        }
+        rspHeader[0] = subRsp.getCommand();
+        rspHeader[1] = static_cast<uint8_t>(subRsp.getDataLength());
+        rsp->commitData(BATCH_HEADER_LEN + subRsp.getDataLength());
+        if (!fits) {
+            break;
+        }
+    }
+}
+
 void CorePacketHandler::handleDebug(Packet const& cmd, Packet* rsp) {
     Unpacker unpacker(cmd);
     DebugFlags flags;
@@ -74,22 +238,60 @@ void CorePacketHandler::handleDebug(Packet const& cmd, Packet* rsp) {
 void CorePacketHandler::handleHeapInfo(Packet const&, Packet* rsp) {
     rsp->setCommand(Command::HEAP_INFO);
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-    struct mallinfo info = mallinfo();
-#pragma GCC diagnostic pop
-    // unittest compiles this file.
-#if defined(__ARM_ARCH)
-    auto growthPotential = getHeapGrowthPotential();
-#else
-    size_t growthPotential = 0;
-#endif
+    uint32_t info[NUM_HEAP_INFO_VALUES];
+    getHeapInfo(info);
+    Packer packer(rsp);
+    packer.packAll(info[0], info[1], info[2], info[3], info[4], info[5]);
+}
+
+void CorePacketHandler::handleLatency(Packet const& cmd, Packet* rsp) {
+    rsp->setCommand(Command::LATENCY);
+    Packer packer(rsp);
+    bool packed = true;
+
+    Unpacker unpacker(cmd);
+    Command::Type command;
+    if (!unpacker.unpack(&command)) {
+        IBus::CommandLatency* table = this->m_bus->getLatencyTable();
+        for (size_t idx = 0; idx < this->m_bus->getLatencyTableSize() && packed; idx++) {
+            if (table[idx].inUse) {
+                packed = packer.pack(table[idx].command);
+            }
+        }
+    } else {
+        uint8_t flags = 0;
+        unpacker.unpack(&flags);
 
-    rsp->append(static_cast<uint32_t>(info.arena));
-    rsp->append(static_cast<uint32_t>(info.uordblks));
-    rsp->append(static_cast<uint32_t>(info.fordblks));
-    rsp->append(static_cast<uint32_t>(info.ordblks));
-    rsp->append(static_cast<uint32_t>(growthPotential));
+        // Most buckets are empty, so only the ones with latencies in them are sent. Only
+        // the buckets which fit are sent, so the number of buckets is filled in at the end.
+        LatencyHistogram empty;
+        LatencyHistogram* histogram = this->m_bus->getLatency(command);
+        LatencyHistogram const& latency = histogram == nullptr ? empty : *histogram;
+        packed = packer.pack(command) && packer.packVarint(latency.getCount()) &&
+                 packer.packVarint(latency.getMax()) && packer.pack(static_cast<uint8_t>(0));
+        if (packed) {
+            uint8_t* numBuckets = &rsp->getData()[rsp->getDataLength() - 1];
+            for (size_t idx = 0; idx < LatencyHistogram::NUM_BUCKETS && packed; idx++) {
+                uint32_t count = latency.getBucket(idx);
+                if (count == 0) {
+                    continue;
+                }
+                // Each bucket is sent whole, or not at all.
+                packed = rsp->getSpaceRemaining() >= 1 + Packer::varintLength(count) &&
+                         packer.pack(static_cast<uint8_t>(idx)) && packer.packVarint(count);
+                if (packed) {
+                    (*numBuckets)++;
+                }
+            }
+        }
+        // A histogram which was only partly sent isn't reset, so nothing is lost.
+        if (histogram != nullptr && packed && (flags & LATENCY_RESET) != 0) {
+            histogram->reset();
+        }
+    }
+    if (!packed) {
+        Log::error("LATENCY response doesn't fit in the response packet");
+    }
 }
 
 void CorePacketHandler::handlePing(Packet const& cmd, Packet* rsp) {
@@ -101,13 +303,104 @@ void CorePacketHandler::handlePing(Packet const& cmd, Packet* rsp) {
 void CorePacketHandler::handleStackInfo(Packet const&, Packet* rsp) {
     rsp->setCommand(Command::STACK_INFO);
 
+    uint32_t info[NUM_STACK_INFO_VALUES];
+    getStackInfo(info);
+    Packer packer(rsp);
+    packer.packAll(info[0], info[1], info[2]);
+}
+
+void CorePacketHandler::handleStats(Packet const& cmd, Packet* rsp) {
+    Unpacker unpacker(cmd);
+    uint8_t flags = 0;
+    unpacker.unpack(&flags);
+
+    // Most of the counters are small, so they're sent as varints. Only the counters which
+    // fit are sent, so the count is filled in at the end.
+    rsp->setCommand(Command::STATS);
+    Packer packer(rsp);
+    if (!packer.pack(static_cast<uint8_t>(0))) {
+        Log::error("STATS response doesn't fit in the response packet");
+        return;
+    }
+    bool reset = (flags & STATS_RESET) != 0;
+    BusStats& stats = this->m_bus->getStats();
+    uint8_t numCounters = 0;
+    for (auto member : BUS_STATS_COUNTERS) {
+        BusCounter& counter = stats.*member;
+        uint32_t value = reset ? counter.take() : counter.get();
+        if (!packer.packVarint(value)) {
+            if (reset) {
+                // The value wasn't reported, so put it back.
+                counter.add(value);
+            }
+            Log::error("STATS response only has room for %" PRIu8 " counters", numCounters);
+            break;
+        }
+        numCounters++;
+    }
+    rsp->getData()[0] = numCounters;
+}
+
+void CorePacketHandler::handleTelemetrySubscribe(Packet const& cmd, Packet* rsp) {
+    Unpacker unpacker(cmd);
+    uint16_t intervalMs = 0;
+    unpacker.unpack(&intervalMs);
+
+    this->m_telemetryIntervalMs = intervalMs;
+    this->m_telemetryLastMs = this->m_bus->getMillis() - intervalMs;
+    this->m_telemetryCount = 0;
+
+    rsp->setCommand(Command::TELEMETRY_SUBSCRIBE);
+    Packer packer(rsp);
+    packer.packAll(intervalMs, static_cast<uint8_t>(NUM_TELEMETRY_VALUES));
+}
+
+void CorePacketHandler::getHeapInfo(uint32_t* info) {
+    HeapStats::Info heap;
+#if !defined(DUINO_BUS_HEAP_HOOKS)
+    // Without the hooks, the allocator has to walk its free lists to get the values.
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+#else
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    struct mallinfo mi = mallinfo();
+#pragma GCC diagnostic pop
+#endif
+    HeapStats::updateHighWater(static_cast<uint32_t>(mi.uordblks));
+    HeapStats::getInfo(&heap);
+    heap.arena = static_cast<uint32_t>(mi.arena);
+    heap.allocated = static_cast<uint32_t>(mi.uordblks);
+    heap.free = static_cast<uint32_t>(mi.fordblks);
+    // mallinfo doesn't report the size of the largest free block, so like the hooks, report
+    // the number of free bytes, which is an upper bound.
+    heap.largestFree = static_cast<uint32_t>(mi.fordblks);
+#else
+    HeapStats::getInfo(&heap);
+#endif
+    // unittest compiles this file.
+#if defined(__ARM_ARCH)
+    auto growthPotential = getHeapGrowthPotential();
+#else
+    size_t growthPotential = 0;
+#endif
+
+    info[0] = heap.arena;
+    info[1] = heap.allocated;
+    info[2] = heap.free;
+    info[3] = heap.largestFree;
+    info[4] = static_cast<uint32_t>(growthPotential);
+    info[5] = heap.highWater;
+}
+
+void CorePacketHandler::getStackInfo(uint32_t* info) {
 #if defined(__ARM_ARCH)
-    rsp->append(static_cast<uint32_t>(getStackSize()));
-    rsp->append(static_cast<uint32_t>(getUsedStackSpace()));
-    rsp->append(static_cast<uint32_t>(getUnusedStackSpace()));
+    info[0] = static_cast<uint32_t>(getStackSize());
+    info[1] = static_cast<uint32_t>(getUsedStackSpace());
+    info[2] = static_cast<uint32_t>(getUnusedStackSpace());
 #else
-    rsp->append(static_cast<uint32_t>(0));
-    rsp->append(static_cast<uint32_t>(0));
-    rsp->append(static_cast<uint32_t>(0));
+    info[0] = 0;
+    info[1] = 0;
+    info[2] = 0;
 #endif
 }
@@ -0,0 +1,145 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   Crc.cpp
+ *
+ *   @brief  Wider CRCs which can be used to protect packets.
+ *
+ ****************************************************************************/
+
+#include "duino_bus/Crc.h"
+
+#include <array>
+#include <cstring>
+
+// The CRC instructions are compiled using target attributes, so the default build can
+// use them, and they're only called if the CPU says it has them.
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define CRC32C_HAVE_SSE42 1
+#define CRC32C_HW_TARGET __attribute__((target("sse4.2")))
+#elif defined(__aarch64__) && defined(__GNUC__) && \
+    (defined(__ARM_FEATURE_CRC32) || defined(__linux__))
+#include <arm_acle.h>
+#if !defined(__ARM_FEATURE_CRC32)
+#include <sys/auxv.h>
+#endif
+#define CRC32C_HAVE_ARMV8 1
+#if defined(__clang__)
+#define CRC32C_HW_TARGET __attribute__((target("crc")))
+#else
+#define CRC32C_HW_TARGET __attribute__((target("+crc")))
+#endif
+#endif
+
+namespace {
+
+//! Builds the byte-at-a-time lookup table for CRC-16/CCITT.
+constexpr std::array<uint16_t, 256> makeCrc16Table() {
+    std::array<uint16_t, 256> table{};
+    for (uint32_t byte = 0; byte < 256; byte++) {
+        uint16_t crc = static_cast<uint16_t>(byte << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021)
+                                 : static_cast<uint16_t>(crc << 1);
+        }
+        table[byte] = crc;
+    }
+    return table;
+}
+
+constexpr std::array<uint16_t, 256> CRC16_TABLE = makeCrc16Table();
+
+//! Builds the byte-at-a-time lookup table for CRC-32C (reflected polynomial).
+constexpr std::array<uint32_t, 256> makeCrc32cTable() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t byte = 0; byte < 256; byte++) {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78 : (crc >> 1);
+        }
+        table[byte] = crc;
+    }
+    return table;
+}
+
+constexpr std::array<uint32_t, 256> CRC32C_TABLE = makeCrc32cTable();
+
+//! Calculates a CRC-32C a byte at a time using CRC32C_TABLE (crc is already inverted).
+//! @returns the updated CRC.
+uint32_t crc32cTable(uint32_t crc, size_t len, uint8_t const* data8) {
+    for (; len > 0; len--, data8++) {
+        crc = (crc >> 8) ^ CRC32C_TABLE[(crc ^ *data8) & 0xff];
+    }
+    return crc;
+}
+
+#if defined(CRC32C_HAVE_SSE42) || defined(CRC32C_HAVE_ARMV8)
+
+//! Calculates a CRC-32C using the CPU's CRC instructions (crc is already inverted).
+//! @returns the updated CRC.
+CRC32C_HW_TARGET uint32_t crc32cHw(uint32_t crc, size_t len, uint8_t const* data8) {
+    // Process 8 bytes at a time, and then finish off the remaining bytes.
+    for (; len >= 8; len -= 8, data8 += 8) {
+        uint64_t val;
+        memcpy(&val, data8, sizeof(val));
+#if defined(CRC32C_HAVE_SSE42)
+        crc = static_cast<uint32_t>(_mm_crc32_u64(crc, val));
+#else
+        crc = __crc32cd(crc, val);
+#endif
+    }
+    for (; len > 0; len--, data8++) {
+#if defined(CRC32C_HAVE_SSE42)
+        crc = _mm_crc32_u8(crc, *data8);
+#else
+        crc = __crc32cb(crc, *data8);
+#endif
+    }
+    return crc;
+}
+
+#endif
+
+//! Signature of the functions which calculate a CRC-32C.
+using Crc32cFunc = uint32_t (*)(uint32_t crc, size_t len, uint8_t const* data8);
+
+//! Picks the fastest way of calculating a CRC-32C that this CPU supports.
+//! @returns the function to use.
+Crc32cFunc selectCrc32c() {
+#if defined(CRC32C_HAVE_SSE42)
+    if (__builtin_cpu_supports("sse4.2")) {
+        return crc32cHw;
+    }
+#elif defined(CRC32C_HAVE_ARMV8) && defined(__ARM_FEATURE_CRC32)
+    return crc32cHw;
+#elif defined(CRC32C_HAVE_ARMV8)
+    if ((getauxval(AT_HWCAP) & HWCAP_CRC32) != 0) {
+        return crc32cHw;
+    }
+#endif
+    return crc32cTable;
+}
+
+}  // namespace
+
+uint16_t Crc16Ccitt(uint16_t crc, size_t len, void const* data) {
+    auto const* data8 = static_cast<uint8_t const*>(data);
+    for (size_t i = 0; i < len; i++) {
+        crc = static_cast<uint16_t>((crc << 8) ^ CRC16_TABLE[(crc >> 8) ^ data8[i]]);
+    }
+    return crc;
+}
+
+uint32_t Crc32c(uint32_t crc, size_t len, void const* data) {
+    // The CPU is only checked once.
+    static Crc32cFunc const crc32cFunc = selectCrc32c();
+    return ~crc32cFunc(~crc, len, static_cast<uint8_t const*>(data));
+}
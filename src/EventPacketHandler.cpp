@@ -0,0 +1,167 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   EventPacketHandler.cpp
+ *
+ *   @brief  Packet handler which pushes events that the host has subscribed to.
+ *
+ ****************************************************************************/
+
+#include "duino_bus/EventPacketHandler.h"
+
+#include <cstring>
+
+#include "duino_bus/Bus.h"
+#include "duino_bus/CorePacketHandler.h"
+#include "duino_bus/Unpacker.h"
+
+using Command = CorePacketHandler::Command;
+
+//! Number of bytes (id and length) before each value in an EVENT packet.
+static constexpr size_t EVENT_HEADER_LEN = 3;
+
+void EventPacketHandler::setSubscriptionTable(
+    size_t numSubscriptions,
+    Subscription* subscriptions) {
+    this->m_numSubscriptions = numSubscriptions;
+    this->m_subscriptions = subscriptions;
+    this->m_nextIdx = 0;
+    for (size_t idx = 0; idx < numSubscriptions; idx++) {
+        subscriptions[idx].inUse = false;
+        subscriptions[idx].pending = false;
+    }
+}
+
+bool EventPacketHandler::publish(EventId id, size_t length, void const* value) {
+    Subscription* sub = this->findSubscription(id);
+    if (sub == nullptr || length > MAX_VALUE_LEN) {
+        return false;
+    }
+    // Only the latest value is kept, so events published faster than the host wants them
+    // are coalesced.
+    memcpy(sub->value, value, length);
+    sub->length = static_cast<uint8_t>(length);
+    sub->pending = true;
+    return true;
+}
+
+bool EventPacketHandler::service() {
+    Packet* evt = this->m_bus == nullptr ? nullptr : this->m_bus->getEventPacket();
+    if (evt == nullptr || this->m_numSubscriptions == 0 || !this->m_bus->isSpaceAvailable() ||
+        !this->m_bus->canQueuePacket(BusChannel::EVENT, evt)) {
+        return false;
+    }
+    evt->setCommand(Command::EVENT);
+    evt->setChannel(BusChannel::EVENT);
+    evt->setData(0, nullptr);
+
+    // Start where the last packet left off, so that when more events are due than fit in
+    // one packet, the ones at the end of the table still get sent.
+    uint32_t now = this->m_bus->getMillis();
+    size_t idx = this->m_nextIdx;
+    for (size_t count = 0; count < this->m_numSubscriptions; count++) {
+        Subscription& sub = this->m_subscriptions[idx];
+        if (sub.inUse && sub.pending && now - sub.lastSentMs >= sub.intervalMs) {
+            if (evt->getSpaceRemaining() < EVENT_HEADER_LEN + sub.length) {
+                break;
+            }
+            evt->append(sub.id);
+            evt->appendByte(sub.length);
+            evt->appendData(sub.length, sub.value);
+            sub.lastSentMs = now;
+            sub.pending = false;
+        }
+        idx = (idx + 1) % this->m_numSubscriptions;
+    }
+    this->m_nextIdx = idx;
+
+    if (evt->getDataLength() == 0) {
+        return false;
+    }
+    this->m_bus->queuePacket(BusChannel::EVENT, evt);
+    return true;
+}
+
+size_t EventPacketHandler::getNumSubscribed() const {
+    size_t numSubscribed = 0;
+    for (size_t idx = 0; idx < this->m_numSubscriptions; idx++) {
+        if (this->m_subscriptions[idx].inUse) {
+            numSubscribed++;
+        }
+    }
+    return numSubscribed;
+}
+
+bool EventPacketHandler::handlePacket(Packet const& cmd, Packet* rsp) {
+    if (cmd.getCommand() != Command::EVENT_SUBSCRIBE) {
+        return false;
+    }
+    this->handleSubscribe(cmd, rsp);
+    return true;
+}
+
+char const* EventPacketHandler::as_str(Packet::Command::Type cmd) const {
+    switch (cmd) {
+        case Command::EVENT:
+            return "EVENT";
+        case Command::EVENT_SUBSCRIBE:
+            return "EVENT_SUBSCRIBE";
+    }
+    return "???";
+}
+
+void EventPacketHandler::handleSubscribe(Packet const& cmd, Packet* rsp) {
+    rsp->setCommand(Command::EVENT_SUBSCRIBE);
+
+    Unpacker unpacker(cmd);
+    EventId id;
+    uint16_t intervalMs;
+    while (unpacker.unpackAll(&id, &intervalMs)) {
+        Subscription* sub = this->findSubscription(id);
+        if (intervalMs == UNSUBSCRIBE) {
+            if (sub != nullptr) {
+                sub->inUse = false;
+                sub->pending = false;
+            }
+            rsp->appendByte(static_cast<uint8_t>(Status::OK));
+            continue;
+        }
+        if (sub == nullptr) {
+            for (size_t idx = 0; idx < this->m_numSubscriptions; idx++) {
+                if (!this->m_subscriptions[idx].inUse) {
+                    sub = &this->m_subscriptions[idx];
+                    break;
+                }
+            }
+            if (sub == nullptr) {
+                rsp->appendByte(static_cast<uint8_t>(Status::FULL));
+                continue;
+            }
+            // A new subscription gets sent as soon as it's published.
+            sub->id = id;
+            sub->inUse = true;
+            sub->pending = false;
+            sub->length = 0;
+            sub->lastSentMs = this->m_bus->getMillis() - intervalMs;
+        }
+        sub->intervalMs = intervalMs;
+        rsp->appendByte(static_cast<uint8_t>(Status::OK));
+    }
+}
+
+EventPacketHandler::Subscription* EventPacketHandler::findSubscription(EventId id) const {
+    for (size_t idx = 0; idx < this->m_numSubscriptions; idx++) {
+        Subscription& sub = this->m_subscriptions[idx];
+        if (sub.inUse && sub.id == id) {
+            return &sub;
+        }
+    }
+    return nullptr;
+}
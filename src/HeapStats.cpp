@@ -0,0 +1,127 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   HeapStats.cpp
+ *
+ *   @brief  Heap counters which are maintained incrementally.
+ *
+ ****************************************************************************/
+
+#include "duino_bus/HeapStats.h"
+
+#include <malloc.h>
+
+#include <atomic>
+
+// The counters are updated from whichever thread or core is allocating, so they're
+// atomic. Relaxed ordering is enough since they're only ever read as a snapshot.
+static std::atomic<uint32_t> g_arena{0};      //!< Number of bytes obtained from the system.
+static std::atomic<uint32_t> g_allocated{0};  //!< Number of bytes in allocated blocks.
+static std::atomic<uint32_t> g_highWater{0};  //!< Largest value of g_allocated.
+
+void HeapStats::recordAlloc(size_t size) {
+    uint32_t allocated =
+        g_allocated.fetch_add(static_cast<uint32_t>(size), std::memory_order_relaxed) + size;
+    updateHighWater(allocated);
+}
+
+void HeapStats::recordFree(size_t size) {
+    g_allocated.fetch_sub(static_cast<uint32_t>(size), std::memory_order_relaxed);
+}
+
+void HeapStats::recordArena(ptrdiff_t increment) {
+    g_arena.fetch_add(static_cast<uint32_t>(increment), std::memory_order_relaxed);
+}
+
+void HeapStats::updateHighWater(uint32_t allocated) {
+    uint32_t highWater = g_highWater.load(std::memory_order_relaxed);
+    while (allocated > highWater &&
+           !g_highWater.compare_exchange_weak(highWater, allocated, std::memory_order_relaxed)) {
+    }
+}
+
+void HeapStats::getInfo(Info* info) {
+    info->arena = g_arena.load(std::memory_order_relaxed);
+    info->allocated = g_allocated.load(std::memory_order_relaxed);
+    info->free = info->arena > info->allocated ? info->arena - info->allocated : 0;
+    info->largestFree = info->free;
+    info->highWater = g_highWater.load(std::memory_order_relaxed);
+}
+
+void HeapStats::reset() {
+    g_arena.store(0, std::memory_order_relaxed);
+    g_allocated.store(0, std::memory_order_relaxed);
+    g_highWater.store(0, std::memory_order_relaxed);
+}
+
+#if defined(DUINO_BUS_HEAP_HOOKS)
+
+// These replace the allocator's entry points when the program is linked with --wrap (see
+// HeapStats.h). The usable size of each block is used, so that free can find out how big
+// the block was without keeping track of it.
+
+extern "C" {
+
+void* __real_malloc(size_t size);
+void __real_free(void* ptr);
+void* __real_calloc(size_t num, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+    void* ptr = __real_malloc(size);
+    if (ptr != nullptr) {
+        HeapStats::recordAlloc(malloc_usable_size(ptr));
+    }
+    return ptr;
+}
+
+void __wrap_free(void* ptr) {
+    if (ptr != nullptr) {
+        HeapStats::recordFree(malloc_usable_size(ptr));
+    }
+    __real_free(ptr);
+}
+
+void* __wrap_calloc(size_t num, size_t size) {
+    void* ptr = __real_calloc(num, size);
+    if (ptr != nullptr) {
+        HeapStats::recordAlloc(malloc_usable_size(ptr));
+    }
+    return ptr;
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    size_t oldSize = ptr == nullptr ? 0 : malloc_usable_size(ptr);
+    void* newPtr = __real_realloc(ptr, size);
+    if (newPtr != nullptr) {
+        HeapStats::recordFree(oldSize);
+        HeapStats::recordAlloc(malloc_usable_size(newPtr));
+    } else if (size == 0) {
+        // realloc with a size of 0 frees the block.
+        HeapStats::recordFree(oldSize);
+    }
+    return newPtr;
+}
+
+#if !defined(__GLIBC__)
+void* __real__sbrk(ptrdiff_t increment);
+
+void* __wrap__sbrk(ptrdiff_t increment) {
+    void* ptr = __real__sbrk(increment);
+    if (ptr != reinterpret_cast<void*>(-1)) {
+        HeapStats::recordArena(increment);
+    }
+    return ptr;
+}
+#endif  // !__GLIBC__
+
+}  // extern "C"
+
+#endif  // DUINO_BUS_HEAP_HOOKS
@@ -0,0 +1,121 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   LogRing.cpp
+ *
+ *   @brief  Lock-free ring buffer of log messages.
+ *
+ ****************************************************************************/
+
+#include "duino_bus/LogRing.h"
+
+#include <cassert>
+#include <cstring>
+
+// Each message is laid out in the buffer as:
+//     uint32_t header (COMMITTED, SKIP and the number of words in the message)
+//     uint32_t timestamp
+//     uint32_t command (bits 16-23) and length (bits 0-15)
+//     char const* format (padded to a multiple of 4 bytes)
+//     uint8_t data[length] (padded to a multiple of 4 bytes)
+//
+// The headers are accessed using the compiler's atomic builtins, since the buffer is
+// provided by the caller as plain words. The head and tail are free running counters,
+// which are masked to get an index into the buffer.
+
+LogRing::LogRing(size_t numWords, uint32_t* buffer) : m_numWords{numWords}, m_buffer{buffer} {
+    assert((numWords & (numWords - 1)) == 0 && numWords <= SIZE_MASK + 1);
+    memset(buffer, 0, numWords * sizeof(uint32_t));
+}
+
+bool LogRing::write(
+    uint32_t timestamp,
+    uint8_t command,
+    char const* format,
+    size_t length,
+    uint8_t const* data) {
+    uint32_t numWords = HEADER_WORDS + (length + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+    if (numWords > this->m_numWords || numWords > SIZE_MASK || length > UINT16_MAX) {
+        this->m_numDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Reserve the space, along with any space at the end of the buffer that the message
+    // doesn't fit in.
+    uint32_t head = this->m_head.load(std::memory_order_relaxed);
+    uint32_t skip;
+    do {
+        uint32_t idx = head & (this->m_numWords - 1);
+        skip = (idx + numWords > this->m_numWords) ? this->m_numWords - idx : 0;
+        uint32_t tail = this->m_tail.load(std::memory_order_acquire);
+        if (head + skip + numWords - tail > this->m_numWords) {
+            this->m_numDropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    } while (!this->m_head.compare_exchange_weak(
+        head, head + skip + numWords, std::memory_order_relaxed, std::memory_order_relaxed));
+
+    if (skip > 0) {
+        uint32_t* header = &this->m_buffer[head & (this->m_numWords - 1)];
+        __atomic_store_n(header, COMMITTED | SKIP | skip, __ATOMIC_RELEASE);
+    }
+    uint32_t* msg = &this->m_buffer[(head + skip) & (this->m_numWords - 1)];
+    msg[1] = timestamp;
+    msg[2] = (static_cast<uint32_t>(command) << 16) | static_cast<uint32_t>(length);
+    memcpy(&msg[3], &format, sizeof(format));
+    memcpy(&msg[HEADER_WORDS], data, length);
+    __atomic_store_n(&msg[0], COMMITTED | numWords, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool LogRing::peek(Entry* entry) {
+    while (true) {
+        uint32_t tail = this->m_tail.load(std::memory_order_relaxed);
+        uint32_t* msg = &this->m_buffer[tail & (this->m_numWords - 1)];
+        uint32_t header = __atomic_load_n(&msg[0], __ATOMIC_ACQUIRE);
+        if ((header & COMMITTED) == 0) {
+            return false;
+        }
+        if ((header & SKIP) != 0) {
+            this->release(header & SIZE_MASK);
+            continue;
+        }
+        entry->timestamp = msg[1];
+        entry->command = static_cast<uint8_t>(msg[2] >> 16);
+        entry->length = msg[2] & 0xffff;
+        memcpy(&entry->format, &msg[3], sizeof(entry->format));
+        return true;
+    }
+}
+
+bool LogRing::pop(Packet* packet) {
+    uint32_t tail = this->m_tail.load(std::memory_order_relaxed);
+    uint32_t* msg = &this->m_buffer[tail & (this->m_numWords - 1)];
+    size_t length = msg[2] & 0xffff;
+    bool appended = packet->getSpaceRemaining() >= length;
+    if (appended) {
+        packet->appendData(length, &msg[HEADER_WORDS]);
+    } else {
+        this->m_numDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    this->release(__atomic_load_n(&msg[0], __ATOMIC_RELAXED) & SIZE_MASK);
+    return appended;
+}
+
+void LogRing::release(uint32_t numWords) {
+    // The space is cleared before it's handed back, so that when a message is reserved
+    // there, the reader sees an uncommitted header (rather than old data) until the
+    // message has been written.
+    uint32_t tail = this->m_tail.load(std::memory_order_relaxed);
+    uint32_t* msg = &this->m_buffer[tail & (this->m_numWords - 1)];
+    memset(&msg[1], 0, (numWords - 1) * sizeof(uint32_t));
+    __atomic_store_n(&msg[0], 0, __ATOMIC_RELAXED);
+    this->m_tail.store(tail + numWords, std::memory_order_release);
+}
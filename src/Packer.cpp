@@ -39,3 +39,52 @@ bool Packer::pack(char const* str) {
 
     return true;
 }
+
+bool Packer::packVarint(uint32_t value) {
+    uint8_t data[5];
+    size_t numBytes = 0;
+    while (value >= 0x80) {
+        data[numBytes++] = static_cast<uint8_t>(value) | 0x80;
+        value >>= 7;
+    }
+    data[numBytes++] = static_cast<uint8_t>(value);
+
+    if (this->m_packet->getSpaceRemaining() < numBytes) {
+        return false;
+    }
+    this->m_packet->appendData(numBytes, data);
+    return true;
+}
+
+size_t Packer::varintLength(uint32_t value) {
+    size_t numBytes = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        numBytes++;
+    }
+    return numBytes;
+}
+
+bool Packer::packSignedVarint(int32_t value) {
+    uint32_t zigzag = (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+    return this->packVarint(zigzag);
+}
+
+Packer::Reservation Packer::reserve(size_t numBytes) {
+    uint8_t* data = this->m_packet->reserveData(numBytes);
+    return Reservation(this->m_packet, data, data == nullptr ? 0 : numBytes);
+}
+
+bool Packer::Reservation::commit(size_t numBytes) {
+    if (this->m_data == nullptr || numBytes > this->m_size) {
+        return false;
+    }
+    // Make sure that nothing was appended to the packet since we made the reservation.
+    if (this->m_packet->reserveData(numBytes) != this->m_data) {
+        return false;
+    }
+    this->m_packet->commitData(numBytes);
+    this->m_data = nullptr;
+    this->m_size = 0;
+    return true;
+}
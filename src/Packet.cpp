@@ -20,8 +20,10 @@
 #include <cassert>
 #include <cinttypes>
 #include <memory>
+#include <utility>
 
 #include "duino_bus/Bus.h"
+#include "duino_bus/Crc.h"
 #include "duino_log/Log.h"
 #include "duino_log/DumpMem.h"
 #include "duino_util/Crc8.h"
@@ -55,13 +57,27 @@ void Packet::dump(char const* label, IBus const* bus) const {
     Command cmd{this->getCommand()};
     char const* cmd_str = (bus == nullptr) ? "???" : bus->as_str(cmd.value);
     Log::info(
-        "%s: Command: 0x%02" PRIx8 " (%s) Len: %zu CRC: 0x%02" PRIx8, label, cmd.value, cmd_str,
-        this->getDataLength(), this->getCrc());
+        "%s: Command: 0x%02" PRIx8 " (%s) Len: %zu CRC: 0x%0*" PRIx32, label, cmd.value, cmd_str,
+        this->getDataLength(), static_cast<int>(crcSize(this->m_crcType) * 2), this->getCrc());
+    if (this->m_hasAddress) {
+        Log::info("%s: Address: 0x%02" PRIx8, label, this->m_address);
+    }
+    if (this->m_hasChannel) {
+        Log::info("%s: Channel: %" PRIu8, label, this->m_channel);
+    }
     DumpMem(label, 0, this->m_data, this->getDataLength());
+    size_t offset = this->getDataLength();
+    for (size_t idx = 0; idx < this->m_numSegments; idx++) {
+        auto const& segment = this->m_segments[idx];
+        DumpMem(label, offset, segment.data, segment.len);
+        offset += segment.len;
+    }
 }
 
 void Packet::setData(size_t dataLen, void const* data) {
     this->m_dataLen = 0;
+    this->m_numSegments = 0;
+    this->m_segmentDataLen = 0;
     if (dataLen > 0) {
         this->appendData(dataLen, data);
     }
@@ -69,17 +85,39 @@ void Packet::setData(size_t dataLen, void const* data) {
 
 void Packet::appendByte(uint8_t byte) {
     assert(this->getDataLength() < this->getMaxDataLength());
+    assert(this->m_numSegments == 0);
     this->m_data[this->m_dataLen++] = byte;
 }
 
 void Packet::appendData(size_t dataLen, void const* data) {
     assert(this->getDataLength() + dataLen <= this->getMaxDataLength());
+    assert(this->m_numSegments == 0);
     if (dataLen > 0) {
         memcpy(&this->m_data[this->m_dataLen], data, dataLen);
         this->m_dataLen += dataLen;
     }
 }
 
+void Packet::setSegmentStorage(size_t maxSegments, Segment* segments) {
+    this->m_segments = segments;
+    this->m_maxSegments = maxSegments;
+    this->m_numSegments = 0;
+    this->m_segmentDataLen = 0;
+}
+
+bool Packet::appendSegment(size_t dataLen, void const* data) {
+    assert(this->m_numSegments < this->m_maxSegments);
+    if (this->getTotalDataLength() + dataLen > this->m_maxDataLen) {
+        return false;
+    }
+    if (dataLen > 0) {
+        this->m_segments[this->m_numSegments++] =
+            Segment{reinterpret_cast<uint8_t const*>(data), dataLen};
+        this->m_segmentDataLen += dataLen;
+    }
+    return true;
+}
+
 void Packet::append(char const* str) {
     // Get the length (including the terminating null)
     uint8_t strLength = strnlen(str, 256) + 1;
@@ -91,26 +129,83 @@ void Packet::append(char const* str) {
     this->appendData(strLength, str);
 }
 
-uint8_t Packet::getCrc() const {
+uint32_t Packet::getCrc() const {
     return this->m_crc;
 }
 
-uint8_t Packet::calcCrc() const {
-    uint8_t expectedCrc = Crc8(0, this->m_command.value);
-    expectedCrc = Crc8(expectedCrc, this->getDataLength(), this->getData());
-    return expectedCrc;
+//! Helper which runs the command, address, channel, data, and segments through a CRC function.
+//! @returns the CRC over the command and the data.
+template <typename T, typename CrcFn>
+static T calcPacketCrc(
+    Packet const& packet,  //!< [in] Packet to calculate the CRC of.
+    T crc,                 //!< [in] Initial CRC value.
+    CrcFn crcFn            //!< [in] Function which updates the CRC.
+) {
+    uint8_t cmd = packet.getCommand();
+    crc = crcFn(crc, 1, &cmd);
+    if (packet.hasAddress()) {
+        uint8_t address = packet.getAddress();
+        crc = crcFn(crc, 1, &address);
+    }
+    if (packet.hasChannel()) {
+        uint8_t channel = packet.getChannel();
+        crc = crcFn(crc, 1, &channel);
+    }
+    crc = crcFn(crc, packet.getDataLength(), packet.getData());
+    for (size_t idx = 0; idx < packet.getNumSegments(); idx++) {
+        auto const& segment = packet.getSegment(idx);
+        crc = crcFn(crc, segment.len, segment.data);
+    }
+    return crc;
 }
 
-uint8_t Packet::extractCrc() {
-    assert(this->m_dataLen >= 1);
+uint32_t Packet::calcCrc() const {
+    switch (this->m_crcType) {
+        case CrcType::CRC8:
+            return calcPacketCrc<uint8_t>(
+                *this, 0, [](uint8_t crc, size_t len, void const* data) {
+                    return Crc8(crc, len, data);
+                });
+        case CrcType::CRC16:
+            return calcPacketCrc<uint16_t>(*this, CRC16_CCITT_INIT, Crc16Ccitt);
+        case CrcType::CRC32C:
+            return calcPacketCrc<uint32_t>(*this, 0, Crc32c);
+        case CrcType::NONE:
+            break;
+    }
+    return 0;
+}
+
+uint32_t Packet::extractCrc() {
+    size_t crcLen = crcSize(this->m_crcType);
+    assert(this->m_dataLen >= crcLen);
     // When receiving data we don't know the length ahead of time, so the
-    // CRC will be the last byte of the data. We remove it from the data
+    // CRC will be the last bytes of the data. We remove it from the data
     // and store it in the crc field.
-    this->m_dataLen--;
-    this->m_crc = this->m_data[this->m_dataLen];
+    this->m_dataLen -= crcLen;
+    this->m_crc = 0;
+    for (size_t i = 0; i < crcLen; i++) {
+        this->m_crc |= static_cast<uint32_t>(this->m_data[this->m_dataLen + i]) << (i * 8);
+    }
     return this->m_crc;
 }
 
 void Packet::calcAndStoreCrc() {
     this->m_crc = this->calcCrc();
 }
+
+void Packet::swap(Packet& other) {
+    // Each packet keeps its own segment storage, so only packets without segments, whose
+    // buffers are interchangeable, can be swapped.
+    assert(this->m_maxDataLen == other.m_maxDataLen);
+    assert(this->m_numSegments == 0 && other.m_numSegments == 0);
+    std::swap(this->m_command, other.m_command);
+    std::swap(this->m_dataLen, other.m_dataLen);
+    std::swap(this->m_data, other.m_data);
+    std::swap(this->m_crc, other.m_crc);
+    std::swap(this->m_crcType, other.m_crcType);
+    std::swap(this->m_address, other.m_address);
+    std::swap(this->m_hasAddress, other.m_hasAddress);
+    std::swap(this->m_channel, other.m_channel);
+    std::swap(this->m_hasChannel, other.m_hasChannel);
+}
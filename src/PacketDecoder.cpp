@@ -24,14 +24,191 @@
 #include "duino_bus/Bus.h"
 #include "duino_log/DumpMem.h"
 #include "duino_log/Log.h"
-#include "duino_util/Crc8.h"
 
-PacketDecoder::PacketDecoder(IBus const* bus, Packet* pkt) : m_bus{bus}, m_packet{pkt} {}
+PacketDecoder::PacketDecoder(IBus const* bus, Packet* pkt)
+    : m_bus{bus}, m_defaultPacket{pkt}, m_packet{pkt}, m_channelPackets{nullptr} {}
 
 Packet::Error PacketDecoder::decodeByte(uint8_t byte) {
+    Packet::Error err = this->decodeFramedByte(byte);
+    if (this->m_stats != nullptr) {
+        this->m_stats->recordRx(err);
+    }
+    return err;
+}
+
+Packet::Error PacketDecoder::decodeFramedByte(uint8_t byte) {
+    switch (this->m_framing) {
+        case Framing::SLIP:
+            return this->decodeSlipByte(byte);
+        case Framing::COBS:
+            return this->decodeCobsByte(byte);
+        case Framing::LENGTH:
+            return this->decodeLengthByte(byte);
+    }
+    return Packet::Error::BAD_STATE;
+}
+
+Packet::Error PacketDecoder::decodeByte(uint8_t byte, uint32_t nowMsec) {
+    Packet::Error err = this->checkTimeout(nowMsec);
+    this->m_lastByteMsec = nowMsec;
+    if (err == Packet::Error::TIMEOUT) {
+        // The decoder is now idle, so this byte can't complete a packet.
+        this->decodeByte(byte);
+        return err;
+    }
+    return this->decodeByte(byte);
+}
+
+Packet::Error PacketDecoder::checkTimeout(uint32_t nowMsec) {
+    if (this->m_timeoutMsec == 0 || !this->isFrameInProgress()) {
+        return Packet::Error::NOT_DONE;
+    }
+    // Unsigned arithmetic takes care of the millisecond counter wrapping around.
+    if (nowMsec - this->m_lastByteMsec < this->m_timeoutMsec) {
+        return Packet::Error::NOT_DONE;
+    }
+    Log::error("Packet timed out");
+    if (this->m_stats != nullptr) {
+        this->m_stats->rxTimeouts.add();
+    }
+    this->discardFrame();
+    this->m_state = State::IDLE;
+    this->m_escape = false;
+    return Packet::Error::TIMEOUT;
+}
+
+bool PacketDecoder::isFrameInProgress() const {
+    switch (this->m_state) {
+        case State::IDLE:
+        case State::HUNT:
+            return false;
+
+        case State::IGNORE:
+            // LENGTH framing needs to count the ignored bytes to stay in sync.
+            return this->m_framing == Framing::LENGTH;
+
+        case State::COMMAND:
+        case State::CODE:
+            // These states are also used between packets.
+            return this->m_headerIdx > 0 || this->m_escape;
+
+        default:
+            break;
+    }
+    return true;
+}
+
+void PacketDecoder::discardFrame() {
+    if (this->m_headerIdx > 0) {
+        size_t numBytes = this->m_headerIdx;
+        if (this->m_headerIdx == this->headerLength()) {
+            numBytes += this->m_packet->getDataLength();
+        }
+        this->addDiscardedBytes(numBytes);
+        this->m_headerIdx = 0;
+    }
+}
+
+void PacketDecoder::addDiscardedBytes(size_t numBytes) {
+    this->m_discardedBytes += numBytes;
+    if (this->m_stats != nullptr) {
+        this->m_stats->rxDiscarded.add(static_cast<uint32_t>(numBytes));
+    }
+}
+
+void PacketDecoder::storeHeaderByte(uint8_t byte) {
+    size_t idx = this->m_headerIdx++;
+    if (idx == 0) {
+        this->m_rxCommand = byte;
+    } else if (this->m_addressed && idx == 1) {
+        if (!this->acceptsAddress(byte)) {
+            // The frame is for another node, so we ignore the rest of it without
+            // buffering it or calculating its CRC.
+            this->m_headerIdx = 0;
+            this->m_state = State::IGNORE;
+            return;
+        }
+        this->m_rxAddress = byte;
+    } else {
+        Packet* packet = (byte < this->m_numChannels) ? this->m_channelPackets[byte] : nullptr;
+        if (packet == nullptr) {
+            // Nobody is listening on this channel.
+            this->m_headerIdx = 0;
+            this->m_state = State::IGNORE;
+            return;
+        }
+        this->m_packet = packet;
+        this->m_packet->setChannel(byte);
+    }
+    if (this->m_headerIdx < this->headerLength()) {
+        return;
+    }
+
+    if (this->m_numChannels == 0) {
+        this->m_packet = this->m_defaultPacket;
+        this->m_packet->clearChannel();
+    }
+    this->m_packet->setCommand(this->m_rxCommand);
+    this->m_packet->setData(0, nullptr);
+    if (this->m_addressed) {
+        this->m_packet->setAddress(this->m_rxAddress);
+    } else {
+        this->m_packet->clearAddress();
+    }
+}
+
+Packet::Error PacketDecoder::storeByte(uint8_t byte) {
+    if (this->m_headerIdx < this->headerLength()) {
+        this->storeHeaderByte(byte);
+        return Packet::Error::NOT_DONE;
+    }
+    if (this->m_packet->getDataLength() >= this->m_packet->getMaxDataLength()) {
+        // Not enough room to store any more bytes.
+        if (this->m_debug) {
+            this->m_packet->dump("2Big", this->m_bus);
+        }
+        this->addDiscardedBytes(1);
+        this->discardFrame();
+        return Packet::Error::TOO_MUCH_DATA;
+    }
+    this->m_packet->appendByte(byte);
+    return Packet::Error::NOT_DONE;
+}
+
+Packet::Error PacketDecoder::finishPacket() {
+    size_t crcLen = Packet::crcSize(this->m_crcType);
+    if (this->m_headerIdx < this->headerLength() || this->m_packet->getDataLength() < crcLen) {
+        // Minimum packet requires a Cmd, Address and Channel (if enabled) and CRC
+        this->discardFrame();
+        return Packet::Error::TOO_SMALL;
+    }
+
+    this->m_packet->setCrcType(this->m_crcType);
+    uint32_t rcvdCrc = this->m_packet->extractCrc();
+    uint32_t expectedCrc = this->m_packet->calcCrc();
+    if (rcvdCrc == expectedCrc) {
+        this->m_headerIdx = 0;
+        if (this->m_debug) {
+            this->m_packet->dump("Rcvd", this->m_bus);
+        }
+        return Packet::Error::NONE;
+    }
+    int width = static_cast<int>(crcLen * 2);
+    Log::error(
+        "CRC Error: Received 0x%0*" PRIx32 " Expected 0x%0*" PRIx32, width, rcvdCrc, width,
+        expectedCrc);
+    if (this->m_debug) {
+        this->m_packet->dump("CRC ", this->m_bus);
+    }
+    this->addDiscardedBytes(crcLen);
+    this->discardFrame();
+    return Packet::Error::CRC;
+}
+
+Packet::Error PacketDecoder::decodeSlipByte(uint8_t byte) {
     // Since we need to escape for multiple states, it's easier to put
     // the escape logic here.
-    if (this->m_state != State::IDLE) {
+    if (this->m_state == State::COMMAND || this->m_state == State::DATA) {
         if (this->m_escape) {
             if (byte == Packet::ESC_END) {
                 byte = Packet::END;
@@ -49,9 +226,13 @@ Packet::Error PacketDecoder::decodeByte(uint8_t byte) {
     }
 
     switch (this->m_state) {
-        case State::IDLE: {  // We're waiting for the beginning of the packet (0xC0)
+        case State::IDLE:      // We're waiting for the beginning of the packet (0xC0)
+        case State::HUNT:      // We're discarding the remainder of a bad packet
+        case State::IGNORE: {  // We're ignoring a packet for another node
             if (byte == Packet::END) {
                 this->m_state = State::COMMAND;
+            } else if (this->m_state != State::IGNORE) {
+                this->addDiscardedBytes(1);
             }
             return Packet::Error::NOT_DONE;
         }
@@ -63,49 +244,170 @@ Packet::Error PacketDecoder::decodeByte(uint8_t byte) {
                 return Packet::Error::NOT_DONE;
             }
             this->m_escape = false;
-            this->m_packet->setCommand(byte);
-            this->m_packet->setData(0, nullptr);
+            this->m_headerIdx = 0;
             this->m_state = State::DATA;
-            return Packet::Error::NOT_DONE;
+            return this->storeByte(byte);
         }
 
         case State::DATA: {
             if (byte == Packet::END && !this->m_escape) {
-                // A regular END marks the beginning/end of a packet.
-                if (this->m_packet->getDataLength() == 0) {
-                    // Minimum packet requires a Cmd and CRC
-                    return Packet::Error::TOO_SMALL;
-                }
+                // A regular END marks the end of the packet. If the packet was bad,
+                // then we treat the END as the beginning of the next packet.
+                auto err = this->finishPacket();
+                this->m_state = (err == Packet::Error::NONE) ? State::IDLE : State::COMMAND;
+                return err;
+            }
+            this->m_escape = false;
+            auto err = this->storeByte(byte);
+            if (err != Packet::Error::NOT_DONE) {
+                this->m_state = State::HUNT;
+            }
+            return err;
+        }
 
-                uint8_t rcvdCrc = this->m_packet->extractCrc();
-                uint8_t expectedCrc = this->m_packet->calcCrc();
-                if (rcvdCrc == expectedCrc) {
-                    this->m_state = State::IDLE;
-                    if (this->m_debug) {
-                        this->m_packet->dump("Rcvd", this->m_bus);
-                    }
-                    return Packet::Error::NONE;
+        default:
+            break;
+    }
+    return Packet::Error::BAD_STATE;
+}
+
+Packet::Error PacketDecoder::decodeCobsByte(uint8_t byte) {
+    switch (this->m_state) {
+        case State::IDLE:      // We're waiting for a delimiter (0x00)
+        case State::HUNT:      // We're discarding the remainder of a bad packet
+        case State::IGNORE: {  // We're ignoring a packet for another node
+            if (byte == Packet::COBS_DELIM) {
+                this->m_cobsZero = false;
+                this->m_state = State::CODE;
+            } else if (this->m_state != State::IGNORE) {
+                this->addDiscardedBytes(1);
+            }
+            return Packet::Error::NOT_DONE;
+        }
+
+        case State::CODE: {
+            if (byte == Packet::COBS_DELIM) {
+                if (this->m_headerIdx == 0) {
+                    // Back-to-back delimiters, which is an empty packet that we ignore.
+                    return Packet::Error::NOT_DONE;
+                }
+                // The delimiter which ends this packet also starts the next one.
+                // The zero implied by the last code byte is dropped.
+                this->m_cobsZero = false;
+                return this->finishPacket();
+            }
+            if (this->m_cobsZero) {
+                // The previous block was terminated by a zero.
+                if (auto err = this->storeByte(0); err != Packet::Error::NOT_DONE) {
+                    this->m_state = State::HUNT;
+                    return err;
                 }
-                Log::error(
-                    "CRC Error: Received 0x%02" PRIx8 " Expected 0x%02" PRIx8, rcvdCrc,
-                    expectedCrc);
-                if (this->m_debug) {
-                    this->m_packet->dump("CRC ", this->m_bus);
+                if (this->m_state == State::IGNORE) {
+                    return Packet::Error::NOT_DONE;
                 }
+            }
+            this->m_remaining = byte - 1;
+            this->m_cobsZero = (byte != Packet::COBS_MAX_CODE);
+            if (this->m_remaining > 0) {
+                this->m_state = State::DATA;
+            }
+            return Packet::Error::NOT_DONE;
+        }
+
+        case State::DATA: {
+            if (byte == Packet::COBS_DELIM) {
+                // A delimiter in the middle of a block means that the packet was
+                // truncated. The delimiter starts the next packet.
+                Log::error("COBS packet truncated");
+                this->discardFrame();
+                this->m_cobsZero = false;
+                this->m_state = State::CODE;
                 return Packet::Error::CRC;
             }
-            this->m_escape = false;
+            if (auto err = this->storeByte(byte); err != Packet::Error::NOT_DONE) {
+                // Wait for the delimiter which starts the next packet.
+                this->m_state = State::HUNT;
+                return err;
+            }
+            if (this->m_state == State::IGNORE) {
+                return Packet::Error::NOT_DONE;
+            }
+            this->m_remaining--;
+            if (this->m_remaining == 0) {
+                this->m_state = State::CODE;
+            }
+            return Packet::Error::NOT_DONE;
+        }
 
-            if (this->m_packet->getDataLength() >= this->m_packet->getMaxDataLength()) {
-                // Not enough room to store any more bytes.
-                if (this->m_debug) {
-                    this->m_packet->dump("2Big", this->m_bus);
-                }
+        default:
+            break;
+    }
+    return Packet::Error::BAD_STATE;
+}
+
+Packet::Error PacketDecoder::decodeLengthByte(uint8_t byte) {
+    switch (this->m_state) {
+        case State::IDLE: {
+            this->m_remaining = byte;
+            this->m_state = State::LENGTH;
+            return Packet::Error::NOT_DONE;
+        }
+
+        case State::LENGTH: {
+            this->m_remaining |= static_cast<size_t>(byte) << 8;
+            if (this->m_remaining < this->headerLength() + Packet::crcSize(this->m_crcType)) {
+                // Minimum packet requires a Cmd, Address and Channel (if enabled) and CRC
+                this->m_state = (this->m_remaining > 0) ? State::SKIP : State::IDLE;
+                return Packet::Error::TOO_SMALL;
+            }
+            if (this->m_numChannels == 0 &&
+                this->m_remaining - this->headerLength() > this->m_packet->getMaxDataLength()) {
+                // The CRC is temporarily stored in the data, so it needs to fit too.
+                // With channels, the packet (and hence the limit) isn't known until the
+                // channel byte has been received.
+                this->m_state = State::SKIP;
                 return Packet::Error::TOO_MUCH_DATA;
             }
-            this->m_packet->appendByte(byte);
+            this->m_headerIdx = 0;
+            this->m_state = State::DATA;
             return Packet::Error::NOT_DONE;
         }
+
+        case State::DATA: {
+            auto err = this->storeByte(byte);
+            this->m_remaining--;
+            if (err != Packet::Error::NOT_DONE) {
+                // The channel's packet was too small, so skip the rest of the frame.
+                this->m_state = (this->m_remaining > 0) ? State::SKIP : State::IDLE;
+                return err;
+            }
+            if (this->m_state == State::IGNORE) {
+                if (this->m_remaining == 0) {
+                    this->m_state = State::IDLE;
+                }
+                return Packet::Error::NOT_DONE;
+            }
+            if (this->m_remaining > 0) {
+                return Packet::Error::NOT_DONE;
+            }
+            this->m_state = State::IDLE;
+            return this->finishPacket();
+        }
+
+        case State::SKIP:      // We're skipping a bad packet
+        case State::IGNORE: {  // We're ignoring a packet for another node
+            if (this->m_state == State::SKIP) {
+                this->addDiscardedBytes(1);
+            }
+            this->m_remaining--;
+            if (this->m_remaining == 0) {
+                this->m_state = State::IDLE;
+            }
+            return Packet::Error::NOT_DONE;
+        }
+
+        default:
+            break;
     }
     return Packet::Error::BAD_STATE;
 }
@@ -27,6 +27,18 @@
 #include "duino_util/Util.h"
 
 void PacketEncoder::encodeStart(Packet* packet) {
+    // The node address and channel are covered by the CRC, so they need to be set first.
+    if (!this->m_addressed) {
+        packet->clearAddress();
+    } else if (!packet->hasAddress()) {
+        packet->setAddress(this->m_address);
+    }
+    if (!this->m_channels) {
+        packet->clearChannel();
+    } else if (!packet->hasChannel()) {
+        packet->setChannel(0);
+    }
+    packet->setCrcType(this->m_crcType);
     packet->calcAndStoreCrc();
     this->m_packet = packet;
 
@@ -35,6 +47,9 @@ void PacketEncoder::encodeStart(Packet* packet) {
     }
 
     this->m_state = State::IDLE;
+    this->m_segmentIdx = 0;
+    this->m_segmentStart = 0;
+    this->m_encodedLen = 0;
 }
 
 PacketEncoder::State PacketEncoder::handleEscape(uint8_t* byte) {
@@ -51,31 +66,82 @@ PacketEncoder::State PacketEncoder::handleEscape(uint8_t* byte) {
     return State::DATA;
 }
 
+uint8_t PacketEncoder::frameByte(size_t idx) {
+    if (idx == 0) {
+        return this->m_packet->getCommand();
+    }
+    if (idx < this->headerLength()) {
+        // The node address (if enabled) comes before the channel.
+        if (this->m_addressed && idx == 1) {
+            return this->m_packet->getAddress();
+        }
+        return this->m_packet->getChannel();
+    }
+    idx -= this->headerLength();
+    if (idx < this->m_packet->getDataLength()) {
+        return this->m_packet->getData()[idx];
+    }
+    if (idx >= this->m_packet->getTotalDataLength()) {
+        // The CRC was calculated by encodeStart, and is sent in little-endian order.
+        idx -= this->m_packet->getTotalDataLength();
+        return static_cast<uint8_t>(this->m_packet->getCrc() >> (idx * 8));
+    }
+
+    // The byte is in an external segment. Accesses are almost always sequential,
+    // so we remember which segment was used last time.
+    idx -= this->m_packet->getDataLength();
+    if (idx < this->m_segmentStart) {
+        this->m_segmentIdx = 0;
+        this->m_segmentStart = 0;
+    }
+    while (idx >= this->m_segmentStart + this->m_packet->getSegment(this->m_segmentIdx).len) {
+        this->m_segmentStart += this->m_packet->getSegment(this->m_segmentIdx).len;
+        this->m_segmentIdx++;
+    }
+    return this->m_packet->getSegment(this->m_segmentIdx).data[idx - this->m_segmentStart];
+}
+
 Packet::Error PacketEncoder::encodeByte(uint8_t* byte) {
+    Packet::Error err = this->encodeFramedByte(byte);
+    if (this->m_stats != nullptr) {
+        // The counters are only updated once per frame, to keep the per-byte cost down.
+        if (err == Packet::Error::NOT_DONE) {
+            this->m_encodedLen++;
+        } else if (err == Packet::Error::NONE) {
+            this->m_encodedLen++;
+            this->m_stats->txFrames.add();
+            this->m_stats->txBytes.add(this->m_encodedLen);
+            this->m_stats->txOverhead.add(this->m_encodedLen - this->frameLength());
+        }
+    }
+    return err;
+}
+
+Packet::Error PacketEncoder::encodeFramedByte(uint8_t* byte) {
+    switch (this->m_framing) {
+        case Framing::SLIP:
+            return this->encodeSlipByte(byte);
+        case Framing::COBS:
+            return this->encodeCobsByte(byte);
+        case Framing::LENGTH:
+            return this->encodeLengthByte(byte);
+    }
+    return Packet::Error::BAD_STATE;
+}
+
+Packet::Error PacketEncoder::encodeSlipByte(uint8_t* byte) {
     switch (this->m_state) {
         case State::IDLE: {
             *byte = Packet::END;
-            this->m_state = State::COMMAND;
-            return Packet::Error::NOT_DONE;
-        }
-
-        case State::COMMAND: {
-            *byte = this->m_packet->getCommand();
-            this->m_state = this->handleEscape(byte);
             this->m_encodeIdx = 0;
+            this->m_state = State::DATA;
             return Packet::Error::NOT_DONE;
         }
 
         case State::DATA: {
-            if (this->m_encodeIdx < this->m_packet->getDataLength()) {
-                *byte = this->m_packet->getData()[this->m_encodeIdx++];
-                this->m_state = this->handleEscape(byte);
-                return Packet::Error::NOT_DONE;
-            }
-            if (this->m_encodeIdx == this->m_packet->getDataLength()) {
-                *byte = this->m_packet->calcCrc();
+            if (this->m_encodeIdx < this->frameLength()) {
+                *byte = this->frameByte(this->m_encodeIdx++);
                 this->m_state = this->handleEscape(byte);
-                this->m_encodeIdx++;
                 return Packet::Error::NOT_DONE;
             }
             *byte = Packet::END;
@@ -88,6 +154,99 @@ Packet::Error PacketEncoder::encodeByte(uint8_t* byte) {
             this->m_state = State::DATA;
             return Packet::Error::NOT_DONE;
         }
+
+        default:
+            break;
+    }
+    return Packet::Error::BAD_STATE;
+}
+
+PacketEncoder::State PacketEncoder::cobsBlockDone() {
+    if (this->m_encodeIdx == this->frameLength()) {
+        // A trailing zero is implied at the end of the frame, so we're done.
+        return State::END;
+    }
+    if (this->m_cobsCode != Packet::COBS_MAX_CODE) {
+        // The block was terminated by a zero, which the code byte represents.
+        this->m_encodeIdx++;
+    }
+    return State::CODE;
+}
+
+Packet::Error PacketEncoder::encodeCobsByte(uint8_t* byte) {
+    switch (this->m_state) {
+        case State::IDLE: {
+            *byte = Packet::COBS_DELIM;
+            this->m_encodeIdx = 0;
+            this->m_state = State::CODE;
+            return Packet::Error::NOT_DONE;
+        }
+
+        case State::CODE: {
+            // Count the non-zero bytes which follow (up to 254 of them).
+            size_t frameLen = this->frameLength();
+            size_t run = 0;
+            while (run < Packet::COBS_MAX_CODE - 1 && this->m_encodeIdx + run < frameLen &&
+                   this->frameByte(this->m_encodeIdx + run) != 0) {
+                run++;
+            }
+            this->m_cobsCode = static_cast<uint8_t>(run + 1);
+            this->m_cobsRemaining = run;
+            *byte = this->m_cobsCode;
+            this->m_state = (run > 0) ? State::DATA : this->cobsBlockDone();
+            return Packet::Error::NOT_DONE;
+        }
+
+        case State::DATA: {
+            *byte = this->frameByte(this->m_encodeIdx++);
+            this->m_cobsRemaining--;
+            if (this->m_cobsRemaining == 0) {
+                this->m_state = this->cobsBlockDone();
+            }
+            return Packet::Error::NOT_DONE;
+        }
+
+        case State::END: {
+            *byte = Packet::COBS_DELIM;
+            this->m_state = State::IDLE;
+            return Packet::Error::NONE;
+        }
+
+        default:
+            break;
+    }
+    return Packet::Error::BAD_STATE;
+}
+
+Packet::Error PacketEncoder::encodeLengthByte(uint8_t* byte) {
+    switch (this->m_state) {
+        case State::IDLE: {
+            if (this->frameLength() > UINT16_MAX) {
+                return Packet::Error::TOO_MUCH_DATA;
+            }
+            *byte = static_cast<uint8_t>(this->frameLength());
+            this->m_state = State::LENGTH;
+            return Packet::Error::NOT_DONE;
+        }
+
+        case State::LENGTH: {
+            *byte = static_cast<uint8_t>(this->frameLength() >> 8);
+            this->m_encodeIdx = 0;
+            this->m_state = State::DATA;
+            return Packet::Error::NOT_DONE;
+        }
+
+        case State::DATA: {
+            *byte = this->frameByte(this->m_encodeIdx++);
+            if (this->m_encodeIdx < this->frameLength()) {
+                return Packet::Error::NOT_DONE;
+            }
+            this->m_state = State::IDLE;
+            return Packet::Error::NONE;
+        }
+
+        default:
+            break;
     }
     return Packet::Error::BAD_STATE;
 }
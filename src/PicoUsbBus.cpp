@@ -16,6 +16,7 @@
 
 #include "duino_bus/PicoUsbBus.h"
 
+#include <algorithm>
 #include <cassert>
 
 #include "tusb.h"
@@ -57,6 +58,12 @@ bool PicoUsbBus::isSpaceAvailable() const {
     return tud_cdc_n_write_available(this->m_intf) > 0;
 }
 
+bool PicoUsbBus::hasSpaceFor(size_t numBytes) const {
+    // Packets bigger than the FIFO are written once it's empty.
+    return tud_cdc_n_write_available(this->m_intf) >=
+           std::min<size_t>(numBytes, CFG_TUD_CDC_TX_BUFSIZE);
+}
+
 void PicoUsbBus::writeByte(uint8_t byte) {
     if (this->isConnected()) {
         tud_cdc_n_write(this->m_intf, &byte, 1);
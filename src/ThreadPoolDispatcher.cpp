@@ -0,0 +1,240 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   ThreadPoolDispatcher.cpp
+ *
+ *   @brief  Handles received commands on a pool of worker threads.
+ *
+ ****************************************************************************/
+
+#if !defined(ARDUINO)
+
+#include "duino_bus/ThreadPoolDispatcher.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cinttypes>
+
+#include "duino_log/Log.h"
+
+ThreadPoolDispatcher::ThreadPoolDispatcher(
+    IBus& bus,
+    size_t maxDataLen,
+    size_t numThreads,
+    Ordering ordering)
+    : m_bus{bus}, m_maxDataLen{maxDataLen}, m_ordering{ordering} {
+    assert(numThreads > 0);
+    for (size_t idx = 0; idx < numThreads; idx++) {
+        this->m_workers.push_back(std::make_unique<Worker>());
+    }
+    // The workers are started once they've all been created, since they steal from each other.
+    for (size_t idx = 0; idx < numThreads; idx++) {
+        this->m_workers[idx]->m_thread = std::thread{&ThreadPoolDispatcher::run, this, idx};
+    }
+}
+
+ThreadPoolDispatcher::~ThreadPoolDispatcher() {
+    {
+        std::lock_guard<std::mutex> lock{this->m_sleepMutex};
+        this->m_stop = true;
+    }
+    this->m_wakeup.notify_all();
+    for (auto& worker : this->m_workers) {
+        worker->m_thread.join();
+        for (auto job : worker->m_jobs) {
+            delete job;
+        }
+    }
+    Job* job = this->m_responses.exchange(nullptr);
+    while (job != nullptr) {
+        Job* next = job->m_next;
+        delete job;
+        job = next;
+    }
+    for (auto waiting : this->m_waiting) {
+        delete waiting;
+    }
+    for (auto queued : this->m_queued) {
+        delete queued;
+    }
+}
+
+bool ThreadPoolDispatcher::submit(BusChannel& channel, Packet const& cmd) {
+    if (cmd.getTotalDataLength() > this->m_maxDataLen || cmd.getNumSegments() != 0) {
+        return false;
+    }
+
+    auto job = new Job{this->m_maxDataLen};
+    job->m_cmd.setCommand(cmd.getCommand());
+    job->m_cmd.setData(cmd.getDataLength(), cmd.getData());
+    if (cmd.hasAddress()) {
+        job->m_cmd.setAddress(cmd.getAddress());
+    }
+    if (cmd.hasChannel()) {
+        job->m_cmd.setChannel(cmd.getChannel());
+    }
+    job->m_channel = &channel;
+    job->m_isBroadcast = cmd.hasAddress() && cmd.getAddress() == Packet::BROADCAST_ADDRESS;
+    job->m_startUs = this->m_bus.getCommandStartUs();
+
+    // Commands which need to be handled in order always go to the same worker, and since
+    // those workers don't have their jobs stolen, they're handled one at a time.
+    size_t idx = 0;
+    switch (this->m_ordering) {
+        case Ordering::NONE: {
+            idx = this->m_nextWorker;
+            this->m_nextWorker = (this->m_nextWorker + 1) % this->m_workers.size();
+            break;
+        }
+        case Ordering::CHANNEL: {
+            idx = channel.getId() % this->m_workers.size();
+            break;
+        }
+        case Ordering::BUS: {
+            idx = 0;
+            break;
+        }
+    }
+
+    // The job is queued with m_sleepMutex held, so that a worker which is about to go to
+    // sleep can't miss it.
+    Worker& worker = *this->m_workers[idx];
+    {
+        std::lock_guard<std::mutex> sleepLock{this->m_sleepMutex};
+        std::lock_guard<std::mutex> lock{worker.m_mutex};
+        worker.m_jobs.push_back(job);
+        worker.m_numJobs++;
+        this->m_numQueued++;
+    }
+    this->m_wakeup.notify_all();
+    return true;
+}
+
+bool ThreadPoolDispatcher::serviceResponses() {
+    // Channels only queue a pointer to the response, so jobs are kept until they're sent.
+    auto sent = std::remove_if(this->m_queued.begin(), this->m_queued.end(), [this](Job* job) {
+        if (this->m_bus.isQueued(&job->m_rsp)) {
+            return false;
+        }
+        delete job;
+        return true;
+    });
+    this->m_queued.erase(sent, this->m_queued.end());
+
+    // The response queue is a stack, so it's reversed to write the responses in the order
+    // that they were handled.
+    Job* job = this->m_responses.exchange(nullptr, std::memory_order_acquire);
+    Job* ordered = nullptr;
+    while (job != nullptr) {
+        Job* next = job->m_next;
+        job->m_next = ordered;
+        ordered = job;
+        job = next;
+    }
+    for (; ordered != nullptr; ordered = ordered->m_next) {
+        this->m_waiting.push_back(ordered);
+    }
+
+    // Responses are queued in order, so a full channel holds up the responses behind it.
+    bool queued = false;
+    while (!this->m_waiting.empty()) {
+        job = this->m_waiting.front();
+        uint8_t channelId = job->m_channel->getId();
+        if (!this->m_bus.canQueuePacket(channelId, &job->m_rsp)) {
+            break;
+        }
+        this->m_waiting.pop_front();
+        job->m_rsp.setChannel(channelId);
+        this->m_bus.queuePacket(channelId, &job->m_rsp);
+        this->m_bus.timeResponse(job->m_cmd.getCommand(), job->m_startUs, &job->m_rsp);
+        if (this->m_bus.isQueued(&job->m_rsp)) {
+            this->m_queued.push_back(job);
+        } else {
+            delete job;
+        }
+        queued = true;
+    }
+    return queued;
+}
+
+void ThreadPoolDispatcher::run(size_t idx) {
+    Worker& worker = *this->m_workers[idx];
+    while (true) {
+        Job* job = this->takeJob(idx);
+        if (job == nullptr) {
+            std::unique_lock<std::mutex> lock{this->m_sleepMutex};
+            this->m_wakeup.wait(lock, [&] { return this->m_stop || this->hasWork(worker); });
+            if (this->m_stop) {
+                return;
+            }
+            continue;
+        }
+
+        bool handled = this->m_bus.dispatchPacket(*job->m_channel, job->m_cmd, &job->m_rsp);
+        if (!handled) {
+            this->m_bus.getStats().unhandled.add();
+            Log::error("Unhandled command: 0x%02" PRIx8, job->m_cmd.getCommand());
+        }
+        if (!handled || job->m_rsp.getCommand() == 0 || job->m_isBroadcast) {
+            delete job;
+        } else {
+            this->pushResponse(job);
+        }
+    }
+}
+
+bool ThreadPoolDispatcher::hasWork(Worker const& worker) const {
+    if (this->m_ordering == Ordering::NONE) {
+        return this->m_numQueued > 0;
+    }
+    return worker.m_numJobs > 0;
+}
+
+ThreadPoolDispatcher::Job* ThreadPoolDispatcher::takeJob(size_t idx) {
+    // Workers take the oldest job from their own queue, so jobs are handled in order.
+    Worker& worker = *this->m_workers[idx];
+    {
+        std::lock_guard<std::mutex> lock{worker.m_mutex};
+        if (!worker.m_jobs.empty()) {
+            Job* job = worker.m_jobs.front();
+            worker.m_jobs.pop_front();
+            worker.m_numJobs--;
+            this->m_numQueued--;
+            return job;
+        }
+    }
+    if (this->m_ordering != Ordering::NONE) {
+        return nullptr;
+    }
+
+    // Steal the newest job from another worker.
+    size_t numWorkers = this->m_workers.size();
+    for (size_t offset = 1; offset < numWorkers; offset++) {
+        Worker& victim = *this->m_workers[(idx + offset) % numWorkers];
+        std::lock_guard<std::mutex> lock{victim.m_mutex};
+        if (!victim.m_jobs.empty()) {
+            Job* job = victim.m_jobs.back();
+            victim.m_jobs.pop_back();
+            victim.m_numJobs--;
+            this->m_numQueued--;
+            return job;
+        }
+    }
+    return nullptr;
+}
+
+void ThreadPoolDispatcher::pushResponse(Job* job) {
+    job->m_next = this->m_responses.load(std::memory_order_relaxed);
+    while (!this->m_responses.compare_exchange_weak(
+        job->m_next, job, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+}
+
+#endif  // !defined(ARDUINO)
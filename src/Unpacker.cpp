@@ -58,3 +58,27 @@ bool Unpacker::unpack(char const** str) {
 
     return true;
 }
+
+bool Unpacker::unpackVarint(uint32_t* value) {
+    uint32_t result = 0;
+    for (size_t idx = 0; idx < 5 && idx < this->m_dataRemaining; idx++) {
+        uint8_t byte = this->m_data[idx];
+        result |= static_cast<uint32_t>(byte & 0x7f) << (7 * idx);
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            this->m_data += idx + 1;
+            this->m_dataRemaining -= idx + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Unpacker::unpackSignedVarint(int32_t* value) {
+    uint32_t zigzag;
+    if (!this->unpackVarint(&zigzag)) {
+        return false;
+    }
+    *value = static_cast<int32_t>((zigzag >> 1) ^ (0u - (zigzag & 1)));
+    return true;
+}
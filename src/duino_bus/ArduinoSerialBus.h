@@ -39,6 +39,8 @@ class ArduinoSerialBus : public IBus {
     bool readByte(uint8_t* byte) override;
     bool isSpaceAvailable() const override;
     void writeByte(uint8_t byte) override;
+    uint32_t getMillis() const override { return millis(); }
+    uint32_t getMicros() const override { return micros(); }
 
  private:
     HardwareSerial* const m_serial;  //!< Serial port to use.
@@ -0,0 +1,88 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   BulkBlob.h
+ *
+ *   @brief  Source or destination of a bulk transfer.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+//! Abstract base class for the source or destination of a bulk transfer (see
+//! BulkPacketHandler). Data is read directly into the packet being sent, and written
+//! directly from the packet that was received, so implementations which access flash or
+//! a filesystem don't need a buffer of their own.
+class IBulkBlob {
+ public:
+    //! Destructor.
+    virtual ~IBulkBlob() = default;
+
+    //! @returns the size of the blob in bytes. Transfers can't go beyond this size.
+    virtual uint32_t getSize() const = 0;
+
+    //! Reads data from the blob.
+    //! @returns true if the data was read, false if an error occurred.
+    virtual bool read(
+        uint32_t offset,  //!< [in] Offset within the blob to read from.
+        size_t len,       //!< [in] Number of bytes to read.
+        uint8_t* data     //!< [out] Place to store the data.
+        ) = 0;
+
+    //! Writes data to the blob. Data is always written in increasing offset order.
+    //! @returns true if the data was written, false if an error occurred.
+    virtual bool write(
+        uint32_t offset,     //!< [in] Offset within the blob to write to.
+        size_t len,          //!< [in] Number of bytes to write.
+        uint8_t const* data  //!< [in] Data to write.
+        ) = 0;
+};
+
+//! A blob which is stored in a caller supplied buffer.
+class BufferBulkBlob : public IBulkBlob {
+ public:
+    //! Constructor for a blob which can be read from and written to.
+    BufferBulkBlob(
+        size_t size,   //!< [in] Size of the buffer.
+        uint8_t* data  //!< [mod] Buffer containing the blob.
+        )
+        : m_size{size}, m_data{data}, m_writeData{data} {}
+
+    //! Constructor for a blob which can only be read from.
+    BufferBulkBlob(
+        size_t size,         //!< [in] Size of the buffer.
+        uint8_t const* data  //!< [in] Buffer containing the blob.
+        )
+        : m_size{size}, m_data{data} {}
+
+    uint32_t getSize() const override { return static_cast<uint32_t>(this->m_size); }
+
+    bool read(uint32_t offset, size_t len, uint8_t* data) override {
+        memcpy(data, &this->m_data[offset], len);
+        return true;
+    }
+
+    bool write(uint32_t offset, size_t len, uint8_t const* data) override {
+        if (this->m_writeData == nullptr) {
+            return false;
+        }
+        memcpy(&this->m_writeData[offset], data, len);
+        return true;
+    }
+
+ private:
+    size_t m_size;                   //!< Size of the buffer.
+    uint8_t const* m_data;           //!< Buffer containing the blob.
+    uint8_t* m_writeData = nullptr;  //!< Buffer containing the blob (if it's writable).
+};
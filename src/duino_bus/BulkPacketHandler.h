@@ -0,0 +1,160 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   BulkPacketHandler.h
+ *
+ *   @brief  Handles windowed bulk transfers of large blobs.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <vector>
+
+#include "BulkBlob.h"
+#include "PacketHandler.h"
+
+//! Packet handler which transfers large blobs (i.e. firmware images or file contents) in
+//! either direction.
+//!
+//! The blob is split into chunks which fill a packet, and each chunk carries its offset.
+//! Up to `window` chunks can be outstanding before the sender has to wait for an
+//! acknowledgement, so the link stays busy rather than waiting a round trip per packet.
+//! Acknowledgements are cumulative (the offset of the first byte that hasn't been
+//! received), and the receiver drops any chunks which arrive out of order. When the
+//! receiver sees a gap it sends a NAK, and the sender goes back to the NAK'd offset.
+//! Transfers can be resumed by starting a new transfer at a non-zero offset.
+//!
+//! Reads (device to host) are sent as a streamed response (see IBus::startStream), so
+//! IBus::serviceTx needs to be called regularly. Since bulk transfers use large packets,
+//! this handler is normally added to the BusChannel::BULK channel. Only one transfer can
+//! be active at a time, and starting a new one aborts the current one.
+class BulkPacketHandler : public IPacketHandler {
+ public:
+    //! Commands accepted by the bulk packet handler.
+    struct Command : public Packet::Command {
+        static constexpr Type BULK_READ = LITTLEFS_COMMAND_BASE + 0x00;   //!< Start a read.
+        static constexpr Type BULK_WRITE = LITTLEFS_COMMAND_BASE + 0x01;  //!< Start a write.
+        static constexpr Type BULK_DATA = LITTLEFS_COMMAND_BASE + 0x02;   //!< A chunk of data.
+        static constexpr Type BULK_ACK = LITTLEFS_COMMAND_BASE + 0x03;    //!< Acknowledgement.
+    };
+
+    //! Status returned in the BULK_READ and BULK_WRITE responses.
+    enum class Status : uint8_t {
+        OK = 0,           //!< The transfer was started.
+        NO_BLOB = 1,      //!< There is no blob with the requested id.
+        BAD_OFFSET = 2,   //!< The offsets are beyond the end of the blob.
+        BAD_REQUEST = 3,  //!< The command was too short.
+        TOO_SMALL = 4,    //!< The packets are too small to carry any data.
+    };
+
+    //! Flags sent in BULK_ACK packets.
+    //@{
+    static constexpr uint8_t ACK_NAK = 0x01;    //!< Resend the data starting at the offset.
+    static constexpr uint8_t ACK_ABORT = 0x02;  //!< The transfer has been aborted.
+    //@}
+
+    //! Offset which can be passed to BULK_WRITE to resume the previous write to a blob.
+    static constexpr uint32_t RESUME_OFFSET = UINT32_MAX;
+
+    //! Number of bytes in a BULK_DATA packet before the data.
+    static constexpr size_t DATA_HEADER_LEN = sizeof(uint32_t);
+
+    //! Adds a blob which can be transferred.
+    void addBlob(
+        uint8_t id,      //!< [in] Id that the host uses to refer to the blob.
+        IBulkBlob& blob  //!< [in] Blob to add.
+    );
+
+    bool handlePacket(Packet const& cmd, Packet* rsp) override;
+
+    bool nextStreamPacket(Packet* rsp) override;
+
+    char const* as_str(Packet::Command::Type cmd) const override;
+
+ protected:
+    //! Direction of the active transfer.
+    enum class Direction {
+        NONE,   //!< No transfer is active.
+        READ,   //!< Device to host.
+        WRITE,  //!< Host to device.
+    };
+
+    //! Handles the BULK_READ and BULK_WRITE commands, which start a transfer.
+    //! Command:
+    //!     uint8_t blobId
+    //!     uint32_t offset (RESUME_OFFSET resumes the previous write to the same blob)
+    //!     uint32_t endOffset
+    //!     uint8_t window (number of chunks which can be outstanding)
+    //! Response:
+    //!     uint8_t status (see Status)
+    //!     uint32_t offset (where the transfer starts)
+    //!     uint32_t endOffset (clipped to the size of the blob for reads)
+    //!     uint16_t chunkSize (maximum number of data bytes in each BULK_DATA packet)
+    //! For reads, the response is followed by BULK_DATA packets, and then a STREAM_END
+    //! packet once all of the data has been acknowledged.
+    void handleStart(
+        Packet const& cmd,  //!< [in] BULK_READ or BULK_WRITE packet.
+        Packet* rsp         //!< [out] Place to store the response.
+    );
+
+    //! Handles a BULK_DATA command, which carries a chunk of a write.
+    //! Command:
+    //!     uint32_t offset
+    //!     uint8_t data[]
+    //! Response (only sent when an acknowledgement is due):
+    //!     uint32_t offset (all of the data before this offset has been written)
+    //!     uint8_t flags (see ACK_NAK and ACK_ABORT)
+    void handleData(
+        Packet const& cmd,  //!< [in] BULK_DATA packet.
+        Packet* rsp         //!< [out] Place to store the response.
+    );
+
+    //! Handles a BULK_ACK command, which acknowledges the data sent by a read.
+    //! Command:
+    //!     uint32_t offset (all of the data before this offset has been received)
+    //!     uint8_t flags (see ACK_NAK and ACK_ABORT)
+    //! There is no response.
+    void handleAck(
+        Packet const& cmd  //!< [in] BULK_ACK packet.
+    );
+
+    //! Abandons the active transfer (if there is one), without ending the read stream.
+    void abort();
+
+    //! Fills in a BULK_ACK response for the data written so far.
+    void sendAck(
+        uint8_t flags,  //!< [in] Flags to send.
+        Packet* rsp     //!< [out] Place to store the response.
+    );
+
+    //! @returns the blob with the indicated id, or nullptr if there isn't one.
+    IBulkBlob* findBlob(
+        uint8_t id  //!< [in] Id of the blob to find.
+    ) const;
+
+    //! A blob which was added by addBlob.
+    struct BlobEntry {
+        uint8_t id;       //!< Id that the host uses to refer to the blob.
+        IBulkBlob* blob;  //!< The blob.
+    };
+
+    std::vector<BlobEntry> m_blobs;           //!< Blobs which can be transferred.
+    Direction m_direction = Direction::NONE;  //!< Direction of the active transfer.
+    IBulkBlob* m_blob = nullptr;              //!< Blob being transferred.
+    IBulkBlob* m_writeBlob = nullptr;         //!< Blob written by the most recent transfer.
+    uint32_t m_endOffset = 0;                 //!< Offset where the transfer ends.
+    uint32_t m_sendOffset = 0;                //!< Offset of the next chunk to read.
+    uint32_t m_ackOffset = 0;                 //!< Data before this has been acknowledged.
+    size_t m_chunkSize = 0;                   //!< Maximum number of bytes per chunk.
+    size_t m_window = 1;                      //!< Chunks which can be outstanding.
+    size_t m_numUnacked = 0;                  //!< Chunks written since the last ack.
+    bool m_nakSent = false;                   //!< Has a NAK been sent for the current gap?
+};
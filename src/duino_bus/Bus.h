@@ -16,13 +16,19 @@
 
 #pragma once
 
+#include <atomic>
 #include <cinttypes>
 #include <vector>
 
+#include "duino_bus/BusChannel.h"
+#include "duino_bus/BusStats.h"
+#include "duino_bus/LatencyHistogram.h"
 #include "duino_bus/Packet.h"
 #include "duino_bus/PacketDecoder.h"
 #include "duino_bus/PacketEncoder.h"
+#include "duino_bus/TxQueue.h"
 
+class IDispatcher;     //!< Forward reference
 class IPacketHandler;  //!< Forward reference
 
 //! Abstract base class for a bus.
@@ -31,6 +37,28 @@ class IBus {
  public:
     using Error = Packet::Error;  //!< Convenience alias.
 
+    //! Identifies a deferred response (see deferResponse).
+    using PendingToken = size_t;
+
+    //! Token returned by deferResponse when the pending table is full.
+    static constexpr PendingToken INVALID_PENDING_TOKEN = SIZE_MAX;
+
+    //! An entry in the table of deferred responses.
+    struct PendingResponse {
+        Packet::Command::Type command = 0;  //!< Command being responded to.
+        uint8_t channel = 0;                //!< Channel the command was received on.
+        bool isBroadcast = false;           //!< Was the command broadcast?
+        bool inUse = false;                 //!< Is this entry being used?
+        uint32_t startUs = 0;               //!< When the command was received (see getMicros).
+    };
+
+    //! An entry in the table of command latencies.
+    struct CommandLatency {
+        Packet::Command::Type command = 0;  //!< Command whose latencies are recorded.
+        bool inUse = false;                 //!< Is this entry being used?
+        LatencyHistogram histogram;         //!< Latencies of the command.
+    };
+
     //! Constructor.
     explicit IBus(
         Packet* cmdPacket,            //!< [mod] Place to store the command packet.
@@ -55,6 +83,24 @@ class IBus {
     //! @returns true if space is available to write another byte, false otherwise.
     virtual bool isSpaceAvailable() const = 0;
 
+    //! @returns true if `numBytes` bytes can be written without waiting. By default this
+    //!          only checks for space for one byte (see isSpaceAvailable), so buses whose
+    //!          transport knows how much space it has should override it.
+    virtual bool hasSpaceFor(
+        size_t numBytes  //!< [in] Number of bytes to be written.
+    ) const {
+        (void)numBytes;
+        return this->isSpaceAvailable();
+    }
+
+    //! @returns true if a packet with `dataLen` bytes of data can be written without
+    //!          waiting, as far as hasSpaceFor can tell.
+    bool hasSpaceForPacket(
+        size_t dataLen  //!< [in] Number of bytes of packet data.
+    ) const {
+        return this->hasSpaceFor(this->m_encoder.maxEncodedLength(dataLen));
+    }
+
     //! Writes a byte to the bus.
     virtual void writeByte(
         uint8_t byte  //!< [in] byte to write.
@@ -66,25 +112,79 @@ class IBus {
     //! @returns true if the "other" side of the bus is open.
     virtual bool isConnected(void) const { return true; }
 
+    //! @returns a free running millisecond counter, which is used for timeouts.
+    virtual uint32_t getMillis() const;
+
+    //! @returns a free running microsecond counter, which is used to time commands.
+    virtual uint32_t getMicros() const;
+
     //! Reads a byte from the bus, and runs it through the packet parser.
     //! @returns Error::NONE if the packet was parsed successfully.
     //! @returns Error::NOT_DONE if the packet is incomplete.
     //! @returns Error::CRC if a CRC error was encountered.
     //! @returns Error::TOO_MUCH_DATA if the data doesn't fit into the packet data.
+    //! @returns Error::TIMEOUT if a partially received packet timed out (see setRxTimeout).
     Error processByte();
 
-    //! Writes a packet on this bus.
+    //! Writes a packet on this bus. This is thread safe: packets are queued on a lock-free
+    //! queue, and whichever thread gets to the queue first writes all of the queued packets,
+    //! so the bytes of different packets never get interleaved. If another thread is
+    //! already writing, this yields until that thread has written the packet.
+    //!
+    //! This can't be called from an interrupt handler, or from writeByte or flush (or
+    //! anything that they call, such as logging to this bus), since the packet would never
+    //! get written. Calls from writeByte or flush assert, or return Error::BAD_STATE when
+    //! asserts are disabled.
     //! @returns Error::NONE if the packet was written successfully, or an error code otherwise.
     Error writePacket(
         Packet* packet  //!< [in] Packet to write.
     );
 
+    //! Queues a packet to be written, without waiting for another thread which is writing.
+    //! If no other thread is writing, the packet is written before this returns, otherwise
+    //! it's written by the thread which is writing (or by the next call to serviceTx). The
+    //! request and its packet need to be left alone until request.isSent() returns true.
+    //! @returns true if the request was queued, false if it was already queued.
+    bool sendPacket(
+        TxRequest& request  //!< [in] Request for the packet to write.
+    );
+
+    //! Queues a packet on a logical channel (or the BusChannel::CONTROL channel, if the
+    //! bus doesn't have that channel), so that it's sent by serviceTx along with the other
+    //! channels' packets. Without logical channels, the packet is written immediately.
+    //! This doesn't wait for room on the channel, and the packet must not be modified
+    //! until isQueued returns false. This needs to be called from the same context that
+    //! calls serviceTx.
+    //! @returns true if the packet was queued (or written), false if the channel is full.
+    bool queuePacket(
+        uint8_t channelId,  //!< [in] Channel to send the packet on.
+        Packet* packet      //!< [in] Packet to send.
+    );
+
+    //! @returns true if queuePacket will accept a packet: it isn't still queued from
+    //!          before, and its channel has room for it.
+    bool canQueuePacket(
+        uint8_t channelId,    //!< [in] Channel to send the packet on.
+        Packet const* packet  //!< [in] Packet to send.
+    );
+
+    //! @returns true if a packet is queued on any channel, waiting to be sent.
+    bool isQueued(
+        Packet const* packet  //!< [in] Packet to look for.
+    );
+
     //! @returns a poiinter to the log packet that was passed into the constructor.
     Packet* getLogPacket() { return this->m_logPacket; }
 
     //! @returns a poiinter to the event packet that was passed into the constructor.
     Packet* getEventPacket() { return this->m_evtPacket; }
 
+    //! @returns the counters which describe the health of this bus.
+    BusStats& getStats() { return this->m_stats; }
+
+    //! @returns the counters which describe the health of this bus.
+    BusStats const& getStats() const { return this->m_stats; }
+
     //! Sets the debug flag which controls whether decoded packets get dumped.
     void setDebug(
         bool debug  //!< [in] Value to set debug flag to.
@@ -93,26 +193,316 @@ class IBus {
         this->m_encoder.setDebug(debug);
     }
 
-    //! Adds a packet handler.
+    //! Sets the framing used to send and receive packets on this bus.
+    //! Both sides of the bus need to use the same framing.
+    void setFraming(
+        Packet::Framing framing  //!< [in] Framing to use.
+    ) {
+        this->m_decoder.setFraming(framing);
+        this->m_encoder.setFraming(framing);
+    }
+
+    //! Sets the type of CRC used to protect packets sent and received on this bus.
+    //! Both sides of the bus need to use the same type of CRC. CrcType::NONE should only
+    //! be used with transports which are already reliable (i.e. TCP sockets).
+    void setCrcType(
+        Packet::CrcType crcType  //!< [in] Type of CRC to use.
+    ) {
+        this->m_decoder.setCrcType(crcType);
+        this->m_encoder.setCrcType(crcType);
+    }
+
+    //! Enables node addressing for use on multi-drop buses (i.e. RS-485). Each packet
+    //! carries a node address after the command, and packets addressed to other nodes are
+    //! dropped by the decoder. Packets sent by this node carry this node's address.
+    //! Commands sent to Packet::BROADCAST_ADDRESS are handled, but never responded to,
+    //! since multiple nodes responding at the same time would collide.
+    void setNodeAddress(
+        uint8_t address  //!< [in] Address of this node.
+    ) {
+        this->m_decoder.setAddressing(true, address);
+        this->m_encoder.setAddressing(true, address);
+    }
+
+    //! Sets the inter-byte receive timeout. A partially received packet is aborted if no
+    //! bytes arrive within the timeout. This is disabled (0) by default.
+    void setRxTimeout(
+        uint32_t timeoutMsec  //!< [in] Timeout in milliseconds (0 disables the timeout).
+    ) {
+        this->m_decoder.setTimeout(timeoutMsec);
+    }
+
+    //! Enables or disables in-place responses.
+    //! When enabled, handlers are called via IPacketHandler::handlePacketInPlace and may
+    //! swap the command packet storage with the response packet storage. Since the buffers
+    //! are swapped, this only applies to channels whose command and response packets have
+    //! the same maximum size, and other channels call IPacketHandler::handlePacket.
+    void setInPlaceResponses(
+        bool inPlace  //!< [in] true to enable in-place responses.
+    ) {
+        this->m_inPlace = inPlace;
+    }
+
+    //! Adds a packet handler for commands received on the BusChannel::CONTROL channel.
     void add(
         IPacketHandler& handler  //!< Packet handler to add.
     );
 
-    //! Runs the received packet through the registered handlers.
+    //! Adds a logical channel, which enables logical channels on this bus. Each packet
+    //! then carries a channel number after the command (and node address), and both
+    //! sides of the bus need to have logical channels enabled.
+    //! Once enabled, responses (and other packets queued on a channel) are sent by
+    //! serviceTx rather than being written immediately.
+    void addChannel(
+        BusChannel& channel  //!< [in] Channel to add.
+    );
+
+    //! Sets a dispatcher, which received commands are handed off to rather than being
+    //! handled inline by handlePacket. The dispatcher's responses are written by serviceTx.
+    //! Pass nullptr to go back to handling commands inline.
+    void setDispatcher(
+        IDispatcher* dispatcher  //!< [in] Dispatcher to use.
+    ) {
+        this->m_dispatcher = dispatcher;
+    }
+
+    //! @returns true if logical channels are enabled (see addChannel).
+    bool hasChannels() const { return !this->m_channels.empty(); }
+
+    //! @returns the channel with the indicated number, or nullptr if there isn't one.
+    BusChannel* getChannel(
+        uint8_t id  //!< [in] Channel number.
+    );
+
+    //! Sends the next queued packet, choosing the channel using deficit round-robin
+    //! scheduling, and produces the next packet of any streamed responses. This should be
+    //! called regularly (i.e. from the main loop) once logical channels are enabled, or
+    //! streamed responses are used.
+    //! @returns true if a packet was sent, false if there was nothing to send.
+    bool serviceTx();
+
+    //! Sends all of the queued packets.
+    void flushTx() {
+        while (this->serviceTx()) {
+        }
+    }
+
+    //! Runs the received packet through the handlers registered for the channel that it
+    //! was received on.
     //! @returns true if the packet was handled, false otherwise.
     bool handlePacket();
 
+    //! Starts a streamed response to the command currently being handled, for responses
+    //! which don't fit in a single packet. This is called from a handler's handlePacket,
+    //! which fills in the first packet of the stream as usual. serviceTx then calls
+    //! handler.nextStreamPacket for each of the remaining packets, but only once the
+    //! previous packet has been sent and the bus has space. When the handler runs out of
+    //! packets a STREAM_END packet is sent, which contains the streamed command (uint8_t)
+    //! and the number of packets streamed (uint32_t), so the host can detect lost packets.
+    //! Each channel can have one stream at a time, and starting a new stream replaces it.
+    void startStream(
+        IPacketHandler& handler,  //!< [in] Handler which produces the stream.
+        Packet const& cmd         //!< [in] Command being responded to.
+    );
+
+    //! Stops any streams produced by a handler, without sending a STREAM_END packet, for
+    //! streams which the host has abandoned (or which a new command has replaced).
+    void cancelStream(
+        IPacketHandler& handler  //!< [in] Handler whose streams should be stopped.
+    );
+
+    //! Runs a packet through the handlers for the channel whose command is currently being
+    //! handled (or the BusChannel::CONTROL channel), without sending the response.
+    //! This allows handlers to run commands which are embedded in other commands.
+    //! @returns true if the packet was handled, false otherwise.
+    bool dispatchPacket(
+        Packet const& cmd,  //!< [in] Packet to run through the handlers.
+        Packet* rsp         //!< [out] Place to store the response.
+    );
+
+    //! Runs a packet through the handlers for a channel, without sending the response.
+    //! This doesn't touch any other bus state, so dispatchers can call it from other
+    //! threads, as long as the handlers are thread safe.
+    //! @returns true if the packet was handled, false otherwise.
+    bool dispatchPacket(
+        BusChannel const& channel,  //!< [in] Channel whose handlers should be used.
+        Packet const& cmd,          //!< [in] Packet to run through the handlers.
+        Packet* rsp                 //!< [out] Place to store the response.
+    ) const;
+
+    //! Sets the table used to keep track of deferred responses. The table is empty by
+    //! default, so this needs to be called before deferResponse can be used.
+    void setPendingTable(
+        size_t maxPending,      //!< [in] Number of entries in `table`.
+        PendingResponse* table  //!< [mod] Place to store pending responses.
+    );
+
+    //! Defers the response to the command currently being handled, for handlers which
+    //! need to wait on something slow (i.e. a flash erase). The handler returns true
+    //! without filling in a response, and calls completeResponse later (from the main
+    //! loop), so the bus can keep handling other commands in the meantime. The handler
+    //! needs to copy anything it needs from the command, since the command packet is
+    //! reused for the next command.
+    //! @returns a token to pass to completeResponse, or INVALID_PENDING_TOKEN if the
+    //!          pending table is full, in which case the handler should respond normally.
+    PendingToken deferResponse(
+        Packet const& cmd  //!< [in] Command whose response is being deferred.
+    );
+
+    //! Sends a deferred response. The response command is set to the deferred command, so
+    //! the host can match it up, since other responses may have been sent in the meantime.
+    //! With logical channels enabled, `rsp` is queued, so it must not be modified until
+    //! it has been sent (see BusChannel::isQueued). This needs to be called from the same
+    //! context that calls handlePacket and serviceTx.
+    //! @returns true if the response was sent, false if the token isn't pending.
+    bool completeResponse(
+        PendingToken token,  //!< [in] Token returned by deferResponse.
+        Packet* rsp          //!< [in] Response to send.
+    );
+
+    //! @returns the number of responses which have been deferred, but not completed.
+    size_t getNumPending() const;
+
+    //! Sets the table used to record the latency of each command, measured from when
+    //! handlePacket is called until the response has been written. With logical channels,
+    //! responses are queued, so they're timed until serviceTx writes them. Deferred
+    //! responses are timed until the response passed to completeResponse has been
+    //! written, streamed responses until their first packet has been written, and
+    //! commands which don't respond until the handler returns. Each command gets an entry
+    //! the first time it's handled, and commands which don't fit aren't recorded. The
+    //! table is empty by default, which disables the timing.
+    void setLatencyTable(
+        size_t numEntries,     //!< [in] Number of entries in `table`.
+        CommandLatency* table  //!< [mod] Place to store the latencies.
+    );
+
+    //! Records the latency of a response once it has been written. Responses sent by
+    //! handlePacket and completeResponse are timed this way automatically, so this is for
+    //! responses which are sent some other way (i.e. by a dispatcher). This needs to be
+    //! called from the context which services the bus, after the response has been
+    //! written or queued. At most MAX_TIMED_RESPONSES queued responses are timed at once,
+    //! and any others are timed until they were queued.
+    void timeResponse(
+        Packet::Command::Type command,  //!< [in] Command being responded to.
+        uint32_t startUs,               //!< [in] When the command was received.
+        Packet const* rsp               //!< [in] Response which was written or queued.
+    );
+
+    //! @returns the time (see getMicros) that the command currently being handled was
+    //!          received. This is only set when the latency table isn't empty.
+    uint32_t getCommandStartUs() const { return this->m_cmdStartUs; }
+
+    //! @returns the number of entries in the latency table.
+    size_t getLatencyTableSize() const { return this->m_numLatency; }
+
+    //! @returns the latency table (see setLatencyTable).
+    CommandLatency* getLatencyTable() { return this->m_latency; }
+
+    //! @returns the latencies recorded for a command, or nullptr if there aren't any.
+    LatencyHistogram* getLatency(
+        Packet::Command::Type command  //!< [in] Command to look up.
+    );
+
     //! @return returns a string version of a command.
     char const* as_str(
         Packet::Command::Type cmd  //!< [in] Command to translater
     ) const;
 
  protected:
-    Packet* m_cmdPacket;                      //!< Place to store the incoming command packet.
-    Packet* m_rspPacket;                      //!< Place to store the outcoming response packet.
-    Packet* m_logPacket;                      //!< Place to store the outgoing log packet.
-    Packet* m_evtPacket;                      //!< Place to store the outgoing event packet.
-    PacketDecoder m_decoder;                  //!< Used to decode incoming packets.
-    PacketEncoder m_encoder;                  //!< Used to encode outgoing packets.
-    std::vector<IPacketHandler*> m_handlers;  //!< Registered packet handlers.
+    //! Number of responses which can be queued on the BusChannel::CONTROL channel.
+    static constexpr size_t CONTROL_QUEUE_LEN = 2;
+
+    //! Number of queued responses whose latencies can be waiting to be recorded.
+    static constexpr size_t MAX_TIMED_RESPONSES = 4;
+
+    //! A queued response whose latency is recorded when it's written (see timeResponse).
+    struct TimedResponse {
+        Packet const* packet = nullptr;     //!< Response (nullptr if the entry is unused).
+        Packet::Command::Type command = 0;  //!< Command being responded to.
+        uint32_t startUs = 0;               //!< When the command was received.
+    };
+
+    Packet* m_cmdPacket;                         //!< Place to store the incoming command packet.
+    Packet* m_rspPacket;                         //!< Place to store the outcoming response packet.
+    Packet* m_logPacket;                         //!< Place to store the outgoing log packet.
+    Packet* m_evtPacket;                         //!< Place to store the outgoing event packet.
+    PacketDecoder m_decoder;                     //!< Used to decode incoming packets.
+    PacketEncoder m_encoder;                     //!< Used to encode outgoing packets.
+    BusStats m_stats;                            //!< Counters updated by the decoder and encoder.
+    Packet* m_controlQueue[CONTROL_QUEUE_LEN];   //!< Control channel transmit queue.
+    BusChannel m_control;                        //!< Channel which uses the packets passed in.
+    std::vector<BusChannel*> m_channels;         //!< Other logical channels.
+    std::vector<Packet*> m_rxPackets;            //!< Command packet for each channel number.
+    size_t m_txIdx = 0;                          //!< Channel being serviced by serviceTx.
+    bool m_txCredited = false;                   //!< Has the channel been given its quantum?
+    BusChannel* m_rxChannel = nullptr;           //!< Channel whose command is being handled.
+    bool m_inPlace = false;                      //!< Are in-place responses enabled?
+    size_t m_maxPending = 0;                     //!< Number of entries in m_pending.
+    PendingResponse* m_pending = nullptr;        //!< Table of deferred responses.
+    size_t m_numLatency = 0;                     //!< Number of entries in m_latency.
+    CommandLatency* m_latency = nullptr;         //!< Table of command latencies.
+    TimedResponse m_timed[MAX_TIMED_RESPONSES];  //!< Queued responses being timed.
+    uint32_t m_cmdStartUs = 0;                   //!< When the current command was received.
+    bool m_deferred = false;                     //!< Was the current response deferred?
+    IDispatcher* m_dispatcher = nullptr;         //!< Commands are handed off to this.
+    TxQueue m_txQueue;                           //!< Packets waiting to be written.
+    std::atomic<bool> m_txWriting{false};        //!< Is a thread writing m_txQueue?
+
+ private:
+    //! Records the latency of a command in the latency table.
+    void recordLatency(
+        Packet::Command::Type command,  //!< [in] Command which was handled.
+        uint32_t latencyUs              //!< [in] Time taken to handle the command.
+    );
+
+    //! Records the latency of a response which was timed by timeResponse, now that it's
+    //! been written.
+    void recordWritten(
+        Packet const* packet  //!< [in] Packet which was written.
+    );
+
+    //! Runs a packet through the encoder and writes it out. This is only called by the
+    //! thread which holds m_txWriting, and writeByte and flush mustn't write packets on
+    //! this bus (see writePacket).
+    //! @returns Error::NONE if the packet was written successfully, or an error code otherwise.
+    Error encodePacket(
+        Packet* packet  //!< [in] Packet to write.
+    );
+
+    //! Writes the packets in m_txQueue, unless another thread is already doing so.
+    //! @returns true if any packets were written, false otherwise.
+    bool serviceTxQueue();
+
+    //! Runs the received packet through the handlers registered for a channel.
+    //! @returns true if the packet was handled, false otherwise.
+    bool handlePacket(
+        BusChannel& channel  //!< [in] Channel the packet was received on.
+    );
+
+    //! Produces the next packet of the streamed response on a channel, if there is one
+    //! and there's room to send it.
+    //! @returns true if a packet was produced, false otherwise.
+    bool serviceStream(
+        BusChannel& channel  //!< [in] Channel to service.
+    );
+
+    //! Sends a response, either immediately or by queuing it on the channel.
+    void sendResponse(
+        BusChannel& channel  //!< [in] Channel to send the response on.
+    );
+
+    //! @returns the channel that packets sent on a channel number are queued on.
+    BusChannel& queueChannel(
+        uint8_t channelId  //!< [in] Channel number.
+    ) {
+        BusChannel* channel = this->getChannel(channelId);
+        return (channel == nullptr) ? this->m_control : *channel;
+    }
+
+    //! @returns the channel at the indicated index in the transmit schedule.
+    BusChannel& txChannel(
+        size_t idx  //!< [in] Index (0 is the CONTROL channel).
+    ) {
+        return (idx == 0) ? this->m_control : *this->m_channels[idx - 1];
+    }
 };
@@ -0,0 +1,138 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   BusChannel.h
+ *
+ *   @brief  A logical channel which is multiplexed over a bus.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "duino_bus/Packet.h"
+
+//! Forward declaration.
+//@{
+class IBus;
+class IPacketHandler;
+//@}
+
+//! A logical channel which is multiplexed over a single bus.
+//!
+//! Each channel has its own command and response packets and its own set of packet
+//! handlers, so (for example) a large bulk transfer doesn't tie up the packets used for
+//! control traffic. Each channel also has a queue of packets waiting to be sent, which
+//! the bus services using a deficit round-robin scheduler (see IBus::serviceTx). Every
+//! scheduling round, each channel with queued packets is given `quantum` bytes of credit,
+//! and may send packets until its credit runs out, so a busy channel can't starve the
+//! others.
+//!
+//! Channel CONTROL always exists, and uses the packets and handlers passed to the bus.
+//! Other channels are added using IBus::addChannel.
+class BusChannel {
+ public:
+    //! Well known channel numbers.
+    //@{
+    static constexpr uint8_t CONTROL = 0;  //!< Commands and responses.
+    static constexpr uint8_t BULK = 1;     //!< Bulk data transfers.
+    static constexpr uint8_t LOG = 2;      //!< Log messages.
+    static constexpr uint8_t EVENT = 3;    //!< Asynchronous events.
+    //@}
+
+    //! Number of bytes of credit each channel gets per scheduling round by default.
+    static constexpr size_t DEFAULT_QUANTUM = 256;
+
+    //! Constructor. Channels which only send (i.e. LOG) don't need command or response
+    //! packets. Channels which receive commands need both.
+    BusChannel(
+        uint8_t id,                       //!< [in] Channel number.
+        Packet* cmdPacket,                //!< [mod] Place to store received commands (or nullptr).
+        Packet* rspPacket,                //!< [mod] Place to store responses (or nullptr).
+        size_t maxQueued,                 //!< [in] Number of entries in txQueue.
+        Packet** txQueue,                 //!< [mod] Place to store packets waiting to be sent.
+        size_t quantum = DEFAULT_QUANTUM  //!< [in] Bytes of credit per scheduling round.
+    );
+
+    //! @returns the channel number.
+    uint8_t getId() const { return this->m_id; }
+
+    //! @returns the packet that commands received on this channel are stored in.
+    //!          This is nullptr for channels which only send.
+    Packet* getCommandPacket() const { return this->m_cmdPacket; }
+
+    //! @returns the packet that responses to commands on this channel are stored in.
+    Packet* getResponsePacket() const { return this->m_rspPacket; }
+
+    //! @returns the number of bytes of credit this channel gets per scheduling round.
+    size_t getQuantum() const { return this->m_quantum; }
+
+    //! Adds a packet handler for commands received on this channel.
+    void add(
+        IPacketHandler& handler  //!< Packet handler to add.
+    );
+
+    //! Queues a packet to be sent on this channel. The packet must not be modified
+    //! until it has been sent (see isQueued).
+    //! @returns true if the packet was queued, false if the queue is full.
+    bool queuePacket(
+        Packet* packet  //!< [in] Packet to send.
+    );
+
+    //! @returns true if the packet is waiting to be sent.
+    bool isQueued(
+        Packet const* packet  //!< [in] Packet to check for.
+    ) const;
+
+    //! @returns the number of packets waiting to be sent.
+    size_t getNumQueued() const { return this->m_numQueued; }
+
+    //! @returns true if a streamed response is being sent on this channel.
+    bool isStreaming() const { return this->m_streamHandler != nullptr; }
+
+    //! @return returns a string version of a command, using this channel's handlers.
+    char const* as_str(
+        Packet::Command::Type cmd  //!< [in] Command to translater
+    ) const;
+
+ private:
+    friend class IBus;
+
+    //! @returns the packet at the head of the queue, or nullptr if the queue is empty.
+    Packet* peekPacket() const {
+        return (this->m_numQueued > 0) ? this->m_txQueue[this->m_queueHead] : nullptr;
+    }
+
+    //! Removes the packet at the head of the queue.
+    void popPacket();
+
+    //! Sets the bus that this channel is associated with.
+    void setBus(
+        IBus* bus  //!< [in] Bus this channel is associated with.
+    );
+
+    uint8_t m_id;                               //!< Channel number.
+    Packet* m_cmdPacket;                        //!< Place to store received commands.
+    Packet* m_rspPacket;                        //!< Place to store responses.
+    size_t m_maxQueued;                         //!< Number of entries in m_txQueue.
+    Packet** m_txQueue;                         //!< Packets waiting to be sent.
+    size_t m_queueHead = 0;                     //!< Index of the next packet to send.
+    size_t m_numQueued = 0;                     //!< Number of packets waiting to be sent.
+    size_t m_quantum;                           //!< Bytes of credit per scheduling round.
+    size_t m_deficit = 0;                       //!< Bytes of credit accumulated.
+    IBus* m_bus = nullptr;                      //!< Bus this channel is associated with.
+    std::vector<IPacketHandler*> m_handlers;    //!< Registered packet handlers.
+    IPacketHandler* m_streamHandler = nullptr;  //!< Handler producing a streamed response.
+    Packet::Command::Type m_streamCommand = 0;  //!< Command being streamed.
+    uint32_t m_streamCount = 0;                 //!< Number of packets streamed so far.
+};
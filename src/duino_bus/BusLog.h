@@ -16,17 +16,166 @@
 
 #pragma once
 
+#include <atomic>
+
 #include "duino_bus/Bus.h"
+#include "duino_bus/LogRing.h"
+#include "duino_bus/PacketHandler.h"
 #include "duino_log/Log.h"
 
 //! Implements logging by sending logging messages over the bus,
-class BusLog : public Log {
+//!
+//! By default, messages are formatted on the device and sent as LOG packets. If a format
+//! table is provided (see setFormatTable), messages are sent in binary instead: the first
+//! time a format string is used, it's assigned an ID which is sent to the host in a
+//! LOG_FORMAT packet, and each message is then sent as a LOG_BINARY packet containing the
+//! format ID and the raw arguments, which the host formats.
+//!
+//! LOG_FORMAT:
+//!     uint16_t id
+//!     str format
+//! LOG_BINARY:
+//!     uint8_t level
+//!     uint16_t id
+//!     Each argument, in the order that it's used by the format string:
+//!         int32_t/uint32_t for integer conversions with no length modifier, or hh/h
+//!         int64_t/uint64_t for integer conversions with a l/ll/j/z/t length modifier
+//!         uint8_t for %c
+//!         uint64_t for %p
+//!         double for floating point conversions
+//!         str for %s (truncated to the precision, if there is one)
+//!         int32_t for a `*` width or precision
+//!
+//! Messages whose format strings don't fit in the table, or which use conversions that
+//! can't be sent in binary (i.e. %n or %Lf), are formatted on the device as usual.
+//!
+//! If a batch packet is provided (see setBatchPacket), messages are collected into LOG_BATCH
+//! packets rather than being written one at a time, and logging never waits on the
+//! transport. The batch is sent when it's full, when the deadline passes (see service), or
+//! when flush is called (i.e. when the main loop is idle). If the batch can't be sent
+//! because the transport is backed up, messages which don't fit are dropped and counted.
+//!
+//! LOG_BATCH:
+//!     uint32_t numDropped (total number of messages dropped so far)
+//!     Repeated for each message (LOG, LOG_FORMAT or LOG_BINARY):
+//!         uint8_t command
+//!         uint8_t length
+//!         uint8_t data[length]
+//!
+//! Normally, messages are built in the bus's log packet and sent immediately (or queued on
+//! the BusChannel::LOG channel, if the bus has logical channels, in which case the next
+//! message waits for it to be sent), so logging can only be done from the context that
+//! services the bus. If a LogRing is provided (see
+//! setLogRing), messages are built on the stack (up to RING_MESSAGE_LEN bytes) and added to
+//! the ring instead, so messages can be logged from any context, including interrupt
+//! handlers and other cores. The ring is drained by service, and each message is sent
+//! (or batched) with the time that it was logged.
+//!
+//! LOG_TIMED:
+//!     uint32_t timestamp (see IBus::getMillis)
+//!     uint8_t command (LOG or LOG_BINARY)
+//!     uint8_t data[] (the rest of the packet)
+//!
+//! Messages can be filtered by module and level, before they're formatted. Messages logged
+//! through the Log functions belong to module 0, and other modules log using BusLog::log.
+//! If BusLog is added to the bus as a packet handler, the host can change which levels are
+//! enabled for each module using the LOG_CONFIG command (see handleLogConfig).
+class BusLog : public Log, public IPacketHandler {
  public:
     //! Constructor.
     explicit BusLog(
         IBus* bus  //!< [in] Bus to send messages over.
-        )
-        : Log(), m_bus{bus} {}
+    );
+
+    //! Enables binary logging. The table stores a pointer to each format string which has
+    //! been sent to the host, so the format strings need to stay around (which is the
+    //! case for string literals). IDs are indices into the table, so at most 65535
+    //! entries are used.
+    void setFormatTable(
+        size_t numFormats,    //!< [in] Number of entries in the table.
+        char const** formats  //!< [in] Storage for the table.
+    );
+
+    //! Forgets the format strings which have been sent, so that they're sent again the next
+    //! time they're used. This should be called when a new host connects.
+    void resetFormats();
+
+    //! Enables batching of log messages. Messages longer than 255 bytes can't be batched,
+    //! so the log packet shouldn't be larger than that.
+    void setBatchPacket(
+        Packet* batch,       //!< [in] Packet to collect messages in.
+        uint32_t deadlineMs  //!< [in] Maximum time that a message waits in the batch.
+    );
+
+    //! Sends log messages from a ring rather than directly (see above).
+    void setLogRing(
+        LogRing* ring  //!< [in] Ring to add messages to.
+    );
+
+    //! Sends the messages in the ring (if there is one), and sends the batch if its deadline
+    //! has passed. This should be called from the main loop.
+    void service();
+
+    //! Sends the batch (if there's anything in it), unless the transport is backed up.
+    //! Without logical channels, the batch is only sent if IBus::hasSpaceFor says the whole
+    //! encoded batch fits. Buses which don't override hasSpaceFor only report space for one
+    //! byte, so on those the write may still block until the batch has been written.
+    //! @returns true if the batch is empty or was sent, false otherwise.
+    bool flush();
+
+    //! @returns the number of messages which have been dropped.
+    uint32_t getNumDropped() const {
+        return this->m_numDropped + (this->m_ring == nullptr ? 0 : this->m_ring->getNumDropped());
+    }
+
+    //! Maximum size of the data for a message which is added to the ring.
+    static constexpr size_t RING_MESSAGE_LEN = 128;
+
+    //! Number of modules whose levels can be configured.
+    static constexpr size_t MAX_MODULES = 16;
+
+    //! Module used by LOG_CONFIG to configure all of the modules at once.
+    static constexpr uint8_t ALL_MODULES = 0xff;
+
+    //! @returns the mask with the bit set for a logging level.
+    static constexpr uint8_t levelMask(
+        Level level  //!< [in] Logging level.
+    ) {
+        return static_cast<uint8_t>(1u << static_cast<uint8_t>(level));
+    }
+
+    //! Sets the logging levels which are enabled for a module.
+    void setLevelMask(
+        uint8_t module,  //!< [in] Module to configure (or ALL_MODULES).
+        uint8_t mask     //!< [in] Levels to enable (see levelMask).
+    );
+
+    //! @returns the logging levels which are enabled for a module.
+    uint8_t getLevelMask(
+        uint8_t module  //!< [in] Module to query.
+    ) const;
+
+    //! @returns true if messages for a module and level will be logged. This can be used
+    //!          to skip gathering the arguments for messages which aren't wanted.
+    bool isEnabled(
+        uint8_t module,  //!< [in] Module that the message belongs to.
+        Level level      //!< [in] Logging level associated with the message.
+    ) const {
+        return module < MAX_MODULES &&
+               (this->m_levelMasks[module].load(std::memory_order_relaxed) & levelMask(level));
+    }
+
+    //! Logs a message for a module, if the module has the level enabled.
+    void log(
+        uint8_t module,   //!< [in] Module that the message belongs to.
+        Level level,      //!< [in] Logging level associated with this message.
+        const char* fmt,  //!< [in] Printf style format string
+        ...               //!< [in] Arguments associated with format string.
+    );
+
+    bool handlePacket(Packet const& cmd, Packet* rsp) override;
+
+    char const* as_str(Packet::Command::Type cmd) const override;
 
  protected:
     //! Implements the actual logging function.
@@ -37,6 +186,28 @@ class BusLog : public Log {
         ) override;
 
  private:
+    //! Handles the LOG_CONFIG command, which sets the levels for each module. Each entry in
+    //! the command is applied in order, so the levels for all modules can be set, and then
+    //! overridden for individual modules. The response contains the resulting levels, so a
+    //! command with no data just queries them.
+    //! Command:
+    //!     Repeated for each module to configure:
+    //!         uint8_t module (or ALL_MODULES)
+    //!         uint8_t levelMask (bit n enables Level n)
+    //! Response:
+    //!     uint8_t levelMask[MAX_MODULES] (only as many as fit in the response)
+    void handleLogConfig(
+        Packet const& cmd,  //!< [in] LOG_CONFIG packet.
+        Packet* rsp         //!< [in] Place to store LOG_CONFIG response.
+    );
+
+    //! Logs a message, without checking whether it's enabled.
+    void logMessage(
+        Level level,      //!< [in] Logging level associated with this message.
+        const char* fmt,  //!< [in] Printf style format string
+        va_list args      //!< [in] Arguments associated with format string.
+    );
+
     //! Function called from vStrXPrintf which appends a single character to the log packet.
     //! @returns 1 if the character was logged successzfully, 0 otherwise.
     static size_t log_char_to_packet(
@@ -44,5 +215,62 @@ class BusLog : public Log {
         char ch          //!< Character to output.
     );
 
-    IBus* m_bus;  //!< Bus to send the log packets on.
+    //! Number of bytes before the messages in a LOG_BATCH packet.
+    static constexpr size_t BATCH_DROPPED_LEN = sizeof(uint32_t);
+
+    //! Sends the message in the log packet, either immediately or by adding it to the batch.
+    //! @returns true if the message was sent or batched, false if it was dropped.
+    bool sendMessage(
+        Packet* log  //!< [in] Message to send.
+    );
+
+    //! @returns the bus's log packet, once the previous message in it has been sent.
+    Packet* getLogPacket();
+
+    //! Empties the batch, once the previous batch has been written.
+    //! @returns true if the batch is ready to have messages added to it.
+    bool startBatch();
+
+    //! Looks up the ID for a format string, and adds it to the table (sending it to the
+    //! host) if it hasn't been seen before.
+    //! @returns true if the format string has an ID, false if it doesn't fit in the table.
+    bool lookupFormat(
+        char const* fmt,  //!< [in] Format string to look up.
+        uint16_t* id      //!< [out] ID of the format string.
+    );
+
+    //! Formats a message into a LOG packet.
+    void formatText(
+        Packet* log,      //!< [out] Packet to store the message in.
+        Level level,      //!< [in] Logging level associated with this message.
+        const char* fmt,  //!< [in] Printf style format string
+        va_list args      //!< [in] Arguments associated with format string.
+    );
+
+    //! Sends the messages which have been added to the ring.
+    void serviceRing();
+
+    //! Stores a message in a LOG_BINARY packet.
+    //! @returns true if the message was stored, false if it needs to be sent as text.
+    bool packBinary(
+        Packet* log,      //!< [out] Packet to store the message in.
+        Level level,      //!< [in] Logging level associated with this message.
+        uint16_t id,      //!< [in] ID of the format string.
+        const char* fmt,  //!< [in] Printf style format string
+        va_list& args     //!< [mod] Arguments associated with format string.
+    );
+
+    IBus* m_bus;                       //!< Bus to send the log packets on.
+    size_t m_numFormats = 0;           //!< Number of entries in m_formats.
+    char const** m_formats = nullptr;  //!< Format strings sent to the host (indexed by ID).
+    Packet* m_batch = nullptr;         //!< Packet that messages are collected in.
+    uint32_t m_batchDeadlineMs = 0;    //!< Maximum time that a message waits in the batch.
+    uint32_t m_batchStartMs = 0;       //!< Time that the first message was batched.
+    bool m_batchSent = true;           //!< Has the batch been handed to the bus?
+    TxRequest m_batchRequest;          //!< Used to send the batch without waiting.
+    uint32_t m_numDropped = 0;         //!< Number of messages dropped.
+    LogRing* m_ring = nullptr;         //!< Ring that messages are added to.
+
+    //! Levels enabled for each module (all levels are enabled by default).
+    std::atomic<uint8_t> m_levelMasks[MAX_MODULES];
 };
@@ -0,0 +1,164 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   BusStats.h
+ *
+ *   @brief  Counters which describe the health of a bus.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+#include <iterator>
+
+#if !defined(__AVR__)
+#include <atomic>
+#endif
+
+#include "duino_bus/Packet.h"
+
+//! A counter which can be incremented cheaply. The counters are updated by whichever
+//! thread or core writes packets (i.e. both cores of an ESP32 or RP2040, or a host's
+//! dispatcher threads), and read from the context which services the bus, so relaxed
+//! atomics are used. AVR has no <atomic> and only one core, so plain integers are used
+//! there, and the counters shouldn't be updated from interrupt handlers.
+class BusCounter {
+ public:
+    //! Adds to the counter.
+    void add(
+        uint32_t count = 1  //!< [in] Amount to add.
+    ) {
+#if defined(__AVR__)
+        this->m_value += count;
+#else
+        this->m_value.fetch_add(count, std::memory_order_relaxed);
+#endif
+    }
+
+    //! @returns the value of the counter.
+    uint32_t get() const {
+#if defined(__AVR__)
+        return this->m_value;
+#else
+        return this->m_value.load(std::memory_order_relaxed);
+#endif
+    }
+
+    //! Sets the counter back to 0, without losing any counts which are added while it's
+    //! being read.
+    //! @returns the value of the counter before it was reset.
+    uint32_t take() {
+#if defined(__AVR__)
+        uint32_t value = this->m_value;
+        this->m_value = 0;
+        return value;
+#else
+        return this->m_value.exchange(0, std::memory_order_relaxed);
+#endif
+    }
+
+    //! Sets the counter back to 0.
+    void reset() {
+#if defined(__AVR__)
+        this->m_value = 0;
+#else
+        this->m_value.store(0, std::memory_order_relaxed);
+#endif
+    }
+
+ private:
+#if defined(__AVR__)
+    uint32_t m_value = 0;  //!< Value of the counter.
+#else
+    std::atomic<uint32_t> m_value{0};  //!< Value of the counter.
+#endif
+};
+
+//! Counters which describe the health of a bus. These are updated by the bus's
+//! PacketDecoder, PacketEncoder and IBus::handlePacket, and reported by the STATS command
+//! (see CorePacketHandler).
+struct BusStats {
+    //! Number of counters, in the order that they're reported by the STATS command.
+    static constexpr size_t NUM_COUNTERS = 11;
+
+    BusCounter rxFrames;       //!< Frames received without errors.
+    BusCounter rxBytes;        //!< Bytes received (including framing).
+    BusCounter rxCrcErrors;    //!< Frames dropped because of a bad CRC (or truncation).
+    BusCounter rxTooMuchData;  //!< Frames dropped because they didn't fit.
+    BusCounter rxTooSmall;     //!< Frames dropped because they were too short.
+    BusCounter rxTimeouts;     //!< Frames dropped because they timed out.
+    BusCounter rxDiscarded;    //!< Bytes discarded (see PacketDecoder::getDiscardedBytes).
+    BusCounter txFrames;       //!< Frames sent.
+    BusCounter txBytes;        //!< Bytes sent (including framing).
+    BusCounter txOverhead;     //!< Bytes added to sent frames by framing and escaping.
+    BusCounter unhandled;      //!< Commands which weren't handled.
+
+    //! Counts the result of decoding a received byte. Timeouts are counted separately,
+    //! since they're detected without receiving a byte.
+    void recordRx(
+        Packet::Error err  //!< [in] Result returned by the decoder.
+    ) {
+        this->rxBytes.add();
+        switch (err) {
+            case Packet::Error::NONE:
+                this->rxFrames.add();
+                break;
+            case Packet::Error::CRC:
+                this->rxCrcErrors.add();
+                break;
+            case Packet::Error::TOO_MUCH_DATA:
+                this->rxTooMuchData.add();
+                break;
+            case Packet::Error::TOO_SMALL:
+                this->rxTooSmall.add();
+                break;
+            default:
+                break;
+        }
+    }
+
+    //! Gets the values of the counters, in the order that they're reported.
+    void get(
+        uint32_t* values  //!< [out] Place to store NUM_COUNTERS values.
+    ) const;
+
+    //! Sets all of the counters back to 0.
+    void reset();
+};
+
+//! The counters in BusStats, in the order that they're reported.
+inline constexpr BusCounter BusStats::*BUS_STATS_COUNTERS[] = {
+    &BusStats::rxFrames,
+    &BusStats::rxBytes,
+    &BusStats::rxCrcErrors,
+    &BusStats::rxTooMuchData,
+    &BusStats::rxTooSmall,
+    &BusStats::rxTimeouts,
+    &BusStats::rxDiscarded,
+    &BusStats::txFrames,
+    &BusStats::txBytes,
+    &BusStats::txOverhead,
+    &BusStats::unhandled,
+};
+static_assert(std::size(BUS_STATS_COUNTERS) == BusStats::NUM_COUNTERS);
+
+inline void BusStats::get(uint32_t* values) const {
+    for (size_t idx = 0; idx < NUM_COUNTERS; idx++) {
+        values[idx] = (this->*BUS_STATS_COUNTERS[idx]).get();
+    }
+}
+
+inline void BusStats::reset() {
+    for (auto counter : BUS_STATS_COUNTERS) {
+        (this->*counter).reset();
+    }
+}
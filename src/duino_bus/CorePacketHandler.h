@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include "BusStats.h"
 #include "PacketHandler.h"
 
 //! Packet handler for dealing with core commands.
@@ -23,29 +24,110 @@ class CorePacketHandler : public IPacketHandler {
  public:
     //! Commands accepted by the Core packet handler.
     struct Command : public Packet::Command {
-        static constexpr Type PING = 0x01;        //!< Check to see if the board is aliave.
-        static constexpr Type DEBUG = 0x02;       //!< Sets debug setting
-        static constexpr Type LOG = 0x03;         //!< Log message (to host)
-        static constexpr Type STACK_INFO = 0x04;  //!< Returns stack information.
-        static constexpr Type HEAP_INFO = 0x05;   //!< Returns heap information.
+        static constexpr Type PING = 0x01;                 //!< Check to see if the board is aliave.
+        static constexpr Type DEBUG = 0x02;                //!< Sets debug setting
+        static constexpr Type LOG = 0x03;                  //!< Log message (to host)
+        static constexpr Type STACK_INFO = 0x04;           //!< Returns stack information.
+        static constexpr Type HEAP_INFO = 0x05;            //!< Returns heap information.
+        static constexpr Type BATCH = 0x06;                //!< Runs several commands at once.
+        // STREAM_END (0x07) is sent by the bus, so it's defined by Packet::Command.
+        static constexpr Type LOG_FORMAT = 0x08;           //!< Binary log format string (to host)
+        static constexpr Type LOG_BINARY = 0x09;           //!< Binary log message (to host)
+        static constexpr Type LOG_BATCH = 0x0A;            //!< Several log messages (to host)
+        static constexpr Type LOG_TIMED = 0x0B;            //!< Timestamped log message (to host)
+        static constexpr Type LOG_CONFIG = 0x0C;           //!< Sets log levels (see BusLog)
+        static constexpr Type EVENT = 0x0D;                //!< Events (to host, EventPacketHandler)
+        static constexpr Type EVENT_SUBSCRIBE = 0x0E;      //!< Subscribes to events
+        static constexpr Type TELEMETRY_SUBSCRIBE = 0x0F;  //!< Streams telemetry records
+        static constexpr Type TELEMETRY = 0x10;            //!< Telemetry record (to host)
+        static constexpr Type STATS = 0x11;                //!< Returns bus statistics.
+        static constexpr Type LATENCY = 0x12;              //!< Returns command latencies.
     };
 
+    //! Number of bytes (command and length) before each record in a BATCH packet.
+    static constexpr size_t BATCH_HEADER_LEN = 2;
+
+    //! Number of values in the HEAP_INFO response.
+    static constexpr size_t NUM_HEAP_INFO_VALUES = 6;
+
+    //! Number of values in the STACK_INFO response.
+    static constexpr size_t NUM_STACK_INFO_VALUES = 3;
+
+    //! Number of values in a TELEMETRY record: the HEAP_INFO values, followed by the
+    //! STACK_INFO values, followed by the bus's BusStats counters (in the order that the
+    //! STATS command reports them).
+    static constexpr size_t NUM_TELEMETRY_VALUES =
+        NUM_HEAP_INFO_VALUES + NUM_STACK_INFO_VALUES + BusStats::NUM_COUNTERS;
+
+    //! Set in the flags of a TELEMETRY record whose values are absolute, rather than deltas.
+    static constexpr uint8_t TELEMETRY_KEYFRAME = 0x01;
+
+    //! Every this many TELEMETRY records is a keyframe, so the host can recover from a
+    //! lost record.
+    static constexpr uint8_t TELEMETRY_KEYFRAME_INTERVAL = 16;
+
+    //! Set in the flags of the STATS command to reset the counters after they're read.
+    static constexpr uint8_t STATS_RESET = 0x01;
+
+    //! Set in the flags of the LATENCY command to reset the histogram after it's read.
+    static constexpr uint8_t LATENCY_RESET = 0x01;
+
     //! Flags passed to DEBUG message.
     //! Currently just a 0/1 but could become a bit mask.
     using DebugFlags = uint32_t;
 
     bool handlePacket(Packet const& cmd, Packet* rsp) override;
 
+    bool handlePacketInPlace(Packet* cmd, Packet* rsp) override;
+
     char const* as_str(Packet::Command::Type cmd) const override;
 
+    //! Queues a TELEMETRY record on the BusChannel::EVENT channel (using the bus's event
+    //! packet) if the host has subscribed to them, the interval has passed, and the event
+    //! packet isn't still queued. Nothing is sent if the bus doesn't have an EVENT channel.
+    //! This should be called periodically from the same context that services the bus. The
+    //! heap values are gathered the same way as HEAP_INFO, so short intervals should only be
+    //! used with the heap hooks.
+    //! @returns true if a record was queued, false otherwise.
+    bool service();
+
  protected:
+    //! Handles the BATCH command. Each sub-command is run through the bus's handlers
+    //! (see IBus::dispatchPacket) and its response is appended to the BATCH response.
+    //! Sub-commands and responses are at most 255 bytes, and nested BATCH commands
+    //! aren't allowed. Each sub-response is stored directly in the BATCH response while
+    //! there's room for a 255 byte response, and is built on the stack and copied once
+    //! there isn't. If a sub-response doesn't fit, it's replaced by an empty record with a
+    //! command of 0, and the remaining sub-commands aren't run, so there may be fewer
+    //! responses than sub-commands.
+    //! Command:
+    //!     Repeated for each sub-command:
+    //!         uint8_t command
+    //!         uint8_t length
+    //!         uint8_t data[length]
+    //! Response:
+    //!     Repeated for each sub-command (in the same order):
+    //!         uint8_t command (0 if there was no response, the command wasn't handled, or
+    //!                          the response didn't fit)
+    //!         uint8_t length
+    //!         uint8_t data[length]
+    void handleBatch(
+        Packet const& cmd,  //!< [in] Batch packet.
+        Packet* rsp         //!< [in] Place to store batch response.
+    );
+
     //! Handles DEBUG command.
     void handleDebug(
         Packet const& cmd,  //!< [in] Ping packet.
         Packet* rsp         //!< [in] Place to store ping response.
     );
 
-    //! Handles the HEAP_INFO command.
+    //! Handles the HEAP_INFO command. Only when the heap hooks are enabled (see HeapStats)
+    //! is this O(1): it reports the counters maintained by the hooks, so it's cheap enough
+    //! to be sampled often. Without the hooks, the values come from mallinfo, which walks
+    //! the allocator's free lists, so it takes longer the more fragmented the heap is.
+    //! Neither knows the size of the largest free block, so heapLargestFree is the number of
+    //! free bytes (the same as heapFree), which is an upper bound.
     //! Command:
     //!     No Data
     //! Response:
@@ -54,17 +136,62 @@ class CorePacketHandler : public IPacketHandler {
     //!     uint32_t heapFree
     //!     uint32_t heapLargestFree
     //!     uint32_t heapGrowthPotential
+    //!     uint32_t heapHighWater
     void handleHeapInfo(
         Packet const& cmd,  //!< [in] Ping packet.
         Packet* rsp         //!< [in] Place to store ping response.
     );
 
+    //! Handles the LATENCY command, which reports the latencies recorded for a command
+    //! (see IBus::setLatencyTable). Bucket i holds latencies starting at
+    //! LatencyHistogram::bucketLowerBound(i) microseconds.
+    //! Command:
+    //!     No Data (lists the commands which have latencies)
+    //!     or
+    //!     uint8_t command
+    //!     uint8_t flags (LATENCY_RESET, optional)
+    //! Response:
+    //!     Repeated for each command which has latencies:
+    //!         uint8_t command
+    //!     or
+    //!     uint8_t command
+    //!     varint count
+    //!     varint maxUs
+    //!     uint8_t numBuckets
+    //!     Repeated numBuckets times, for each bucket which isn't empty:
+    //!         uint8_t bucket
+    //!         varint count
+    //!
+    //! If the response is too small for all of the buckets, only the ones which fit are
+    //! sent (so their counts add up to less than count), and the histogram isn't reset.
+    void handleLatency(
+        Packet const& cmd,  //!< [in] LATENCY packet.
+        Packet* rsp         //!< [in] Place to store the response.
+    );
+
     //! Handles PING command.
     void handlePing(
         Packet const& cmd,  //!< [in] Ping packet.
         Packet* rsp         //!< [in] Place to store ping response.
     );
 
+    //! Handles the TELEMETRY_SUBSCRIBE command. The next TELEMETRY record is a keyframe.
+    //! Command:
+    //!     uint16_t intervalMs (0 stops the records)
+    //! Response:
+    //!     uint16_t intervalMs
+    //!     uint8_t numValues
+    //!
+    //! TELEMETRY records contain:
+    //!     uint8_t flags (TELEMETRY_KEYFRAME)
+    //!     uint8_t numValues
+    //!     Repeated for each value:
+    //!         varint value (for keyframes) or signed varint change from the last record
+    void handleTelemetrySubscribe(
+        Packet const& cmd,  //!< [in] TELEMETRY_SUBSCRIBE packet.
+        Packet* rsp         //!< [in] Place to store the response.
+    );
+
     //! Handles the STACK_INFO command.
     //! Command:
     //!     No Data
@@ -76,4 +203,33 @@ class CorePacketHandler : public IPacketHandler {
         Packet const& cmd,  //!< [in] Ping packet.
         Packet* rsp         //!< [in] Place to store ping response.
     );
+
+    //! Handles the STATS command, which reports the bus's counters (see BusStats). If the
+    //! response packet is too small for all of the counters, only the ones which fit are
+    //! sent (and reset).
+    //! Command:
+    //!     uint8_t flags (STATS_RESET, optional)
+    //! Response:
+    //!     uint8_t numCounters
+    //!     Repeated for each counter:
+    //!         varint value
+    void handleStats(
+        Packet const& cmd,  //!< [in] STATS packet.
+        Packet* rsp         //!< [in] Place to store the response.
+    );
+
+    //! Gets the values reported by HEAP_INFO.
+    static void getHeapInfo(
+        uint32_t* info  //!< [out] Place to store NUM_HEAP_INFO_VALUES values.
+    );
+
+    //! Gets the values reported by STACK_INFO.
+    static void getStackInfo(
+        uint32_t* info  //!< [out] Place to store NUM_STACK_INFO_VALUES values.
+    );
+
+    uint16_t m_telemetryIntervalMs = 0;               //!< Time between TELEMETRY records (0 = off).
+    uint32_t m_telemetryLastMs = 0;                   //!< Time that the last record was sent.
+    uint8_t m_telemetryCount = 0;                     //!< Records since the last keyframe.
+    uint32_t m_telemetry[NUM_TELEMETRY_VALUES] = {};  //!< Values in the last record.
 };
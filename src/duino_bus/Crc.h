@@ -0,0 +1,45 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   Crc.h
+ *
+ *   @brief  Wider CRCs which can be used to protect packets.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+//! Initial value to use with Crc16Ccitt.
+inline constexpr uint16_t CRC16_CCITT_INIT = 0xFFFF;
+
+//! Calculates a CRC-16/CCITT (polynomial 0x1021, no reflection, no final xor).
+//! This matches crcmod.predefined.mkCrcFun('crc-ccitt-false') when the initial
+//! value is CRC16_CCITT_INIT.
+//! @returns the updated CRC.
+uint16_t Crc16Ccitt(
+    uint16_t crc,     //!< [in] CRC calculated so far.
+    size_t len,       //!< [in] Number of bytes of data.
+    void const* data  //!< [in] Data to calculate the CRC over.
+);
+
+//! Calculates a CRC-32C (Castagnoli), which matches crcmod.predefined.mkCrcFun('crc-32c').
+//! The pre and post inversions are done internally, so the initial value is 0 and the
+//! result of one call can be passed in to the next.
+//! On x86-64 and ARMv8 (Linux) hosts, the CPU is checked at runtime, and its CRC
+//! instructions are used if it has them. Otherwise a lookup table is used.
+//! @returns the updated CRC.
+uint32_t Crc32c(
+    uint32_t crc,     //!< [in] CRC calculated so far.
+    size_t len,       //!< [in] Number of bytes of data.
+    void const* data  //!< [in] Data to calculate the CRC over.
+);
@@ -0,0 +1,44 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   Dispatcher.h
+ *
+ *   @brief  Interface for handling received commands somewhere other than inline.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include "duino_bus/BusChannel.h"
+#include "duino_bus/Packet.h"
+
+//! Abstract base class for a dispatcher, which takes received commands from the bus and
+//! runs them through the handlers somewhere else (i.e. on a pool of worker threads), so
+//! that slow handlers don't stall the bus (see IBus::setDispatcher).
+class IDispatcher {
+ public:
+    //! Destructor.
+    virtual ~IDispatcher() = default;
+
+    //! Hands a received command off to be handled. The command packet is reused as soon as
+    //! this returns, so the dispatcher needs to copy it.
+    //! @returns true if the command was accepted, or false if the bus should handle it
+    //!          inline.
+    virtual bool submit(
+        BusChannel& channel,  //!< [in] Channel the command was received on.
+        Packet const& cmd     //!< [in] Command to handle.
+        ) = 0;
+
+    //! Sends the responses to any commands which have finished being handled, by queuing
+    //! them on their channels (see IBus::queuePacket). This is called by IBus::serviceTx,
+    //! from the same context that handles the bus.
+    //! @returns true if a response was sent (or queued), false otherwise.
+    virtual bool serviceResponses() = 0;
+};
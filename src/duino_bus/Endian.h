@@ -0,0 +1,83 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   Endian.h
+ *
+ *   @brief  Helpers for converting data to/from the little-endian wire order.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+//! true if the host stores multi-byte values in little-endian order, which is the
+//! order used over the wire.
+inline constexpr bool HOST_IS_LITTLE_ENDIAN = (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+
+//! Determines if an array of T needs to be byte swapped to convert it to/from wire order.
+//! @tparam T type of the array elements.
+template <typename T>
+inline constexpr bool needsByteSwap = (sizeof(T) > 1) && !HOST_IS_LITTLE_ENDIAN;
+
+//! Copies an array of values, reversing the byte order of each element.
+//! The loop is simple enough that the compiler will vectorize it where possible.
+//! @tparam T type of the array elements.
+template <typename T>
+void copyByteSwapped(
+    size_t count,     //!< [in] Number of elements to copy.
+    void* dst,        //!< [out] Place to copy the swapped elements.
+    void const* src   //!< [in] Elements to copy.
+) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    static_assert(sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8);
+
+    auto* dst8 = static_cast<uint8_t*>(dst);
+    auto const* src8 = static_cast<uint8_t const*>(src);
+    for (size_t i = 0; i < count; i++) {
+        if constexpr (sizeof(T) == 1) {
+            dst8[i] = src8[i];
+        } else if constexpr (sizeof(T) == 2) {
+            uint16_t val;
+            memcpy(&val, &src8[i * 2], 2);
+            val = __builtin_bswap16(val);
+            memcpy(&dst8[i * 2], &val, 2);
+        } else if constexpr (sizeof(T) == 4) {
+            uint32_t val;
+            memcpy(&val, &src8[i * 4], 4);
+            val = __builtin_bswap32(val);
+            memcpy(&dst8[i * 4], &val, 4);
+        } else {
+            uint64_t val;
+            memcpy(&val, &src8[i * 8], 8);
+            val = __builtin_bswap64(val);
+            memcpy(&dst8[i * 8], &val, 8);
+        }
+    }
+}
+
+//! Copies an array of values between host order and wire (little-endian) order.
+//! This turns into a single memcpy when the host is little-endian.
+//! @tparam T type of the array elements.
+template <typename T>
+void copyWireOrder(
+    size_t count,     //!< [in] Number of elements to copy.
+    void* dst,        //!< [out] Place to copy the elements.
+    void const* src   //!< [in] Elements to copy.
+) {
+    if constexpr (needsByteSwap<T>) {
+        copyByteSwapped<T>(count, dst, src);
+    } else {
+        memcpy(dst, src, count * sizeof(T));
+    }
+}
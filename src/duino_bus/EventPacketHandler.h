@@ -0,0 +1,126 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   EventPacketHandler.h
+ *
+ *   @brief  Packet handler which pushes events that the host has subscribed to.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include "duino_bus/PacketHandler.h"
+
+//! Packet handler which lets the host subscribe to events, rather than polling for them.
+//!
+//! The device publishes the latest value of each event using publish. Events which the
+//! host hasn't subscribed to are ignored. For subscribed events, only the latest value is
+//! kept (so repeated events are coalesced), and it's sent no more often than the interval
+//! that the host asked for. service sends the events which are due, packing as many as
+//! will fit into each EVENT packet, which is queued on the BusChannel::EVENT channel using
+//! the bus's event packet. Nothing is sent while the previous packet is still queued.
+//!
+//! publish and service need to be called from the same context that services the bus.
+class EventPacketHandler : public IPacketHandler {
+ public:
+    //! Identifies an event.
+    using EventId = uint16_t;
+
+    //! Maximum number of bytes in an event's value.
+    static constexpr size_t MAX_VALUE_LEN = 8;
+
+    //! Interval passed to EVENT_SUBSCRIBE to unsubscribe from an event.
+    static constexpr uint16_t UNSUBSCRIBE = UINT16_MAX;
+
+    //! Status returned for each event in the EVENT_SUBSCRIBE response.
+    enum class Status : uint8_t {
+        OK = 0,    //!< The subscription was updated.
+        FULL = 1,  //!< There's no room in the subscription table.
+    };
+
+    //! An event that the host has subscribed to.
+    struct Subscription {
+        EventId id;                    //!< Event which was subscribed to.
+        uint16_t intervalMs;           //!< Minimum time between sending the event.
+        uint32_t lastSentMs;           //!< Time that the event was last sent.
+        bool inUse;                    //!< Is this entry being used?
+        bool pending;                  //!< Has the event been published since it was sent?
+        uint8_t length;                //!< Number of bytes in value.
+        uint8_t value[MAX_VALUE_LEN];  //!< Latest value of the event.
+    };
+
+    //! Sets the table which stores the subscriptions. Without a table, the host can't
+    //! subscribe to any events.
+    void setSubscriptionTable(
+        size_t numSubscriptions,     //!< [in] Number of entries in the table.
+        Subscription* subscriptions  //!< [in] Storage for the table.
+    );
+
+    //! Publishes the latest value of an event. If the host has subscribed to it, it will be
+    //! sent by service once the event's interval has passed.
+    //! @returns true if the host has subscribed to the event, false otherwise.
+    bool publish(
+        EventId id,        //!< [in] Event to publish.
+        size_t length,     //!< [in] Number of bytes in the value (at most MAX_VALUE_LEN).
+        void const* value  //!< [in] Value of the event.
+    );
+
+    //! Publishes the latest value of an event (see above).
+    //! @tparam T type of the value.
+    //! @returns true if the host has subscribed to the event, false otherwise.
+    template <typename T>
+    bool publish(
+        EventId id,     //!< [in] Event to publish.
+        T const& value  //!< [in] Value of the event.
+    ) {
+        static_assert(sizeof(T) <= MAX_VALUE_LEN);
+        return this->publish(id, sizeof(value), &value);
+    }
+
+    //! Sends the events which are due.
+    //! @returns true if an EVENT packet was sent (or queued), false otherwise.
+    bool service();
+
+    //! @returns the number of events that the host has subscribed to.
+    size_t getNumSubscribed() const;
+
+    bool handlePacket(Packet const& cmd, Packet* rsp) override;
+
+    char const* as_str(Packet::Command::Type cmd) const override;
+
+ protected:
+    //! Handles the EVENT_SUBSCRIBE command. Subscribing to an event which was already
+    //! subscribed to just changes its interval.
+    //! Command:
+    //!     Repeated for each event:
+    //!         uint16_t id
+    //!         uint16_t intervalMs (UNSUBSCRIBE to unsubscribe)
+    //! Response:
+    //!     uint8_t status[] (see Status, one for each event in the command)
+    //!
+    //! EVENT packets contain:
+    //!     Repeated for each event:
+    //!         uint16_t id
+    //!         uint8_t length
+    //!         uint8_t value[length]
+    void handleSubscribe(
+        Packet const& cmd,  //!< [in] EVENT_SUBSCRIBE packet.
+        Packet* rsp         //!< [out] Place to store the response.
+    );
+
+    //! @returns the subscription for an event, or nullptr if there isn't one.
+    Subscription* findSubscription(
+        EventId id  //!< [in] Event to look for.
+    ) const;
+
+    size_t m_numSubscriptions = 0;            //!< Number of entries in m_subscriptions.
+    Subscription* m_subscriptions = nullptr;  //!< Table of subscriptions.
+    size_t m_nextIdx = 0;                     //!< Where service starts looking for events.
+};
@@ -0,0 +1,83 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   HeapStats.h
+ *
+ *   @brief  Heap counters which are maintained incrementally.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+//! Heap counters which are updated on every allocation, so that reading them is O(1),
+//! unlike mallinfo, which walks the allocator's free lists.
+//!
+//! When DUINO_BUS_HEAP_HOOKS is defined, HeapStats.cpp provides hooks which maintain the
+//! counters. The program needs to be linked with:
+//!     -Wl,--wrap=malloc,--wrap=free,--wrap=calloc,--wrap=realloc,--wrap=_sbrk
+//! The hooks are meant for newlib based devices, where the arena grows using _sbrk. They
+//! take the place of any other malloc wrappers (i.e. the Pico SDK's pico_malloc). glibc
+//! has no _sbrk, so on hosts _sbrk isn't wrapped, and the arena size stays at 0 (the
+//! heap hooks unit test is built this way, see test-heap-hooks in the Makefile).
+//!
+//! Without the hooks, only the high water mark is maintained (see updateHighWater).
+class HeapStats {
+ public:
+    //! Values reported by HEAP_INFO.
+    struct Info {
+        uint32_t arena;        //!< Number of bytes obtained from the system.
+        uint32_t allocated;    //!< Number of bytes in allocated blocks.
+        uint32_t free;         //!< Number of bytes in the arena which aren't allocated.
+        uint32_t largestFree;  //!< Largest free block (an upper bound, see getInfo).
+        uint32_t highWater;    //!< Largest number of bytes which were allocated at once.
+    };
+
+    //! @returns true if the counters are maintained by the hooks.
+    static constexpr bool isEnabled() {
+#if defined(DUINO_BUS_HEAP_HOOKS)
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    //! Records that a block was allocated.
+    static void recordAlloc(
+        size_t size  //!< [in] Usable size of the block.
+    );
+
+    //! Records that a block was freed.
+    static void recordFree(
+        size_t size  //!< [in] Usable size of the block.
+    );
+
+    //! Records that the arena grew (or shrank).
+    static void recordArena(
+        ptrdiff_t increment  //!< [in] Number of bytes added to the arena.
+    );
+
+    //! Updates the high water mark, for when the number of bytes allocated comes from
+    //! somewhere other than the hooks (i.e. mallinfo).
+    static void updateHighWater(
+        uint32_t allocated  //!< [in] Number of bytes allocated.
+    );
+
+    //! Gets the counters. The counters don't include the size of each free block, so
+    //! largestFree is the number of free bytes, which is an upper bound.
+    static void getInfo(
+        Info* info  //!< [out] Place to store the counters.
+    );
+
+    //! Clears the counters (used by tests).
+    static void reset();
+};
@@ -0,0 +1,99 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   LatencyHistogram.h
+ *
+ *   @brief  Fixed size histogram of command latencies.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+
+//! Fixed size log-linear histogram of latencies, in microseconds. Each power of 2 is
+//! split into SUB_BUCKETS linear buckets, so each bucket is within 25% of the latencies
+//! it holds. Latencies below SUB_BUCKETS get a bucket each, and latencies too big for
+//! the last bucket are counted in the last bucket (getMax still reports them exactly).
+//!
+//! Recording a latency is a count leading zeros, a shift and a few increments, so it's
+//! cheap enough to do for every command.
+class LatencyHistogram {
+ public:
+    //! Number of bits used to pick the linear bucket within a power of 2.
+    static constexpr uint32_t SUB_BUCKET_BITS = 2;
+
+    //! Number of linear buckets within each power of 2.
+    static constexpr uint32_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+
+    //! Number of buckets. The last bucket starts at 114688 usec.
+    static constexpr size_t NUM_BUCKETS = 64;
+
+    //! @returns the index of the bucket which holds a latency.
+    static size_t bucketIndex(
+        uint32_t latencyUs  //!< [in] Latency in microseconds.
+    ) {
+        if (latencyUs < SUB_BUCKETS) {
+            return latencyUs;
+        }
+        uint32_t shift = 31 - __builtin_clz(latencyUs) - SUB_BUCKET_BITS;
+        size_t idx = (shift + 1) * SUB_BUCKETS + ((latencyUs >> shift) & (SUB_BUCKETS - 1));
+        return idx < NUM_BUCKETS ? idx : NUM_BUCKETS - 1;
+    }
+
+    //! @returns the smallest latency which is stored in a bucket.
+    static uint32_t bucketLowerBound(
+        size_t idx  //!< [in] Index of the bucket.
+    ) {
+        if (idx < SUB_BUCKETS) {
+            return idx;
+        }
+        return (SUB_BUCKETS + idx % SUB_BUCKETS) << (idx / SUB_BUCKETS - 1);
+    }
+
+    //! Adds a latency to the histogram.
+    void record(
+        uint32_t latencyUs  //!< [in] Latency in microseconds.
+    ) {
+        this->m_buckets[bucketIndex(latencyUs)]++;
+        this->m_count++;
+        if (latencyUs > this->m_maxUs) {
+            this->m_maxUs = latencyUs;
+        }
+    }
+
+    //! @returns the number of latencies which have been recorded.
+    uint32_t getCount() const { return this->m_count; }
+
+    //! @returns the largest latency which has been recorded.
+    uint32_t getMax() const { return this->m_maxUs; }
+
+    //! @returns the number of latencies recorded in a bucket.
+    uint32_t getBucket(
+        size_t idx  //!< [in] Index of the bucket.
+    ) const {
+        return this->m_buckets[idx];
+    }
+
+    //! Clears the histogram.
+    void reset() {
+        for (auto& bucket : this->m_buckets) {
+            bucket = 0;
+        }
+        this->m_count = 0;
+        this->m_maxUs = 0;
+    }
+
+ private:
+    uint32_t m_count = 0;                  //!< Number of latencies recorded.
+    uint32_t m_maxUs = 0;                  //!< Largest latency recorded.
+    uint32_t m_buckets[NUM_BUCKETS] = {};  //!< Number of latencies in each bucket.
+};
@@ -0,0 +1,107 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   LogRing.h
+ *
+ *   @brief  Lock-free ring buffer of log messages.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cinttypes>
+#include <cstddef>
+
+#include "duino_bus/Packet.h"
+
+//! A lock-free multi-producer single-consumer ring buffer of timestamped log messages.
+//!
+//! Messages can be written from any context (other threads, another core, or interrupt
+//! handlers) without blocking: a writer reserves space by advancing the head with a
+//! compare-and-swap, copies the message in, and then marks it as committed. If there isn't
+//! enough space, the message is dropped and counted. Messages are read, in the order that
+//! space was reserved, by a single reader (see BusLog::service).
+//!
+//! Messages never wrap around the end of the buffer. If a message doesn't fit in the space
+//! before the end, that space is skipped.
+//!
+//! Since messages are read in order, a writer which is interrupted between reserving and
+//! committing holds up the reader (but not other writers) until it finishes.
+class LogRing {
+ public:
+    //! Information about the oldest message in the ring.
+    struct Entry {
+        uint32_t timestamp;  //!< Time that the message was written (see IBus::getMillis).
+        uint8_t command;     //!< Command of the log packet (i.e. LOG or LOG_BINARY).
+        char const* format;  //!< Format string, for binary messages (nullptr otherwise).
+        size_t length;       //!< Number of bytes of data.
+    };
+
+    //! Constructor. The buffer is measured in 32-bit words, and its size needs to be a power
+    //! of 2.
+    LogRing(
+        size_t numWords,  //!< [in] Number of words in the buffer.
+        uint32_t* buffer  //!< [in] Storage for the messages.
+    );
+
+    //! Adds a message to the ring. This can be called from any context.
+    //! @returns true if the message was added, false if it was dropped.
+    bool write(
+        uint32_t timestamp,  //!< [in] Time that the message was logged.
+        uint8_t command,     //!< [in] Command of the log packet.
+        char const* format,  //!< [in] Format string, for binary messages.
+        size_t length,       //!< [in] Number of bytes of data.
+        uint8_t const* data  //!< [in] Data for the log packet.
+    );
+
+    //! Gets information about the oldest message. Only the reader can call this.
+    //! @returns true if there's a message, false if the ring is empty (or the oldest
+    //!          message hasn't been committed yet).
+    bool peek(
+        Entry* entry  //!< [out] Information about the message.
+    );
+
+    //! Appends the data from the oldest message to a packet, and removes the message. This
+    //! can only be called after peek returns true. If the data doesn't fit, the message is
+    //! dropped.
+    //! @returns true if the data was appended, false otherwise.
+    bool pop(
+        Packet* packet  //!< [mod] Packet to append the data to.
+    );
+
+    //! @returns the number of messages which have been dropped.
+    uint32_t getNumDropped() const { return this->m_numDropped.load(std::memory_order_relaxed); }
+
+ private:
+    //! Set in a header once the message has been written.
+    static constexpr uint32_t COMMITTED = 0x80000000;
+
+    //! Set in a header for space which was skipped at the end of the buffer.
+    static constexpr uint32_t SKIP = 0x40000000;
+
+    //! Mask for the number of words in the message (including the header).
+    static constexpr uint32_t SIZE_MASK = 0x0000ffff;
+
+    //! Number of words before the data (header, timestamp, command/length and format).
+    static constexpr size_t HEADER_WORDS =
+        3 + (sizeof(char const*) + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+
+    //! Marks the oldest message as read, which makes its space available to writers.
+    void release(
+        uint32_t numWords  //!< [in] Number of words in the message.
+    );
+
+    size_t m_numWords;                      //!< Number of words in m_buffer.
+    uint32_t* m_buffer;                     //!< Storage for the messages.
+    std::atomic<uint32_t> m_head{0};        //!< Where the next message is reserved.
+    std::atomic<uint32_t> m_tail{0};        //!< Oldest message which hasn't been read.
+    std::atomic<uint32_t> m_numDropped{0};  //!< Number of messages dropped.
+};
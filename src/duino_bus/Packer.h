@@ -18,18 +18,58 @@
 
 #include <cassert>
 #include <cstring>
+#include <type_traits>
 
+#include "Endian.h"
 #include "Packet.h"
 
 //! Class for packing variable length data from a packet.
 class Packer {
  public:
+    //! @brief Space reserved at the end of a packet, which can be written in place.
+    //! @details Drivers (or DMA) can write directly into the reserved space, and then call
+    //!          commit with the number of bytes actually written. Nothing is added to the
+    //!          packet if commit isn't called.
+    class Reservation {
+     public:
+        //! Constructor.
+        Reservation(
+            Packet* packet,  //!< [mod] Packet the space was reserved in.
+            uint8_t* data,   //!< [in] Reserved space (nullptr if the reservation failed).
+            size_t size      //!< [in] Number of bytes reserved.
+            )
+            : m_packet{packet}, m_data{data}, m_size{size} {}
+
+        //! @returns true if the space was reserved successfully.
+        bool isValid() const { return this->m_data != nullptr; }
+
+        //! @returns a pointer to the reserved space.
+        uint8_t* data() const { return this->m_data; }
+
+        //! @returns the number of bytes reserved.
+        size_t size() const { return this->m_size; }
+
+        //! Adds the bytes which were written into the reserved space to the packet.
+        //! A reservation can only be committed once, and fails if anything else has been
+        //! appended to the packet since the space was reserved.
+        //! @returns true if the data was committed, false otherwise.
+        bool commit(
+            size_t numBytes  //!< [in] Number of bytes which were written.
+        );
+
+     private:
+        Packet* m_packet;  //!< Packet the space was reserved in.
+        uint8_t* m_data;   //!< Reserved space.
+        size_t m_size;     //!< Number of bytes reserved.
+    };
+
     //! Constructor.
     explicit Packer(
         Packet* packet  //!< [mod] Packet to pack into.
     );
 
     //! Pack a simple type.
+    //! Multi-byte values are packed in little-endian (wire) order.
     //! @tparam T type of value to pack.
     //! @returns true if the data was packed successfully, false otherwise.
     template <typename T>
@@ -42,7 +82,54 @@ class Packer {
         if (this->m_packet->getSpaceRemaining() < sizeof(data)) {
             return false;
         }
-        this->m_packet->appendData(sizeof(data), &data);
+        copyWireOrder<T>(1, this->m_packet->getWriteData(sizeof(data)), &data);
+        return true;
+    }
+
+    //! Packs several simple types.
+    //! The total size is computed at compile time, so only a single capacity check is
+    //! performed. Nothing is packed if there isn't room for all of the values.
+    //! Multi-byte values are packed in little-endian (wire) order.
+    //! @tparam Ts types of the values to pack.
+    //! @returns true if the data was packed successfully, false otherwise.
+    template <typename... Ts>
+    bool packAll(
+        Ts const&... data  //!< [in] Data to pack.
+    ) {
+        // Produce an error if somebody tries to pass a pointer.
+        static_assert((!std::is_pointer_v<Ts> && ...));
+
+        constexpr size_t totalSize = (sizeof(Ts) + ... + 0);
+        if (this->m_packet->getSpaceRemaining() < totalSize) {
+            return false;
+        }
+        uint8_t* dst = this->m_packet->getWriteData(totalSize);
+        ((copyWireOrder<Ts>(1, dst, &data), dst += sizeof(data)), ...);
+        return true;
+    }
+
+    //! Packs an array of simple types.
+    //! Arrays are encoded with a 16-bit element count followed by the elements in
+    //! little-endian order. When the host is little-endian this is a single memcpy.
+    //! @tparam T type of the array elements.
+    //! @returns true if the array was packed successfully, false otherwise.
+    template <typename T>
+    bool packArray(
+        size_t count,  //!< [in] Number of elements in the array.
+        T const* data  //!< [in] Array to pack.
+    ) {
+        static_assert(std::is_arithmetic_v<T>);
+
+        if (count > UINT16_MAX) {
+            return false;
+        }
+        size_t dataLen = count * sizeof(T);
+        if (this->m_packet->getSpaceRemaining() < sizeof(uint16_t) + dataLen) {
+            return false;
+        }
+        uint16_t arrayCount = static_cast<uint16_t>(count);
+        copyWireOrder<uint16_t>(1, this->m_packet->getWriteData(sizeof(arrayCount)), &arrayCount);
+        copyWireOrder<T>(count, this->m_packet->getWriteData(dataLen), data);
         return true;
     }
 
@@ -52,6 +139,32 @@ class Packer {
         char const* str  //!< [in] String to append.
     );
 
+    //! Packs an unsigned integer as a varint: 7 bits per byte, least significant first,
+    //! with the top bit set on every byte except the last. Small values take 1 byte.
+    //! @returns true if the value was packed successfully, false otherwise.
+    bool packVarint(
+        uint32_t value  //!< [in] Value to pack.
+    );
+
+    //! @returns the number of bytes that packVarint uses to pack a value.
+    static size_t varintLength(
+        uint32_t value  //!< [in] Value to be packed.
+    );
+
+    //! Packs a signed integer as a zigzag encoded varint, so that small negative values
+    //! are also small (0, -1, 1, -2 are encoded as 0, 1, 2, 3).
+    //! @returns true if the value was packed successfully, false otherwise.
+    bool packSignedVarint(
+        int32_t value  //!< [in] Value to pack.
+    );
+
+    //! Reserves space at the end of the packet which can be written in place.
+    //! Use Reservation::isValid to determine if there was enough room.
+    //! @returns an object describing the reserved space.
+    Reservation reserve(
+        size_t numBytes  //!< [in] Number of bytes to reserve.
+    );
+
  private:
     Packet* m_packet;
 };
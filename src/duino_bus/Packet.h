@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <cassert>
 #include <cstdint>
 #include <initializer_list>
 
@@ -31,18 +32,77 @@ class Packet {
     // The first byte of each packet is the command.
     // The last byte of the packet is an 8-bit CRC (crcmod.predefined.mkCrcFun('crc-8'))
     // Each packet has data bytes between the command and the CRC.
+    //
+    // Other framings (see Framing) can be selected on a per-bus basis. They carry the
+    // same command, data and CRC bytes.
+    //
+    // Other CRCs (see CrcType) can also be selected on a per-bus basis. Wider CRCs are
+    // stored in little-endian order, and with CrcType::NONE there is no CRC at all.
+    //
+    // On multi-drop buses (i.e. RS-485) addressing can be enabled on a per-bus basis, in
+    // which case a node address byte follows the command, and is covered by the CRC.
+    //
+    // Logical channels (see BusChannel) can also be enabled on a per-bus basis, in which
+    // case a channel byte follows the command (and node address), and is covered by the CRC.
 
     static constexpr uint8_t END = 0xC0;      //!< Start/End of Frame
     static constexpr uint8_t ESC = 0xDB;      //!< Next char is escaped
     static constexpr uint8_t ESC_END = 0xDC;  //!< Escape an END character
     static constexpr uint8_t ESC_ESC = 0xDD;  //!< Escape an ESC character
 
+    static constexpr uint8_t COBS_DELIM = 0x00;     //!< Start/End of a COBS frame
+    static constexpr uint8_t COBS_MAX_CODE = 0xFF;  //!< Code for a run of 254 non-zero bytes
+
+    //! Node address which is accepted by all nodes.
+    static constexpr uint8_t BROADCAST_ADDRESS = 0xFF;
+
+    //! Framing used to delimit packets over the wire.
+    enum class Framing : uint8_t {
+        //! SLIP encoding (the default). Overhead depends on the data, since each
+        //! END or ESC byte takes 2 bytes on the wire.
+        SLIP = 0,
+
+        //! Consistent Overhead Byte Stuffing, with frames delimited by 0x00 bytes.
+        //! The overhead is 2 delimiters, plus 1 byte per 254 bytes of data.
+        COBS = 1,
+
+        //! A 16-bit little-endian length (of the command, data and CRC) followed by the
+        //! unmodified packet bytes. There are no delimiters, so this should only be used
+        //! for transports which are already reliable (i.e. TCP sockets).
+        LENGTH = 2,
+    };
+
+    //! CRC used to protect packets.
+    enum class CrcType : uint8_t {
+        CRC8 = 0,    //!< 8-bit CRC (the default), crcmod 'crc-8'.
+        CRC16 = 1,   //!< CRC-16/CCITT, crcmod 'crc-ccitt-false'.
+        CRC32C = 2,  //!< CRC-32C (Castagnoli), crcmod 'crc-32c'.
+        NONE = 3,    //!< No CRC, for transports which are already reliable.
+    };
+
+    //! @returns the number of bytes that a CRC of the indicated type occupies.
+    static constexpr size_t crcSize(
+        CrcType crcType  //!< [in] Type of CRC.
+    ) {
+        switch (crcType) {
+            case CrcType::CRC8:
+                return 1;
+            case CrcType::CRC16:
+                return 2;
+            case CrcType::CRC32C:
+                return 4;
+            case CrcType::NONE:
+                return 0;
+        }
+        return 0;
+    }
+
     //! Error code.
     enum class Error {
         NONE = 0,           //!< No Error.
         NOT_DONE = 1,       //!< Indicates that parsing is not complete.
         CRC = 2,            //!< CRC error occurred during parsing.
-        TIMEOUT = 3,        //!< Indicates that a timeout occurred while waiting for a reply.
+        TIMEOUT = 3,        //!< Indicates that a timeout occurred while waiting for data.
         TOO_MUCH_DATA = 4,  //!< Packet storage isn't big enough.
         TOO_SMALL = 5,      //!< Not enough data for a packet.
         BAD_STATE = 6,      //!< Not enough data for a packet.
@@ -61,6 +121,9 @@ class Packet {
         //! Base used for assigning CORE commands.
         static constexpr Type CORE_COMMAND_BASE = 0x00;
 
+        //! Sent by the bus at the end of a streamed response (see IBus::startStream).
+        static constexpr Type STREAM_END = CORE_COMMAND_BASE + 0x07;
+
         //! Base used for assigning LITTLEFS commands.
         static constexpr Type LITTLEFS_COMMAND_BASE = 0x40;
 
@@ -68,6 +131,14 @@ class Packet {
         static constexpr Type HWTESTER_COMMAND_BASE = 0x80;
     };
 
+    //! @brief Describes a block of external data which is sent after the packet data.
+    //! @details Segments allow large buffers (flash pages, sample blocks, etc) to be sent
+    //!          without first copying them into the packet.
+    struct Segment {
+        uint8_t const* data;  //!< Pointer to the segment data.
+        size_t len;           //!< Number of bytes in the segment.
+    };
+
     //! Constructor where the storage for parameter data is specified.
     Packet(
         size_t maxData,  //!< [in] Maximum number of data bytes in the packet.
@@ -98,6 +169,42 @@ class Packet {
         this->m_command.value = cmd;
     }
 
+    //! @returns true if the packet has a node address.
+    bool hasAddress() const { return this->m_hasAddress; }
+
+    //! @returns the node address of the packet (only valid if hasAddress returns true).
+    uint8_t getAddress() const { return this->m_address; }
+
+    //! Sets the node address of the packet.
+    //! For packets sent by a host this is the destination node, and for packets sent by
+    //! a node this is the address of the node sending the packet.
+    void setAddress(
+        uint8_t address  //!< [in] Node address.
+    ) {
+        this->m_address = address;
+        this->m_hasAddress = true;
+    }
+
+    //! Removes the node address from the packet.
+    void clearAddress() { this->m_hasAddress = false; }
+
+    //! @returns true if the packet has a logical channel.
+    bool hasChannel() const { return this->m_hasChannel; }
+
+    //! @returns the logical channel of the packet (only valid if hasChannel returns true).
+    uint8_t getChannel() const { return this->m_channel; }
+
+    //! Sets the logical channel that the packet is sent/received on.
+    void setChannel(
+        uint8_t channel  //!< [in] Logical channel.
+    ) {
+        this->m_channel = channel;
+        this->m_hasChannel = true;
+    }
+
+    //! Removes the logical channel from the packet.
+    void clearChannel() { this->m_hasChannel = false; }
+
     //! Returns the length of the data portion of the packet.
     //! Since we don't know the length of the packet ahead of time,
     //! we need maxDataLen to allow for a spot to store the CRC.
@@ -105,11 +212,19 @@ class Packet {
     size_t getMaxDataLength() const { return this->m_maxDataLen; }
 
     //! Returns the length of the data portion of the packet.
+    //! This doesn't include any data stored in external segments.
     //! @returns the number of data bytes in the packet.
     size_t getDataLength() const { return this->m_dataLen; }
 
-    //! @returns the amount of space remaining in the packet.
-    size_t getSpaceRemaining() const { return this->m_maxDataLen - this->m_dataLen; }
+    //! @returns the number of data bytes in the packet, including external segments.
+    size_t getTotalDataLength() const { return this->m_dataLen + this->m_segmentDataLen; }
+
+    //! Data can't be appended once segments have been added (see appendSegment), so this
+    //! is 0 when the packet has segments.
+    //! @returns the number of bytes of data which can still be appended to the packet.
+    size_t getSpaceRemaining() const {
+        return (this->m_numSegments != 0) ? 0 : this->m_maxDataLen - this->m_dataLen;
+    }
 
     //! @returns a mutable pointer to the data portion of the packet.
     uint8_t* getData() { return this->m_data; }
@@ -121,11 +236,33 @@ class Packet {
     uint8_t* getWriteData(
         size_t numBytes = 0  //!< [in] Number of bytes to advance the write pointer by.
     ) {
+        assert(this->m_dataLen + numBytes <= this->m_maxDataLen);
         uint8_t* data = &this->m_data[this->m_dataLen];
         this->m_dataLen += numBytes;
         return data;
     }
 
+    //! Reserves space at the end of the packet data so that it can be written in place.
+    //! The data length isn't changed until commitData is called, so abandoning a
+    //! reservation leaves the packet unchanged.
+    //! @returns a pointer to the reserved space, or nullptr if there isn't enough room.
+    uint8_t* reserveData(
+        size_t numBytes  //!< [in] Number of bytes to reserve.
+    ) {
+        if (this->getSpaceRemaining() < numBytes || this->m_numSegments != 0) {
+            return nullptr;
+        }
+        return &this->m_data[this->m_dataLen];
+    }
+
+    //! Adds data which was written in place (see reserveData) to the packet.
+    void commitData(
+        size_t numBytes  //!< [in] Number of bytes which were written.
+    ) {
+        assert(numBytes <= this->getSpaceRemaining());
+        this->m_dataLen += numBytes;
+    }
+
     //! Sets the packet data.
     //! To set the packet to be empty, pass in a zero dataLen.
     void setData(
@@ -139,6 +276,35 @@ class Packet {
         void const* data  //!< [in] Packet data to copy in.
     );
 
+    //! Sets the storage used to hold external segment descriptors.
+    //! A packet has no segment storage by default, so this needs to be called before
+    //! appendSegment can be used.
+    void setSegmentStorage(
+        size_t maxSegments,  //!< [in] Maximum number of segments.
+        Segment* segments    //!< [in] Place to store segment descriptors.
+    );
+
+    //! Appends an external segment to the packet.
+    //! The segment data isn't copied, so it needs to remain valid until the packet
+    //! has been encoded. Segments are always sent after the packet data, so all of the
+    //! packet data should be appended before the first segment. The packet data and the
+    //! segments together can't be longer than getMaxDataLength().
+    //! @returns true if the segment was appended, false if it doesn't fit.
+    bool appendSegment(
+        size_t dataLen,   //!< [in] Size of the segment data.
+        void const* data  //!< [in] Segment data.
+    );
+
+    //! @returns the number of external segments in the packet.
+    size_t getNumSegments() const { return this->m_numSegments; }
+
+    //! @returns the indicated external segment.
+    Segment const& getSegment(
+        size_t idx  //!< [in] Index of the segment to return.
+    ) const {
+        return this->m_segments[idx];
+    }
+
     //! Appends a byte to the packet.
     void appendByte(
         uint8_t byte  //!< Byte to append.
@@ -161,12 +327,24 @@ class Packet {
         this->appendData(sizeof(data), &data);
     }
 
+    //! @returns the type of CRC used by the packet.
+    CrcType getCrcType() const { return this->m_crcType; }
+
+    //! Sets the type of CRC used by the packet.
+    //! This is normally set by the encoder or decoder from the bus CRC policy.
+    void setCrcType(
+        CrcType crcType  //!< [in] Type of CRC to use.
+    ) {
+        this->m_crcType = crcType;
+    }
+
     //! @returns the CRC contained in the packet.
-    uint8_t getCrc() const;
+    uint32_t getCrc() const;
 
-    //! Calculates the CRC of the data.
-    //! @returns the CRC over the command and the data.
-    uint8_t calcCrc() const;
+    //! Calculates the CRC of the data, using the packet's CRC type.
+    //! @returns the CRC over the command, the node address and channel (if present) and
+    //!          the data.
+    uint32_t calcCrc() const;
 
     //! Calculates the CRC of the data and saves it in the packet.
     void calcAndStoreCrc();
@@ -178,24 +356,41 @@ class Packet {
         }
     }
 
+    //! Swaps the contents (including the data buffer) of this packet with another. This
+    //! allows a command packet to be turned into a response packet without copying the
+    //! data. Both packets need to have the same maximum data length and no segments, since
+    //! each packet keeps its own segment storage.
+    void swap(
+        Packet& other  //!< [mod] Packet to swap contents with.
+    );
+
  private:
     friend class PacketDecoder;
 
     //! This allows the TEST(PacketTest, ExtractCrcTest) function to call extractCrc
     friend class PacketDeathTest_ExtractCrcTest_Test;
 
-    //! Extracts the CRC from the last byte of the data.
+    //! Extracts the CRC from the last bytes of the data.
     //! When receiving a packet we don't know the length ahead of time,
-    //! so the CRC is stored as the last byte of the data. This function
-    //! removes the CRC from that last byte of data and stores it in the
+    //! so the CRC is stored as the last bytes of the data. This function
+    //! removes the CRC from the end of the data and stores it in the
     //! m_crc field.
-    uint8_t extractCrc();
-
-    Command m_command;                //!< Command associated with this packet.
-    size_t const m_maxDataLen = 0;    //!< Max number of bytes of packet data.
-    size_t m_dataLen = 0;             //!< Length of data in the packet.
-    uint8_t* const m_data = nullptr;  //!< Place to store packet data.
-    uint8_t m_crc;                    //!< CRC associated with the data.
+    uint32_t extractCrc();
+
+    Command m_command;                  //!< Command associated with this packet.
+    size_t m_maxDataLen = 0;            //!< Max number of bytes of packet data.
+    size_t m_dataLen = 0;               //!< Length of data in the packet.
+    uint8_t* m_data = nullptr;          //!< Place to store packet data.
+    uint32_t m_crc = 0;                 //!< CRC associated with the data.
+    CrcType m_crcType = CrcType::CRC8;  //!< Type of CRC used by the packet.
+    uint8_t m_address = 0;              //!< Node address associated with this packet.
+    bool m_hasAddress = false;          //!< Does this packet have a node address?
+    uint8_t m_channel = 0;              //!< Logical channel associated with this packet.
+    bool m_hasChannel = false;          //!< Does this packet have a logical channel?
+    Segment* m_segments = nullptr;      //!< Place to store external segment descriptors.
+    size_t m_maxSegments = 0;           //!< Max number of external segments.
+    size_t m_numSegments = 0;           //!< Number of external segments in the packet.
+    size_t m_segmentDataLen = 0;        //!< Total length of the external segment data.
 };
 
 //! Returns a string version of the error code.
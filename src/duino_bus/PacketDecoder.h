@@ -19,6 +19,7 @@
 #include <cstdint>
 #include <initializer_list>
 
+#include "duino_bus/BusStats.h"
 #include "duino_bus/Packet.h"
 #include "duino_util/Util.h"
 
@@ -31,6 +32,9 @@ class PacketDecoderTest_BadStateTest_Test;
 //! Code for decoding a raw byte stream into a packet.
 class PacketDecoder {
  public:
+    using Framing = Packet::Framing;  //!< Convenience alias.
+    using CrcType = Packet::CrcType;  //!< Convenience alias.
+
     //! Constructor
     PacketDecoder(
         IBus const* bus,  //!< [in] Bus this decoder is associated with.
@@ -38,6 +42,8 @@ class PacketDecoder {
     );
 
     //! Runs a single byte through the packet decoder state machine.
+    //! After an error, the remainder of the bad frame is discarded (without producing
+    //! further errors) until the start of the next frame is found.
     //! @returns Error::NONE if the packet was parsed successfully.
     //! @returns Error::NOT_DONE if the packet is incomplete.
     //! @returns Error::CRC if a CRC error was encountered.
@@ -46,6 +52,50 @@ class PacketDecoder {
         uint8_t byte  //!< [in] Byte to parse.
     );
 
+    //! Runs a single byte through the packet decoder state machine, first checking
+    //! whether the partially received frame has timed out (see setTimeout).
+    //! @returns Error::TIMEOUT if the partially received frame was aborted.
+    //! @returns the same values as decodeByte otherwise.
+    Packet::Error decodeByte(
+        uint8_t byte,     //!< [in] Byte to parse.
+        uint32_t nowMsec  //!< [in] Time that the byte was received, in milliseconds.
+    );
+
+    //! Checks whether the partially received frame has timed out, and if so aborts it.
+    //! This should be called periodically when no bytes are being received.
+    //! @returns Error::TIMEOUT if the partially received frame was aborted.
+    //! @returns Error::NOT_DONE otherwise.
+    Packet::Error checkTimeout(
+        uint32_t nowMsec  //!< [in] Current time, in milliseconds.
+    );
+
+    //! Sets the inter-byte timeout. If a frame has been partially received and no bytes
+    //! arrive within the timeout then the frame is aborted. This allows a burst of noise,
+    //! or a lost delimiter, to cost at most one packet.
+    void setTimeout(
+        uint32_t timeoutMsec  //!< [in] Timeout in milliseconds (0 disables the timeout).
+    ) {
+        this->m_timeoutMsec = timeoutMsec;
+    }
+
+    //! @returns the inter-byte timeout in milliseconds (0 means disabled).
+    uint32_t getTimeout() const { return this->m_timeoutMsec; }
+
+    //! @returns the number of received bytes which have been discarded. This includes
+    //!          noise between frames and the contents of bad frames, but not delimiters,
+    //!          length prefixes or escape codes.
+    size_t getDiscardedBytes() const { return this->m_discardedBytes; }
+
+    //! Resets the discarded byte counter.
+    void resetDiscardedBytes() { this->m_discardedBytes = 0; }
+
+    //! Sets the counters which are updated as bytes are decoded (nullptr disables them).
+    void setStats(
+        BusStats* stats  //!< [mod] Counters to update.
+    ) {
+        this->m_stats = stats;
+    }
+
     //! Sets the debug flag which controls whether decoded packets get dumped.
     void setDebug(
         bool debug  //!< [in] Value to set debug flag to.
@@ -53,19 +103,164 @@ class PacketDecoder {
         this->m_debug = debug;
     }
 
+    //! Sets the framing used to decode packets.
+    void setFraming(
+        Framing framing  //!< [in] Framing to use.
+    ) {
+        this->m_framing = framing;
+        this->m_state = State::IDLE;
+        this->m_escape = false;
+        this->m_headerIdx = 0;
+    }
+
+    //! @returns the framing used to decode packets.
+    Framing getFraming() const { return this->m_framing; }
+
+    //! Sets the type of CRC which decoded packets are expected to contain.
+    //! Since the CRC is temporarily stored in the packet data, wider CRCs reduce the
+    //! amount of data which can be received by a few bytes.
+    void setCrcType(
+        CrcType crcType  //!< [in] Type of CRC to use.
+    ) {
+        this->m_crcType = crcType;
+    }
+
+    //! @returns the type of CRC which decoded packets are expected to contain.
+    CrcType getCrcType() const { return this->m_crcType; }
+
+    //! Enables or disables node addressing. When enabled, a node address byte follows
+    //! the command, and frames addressed to other nodes are dropped as soon as the
+    //! address is seen, without being buffered or having their CRC calculated.
+    //! Frames sent to Packet::BROADCAST_ADDRESS are always accepted, and a node address
+    //! of Packet::BROADCAST_ADDRESS accepts all frames (i.e. for a host).
+    void setAddressing(
+        bool addressed,                                  //!< [in] Enable node addressing?
+        uint8_t nodeAddress = Packet::BROADCAST_ADDRESS  //!< [in] Address of this node.
+    ) {
+        this->m_addressed = addressed;
+        this->m_nodeAddress = nodeAddress;
+    }
+
+    //! Enables or disables logical channels. When enabled, a channel byte follows the
+    //! command (and node address), and each frame is decoded into the packet for its
+    //! channel, so a frame on one channel never disturbs another channel's packet.
+    //! Frames for channels without a packet are ignored, like frames for other nodes.
+    void setChannels(
+        size_t numChannels,     //!< [in] Number of entries in packets (0 disables channels).
+        Packet* const* packets  //!< [in] Packet to decode into, indexed by channel.
+    ) {
+        this->m_numChannels = numChannels;
+        this->m_channelPackets = packets;
+    }
+
+    //! @returns the packet which the last frame was decoded into. This is the packet
+    //!          passed to the constructor unless logical channels are enabled.
+    Packet* getPacket() const { return this->m_packet; }
+
  private:
     //! This allows the TEST(PacketTest, BadState) function to access m_state
     friend class ::PacketDecoderTest_BadStateTest_Test;
 
     enum class State {
         IDLE,     //!< Haven't started parsing a packet yet.
+        LENGTH,   //!< Parsing the high byte of the length (LENGTH framing).
+        CODE,     //!< Parsing a code byte (COBS framing).
         COMMAND,  //!< Parsing the command.
         DATA,     //!< Parsing the data.
+        SKIP,     //!< Skipping the remainder of an oversized packet (LENGTH framing).
+        HUNT,     //!< Discarding the remainder of a bad frame until a delimiter is seen.
+        IGNORE,   //!< Ignoring the remainder of a frame addressed to another node.
     };
 
-    IBus const* m_bus;            //!< Bus this packet decoder is associated wiith
-    Packet* m_packet;             //!< Packet being decoded.
-    State m_state = State::IDLE;  //!< State of the parser.
-    bool m_escape = false;        //!< Are we escaping a byte?
-    bool m_debug = false;         //!< Print packets decoded?
+    //! @returns true if a frame with the indicated node address should be accepted.
+    bool acceptsAddress(
+        uint8_t address  //!< [in] Node address from the frame.
+    ) const {
+        return address == this->m_nodeAddress || address == Packet::BROADCAST_ADDRESS ||
+               this->m_nodeAddress == Packet::BROADCAST_ADDRESS;
+    }
+
+    //! @returns the number of bytes in the frame header (command, node address and channel).
+    size_t headerLength() const {
+        return 1 + (this->m_addressed ? 1 : 0) + (this->m_numChannels > 0 ? 1 : 0);
+    }
+
+    //! @returns true if a frame has been partially received.
+    bool isFrameInProgress() const;
+
+    //! Discards the partially received frame, adding its bytes to the discarded count.
+    void discardFrame();
+
+    //! Adds to the discarded byte count.
+    void addDiscardedBytes(
+        size_t numBytes  //!< [in] Number of bytes which were discarded.
+    );
+
+    //! Runs a single byte through the decoder for the current framing.
+    //! @returns the same values as decodeByte.
+    Packet::Error decodeFramedByte(
+        uint8_t byte  //!< [in] Byte to parse.
+    );
+
+    //! Runs a single byte through the SLIP decoder.
+    //! @returns the same values as decodeByte.
+    Packet::Error decodeSlipByte(
+        uint8_t byte  //!< [in] Byte to parse.
+    );
+
+    //! Runs a single byte through the COBS decoder.
+    //! @returns the same values as decodeByte.
+    Packet::Error decodeCobsByte(
+        uint8_t byte  //!< [in] Byte to parse.
+    );
+
+    //! Runs a single byte through the LENGTH decoder.
+    //! @returns the same values as decodeByte.
+    Packet::Error decodeLengthByte(
+        uint8_t byte  //!< [in] Byte to parse.
+    );
+
+    //! Stores a decoded byte into the packet. The first byte is the command, followed by
+    //! the node address (if addressing is enabled) and the channel (if channels are
+    //! enabled). If the frame is addressed to another node, or is for a channel without
+    //! a packet, then the state is changed to IGNORE.
+    //! @returns Error::NOT_DONE if the byte was stored.
+    //! @returns Error::TOO_MUCH_DATA if the data doesn't fit into the packet data.
+    Packet::Error storeByte(
+        uint8_t byte  //!< [in] Decoded byte.
+    );
+
+    //! Stores a byte of the frame header. The header is held in the decoder until it
+    //! is complete, since the channel determines which packet it gets stored in.
+    void storeHeaderByte(
+        uint8_t byte  //!< [in] Decoded byte.
+    );
+
+    //! Called once the entire packet has been received to verify the CRC.
+    //! @returns Error::NONE if the packet was parsed successfully.
+    //! @returns Error::CRC if a CRC error was encountered.
+    //! @returns Error::TOO_SMALL if the packet doesn't contain a CRC.
+    Packet::Error finishPacket();
+
+    IBus const* m_bus;                  //!< Bus this packet decoder is associated wiith
+    Packet* m_defaultPacket;            //!< Packet to decode into without channels.
+    Packet* m_packet;                   //!< Packet being decoded.
+    Packet* const* m_channelPackets;    //!< Packets to decode into, indexed by channel.
+    size_t m_numChannels = 0;           //!< Number of entries in m_channelPackets.
+    State m_state = State::IDLE;        //!< State of the parser.
+    Framing m_framing = Framing::SLIP;  //!< Framing to use.
+    CrcType m_crcType = CrcType::CRC8;  //!< Type of CRC to use.
+    bool m_escape = false;              //!< Are we escaping a byte?
+    bool m_debug = false;               //!< Print packets decoded?
+    size_t m_headerIdx = 0;             //!< Number of header bytes decoded.
+    uint8_t m_rxCommand = 0;            //!< Command from the frame header.
+    uint8_t m_rxAddress = 0;            //!< Node address from the frame header.
+    bool m_addressed = false;           //!< Is node addressing enabled?
+    uint8_t m_nodeAddress = 0;          //!< Address of this node.
+    bool m_cobsZero = false;            //!< Does the current COBS block end with a zero?
+    size_t m_remaining = 0;             //!< Bytes remaining in the COBS block or LENGTH frame.
+    size_t m_discardedBytes = 0;        //!< Number of received bytes which were discarded.
+    uint32_t m_timeoutMsec = 0;         //!< Inter-byte timeout (0 means disabled).
+    uint32_t m_lastByteMsec = 0;        //!< Time that the last byte was received.
+    BusStats* m_stats = nullptr;        //!< Counters to update (may be nullptr).
 };
@@ -19,6 +19,7 @@
 #include <cstdint>
 #include <initializer_list>
 
+#include "duino_bus/BusStats.h"
 #include "duino_bus/Packet.h"
 #include "duino_util/Util.h"
 
@@ -31,6 +32,9 @@ class PacketEncoderTest_BadStateTest_Test;
 //! Code for encoding a packet into its raw byte stream.
 class PacketEncoder {
  public:
+    using Framing = Packet::Framing;  //!< Convenience alias.
+    using CrcType = Packet::CrcType;  //!< Convenience alias.
+
     //! Constructor
     PacketEncoder(
         IBus const* bus = nullptr  //!< [in] Bus this encoder is associated with.
@@ -45,10 +49,37 @@ class PacketEncoder {
     //! Encodes the next byte of the packet.
     //! @returns Error::NONE if the packet encoding has been completed.
     //! @returns Error::NOT_DONE if packet encoding is incomplete.
+    //! @returns Error::TOO_MUCH_DATA if the packet is too big for the framing.
     Packet::Error encodeByte(
         uint8_t* byte  //!< [out] Place to store the next encoded byte.
     );
 
+    //! @returns the largest number of bytes that a packet with `dataLen` bytes of data can
+    //!          be encoded as, using the current framing, CRC, addressing and channels.
+    size_t maxEncodedLength(
+        size_t dataLen  //!< [in] Number of bytes of packet data.
+    ) const {
+        size_t frameLen = dataLen + this->headerLength() + Packet::crcSize(this->m_crcType);
+        switch (this->m_framing) {
+            case Framing::SLIP:
+                // Every byte may be escaped, plus the delimiters.
+                return 2 * frameLen + 2;
+            case Framing::COBS:
+                // A code byte every 254 bytes (and at the start), plus the delimiters.
+                return frameLen + frameLen / (Packet::COBS_MAX_CODE - 1) + 3;
+            case Framing::LENGTH:
+                return frameLen + 2;
+        }
+        return frameLen;
+    }
+
+    //! Sets the counters which are updated as frames are sent (nullptr disables them).
+    void setStats(
+        BusStats* stats  //!< [mod] Counters to update.
+    ) {
+        this->m_stats = stats;
+    }
+
     //! Sets the debug flag which controls whether decoded packets get dumped.
     void setDebug(
         bool debug  //!< [in] Value to set debug flag to.
@@ -56,23 +87,121 @@ class PacketEncoder {
         this->m_debug = debug;
     }
 
+    //! Sets the framing used to encode packets.
+    void setFraming(
+        Framing framing  //!< [in] Framing to use.
+    ) {
+        this->m_framing = framing;
+        this->m_state = State::IDLE;
+    }
+
+    //! @returns the framing used to encode packets.
+    Framing getFraming() const { return this->m_framing; }
+
+    //! Sets the type of CRC added to encoded packets.
+    void setCrcType(
+        CrcType crcType  //!< [in] Type of CRC to use.
+    ) {
+        this->m_crcType = crcType;
+    }
+
+    //! @returns the type of CRC added to encoded packets.
+    CrcType getCrcType() const { return this->m_crcType; }
+
+    //! Enables or disables node addressing. When enabled, a node address byte is sent
+    //! after the command.
+    void setAddressing(
+        bool addressed,                              //!< [in] Enable node addressing?
+        uint8_t address = Packet::BROADCAST_ADDRESS  //!< [in] Address for packets without one.
+    ) {
+        this->m_addressed = addressed;
+        this->m_address = address;
+    }
+
+    //! Enables or disables logical channels. When enabled, a channel byte is sent after
+    //! the command (and node address). Packets without a channel are sent on channel 0.
+    void setChannels(
+        bool channels  //!< [in] Enable logical channels?
+    ) {
+        this->m_channels = channels;
+    }
+
  private:
     //! This allows the TEST(PacketTest, BadState) function to access m_state
     friend class ::PacketEncoderTest_BadStateTest_Test;
 
     enum class State {
-        IDLE,     //!< Haven't started parsing a packet yet.
-        COMMAND,  //!< Encoding the command.
-        DATA,     //!< Encoding the data portion of the packet.
-        ESCAPE,   //!< Encoding an escape character.
+        IDLE,    //!< Haven't started encoding a packet yet.
+        LENGTH,  //!< Encoding the high byte of the length (LENGTH framing).
+        CODE,    //!< Encoding a code byte (COBS framing).
+        DATA,    //!< Encoding the command, data and CRC.
+        ESCAPE,  //!< Encoding an escape character (SLIP framing).
+        END,     //!< Encoding the trailing delimiter (COBS framing).
     };
 
     State handleEscape(uint8_t* byte);
 
-    IBus const* m_bus;                 //!< Bus this packet encoder is associated wiith
-    Packet const* m_packet = nullptr;  //!< Packet being encoded.
-    State m_state = State::IDLE;       //!< State of the parser.
-    size_t m_encodeIdx = 0;            //!< Data byte being encoded.
-    uint8_t m_escapeChar;              //!< Character being escaped.
-    bool m_debug = false;              //!< Print packets encoded?
+    //! Encodes the next byte of the packet using the selected framing.
+    //! @returns the same values as encodeByte.
+    Packet::Error encodeFramedByte(
+        uint8_t* byte  //!< [out] Place to store the next encoded byte.
+    );
+
+    //! Encodes the next byte of the packet using SLIP framing.
+    //! @returns the same values as encodeByte.
+    Packet::Error encodeSlipByte(
+        uint8_t* byte  //!< [out] Place to store the next encoded byte.
+    );
+
+    //! Encodes the next byte of the packet using COBS framing.
+    //! @returns the same values as encodeByte.
+    Packet::Error encodeCobsByte(
+        uint8_t* byte  //!< [out] Place to store the next encoded byte.
+    );
+
+    //! Encodes the next byte of the packet using LENGTH framing.
+    //! @returns the same values as encodeByte.
+    Packet::Error encodeLengthByte(
+        uint8_t* byte  //!< [out] Place to store the next encoded byte.
+    );
+
+    //! Determines the state to use after a COBS block has been encoded.
+    //! @returns the next state.
+    State cobsBlockDone();
+
+    //! @returns the number of bytes in the frame (command, data and CRC).
+    size_t frameLength() const {
+        return this->m_packet->getTotalDataLength() + this->headerLength() +
+               Packet::crcSize(this->m_crcType);
+    }
+
+    //! @returns the number of bytes in the frame header (command, node address and channel).
+    size_t headerLength() const {
+        return 1 + (this->m_addressed ? 1 : 0) + (this->m_channels ? 1 : 0);
+    }
+
+    //! Returns a byte from the frame, which is made up of the command, the packet data,
+    //! any external segments and the CRC.
+    //! @returns the frame byte at the given index.
+    uint8_t frameByte(
+        size_t idx  //!< [in] Index of the byte to return.
+    );
+
+    IBus const* m_bus;                  //!< Bus this packet encoder is associated wiith
+    Packet const* m_packet = nullptr;   //!< Packet being encoded.
+    State m_state = State::IDLE;        //!< State of the parser.
+    Framing m_framing = Framing::SLIP;  //!< Framing to use.
+    CrcType m_crcType = CrcType::CRC8;  //!< Type of CRC to use.
+    bool m_addressed = false;           //!< Is node addressing enabled?
+    uint8_t m_address = 0;              //!< Address for packets without one.
+    bool m_channels = false;            //!< Are logical channels enabled?
+    size_t m_encodeIdx = 0;             //!< Frame byte being encoded.
+    size_t m_segmentIdx = 0;            //!< Cached external segment index.
+    size_t m_segmentStart = 0;          //!< Data offset of segment m_segmentIdx.
+    size_t m_cobsRemaining = 0;         //!< Bytes remaining in the COBS block.
+    uint8_t m_cobsCode = 0;             //!< Code byte of the current COBS block.
+    uint8_t m_escapeChar;               //!< Character being escaped.
+    bool m_debug = false;               //!< Print packets encoded?
+    BusStats* m_stats = nullptr;        //!< Counters to update (may be nullptr).
+    size_t m_encodedLen = 0;            //!< Number of bytes encoded in this frame.
 };
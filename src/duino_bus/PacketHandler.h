@@ -29,6 +29,34 @@ class IPacketHandler {
         Packet* rsp         //!< [out] Place to store response.
         ) = 0;
 
+    //! Function called to handle an incoming packet when the bus has in-place responses
+    //! enabled (see IBus::setInPlaceResponses).
+    //! Handlers which echo or transform the command (like PING) can override this, modify
+    //! `cmd` and then call `rsp->swap(*cmd)` so that the command buffer is sent as the
+    //! response without copying the data. `cmd` should only be modified if true is returned.
+    //! The default implementation just calls handlePacket.
+    //! @returns true if the packet was handled, false if it wasn't.
+    virtual bool handlePacketInPlace(
+        Packet* cmd,  //!< [mod] Packet that was received.
+        Packet* rsp   //!< [out] Place to store response.
+    ) {
+        return this->handlePacket(*cmd, rsp);
+    }
+
+    //! Function called to fill in the next packet of a streamed response (see
+    //! IBus::startStream). This is only called once the previous packet has been sent,
+    //! so the stream never gets ahead of the bus. Handlers which are waiting on something
+    //! (i.e. an acknowledgement) can return true without setting a command in `rsp`, and
+    //! will be called again the next time IBus::serviceTx is called.
+    //! @returns true if `rsp` was filled in (or the stream is paused), false if the stream
+    //!          has ended.
+    virtual bool nextStreamPacket(
+        Packet* rsp  //!< [out] Place to store the next response.
+    ) {
+        (void)rsp;
+        return false;
+    }
+
     //! Converts a command into it's string representation.
     //! @returns a pointer to literal string.
     virtual char const* as_str(
@@ -19,6 +19,7 @@
 #include <cinttypes>
 #include <vector>
 
+#include "pico/time.h"
 #include "tusb.h"
 
 #include "duino_bus/Bus.h"
@@ -41,9 +42,14 @@ class PicoUsbBus : public IBus {
     bool isDataAvailable() const override;
     bool readByte(uint8_t* byte) override;
     bool isSpaceAvailable() const override;
+    bool hasSpaceFor(size_t numBytes) const override;
     void writeByte(uint8_t byte) override;
     void flush(void) override;
     bool isConnected(void) const override;
+    uint32_t getMillis() const override { return to_ms_since_boot(get_absolute_time()); }
+    uint32_t getMicros() const override {
+        return static_cast<uint32_t>(to_us_since_boot(get_absolute_time()));
+    }
 
  private:
     friend void tud_cdc_line_state_cb(uint8_t itf, bool dtr, bool rts);
@@ -0,0 +1,135 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   ThreadPoolDispatcher.h
+ *
+ *   @brief  Handles received commands on a pool of worker threads.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#if !defined(ARDUINO)
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "duino_bus/Bus.h"
+#include "duino_bus/Dispatcher.h"
+
+//! Dispatcher for Linux hosted buses (i.e. device simulators), which runs handlers on a
+//! pool of worker threads, so that a slow handler doesn't stall the thread doing the I/O.
+//!
+//! Each worker has its own queue of commands. Commands which need to be handled in order
+//! are always queued on the same worker, and commands which don't are spread across the
+//! workers, and can be stolen by idle workers. Responses are passed back to the I/O thread
+//! through a lock-free queue, and queued on their channels by IBus::serviceTx.
+//!
+//! Since handlers run on the worker threads, they need to be thread safe (unless
+//! Ordering::BUS is used), and can't use the bus functions which only work inline (i.e.
+//! IBus::startStream and IBus::deferResponse).
+class ThreadPoolDispatcher : public IDispatcher {
+ public:
+    //! Determines which commands need to be handled in the order they were received.
+    enum class Ordering {
+        NONE,     //!< Commands can be handled in any order.
+        CHANNEL,  //!< Commands on the same channel are handled in order.
+        BUS,      //!< All commands are handled in order (but not on the I/O thread).
+    };
+
+    //! Constructor. Starts the worker threads.
+    ThreadPoolDispatcher(
+        IBus& bus,                             //!< [in] Bus whose commands are dispatched.
+        size_t maxDataLen,                     //!< [in] Maximum command/response data size.
+        size_t numThreads,                     //!< [in] Number of worker threads.
+        Ordering ordering = Ordering::CHANNEL  //!< [in] Which commands need to be in order.
+    );
+
+    //! Destructor. Stops the worker threads, and discards any unfinished commands. Any
+    //! queued responses need to have been sent first (see IBus::flushTx).
+    ~ThreadPoolDispatcher() override;
+
+    bool submit(BusChannel& channel, Packet const& cmd) override;
+
+    bool serviceResponses() override;
+
+ private:
+    //! A command which is being handled, along with the storage for its response.
+    struct Job {
+        //! Constructor.
+        explicit Job(
+            size_t maxDataLen  //!< [in] Maximum command/response data size.
+            )
+            : m_cmdData(maxDataLen),
+              m_rspData(maxDataLen),
+              m_cmd{maxDataLen, m_cmdData.data()},
+              m_rsp{maxDataLen, m_rspData.data()} {}
+
+        std::vector<uint8_t> m_cmdData;         //!< Storage for the command data.
+        std::vector<uint8_t> m_rspData;         //!< Storage for the response data.
+        Packet m_cmd;                           //!< Copy of the command.
+        Packet m_rsp;                           //!< Response to the command.
+        BusChannel const* m_channel = nullptr;  //!< Channel the command was received on.
+        bool m_isBroadcast = false;             //!< Was the command broadcast?
+        uint32_t m_startUs = 0;                 //!< When the command was received.
+        Job* m_next = nullptr;                  //!< Next job in the response queue.
+    };
+
+    //! A worker thread and its queue of jobs.
+    struct Worker {
+        std::thread m_thread;              //!< The worker thread.
+        std::mutex m_mutex;                //!< Protects m_jobs.
+        std::deque<Job*> m_jobs;           //!< Jobs queued on this worker.
+        std::atomic<size_t> m_numJobs{0};  //!< Number of entries in m_jobs.
+    };
+
+    //! Main loop for a worker thread.
+    void run(
+        size_t idx  //!< [in] Index of the worker.
+    );
+
+    //! @returns true if there's a job that the worker can take. This needs to be called
+    //!          with m_sleepMutex held.
+    bool hasWork(
+        Worker const& worker  //!< [in] Worker to check for.
+    ) const;
+
+    //! @returns the next job for a worker, taken from its own queue or stolen from
+    //!          another worker, or nullptr if there's nothing to do.
+    Job* takeJob(
+        size_t idx  //!< [in] Index of the worker.
+    );
+
+    //! Adds a job which has been handled to the response queue. This is lock-free, and
+    //! can be called from any worker.
+    void pushResponse(
+        Job* job  //!< [in] Job which has been handled.
+    );
+
+    IBus& m_bus;                                     //!< Bus whose commands are dispatched.
+    size_t m_maxDataLen;                             //!< Maximum command/response data size.
+    Ordering m_ordering;                             //!< Which commands need to be in order.
+    std::vector<std::unique_ptr<Worker>> m_workers;  //!< The worker threads.
+    size_t m_nextWorker = 0;                         //!< Where to queue the next unordered job.
+    std::mutex m_sleepMutex;                         //!< Used by idle workers to wait.
+    std::condition_variable m_wakeup;                //!< Wakes up idle workers.
+    std::atomic<size_t> m_numQueued{0};              //!< Number of jobs queued on all workers.
+    bool m_stop = false;                             //!< Tells the workers to exit.
+    std::atomic<Job*> m_responses{nullptr};          //!< Handled jobs (newest first).
+    std::deque<Job*> m_waiting;                      //!< Handled jobs waiting to be queued.
+    std::vector<Job*> m_queued;                      //!< Jobs whose responses are queued.
+};
+
+#endif  // !defined(ARDUINO)
@@ -0,0 +1,110 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   TxQueue.h
+ *
+ *   @brief  Lock-free queue of packets waiting to be written to a bus.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <atomic>
+
+#include "duino_bus/Packet.h"
+
+//! A request to write a packet, which is queued on a TxQueue. The request is owned by the
+//! caller, so queuing a packet doesn't allocate anything. The request and its packet must
+//! not be modified (or go out of scope) until isSent returns true.
+class TxRequest {
+ public:
+    //! Constructor.
+    explicit TxRequest(
+        Packet* packet = nullptr  //!< [in] Packet to write.
+        )
+        : m_packet{packet} {}
+
+    //! @returns the packet to write.
+    Packet* getPacket() const { return this->m_packet; }
+
+    //! Sets the packet to write. This can only be done while the request isn't queued.
+    void setPacket(
+        Packet* packet  //!< [in] Packet to write.
+    ) {
+        this->m_packet = packet;
+    }
+
+    //! @returns true if the packet has been written (or was never queued).
+    bool isSent() const { return !this->m_queued.load(std::memory_order_acquire); }
+
+    //! @returns the result of writing the packet. Only valid once isSent returns true.
+    Packet::Error getError() const { return this->m_err; }
+
+ private:
+    friend class IBus;
+    friend class TxQueue;
+
+    Packet* m_packet;                           //!< Packet to write.
+    TxRequest* m_next = nullptr;                //!< Next request in the queue.
+    Packet::Error m_err = Packet::Error::NONE;  //!< Result of writing the packet.
+    std::atomic<bool> m_queued{false};          //!< Is the request waiting to be written?
+};
+
+//! A lock-free multi-producer single-consumer queue of TxRequests.
+//!
+//! Producers push onto a lock-free stack, and the consumer takes the entire stack at once
+//! and reverses it, so requests are popped in the order that they were pushed. Any thread
+//! can push, but only one thread at a time can pop (see IBus::serviceTxQueue).
+class TxQueue {
+ public:
+    //! Adds a request to the queue. This can be called from any thread.
+    //! @returns true if the request was queued, false if it was already queued.
+    bool push(
+        TxRequest* request  //!< [in] Request to queue.
+    ) {
+        if (request->m_queued.exchange(true, std::memory_order_acq_rel)) {
+            return false;
+        }
+        request->m_next = this->m_incoming.load(std::memory_order_relaxed);
+        while (!this->m_incoming.compare_exchange_weak(
+            request->m_next, request, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+        return true;
+    }
+
+    //! Removes the oldest request from the queue. Only one thread can call this at a time.
+    //! @returns the request, or nullptr if the queue is empty.
+    TxRequest* pop() {
+        if (this->m_pending == nullptr) {
+            TxRequest* request = this->m_incoming.exchange(nullptr, std::memory_order_acquire);
+            while (request != nullptr) {
+                TxRequest* next = request->m_next;
+                request->m_next = this->m_pending;
+                this->m_pending = request;
+                request = next;
+            }
+        }
+        TxRequest* request = this->m_pending;
+        if (request != nullptr) {
+            this->m_pending = request->m_next;
+        }
+        return request;
+    }
+
+    //! @returns true if requests have been pushed since pop last took the incoming requests.
+    //!          This can be called from any thread.
+    bool hasIncoming() const {
+        return this->m_incoming.load(std::memory_order_acquire) != nullptr;
+    }
+
+ private:
+    std::atomic<TxRequest*> m_incoming{nullptr};  //!< Requests pushed (newest first).
+    TxRequest* m_pending = nullptr;               //!< Requests taken by pop (oldest first).
+};
@@ -17,7 +17,9 @@
 #pragma once
 
 #include <cstring>
+#include <type_traits>
 
+#include "Endian.h"
 #include "Packet.h"
 
 //! Class for unpacking variable length data from a packet.
@@ -37,6 +39,7 @@ class Unpacker {
     );
 
     //! Unpack a simple type.
+    //! Multi-byte values are unpacked from little-endian (wire) order.
     //! @tparam T type of value to unpack.
     //! @returns true if the data was unpacked successfully, false otherwise.
     template <typename T>
@@ -49,12 +52,34 @@ class Unpacker {
         if (this->m_dataRemaining < sizeof(*data)) {
             return false;
         }
-        memcpy(data, this->m_data, sizeof(*data));
+        copyWireOrder<T>(1, data, this->m_data);
         this->m_data += sizeof(*data);
         this->m_dataRemaining -= sizeof(*data);
         return true;
     }
 
+    //! Unpacks several simple types.
+    //! The total size is computed at compile time, so only a single bounds check is
+    //! performed. Nothing is unpacked if there isn't enough data for all of the values.
+    //! Multi-byte values are unpacked from little-endian (wire) order.
+    //! @tparam Ts types of the values to unpack.
+    //! @returns true if the data was unpacked successfully, false otherwise.
+    template <typename... Ts>
+    bool unpackAll(
+        Ts*... data  //!< [out] Places to store extracted data.
+    ) {
+        // Produce an error if somebody tries to pass a pointer.
+        static_assert((!std::is_pointer_v<Ts> && ...));
+
+        constexpr size_t totalSize = (sizeof(Ts) + ... + 0);
+        if (this->m_dataRemaining < totalSize) {
+            return false;
+        }
+        ((copyWireOrder<Ts>(1, data, this->m_data), this->m_data += sizeof(*data)), ...);
+        this->m_dataRemaining -= totalSize;
+        return true;
+    }
+
     //! Unpacks arbitrary data.
     //! This function will populate data to point to the data inside the packet.
     //! The caller should copy the data out, if required.
@@ -64,6 +89,60 @@ class Unpacker {
         uint8_t const** data  //!< [out] Place to store pointer to data.
     );
 
+    //! Unpacks an array of simple types, which was packed using Packer::packArray.
+    //! Nothing is unpacked if the array doesn't fit in `data` or is truncated.
+    //! @tparam T type of the array elements.
+    //! @returns true if the array was unpacked successfully, false otherwise.
+    template <typename T>
+    bool unpackArray(
+        size_t maxCount,  //!< [in] Maximum number of elements which will fit in `data`.
+        T* data,          //!< [out] Place to store the extracted elements.
+        size_t* count     //!< [out] Number of elements extracted.
+    ) {
+        static_assert(std::is_arithmetic_v<T>);
+
+        uint16_t arrayCount;
+        if (!this->peekArrayCount<T>(&arrayCount) || arrayCount > maxCount) {
+            return false;
+        }
+        copyWireOrder<T>(arrayCount, data, this->m_data + sizeof(arrayCount));
+        this->advance(sizeof(arrayCount) + arrayCount * sizeof(T));
+        *count = arrayCount;
+        return true;
+    }
+
+    //! Unpacks an array of simple types without copying it.
+    //! This function will populate data to point to the array inside the packet. This
+    //! is only possible when the host is little-endian and the array inside the packet
+    //! is suitably aligned for T, so callers should fall back to unpackArray when this
+    //! function returns false. Nothing is unpacked when false is returned.
+    //! @tparam T type of the array elements.
+    //! @returns true if the array was unpacked successfully, false otherwise.
+    template <typename T>
+    bool unpackView(
+        T const** data,  //!< [out] Place to store pointer to the array.
+        size_t* count    //!< [out] Number of elements in the array.
+    ) {
+        static_assert(std::is_arithmetic_v<T>);
+
+        if constexpr (needsByteSwap<T>) {
+            return false;
+        } else {
+            uint16_t arrayCount;
+            if (!this->peekArrayCount<T>(&arrayCount)) {
+                return false;
+            }
+            uint8_t const* arrayData = this->m_data + sizeof(arrayCount);
+            if (reinterpret_cast<uintptr_t>(arrayData) % alignof(T) != 0) {
+                return false;
+            }
+            *data = reinterpret_cast<T const*>(arrayData);
+            *count = arrayCount;
+            this->advance(sizeof(arrayCount) + arrayCount * sizeof(T));
+            return true;
+        }
+    }
+
     //! Unpacks a string.
     //! This function wil populate str to point to the string inside the packet.
     //! The caller should copy the data out, if required.
@@ -72,7 +151,41 @@ class Unpacker {
         char const** str  //!< [out] Place to store extracted string.
     );
 
+    //! Unpacks a varint, which was packed using Packer::packVarint.
+    //! @returns true if the value was unpacked successfully, false otherwise.
+    bool unpackVarint(
+        uint32_t* value  //!< [out] Place to store extracted value.
+    );
+
+    //! Unpacks a zigzag encoded varint, which was packed using Packer::packSignedVarint.
+    //! @returns true if the value was unpacked successfully, false otherwise.
+    bool unpackSignedVarint(
+        int32_t* value  //!< [out] Place to store extracted value.
+    );
+
  private:
+    //! Retrieves the element count of an array without consuming any data.
+    //! @tparam T type of the array elements.
+    //! @returns true if the entire array is present, false otherwise.
+    template <typename T>
+    bool peekArrayCount(
+        uint16_t* count  //!< [out] Number of elements in the array.
+    ) const {
+        if (this->m_dataRemaining < sizeof(*count)) {
+            return false;
+        }
+        copyWireOrder<uint16_t>(1, count, this->m_data);
+        return this->m_dataRemaining - sizeof(*count) >= *count * sizeof(T);
+    }
+
+    //! Advances past data which has been unpacked.
+    void advance(
+        size_t numBytes  //!< [in] Number of bytes to advance by.
+    ) {
+        this->m_data += numBytes;
+        this->m_dataRemaining -= numBytes;
+    }
+
     uint8_t const* m_data = nullptr;
     size_t m_dataRemaining = 0;
 };
@@ -16,9 +16,18 @@
 
 #pragma once
 
+#include "duino_bus/BulkBlob.h"
+#include "duino_bus/BulkPacketHandler.h"
 #include "duino_bus/Bus.h"
+#include "duino_bus/BusChannel.h"
+#include "duino_bus/BusStats.h"
 #include "duino_bus/CorePacketHandler.h"
+#include "duino_bus/EventPacketHandler.h"
+#include "duino_bus/HeapStats.h"
+#include "duino_bus/LatencyHistogram.h"
+#include "duino_bus/LogRing.h"
 #include "duino_bus/Packet.h"
 #include "duino_bus/PacketDecoder.h"
 #include "duino_bus/PacketEncoder.h"
 #include "duino_bus/SocketBus.h"
+#include "duino_bus/TxQueue.h"
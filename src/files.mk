@@ -1,12 +1,20 @@
 # This list of files only includes the files requried for testing
 
 SOURCES_CPP += \
+    BulkPacketHandler.cpp \
     Bus.cpp \
+    BusChannel.cpp \
+    BusLog.cpp \
     CorePacketHandler.cpp \
+    Crc.cpp \
+    EventPacketHandler.cpp \
+    HeapStats.cpp \
     LinuxSerialBus.cpp \
+    LogRing.cpp \
     Packer.cpp \
     Packet.cpp \
     PacketDecoder.cpp \
     PacketEncoder.cpp \
     SocketBus.cpp \
+    ThreadPoolDispatcher.cpp \
     Unpacker.cpp
@@ -0,0 +1,381 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   BulkPacketHandlerTest.cpp
+ *
+ *   @brief  Tests for the BulkPacketHandler class.
+ *
+ ****************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "duino_bus/Bus.h"
+#include "duino_bus/BulkPacketHandler.h"
+#include "duino_bus/Packer.h"
+#include "duino_bus/Packet.h"
+#include "duino_bus/PacketEncoder.h"
+#include "duino_bus/Unpacker.h"
+#include "duino_util/Util.h"
+
+using Command = BulkPacketHandler::Command;  //!< Convenience alias
+using Status = BulkPacketHandler::Status;    //!< Convenience alias
+
+//! Bus which the handler is attached to. Most tests call the handler directly, but bytes
+//! can also be fed through the decoder. Nothing written to the bus is kept.
+class BulkTestBus : public IBus {
+ public:
+    //! Constructor.
+    BulkTestBus(
+        Packet* cmdPacket,  //!< [in] Place to store incoming packet.
+        Packet* rspPacket   //!< [in] Place to store response packet.
+        )
+        : IBus{cmdPacket, rspPacket} {}
+
+    bool isDataAvailable() const override {
+        return this->m_decodeIdx < this->m_dataToDecode.size();
+    }
+
+    bool readByte(uint8_t* byte) override {
+        if (this->isDataAvailable()) {
+            *byte = this->m_dataToDecode[this->m_decodeIdx++];
+            return true;
+        }
+        return false;
+    }
+
+    bool isSpaceAvailable() const override { return true; }
+    void writeByte(uint8_t) override {}
+
+    //! Runs encoded bytes through the decoder.
+    //! @returns the error from the last byte.
+    Packet::Error processBytes(
+        ByteBuffer const& bytes  //!< [in] Encoded packet.
+    ) {
+        this->m_dataToDecode = bytes;
+        this->m_decodeIdx = 0;
+        Packet::Error err = Packet::Error::NOT_DONE;
+        while (err == Packet::Error::NOT_DONE && this->isDataAvailable()) {
+            err = this->processByte();
+        }
+        return err;
+    }
+
+    size_t m_decodeIdx = 0;     //!< Index of the next byte to decode.
+    ByteBuffer m_dataToDecode;  //!< Incoming data.
+};
+
+//! @returns the bytes that a packet is encoded as, using the default framing and CRC.
+static ByteBuffer encodePacket(
+    Packet* packet  //!< [in] Packet to encode.
+) {
+    PacketEncoder encoder;
+    encoder.encodeStart(packet);
+    ByteBuffer bytes;
+    uint8_t byte;
+    Packet::Error err;
+    do {
+        err = encoder.encodeByte(&byte);
+        bytes.push_back(byte);
+    } while (err == Packet::Error::NOT_DONE);
+    return bytes;
+}
+
+//! Test data used by individual tests.
+struct BulkTestData {
+    //! Constructor.
+    BulkTestData()
+        : m_cmdPacket{LEN(m_cmdData), m_cmdData},
+          m_rspPacket{LEN(m_rspData), m_rspData},
+          m_bus{&m_cmdPacket, &m_rspPacket},
+          m_blob{LEN(m_blobData), m_blobData} {
+        for (size_t i = 0; i < LEN(m_blobData); i++) {
+            this->m_blobData[i] = static_cast<uint8_t>(i);
+        }
+        this->m_handler.addBlob(1, this->m_blob);
+        this->m_bus.add(this->m_handler);
+    }
+
+    //! Sends a BULK_READ or BULK_WRITE command and checks the response.
+    void start(
+        Packet::Command::Type command,  //!< [in] BULK_READ or BULK_WRITE.
+        uint32_t offset,                //!< [in] Offset to start at.
+        uint32_t endOffset,             //!< [in] Offset to end at.
+        uint8_t window,                 //!< [in] Number of outstanding chunks.
+        Status expectedStatus,          //!< [in] Status expected in the response.
+        uint32_t expectedOffset         //!< [in] Offset expected in the response.
+    ) {
+        this->m_cmdPacket.setCommand(command);
+        this->m_cmdPacket.setData(0, nullptr);
+        Packer packer(&this->m_cmdPacket);
+        packer.packAll(static_cast<uint8_t>(1), offset, endOffset, window);
+        this->handle();
+        EXPECT_EQ(this->m_rspPacket.getCommand(), command);
+
+        Unpacker unpacker(this->m_rspPacket);
+        uint8_t status;
+        uint32_t rspOffset;
+        uint32_t rspEndOffset;
+        uint16_t chunkSize;
+        EXPECT_TRUE(unpacker.unpackAll(&status, &rspOffset, &rspEndOffset, &chunkSize));
+        EXPECT_EQ(status, static_cast<uint8_t>(expectedStatus));
+        EXPECT_EQ(rspOffset, expectedOffset);
+        EXPECT_EQ(chunkSize, 12);
+    }
+
+    //! Sends a BULK_DATA command containing blob data.
+    void sendData(
+        uint32_t offset,    //!< [in] Offset of the data.
+        size_t len,         //!< [in] Number of bytes to send.
+        uint8_t firstByte   //!< [in] Value of the first byte (the rest increment from there).
+    ) {
+        this->m_cmdPacket.setCommand(Command::BULK_DATA);
+        this->m_cmdPacket.setData(0, nullptr);
+        Packer packer(&this->m_cmdPacket);
+        packer.pack(offset);
+        for (size_t i = 0; i < len; i++) {
+            packer.pack(static_cast<uint8_t>(firstByte + i));
+        }
+        this->handle();
+    }
+
+    //! Sends a BULK_ACK command.
+    void sendAck(
+        uint32_t offset,  //!< [in] Offset being acknowledged.
+        uint8_t flags     //!< [in] Flags to send.
+    ) {
+        this->m_cmdPacket.setCommand(Command::BULK_ACK);
+        this->m_cmdPacket.setData(0, nullptr);
+        Packer packer(&this->m_cmdPacket);
+        packer.packAll(offset, flags);
+        this->handle();
+        EXPECT_EQ(this->m_rspPacket.getCommand(), 0);
+    }
+
+    //! Checks that the response is a BULK_ACK.
+    void expectAck(
+        uint32_t expectedOffset,  //!< [in] Offset expected in the ack.
+        uint8_t expectedFlags     //!< [in] Flags expected in the ack.
+    ) {
+        EXPECT_EQ(this->m_rspPacket.getCommand(), Command::BULK_ACK);
+        Unpacker unpacker(this->m_rspPacket);
+        uint32_t offset;
+        uint8_t flags;
+        EXPECT_TRUE(unpacker.unpackAll(&offset, &flags));
+        EXPECT_EQ(offset, expectedOffset);
+        EXPECT_EQ(flags, expectedFlags);
+    }
+
+    //! Gets the next packet of a read, and checks that it's a BULK_DATA packet.
+    void expectData(
+        uint32_t expectedOffset,  //!< [in] Offset expected in the data packet.
+        size_t expectedLen        //!< [in] Number of data bytes expected.
+    ) {
+        this->resetRsp();
+        EXPECT_TRUE(this->m_handler.nextStreamPacket(&this->m_rspPacket));
+        EXPECT_EQ(this->m_rspPacket.getCommand(), Command::BULK_DATA);
+        Unpacker unpacker(this->m_rspPacket);
+        uint32_t offset;
+        uint8_t const* data;
+        EXPECT_TRUE(unpacker.unpack(&offset));
+        EXPECT_EQ(offset, expectedOffset);
+        EXPECT_EQ(this->m_rspPacket.getDataLength() - sizeof(offset), expectedLen);
+        EXPECT_TRUE(unpacker.unpack(expectedLen, &data));
+        EXPECT_EQ(memcmp(data, &this->m_blobData[offset], expectedLen), 0);
+    }
+
+    //! Gets the next packet of a read, and checks that the read is waiting for an ack.
+    void expectPaused() {
+        this->resetRsp();
+        EXPECT_TRUE(this->m_handler.nextStreamPacket(&this->m_rspPacket));
+        EXPECT_EQ(this->m_rspPacket.getCommand(), 0);
+    }
+
+    //! Runs the command packet through the handler.
+    void handle() {
+        this->resetRsp();
+        EXPECT_TRUE(this->m_handler.handlePacket(this->m_cmdPacket, &this->m_rspPacket));
+    }
+
+    //! Clears the response packet.
+    void resetRsp() {
+        this->m_rspPacket.setCommand(0);
+        this->m_rspPacket.setData(0, nullptr);
+    }
+
+    uint8_t m_cmdData[17];        //!< Storage for command packet data (12 byte chunks).
+    uint8_t m_rspData[17];        //!< Storage for response packet data (12 byte chunks).
+    uint8_t m_blobData[30];       //!< Storage for the blob.
+    Packet m_cmdPacket;           //!< Command packet.
+    Packet m_rspPacket;           //!< Response packet.
+    BulkTestBus m_bus;            //!< Bus that the handler is attached to.
+    BufferBulkBlob m_blob;        //!< Blob being transferred.
+    BulkPacketHandler m_handler;  //!< Packet handler.
+};
+
+TEST(BulkPacketHandlerTest, ReadTest) {
+    BulkTestData test;
+    test.start(Command::BULK_READ, 0, UINT32_MAX, 2, Status::OK, 0);
+    EXPECT_TRUE(test.m_bus.getChannel(BusChannel::CONTROL)->isStreaming());
+
+    // Two chunks are sent, and then the window is full.
+    test.expectData(0, 12);
+    test.expectData(12, 12);
+    test.expectPaused();
+
+    test.sendAck(12, 0);
+    test.expectData(24, 6);
+    test.expectPaused();
+
+    // The stream ends once everything has been acknowledged.
+    test.sendAck(30, 0);
+    test.resetRsp();
+    EXPECT_FALSE(test.m_handler.nextStreamPacket(&test.m_rspPacket));
+}
+
+TEST(BulkPacketHandlerTest, ReadNakTest) {
+    BulkTestData test;
+    test.start(Command::BULK_READ, 0, 24, 2, Status::OK, 0);
+    test.expectData(0, 12);
+    test.expectData(12, 12);
+
+    // The host lost the first chunk, so both chunks get resent.
+    test.sendAck(0, BulkPacketHandler::ACK_NAK);
+    test.expectData(0, 12);
+    test.expectData(12, 12);
+
+    // Stale acknowledgements are ignored.
+    test.sendAck(24, 0);
+    test.sendAck(12, BulkPacketHandler::ACK_NAK);
+    test.resetRsp();
+    EXPECT_FALSE(test.m_handler.nextStreamPacket(&test.m_rspPacket));
+}
+
+TEST(BulkPacketHandlerTest, ReadResumeTest) {
+    BulkTestData test;
+    test.start(Command::BULK_READ, 20, 30, 4, Status::OK, 20);
+    test.expectData(20, 10);
+    test.sendAck(30, 0);
+    test.resetRsp();
+    EXPECT_FALSE(test.m_handler.nextStreamPacket(&test.m_rspPacket));
+
+    test.start(Command::BULK_READ, 31, 40, 4, Status::BAD_OFFSET, 31);
+}
+
+TEST(BulkPacketHandlerTest, WriteTest) {
+    BulkTestData test;
+    test.start(Command::BULK_WRITE, 0, 20, 2, Status::OK, 0);
+
+    test.sendData(0, 12, 0x80);
+    test.expectAck(12, 0);
+    test.sendData(12, 8, 0x8c);
+    test.expectAck(20, 0);
+    for (size_t i = 0; i < 20; i++) {
+        EXPECT_EQ(test.m_blobData[i], 0x80 + i);
+    }
+    EXPECT_EQ(test.m_blobData[20], 20);
+
+    // Data sent after the transfer is complete is rejected.
+    test.sendData(20, 1, 0);
+    test.expectAck(20, BulkPacketHandler::ACK_ABORT);
+}
+
+TEST(BulkPacketHandlerTest, WriteNakTest) {
+    BulkTestData test;
+    test.start(Command::BULK_WRITE, 0, 30, 4, Status::OK, 0);
+
+    // With a window of 4, every second chunk is acknowledged.
+    test.sendData(0, 12, 0x80);
+    EXPECT_EQ(test.m_rspPacket.getCommand(), 0);
+
+    // The second chunk was lost, so the third is NAK'd, and the fourth is just dropped.
+    test.sendData(24, 6, 0x98);
+    test.expectAck(12, BulkPacketHandler::ACK_NAK);
+    test.sendData(36, 1, 0);
+    EXPECT_EQ(test.m_rspPacket.getCommand(), 0);
+
+    test.sendData(12, 12, 0x8c);
+    test.expectAck(24, 0);
+
+    // Restarting the write with RESUME_OFFSET picks up where the last write got to.
+    test.start(Command::BULK_WRITE, BulkPacketHandler::RESUME_OFFSET, 30, 4, Status::OK, 24);
+    test.sendData(24, 6, 0x98);
+    test.expectAck(30, 0);
+    for (size_t i = 0; i < 30; i++) {
+        EXPECT_EQ(test.m_blobData[i], 0x80 + i);
+    }
+}
+
+TEST(BulkPacketHandlerTest, NoBlobTest) {
+    BulkTestData test;
+    test.m_cmdPacket.setCommand(Command::BULK_WRITE);
+    Packer packer(&test.m_cmdPacket);
+    packer.packAll(static_cast<uint8_t>(2), static_cast<uint32_t>(0), static_cast<uint32_t>(1),
+                   static_cast<uint8_t>(1));
+    test.handle();
+    EXPECT_EQ(test.m_rspPacket.getData()[0], static_cast<uint8_t>(Status::NO_BLOB));
+
+    // Data without an active transfer is rejected.
+    test.sendData(0, 1, 0);
+    test.expectAck(0, BulkPacketHandler::ACK_ABORT);
+}
+
+TEST(BulkPacketHandlerTest, WriteDecodedTest) {
+    BulkTestData test;
+    test.start(Command::BULK_WRITE, 0, 12, 1, Status::OK, 0);
+
+    // A full chunk, along with its CRC, fits in the command packet when it's decoded.
+    uint8_t data[BulkPacketHandler::DATA_HEADER_LEN + 12];
+    Packet chunk{LEN(data), data};
+    chunk.setCommand(Command::BULK_DATA);
+    Packer packer(&chunk);
+    packer.pack(static_cast<uint32_t>(0));
+    for (uint8_t i = 0; i < 12; i++) {
+        packer.pack(static_cast<uint8_t>(0x80 + i));
+    }
+    EXPECT_EQ(test.m_bus.processBytes(encodePacket(&chunk)), Packet::Error::NONE);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    for (size_t i = 0; i < 12; i++) {
+        EXPECT_EQ(test.m_blobData[i], 0x80 + i);
+    }
+}
+
+TEST(BulkPacketHandlerTest, TooSmallTest) {
+    BulkTestData test;
+
+    // The response packet can't hold the chunk offset and the CRC, along with any data,
+    // so the read doesn't start.
+    uint8_t rspData[BulkPacketHandler::DATA_HEADER_LEN + 1];
+    Packet rsp{LEN(rspData), rspData};
+    test.m_cmdPacket.setCommand(Command::BULK_READ);
+    test.m_cmdPacket.setData(0, nullptr);
+    Packer packer(&test.m_cmdPacket);
+    packer.packAll(static_cast<uint8_t>(1), uint32_t{0}, uint32_t{30}, uint8_t{1});
+    EXPECT_TRUE(test.m_handler.handlePacket(test.m_cmdPacket, &rsp));
+    EXPECT_FALSE(test.m_bus.getChannel(BusChannel::CONTROL)->isStreaming());
+}
+
+TEST(BulkPacketHandlerTest, CancelReadTest) {
+    BulkTestData test;
+    BusChannel* control = test.m_bus.getChannel(BusChannel::CONTROL);
+
+    // Starting a write abandons the read, without ending its stream.
+    test.start(Command::BULK_READ, 0, 24, 2, Status::OK, 0);
+    EXPECT_TRUE(control->isStreaming());
+    test.start(Command::BULK_WRITE, 0, 24, 2, Status::OK, 0);
+    EXPECT_FALSE(control->isStreaming());
+
+    // So does a read which fails to start, or which the host aborts.
+    test.start(Command::BULK_READ, 0, 24, 2, Status::OK, 0);
+    test.start(Command::BULK_READ, 31, 40, 2, Status::BAD_OFFSET, 31);
+    EXPECT_FALSE(control->isStreaming());
+    test.start(Command::BULK_READ, 0, 24, 2, Status::OK, 0);
+    test.sendAck(0, BulkPacketHandler::ACK_ABORT);
+    EXPECT_FALSE(control->isStreaming());
+}
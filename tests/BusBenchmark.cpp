@@ -0,0 +1,439 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   BusBenchmark.cpp
+ *
+ *   @brief  Benchmarks for the packet framings and bulk transfers.
+ *
+ *   The numbers depend on the machine, so this is built into its own executable,
+ *   rather than the unittest one (see bench in the Makefile).
+ *
+ ****************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "duino_bus/BulkPacketHandler.h"
+#include "duino_bus/Bus.h"
+#include "duino_bus/BusChannel.h"
+#include "duino_bus/Packer.h"
+#include "duino_bus/Packet.h"
+#include "duino_bus/PacketDecoder.h"
+#include "duino_bus/PacketEncoder.h"
+#include "duino_bus/Unpacker.h"
+#include "duino_util/Util.h"
+
+using Command = BulkPacketHandler::Command;  //!< Convenience alias
+using Status = BulkPacketHandler::Status;    //!< Convenience alias
+
+//! Number of times the packets are run through each framing.
+static constexpr int FRAMING_ITERATIONS = 2000;
+
+//! Size of the blob moved in each direction by the bulk benchmark.
+static constexpr size_t BLOB_SIZE = 256 * 1024;
+
+//! Window used by the bulk benchmark.
+static constexpr uint8_t BULK_WINDOW = 8;
+
+//! @returns the number of microseconds since `start`.
+static double usecSince(
+    std::chrono::steady_clock::time_point start  //!< [in] Time to measure from.
+) {
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::micro>(elapsed).count();
+}
+
+//! Simple pseudo-random number generator, so every run uses the same data.
+class Random {
+ public:
+    //! @returns the next pseudo-random byte.
+    uint8_t next() {
+        this->m_state = this->m_state * 1103515245 + 12345;
+        return static_cast<uint8_t>(this->m_state >> 16);
+    }
+
+ private:
+    uint32_t m_state = 1;  //!< Generator state.
+};
+
+//! Packets with the mix of payloads seen on a typical bus: short commands and
+//! acknowledgements, log messages, telemetry records and bulk data.
+class PacketMix {
+ public:
+    //! Constructor.
+    PacketMix() {
+        this->m_packets.reserve(NUM_PACKETS);
+        Random random;
+
+        // Short commands and responses, which are mostly small integers (so they contain
+        // zeros, which COBS has to encode).
+        for (int i = 0; i < 8; i++) {
+            Packet* packet = this->add(0x01);
+            Packer packer(packet);
+            packer.packAll(static_cast<uint32_t>(i * 240), uint8_t{0});
+        }
+
+        // Log messages, which are ASCII text.
+        for (int i = 0; i < 4; i++) {
+            Packet* packet = this->add(0x02);
+            Packer packer(packet);
+            packer.pack("bus: queued 12 packets on channel 3, 1200 bytes outstanding");
+        }
+
+        // Telemetry records, which are mostly one byte deltas.
+        for (int i = 0; i < 2; i++) {
+            Packet* packet = this->add(0x03);
+            Packer packer(packet);
+            for (int value = 0; value < 20; value++) {
+                packer.packSignedVarint(value % 5 - 2);
+            }
+        }
+
+        // Bulk data, which is arbitrary binary (so it contains SLIP's END and ESC bytes).
+        for (int i = 0; i < 2; i++) {
+            Packet* packet = this->add(0x04);
+            Packer packer(packet);
+            packer.pack(static_cast<uint32_t>(i * 240));
+            while (packet->getSpaceRemaining() > 0) {
+                packet->appendByte(random.next());
+            }
+        }
+    }
+
+    //! Number of packets in the mix.
+    static constexpr size_t NUM_PACKETS = 16;
+
+    //! Size of each packet.
+    static constexpr size_t PACKET_SIZE = 244;
+
+    uint8_t m_data[NUM_PACKETS][PACKET_SIZE];  //!< Storage for the packets.
+    std::vector<Packet> m_packets;             //!< The packets.
+
+ private:
+    //! Adds an empty packet to the mix.
+    //! @returns the packet.
+    Packet* add(
+        Packet::Command::Type command  //!< [in] Command of the packet.
+    ) {
+        this->m_packets.emplace_back(PACKET_SIZE, this->m_data[this->m_packets.size()]);
+        Packet* packet = &this->m_packets.back();
+        packet->setCommand(command);
+        return packet;
+    }
+};
+
+//! Times encoding and decoding the packet mix with each framing.
+static void benchmarkFraming() {
+    PacketMix mix;
+
+    struct {
+        Packet::Framing framing;  //!< Framing to measure.
+        char const* name;         //!< Name to print.
+    } framings[] = {
+        {Packet::Framing::SLIP, "SLIP"},
+        {Packet::Framing::COBS, "COBS"},
+        {Packet::Framing::LENGTH, "LENGTH"},
+    };
+
+    size_t frameLen = 0;
+    for (auto const& packet : mix.m_packets) {
+        frameLen += 1 + packet.getDataLength() + Packet::crcSize(Packet::CrcType::CRC8);
+    }
+
+    printf("Framing (%zu packets, %zu bytes before framing)\n", mix.m_packets.size(), frameLen);
+    for (auto const& entry : framings) {
+        PacketEncoder encoder;
+        encoder.setFraming(entry.framing);
+        ByteBuffer encoded;
+        auto start = std::chrono::steady_clock::now();
+        for (int iter = 0; iter < FRAMING_ITERATIONS; iter++) {
+            encoded.clear();
+            for (auto& packet : mix.m_packets) {
+                encoder.encodeStart(&packet);
+                uint8_t byte;
+                Packet::Error err;
+                do {
+                    err = encoder.encodeByte(&byte);
+                    encoded.push_back(byte);
+                } while (err == Packet::Error::NOT_DONE);
+            }
+        }
+        double encodeUsec = usecSince(start);
+
+        uint8_t rxData[PacketMix::PACKET_SIZE + 1];
+        Packet rxPacket{LEN(rxData), rxData};
+        PacketDecoder decoder{nullptr, &rxPacket};
+        decoder.setFraming(entry.framing);
+        size_t numDecoded = 0;
+        start = std::chrono::steady_clock::now();
+        for (int iter = 0; iter < FRAMING_ITERATIONS; iter++) {
+            for (uint8_t byte : encoded) {
+                if (decoder.decodeByte(byte) == Packet::Error::NONE) {
+                    numDecoded++;
+                }
+            }
+        }
+        double decodeUsec = usecSince(start);
+
+        double numBytes = static_cast<double>(frameLen) * FRAMING_ITERATIONS;
+        printf(
+            "  %-6s %zu bytes (%.1f%% overhead), encode %.1f MB/s, decode %.1f MB/s%s\n",
+            entry.name, encoded.size(), 100.0 * (encoded.size() - frameLen) / frameLen,
+            numBytes / encodeUsec, numBytes / decodeUsec,
+            numDecoded == mix.m_packets.size() * FRAMING_ITERATIONS ? "" : " (DECODE FAILED)");
+    }
+}
+
+//! One end of a loopback link. Bytes written to one end are read by the other.
+class LoopbackBus : public IBus {
+ public:
+    //! Constructor.
+    LoopbackBus(
+        Packet* cmdPacket,   //!< [in] Place to store incoming packet.
+        Packet* rspPacket,   //!< [in] Place to store response packet.
+        ByteBuffer* rxData,  //!< [mod] Bytes written by the other end.
+        ByteBuffer* txData   //!< [mod] Bytes read by the other end.
+        )
+        : IBus{cmdPacket, rspPacket}, m_rxData{rxData}, m_txData{txData} {}
+
+    bool isDataAvailable() const override { return this->m_rxIdx < this->m_rxData->size(); }
+
+    bool readByte(uint8_t* byte) override {
+        if (!this->isDataAvailable()) {
+            return false;
+        }
+        *byte = (*this->m_rxData)[this->m_rxIdx++];
+        if (this->m_rxIdx == this->m_rxData->size()) {
+            this->m_rxData->clear();
+            this->m_rxIdx = 0;
+        }
+        return true;
+    }
+
+    bool isSpaceAvailable() const override { return true; }
+
+    void writeByte(uint8_t byte) override { this->m_txData->push_back(byte); }
+
+    //! Handles all of the packets received so far, and then sends everything queued.
+    void service() {
+        while (this->isDataAvailable()) {
+            if (this->processByte() == Packet::Error::NONE) {
+                this->handlePacket();
+            }
+        }
+        this->flushTx();
+    }
+
+ private:
+    ByteBuffer* m_rxData;  //!< Bytes written by the other end.
+    ByteBuffer* m_txData;  //!< Bytes read by the other end.
+    size_t m_rxIdx = 0;    //!< Index of the next byte to read.
+};
+
+//! Handles the packets which the device sends to the host during a bulk transfer, like
+//! the host side of the protocol would.
+class HostBulkHandler : public IPacketHandler {
+ public:
+    bool handlePacket(Packet const& cmd, Packet* rsp) override {
+        Unpacker unpacker(cmd);
+        switch (cmd.getCommand()) {
+            case Command::BULK_READ:
+            case Command::BULK_WRITE: {
+                uint8_t status = 0;
+                uint32_t offset = 0;
+                uint16_t chunkSize = 0;
+                unpacker.unpackAll(&status, &offset, &this->m_endOffset, &chunkSize);
+                this->m_ok = status == to_underlying(Status::OK);
+                this->m_chunkSize = chunkSize;
+                return true;
+            }
+            case Command::BULK_DATA: {
+                // Data being read, which is acknowledged every half window.
+                uint32_t offset = 0;
+                unpacker.unpack(&offset);
+                size_t len = cmd.getDataLength() - BulkPacketHandler::DATA_HEADER_LEN;
+                if (offset != this->m_offset || offset + len > this->m_data.size()) {
+                    this->m_ok = false;
+                    return true;
+                }
+                memcpy(
+                    &this->m_data[offset], &cmd.getData()[BulkPacketHandler::DATA_HEADER_LEN],
+                    len);
+                this->m_offset += static_cast<uint32_t>(len);
+                if (++this->m_numUnacked >= BULK_WINDOW / 2 ||
+                    this->m_offset == this->m_endOffset) {
+                    rsp->setCommand(Command::BULK_ACK);
+                    Packer packer(rsp);
+                    packer.packAll(this->m_offset, uint8_t{0});
+                    this->m_numUnacked = 0;
+                }
+                return true;
+            }
+            case Command::BULK_ACK: {
+                // Acknowledgement of data being written.
+                uint8_t flags = 0;
+                unpacker.unpackAll(&this->m_offset, &flags);
+                this->m_ok = this->m_ok && flags == 0;
+                return true;
+            }
+            case Packet::Command::STREAM_END:
+                this->m_done = true;
+                return true;
+        }
+        return false;
+    }
+
+    char const* as_str(Packet::Command::Type) const override { return "???"; }
+
+    //! Gets ready for the next transfer.
+    void reset() {
+        this->m_ok = true;
+        this->m_done = false;
+        this->m_offset = 0;
+        this->m_endOffset = 0;
+        this->m_chunkSize = 0;
+        this->m_numUnacked = 0;
+    }
+
+    //! Data read from the device.
+    std::vector<uint8_t> m_data = std::vector<uint8_t>(BLOB_SIZE);
+
+    bool m_ok = true;          //!< false if the transfer went wrong.
+    bool m_done = false;       //!< true once a read has ended.
+    uint32_t m_offset = 0;     //!< Offset read up to, or acknowledged by the device.
+    uint32_t m_endOffset = 0;  //!< Offset where the transfer ends.
+    size_t m_chunkSize = 0;    //!< Maximum number of data bytes in each BULK_DATA packet.
+    size_t m_numUnacked = 0;   //!< Chunks read since the last acknowledgement.
+};
+
+//! Times moving a blob in each direction between a host and a device bus, connected by
+//! a loopback link, with the bulk handlers on the BULK channel.
+static void benchmarkBulk() {
+    std::vector<uint8_t> blobData(BLOB_SIZE);
+    Random random;
+    for (auto& byte : blobData) {
+        byte = random.next();
+    }
+    BufferBulkBlob blob{BLOB_SIZE, blobData.data()};
+
+    ByteBuffer toDevice;
+    ByteBuffer toHost;
+
+    uint8_t deviceCmdData[256];
+    uint8_t deviceRspData[256];
+    uint8_t deviceBulkCmdData[256];
+    uint8_t deviceBulkRspData[256];
+    Packet deviceCmd{LEN(deviceCmdData), deviceCmdData};
+    Packet deviceRsp{LEN(deviceRspData), deviceRspData};
+    Packet deviceBulkCmd{LEN(deviceBulkCmdData), deviceBulkCmdData};
+    Packet deviceBulkRsp{LEN(deviceBulkRspData), deviceBulkRspData};
+    Packet* deviceQueue[2];
+    LoopbackBus device{&deviceCmd, &deviceRsp, &toDevice, &toHost};
+    BusChannel deviceBulk{
+        BusChannel::BULK, &deviceBulkCmd, &deviceBulkRsp, LEN(deviceQueue), deviceQueue};
+    BulkPacketHandler deviceHandler;
+    deviceHandler.addBlob(1, blob);
+    deviceBulk.add(deviceHandler);
+    device.addChannel(deviceBulk);
+
+    uint8_t hostCmdData[256];
+    uint8_t hostRspData[256];
+    uint8_t hostBulkCmdData[256];
+    uint8_t hostBulkRspData[256];
+    uint8_t hostData[256];
+    Packet hostCmd{LEN(hostCmdData), hostCmdData};
+    Packet hostRsp{LEN(hostRspData), hostRspData};
+    Packet hostBulkCmd{LEN(hostBulkCmdData), hostBulkCmdData};
+    Packet hostBulkRsp{LEN(hostBulkRspData), hostBulkRspData};
+    Packet hostPacket{LEN(hostData), hostData};
+    Packet* hostQueue[2];
+    LoopbackBus host{&hostCmd, &hostRsp, &toHost, &toDevice};
+    BusChannel hostBulk{BusChannel::BULK, &hostBulkCmd, &hostBulkRsp, LEN(hostQueue), hostQueue};
+    HostBulkHandler hostHandler;
+    hostBulk.add(hostHandler);
+    host.addChannel(hostBulk);
+
+    // Sends a command from the host on the BULK channel.
+    auto sendCommand = [&](Packet::Command::Type command, auto... args) {
+        hostPacket.setCommand(command);
+        hostPacket.setData(0, nullptr);
+        hostPacket.setChannel(BusChannel::BULK);
+        Packer packer(&hostPacket);
+        packer.packAll(args...);
+        host.writePacket(&hostPacket);
+    };
+
+    // Services both ends of the link.
+    // @returns false if neither end has anything left to send.
+    auto service = [&]() {
+        device.service();
+        host.service();
+        return !toDevice.empty() || !toHost.empty();
+    };
+
+    // Read: the device streams the chunks, and the host acknowledges them.
+    hostHandler.reset();
+    auto start = std::chrono::steady_clock::now();
+    sendCommand(Command::BULK_READ, uint8_t{1}, uint32_t{0}, uint32_t{BLOB_SIZE}, BULK_WINDOW);
+    while (hostHandler.m_ok && !hostHandler.m_done) {
+        if (!service() && !hostHandler.m_done) {
+            // The transfer stalled.
+            hostHandler.m_ok = false;
+        }
+    }
+    double readUsec = usecSince(start);
+    bool readOk = hostHandler.m_ok && hostHandler.m_data == blobData;
+
+    // Write: the host sends the chunks, and the device acknowledges them.
+    std::vector<uint8_t> source(blobData.rbegin(), blobData.rend());
+    hostHandler.reset();
+    start = std::chrono::steady_clock::now();
+    sendCommand(Command::BULK_WRITE, uint8_t{1}, uint32_t{0}, uint32_t{BLOB_SIZE}, BULK_WINDOW);
+    service();
+    uint32_t sendOffset = 0;
+    while (hostHandler.m_ok && hostHandler.m_chunkSize > 0 && hostHandler.m_offset < BLOB_SIZE) {
+        while (sendOffset < BLOB_SIZE &&
+               sendOffset - hostHandler.m_offset < BULK_WINDOW * hostHandler.m_chunkSize) {
+            size_t len = std::min<size_t>(hostHandler.m_chunkSize, BLOB_SIZE - sendOffset);
+            hostPacket.setCommand(Command::BULK_DATA);
+            hostPacket.setData(0, nullptr);
+            hostPacket.setChannel(BusChannel::BULK);
+            Packer packer(&hostPacket);
+            packer.pack(sendOffset);
+            hostPacket.appendData(len, &source[sendOffset]);
+            host.writePacket(&hostPacket);
+            sendOffset += static_cast<uint32_t>(len);
+        }
+        uint32_t ackOffset = hostHandler.m_offset;
+        if (!service() && hostHandler.m_offset == ackOffset) {
+            // The transfer stalled.
+            hostHandler.m_ok = false;
+        }
+    }
+    double writeUsec = usecSince(start);
+    bool writeOk = hostHandler.m_ok && blobData == source;
+
+    printf("BULK (%zu bytes each way over a loopback bus, window %d)\n", BLOB_SIZE, BULK_WINDOW);
+    printf(
+        "  read  %.0f usec (%.1f MB/s)%s\n", readUsec, BLOB_SIZE / readUsec,
+        readOk ? "" : " (FAILED)");
+    printf(
+        "  write %.0f usec (%.1f MB/s)%s\n", writeUsec, BLOB_SIZE / writeUsec,
+        writeOk ? "" : " (FAILED)");
+}
+
+int main() {
+    benchmarkFraming();
+    benchmarkBulk();
+    return 0;
+}
@@ -0,0 +1,351 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   BusLogTest.cpp
+ *
+ *   @brief  Tests for the BusLog class.
+ *
+ ****************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "duino_bus/Bus.h"
+#include "duino_bus/BusLog.h"
+#include "duino_bus/CorePacketHandler.h"
+#include "duino_util/AsciiHex.h"
+#include "duino_util/Util.h"
+
+using Level = Log::Level;  //!< Convenience alias
+
+//! Bus which records the bytes written to it.
+class LogTestBus : public IBus {
+ public:
+    //! Constructor.
+    LogTestBus(
+        Packet* cmdPacket,  //!< [in] Place to store incoming packet.
+        Packet* rspPacket,  //!< [in] Place to store response packet.
+        Packet* logPacket   //!< [in] Place to store log packet.
+        )
+        : IBus{cmdPacket, rspPacket, logPacket} {
+        // Leaving out the CRC makes the expected output easier to read.
+        this->setCrcType(Packet::CrcType::NONE);
+    }
+
+    bool isDataAvailable() const override { return false; }
+    bool readByte(uint8_t*) override { return false; }
+    bool isSpaceAvailable() const override { return this->m_spaceAvailable; }
+    bool hasSpaceFor(size_t numBytes) const override {
+        return this->m_spaceAvailable && numBytes <= this->m_txSpace;
+    }
+    void writeByte(uint8_t byte) override { this->m_encodedData.push_back(byte); }
+    uint32_t getMillis() const override { return this->m_millis; }
+
+    ByteBuffer m_encodedData;      //!< Place to store outgoing data.
+    uint32_t m_millis = 0;         //!< Simulated millisecond counter.
+    bool m_spaceAvailable = true;  //!< Simulated transmit space.
+    size_t m_txSpace = SIZE_MAX;   //!< Simulated number of bytes of transmit space.
+};
+
+//! BusLog which can be called directly, rather than through the global logger.
+class TestBusLog : public BusLog {
+ public:
+    using BusLog::BusLog;
+    using BusLog::log;
+
+    //! Logs a message.
+    void log(
+        Level level,      //!< [in] Logging level associated with this message.
+        const char* fmt,  //!< [in] Printf style format string
+        ...               //!< [in] Arguments associated with format string.
+    ) {
+        va_list args;
+        va_start(args, fmt);
+        this->do_log(level, fmt, args);
+        va_end(args);
+    }
+};
+
+//! Test data used by individual tests.
+struct BusLogTestData {
+    //! Constructor.
+    BusLogTestData()
+        : m_cmdPacket{LEN(m_cmdData), m_cmdData},
+          m_rspPacket{LEN(m_rspData), m_rspData},
+          m_logPacket{LEN(m_logData), m_logData},
+          m_batchPacket{LEN(m_batchData), m_batchData},
+          m_bus{&m_cmdPacket, &m_rspPacket, &m_logPacket},
+          m_log{&m_bus} {}
+
+    uint8_t m_cmdData[16];  //!< Storage for command packet data.
+    uint8_t m_rspData[16];  //!< Storage for response packet data.
+    uint8_t m_logData[64];    //!< Storage for log packet data.
+    uint8_t m_batchData[16];  //!< Storage for batch packet data.
+    Packet m_cmdPacket;       //!< Command packet.
+    Packet m_rspPacket;       //!< Response packet.
+    Packet m_logPacket;       //!< Log packet.
+    Packet m_batchPacket;     //!< Batch packet.
+    LogTestBus m_bus;         //!< Bus that messages are logged on.
+    TestBusLog m_log;         //!< Logger being tested.
+};
+
+TEST(BusLogTest, TextTest) {
+    BusLogTestData test;
+
+    test.m_log.log(Level::INFO, "y=%u", 5);
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 03 04 04 79 3d 35 00 c0"));
+}
+
+TEST(BusLogTest, ChannelTest) {
+    BusLogTestData test;
+    Packet* logQueue[1];
+    BusChannel logChannel{BusChannel::LOG, nullptr, nullptr, LEN(logQueue), logQueue};
+    test.m_bus.addChannel(logChannel);
+
+    // Messages are queued on the log channel, and the next message waits for the log
+    // packet to be sent.
+    test.m_log.log(Level::INFO, "y=%u", 5);
+    EXPECT_TRUE(logChannel.isQueued(&test.m_logPacket));
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 0);
+    test.m_log.log(Level::INFO, "y=%u", 6);
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 03 02 04 04 79 3d 35 00 c0"));
+    test.m_bus.m_encodedData.clear();
+    test.m_bus.flushTx();
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 03 02 04 04 79 3d 36 00 c0"));
+}
+
+TEST(BusLogTest, BinaryTest) {
+    BusLogTestData test;
+    char const* formats[1];
+    test.m_log.setFormatTable(LEN(formats), formats);
+
+    // The format string is sent the first time that it's used.
+    test.m_log.log(Level::INFO, "x=%d s=%s", -2, "ab");
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 08 00 00 0a 78 3d 25 64 20 73 3d 25 73 00 c0 "
+                         "c0 09 04 00 00 fe ff ff ff 03 61 62 00 c0"));
+
+    test.m_bus.m_encodedData.clear();
+    test.m_log.log(Level::ERROR, "x=%d s=%s", 1, "");
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 09 02 00 00 01 00 00 00 01 00 c0"));
+
+    // Once the table is full, messages are sent as text.
+    test.m_bus.m_encodedData.clear();
+    test.m_log.log(Level::INFO, "y=%u", 5);
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 03 04 04 79 3d 35 00 c0"));
+
+    // After a reset, the format string is sent again.
+    test.m_bus.m_encodedData.clear();
+    test.m_log.resetFormats();
+    test.m_log.log(Level::INFO, "y=%u", 5);
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 08 00 00 05 79 3d 25 75 00 c0 c0 09 04 00 00 05 00 00 00 c0"));
+}
+
+TEST(BusLogTest, BinaryArgsTest) {
+    BusLogTestData test;
+    char const* formats[1];
+    test.m_log.setFormatTable(LEN(formats), formats);
+
+    test.m_log.log(Level::INFO, "%*d%lld%c%.2s%f", 2, 5, 7LL, 'A', "xyz", 1.5);
+    test.m_bus.m_encodedData.erase(
+        test.m_bus.m_encodedData.begin(), test.m_bus.m_encodedData.begin() + 22);
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 09 04 00 00 02 00 00 00 05 00 00 00 07 00 00 00 00 00 00 00 "
+                         "41 03 78 79 00 00 00 00 00 00 00 f8 3f c0"));
+}
+
+TEST(BusLogTest, BinaryFallbackTest) {
+    BusLogTestData test;
+    char const* formats[1];
+    test.m_log.setFormatTable(LEN(formats), formats);
+
+    // long double can't be sent in binary.
+    test.m_log.log(Level::INFO, "%Lg", 1.0L);
+    ByteBuffer const& data = test.m_bus.m_encodedData;
+    ByteBuffer format(data.begin(), data.begin() + 10);
+    EXPECT_EQ(format, AsciiHexToBinary("c0 08 00 00 04 25 4c 67 00 c0"));
+    ByteBuffer text(data.begin() + 10, data.begin() + 13);
+    EXPECT_EQ(text, AsciiHexToBinary("c0 03 04"));
+}
+
+TEST(BusLogTest, BatchDeadlineTest) {
+    BusLogTestData test;
+    test.m_log.setBatchPacket(&test.m_batchPacket, 10);
+
+    test.m_bus.m_millis = 5;
+    test.m_log.log(Level::INFO, "a");
+    test.m_log.service();
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 0);
+
+    test.m_bus.m_millis = 14;
+    test.m_log.service();
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 0);
+
+    test.m_bus.m_millis = 15;
+    test.m_log.service();
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 0a 00 00 00 00 03 04 04 02 61 00 c0"));
+
+    // Nothing is sent once the batch is empty.
+    test.m_bus.m_encodedData.clear();
+    test.m_bus.m_millis = 100;
+    test.m_log.service();
+    EXPECT_TRUE(test.m_log.flush());
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 0);
+}
+
+TEST(BusLogTest, BatchFullTest) {
+    BusLogTestData test;
+    test.m_log.setBatchPacket(&test.m_batchPacket, 1000);
+
+    // Two messages fill the batch, so the third one causes it to be sent.
+    test.m_log.log(Level::INFO, "a");
+    test.m_log.log(Level::INFO, "b");
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 0);
+    test.m_log.log(Level::INFO, "c");
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 0a 00 00 00 00 03 04 04 02 61 00 03 04 04 02 62 00 c0"));
+
+    test.m_bus.m_encodedData.clear();
+    EXPECT_TRUE(test.m_log.flush());
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 0a 00 00 00 00 03 04 04 02 63 00 c0"));
+}
+
+TEST(BusLogTest, BatchDroppedTest) {
+    BusLogTestData test;
+    test.m_log.setBatchPacket(&test.m_batchPacket, 1000);
+
+    // When the transport is backed up, messages which don't fit are dropped.
+    test.m_bus.m_spaceAvailable = false;
+    test.m_log.log(Level::INFO, "a");
+    test.m_log.log(Level::INFO, "b");
+    test.m_log.log(Level::INFO, "c");
+    EXPECT_FALSE(test.m_log.flush());
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 0);
+    EXPECT_EQ(test.m_log.getNumDropped(), 1);
+
+    test.m_bus.m_spaceAvailable = true;
+    EXPECT_TRUE(test.m_log.flush());
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 0a 01 00 00 00 03 04 04 02 61 00 03 04 04 02 62 00 c0"));
+}
+
+TEST(BusLogTest, BatchSpaceTest) {
+    BusLogTestData test;
+    test.m_log.setBatchPacket(&test.m_batchPacket, 1000);
+
+    // The batch isn't sent unless there's room for all of it, with every byte escaped
+    // (2 * 17 + 2 bytes).
+    test.m_log.log(Level::INFO, "a");
+    test.m_log.log(Level::INFO, "b");
+    test.m_bus.m_txSpace = 35;
+    EXPECT_FALSE(test.m_log.flush());
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 0);
+
+    test.m_bus.m_txSpace = 36;
+    EXPECT_TRUE(test.m_log.flush());
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 0a 00 00 00 00 03 04 04 02 61 00 03 04 04 02 62 00 c0"));
+}
+
+TEST(BusLogTest, RingTest) {
+    BusLogTestData test;
+    uint32_t buffer[64];
+    LogRing ring{LEN(buffer), buffer};
+    char const* formats[1];
+    test.m_log.setLogRing(&ring);
+
+    // Messages are only sent when the ring is serviced.
+    test.m_bus.m_millis = 0x1234;
+    test.m_log.log(Level::INFO, "a");
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 0);
+    test.m_log.service();
+    EXPECT_EQ(
+        test.m_bus.m_encodedData, AsciiHexToBinary("c0 0b 34 12 00 00 03 04 02 61 00 c0"));
+
+    // Binary messages get their format ID when they're sent. Once the table is full, the
+    // format string is sent instead.
+    test.m_bus.m_encodedData.clear();
+    test.m_log.setFormatTable(LEN(formats), formats);
+    test.m_log.log(Level::INFO, "%d", 7);
+    test.m_log.log(Level::INFO, "x");
+    test.m_log.service();
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 08 00 00 03 25 64 00 c0 "
+                         "c0 0b 34 12 00 00 09 04 00 00 07 00 00 00 c0 "
+                         "c0 0b 34 12 00 00 03 04 02 78 00 c0"));
+}
+
+TEST(BusLogTest, LevelMaskTest) {
+    BusLogTestData test;
+
+    test.m_log.setLevelMask(0, BusLog::levelMask(Level::ERROR));
+    test.m_log.setLevelMask(3, BusLog::levelMask(Level::DEBUG));
+    EXPECT_TRUE(test.m_log.isEnabled(0, Level::ERROR));
+    EXPECT_FALSE(test.m_log.isEnabled(0, Level::INFO));
+    EXPECT_FALSE(test.m_log.isEnabled(BusLog::MAX_MODULES, Level::ERROR));
+
+    // Messages for disabled levels aren't sent.
+    test.m_log.log(Level::INFO, "a");
+    test.m_log.log(3, Level::INFO, "b");
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 0);
+
+    test.m_log.log(Level::ERROR, "a");
+    test.m_log.log(3, Level::DEBUG, "b");
+    test.m_log.log(1, Level::DEBUG, "c");
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 03 02 02 61 00 c0 c0 03 05 02 62 00 c0 c0 03 05 02 63 00 c0"));
+}
+
+TEST(BusLogTest, LogConfigTest) {
+    BusLogTestData test;
+    test.m_bus.add(test.m_log);
+
+    // Disable everything, and then enable INFO and lower for module 2.
+    uint8_t data[] = {BusLog::ALL_MODULES, 0x00, 0x02, 0x1f};
+    test.m_cmdPacket.setCommand(CorePacketHandler::Command::LOG_CONFIG);
+    test.m_cmdPacket.setData(LEN(data), data);
+    EXPECT_TRUE(test.m_bus.dispatchPacket(test.m_cmdPacket, &test.m_rspPacket));
+    EXPECT_EQ(test.m_rspPacket.getCommand(), CorePacketHandler::Command::LOG_CONFIG);
+    ASSERT_EQ(test.m_rspPacket.getDataLength(), BusLog::MAX_MODULES);
+    EXPECT_EQ(test.m_rspPacket.getData()[0], 0x00);
+    EXPECT_EQ(test.m_rspPacket.getData()[2], 0x1f);
+    EXPECT_EQ(test.m_log.getLevelMask(2), 0x1f);
+    EXPECT_FALSE(test.m_log.isEnabled(0, Level::ERROR));
+    EXPECT_TRUE(test.m_log.isEnabled(2, Level::INFO));
+    EXPECT_FALSE(test.m_log.isEnabled(2, Level::DEBUG));
+}
+
+TEST(BusLogTest, LogConfigSmallResponseTest) {
+    BusLogTestData test;
+
+    // Only the masks for the modules which fit are returned.
+    uint8_t data[] = {0x01, 0x03};
+    test.m_cmdPacket.setCommand(CorePacketHandler::Command::LOG_CONFIG);
+    test.m_cmdPacket.setData(LEN(data), data);
+    uint8_t rspData[4];
+    Packet rsp{LEN(rspData), rspData};
+    EXPECT_TRUE(test.m_log.handlePacket(test.m_cmdPacket, &rsp));
+    EXPECT_EQ(rsp.getCommand(), CorePacketHandler::Command::LOG_CONFIG);
+    ASSERT_EQ(rsp.getDataLength(), LEN(rspData));
+    EXPECT_EQ(rsp.getData()[1], 0x03);
+    EXPECT_EQ(test.m_log.getLevelMask(1), 0x03);
+}
@@ -16,7 +16,11 @@
 
 #include <gtest/gtest.h>
 
+#include <thread>
+
 #include "duino_bus/Bus.h"
+#include "duino_bus/BusChannel.h"
+#include "duino_bus/CorePacketHandler.h"
 #include "duino_bus/Packet.h"
 #include "duino_bus/PacketDecoder.h"
 #include "duino_bus/PacketHandler.h"
@@ -51,13 +55,28 @@ class TestBus : public IBus {
         return false;
     }
 
-    bool isSpaceAvailable() const { return true; }
+    bool isSpaceAvailable() const { return this->m_spaceAvailable; }
+
+    bool hasSpaceFor(size_t numBytes) const override {
+        return this->m_spaceAvailable && numBytes <= this->m_txSpace;
+    }
 
-    void writeByte(uint8_t byte) { this->m_encodedData.push_back(byte); }
+    void writeByte(uint8_t byte) {
+        this->m_encodedData.push_back(byte);
+        this->m_micros += 10;
+    }
 
-    size_t m_decodeIdx = 0;     //!< Index used to iterate thrugh the incoming data.
-    ByteBuffer m_dataToDecode;  //!< Represents incoming data.
-    ByteBuffer m_encodedData;   //!< Place to store outgoing data.
+    uint32_t getMillis() const override { return this->m_millis; }
+
+    uint32_t getMicros() const override { return this->m_micros; }
+
+    size_t m_decodeIdx = 0;        //!< Index used to iterate thrugh the incoming data.
+    ByteBuffer m_dataToDecode;     //!< Represents incoming data.
+    ByteBuffer m_encodedData;      //!< Place to store outgoing data.
+    uint32_t m_millis = 0;         //!< Simulated millisecond counter.
+    uint32_t m_micros = 0;         //!< Simulated microsecond counter (each byte takes 10).
+    bool m_spaceAvailable = true;  //!< Simulated transmit space.
+    size_t m_txSpace = SIZE_MAX;   //!< Simulated number of bytes of transmit space.
 };
 
 //! Test handler for testing handler functions.
@@ -78,10 +97,73 @@ class TestHandler : public IPacketHandler {
         return false;
     }
 
+    bool handlePacketInPlace(Packet* cmd, Packet* rsp) override {
+        if (cmd->getCommand() == 0x01) {
+            // Increment each data byte and send the command packet back as the response.
+            for (size_t i = 0; i < cmd->getDataLength(); i++) {
+                cmd->getData()[i]++;
+            }
+            rsp->swap(*cmd);
+            return true;
+        }
+        return this->handlePacket(*cmd, rsp);
+    }
+
+    char const* as_str(Packet::Command::Type cmd) const override {
+        (void)cmd;
+        return "???";
+    }
+};
+
+//! Test handler which streams a response containing `count` packets of one byte each.
+class StreamHandler : public IPacketHandler {
+ public:
+    bool handlePacket(Packet const& cmd, Packet* rsp) override {
+        if (cmd.getCommand() != 0x10) {
+            return false;
+        }
+        this->m_count = cmd.getData()[0];
+        this->m_next = 0;
+        this->m_bus->startStream(*this, cmd);
+        return this->nextStreamPacket(rsp);
+    }
+
+    bool nextStreamPacket(Packet* rsp) override {
+        if (this->m_next >= this->m_count) {
+            return false;
+        }
+        rsp->setCommand(0x10);
+        rsp->appendByte(this->m_next++);
+        return true;
+    }
+
     char const* as_str(Packet::Command::Type cmd) const override {
         (void)cmd;
         return "???";
     }
+
+    uint8_t m_count = 0;  //!< Number of packets to stream.
+    uint8_t m_next = 0;   //!< Value of the next packet to stream.
+};
+
+//! Test handler which defers its response.
+class DeferHandler : public IPacketHandler {
+ public:
+    bool handlePacket(Packet const& cmd, Packet* rsp) override {
+        (void)rsp;
+        if (cmd.getCommand() != 0x11) {
+            return false;
+        }
+        this->m_token = this->m_bus->deferResponse(cmd);
+        return true;
+    }
+
+    char const* as_str(Packet::Command::Type cmd) const override {
+        (void)cmd;
+        return "???";
+    }
+
+    IBus::PendingToken m_token = IBus::INVALID_PENDING_TOKEN;  //!< Last token returned.
 };
 
 //! Helper class used for tests.
@@ -127,6 +209,31 @@ class BusTest {
     TestBus m_bus;                //!< Bus for testing.
 };
 
+//! Bulk channel, with its own command and response packets, used by the channel tests.
+class BulkChannel {
+ public:
+    //! Constructor. Adds `handler` to the channel, and the channel to `bus`.
+    BulkChannel(
+        IBus* bus,               //!< [mod] Bus to add the channel to.
+        IPacketHandler& handler  //!< [in] Handler for commands received on the channel.
+        )
+        : m_cmdPacket{LEN(this->m_cmdPacketData), this->m_cmdPacketData},
+          m_rspPacket{LEN(this->m_rspPacketData), this->m_rspPacketData},
+          m_channel{
+              BusChannel::BULK, &this->m_cmdPacket, &this->m_rspPacket, LEN(this->m_queue),
+              this->m_queue} {
+        this->m_channel.add(handler);
+        bus->addChannel(this->m_channel);
+    }
+
+    uint8_t m_cmdPacketData[15];  //!< Storage for command packets.
+    uint8_t m_rspPacketData[15];  //!< Storage for response packets.
+    Packet m_cmdPacket;           //!< Command packet.
+    Packet m_rspPacket;           //!< Response packet.
+    Packet* m_queue[2];           //!< Storage for the channel's queue.
+    BusChannel m_channel;         //!< The channel.
+};
+
 TEST(BusTest, ProcessByteTest) {
     auto test = BusTest();
 
@@ -140,11 +247,99 @@ TEST(BusTest, ProcessByteNoDataTest) {
     EXPECT_EQ(test.m_bus.processByte(), Error::NOT_DONE);
 }
 
+TEST(BusTest, ProcessByteTimeoutTest) {
+    auto test = BusTest();
+
+    test.m_bus.setRxTimeout(10);
+    test.processBytes("c0 01", Error::NOT_DONE);
+    test.m_bus.m_millis = 9;
+    EXPECT_EQ(test.m_bus.processByte(), Error::NOT_DONE);
+    test.m_bus.m_millis = 10;
+    EXPECT_EQ(test.m_bus.processByte(), Error::TIMEOUT);
+    EXPECT_EQ(test.m_bus.processByte(), Error::NOT_DONE);
+}
+
 TEST(BusTest, WritePacketTest) {
     auto test = BusTest();
     test.writePacket("c0 01 07 c0");
 }
 
+TEST(BusTest, SendPacketTest) {
+    auto test = BusTest();
+    test.processBytes("c0 01 07 c0", Error::NONE);
+
+    // Nothing else is writing, so the packet is written immediately.
+    TxRequest request{&test.m_cmdPacket};
+    EXPECT_TRUE(test.m_bus.sendPacket(request));
+    EXPECT_TRUE(request.isSent());
+    EXPECT_EQ(request.getError(), Error::NONE);
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 01 07 c0"));
+}
+
+TEST(BusTest, ConcurrentWritePacketTest) {
+    auto test = BusTest();
+    constexpr size_t NUM_THREADS = 4;
+    constexpr size_t NUM_PACKETS = 500;
+
+    // Each thread writes its own packet repeatedly, so any interleaving of the bytes
+    // shows up as a frame that doesn't match.
+    auto writer = [&test](uint8_t id) {
+        uint8_t data[] = {id, id, id, id};
+        Packet packet{LEN(data), data};
+        packet.setCommand(id);
+        packet.getWriteData(LEN(data));
+        for (size_t i = 0; i < NUM_PACKETS; i++) {
+            EXPECT_EQ(test.m_bus.writePacket(&packet), Error::NONE);
+        }
+    };
+    std::thread threads[NUM_THREADS];
+    for (size_t idx = 0; idx < NUM_THREADS; idx++) {
+        threads[idx] = std::thread{writer, static_cast<uint8_t>(idx + 1)};
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    ByteBuffer const& data = test.m_bus.m_encodedData;
+    ASSERT_EQ(data.size(), NUM_THREADS * NUM_PACKETS * 8);
+    size_t count[NUM_THREADS] = {};
+    for (size_t offset = 0; offset < data.size(); offset += 8) {
+        uint8_t id = data[offset + 1];
+        ASSERT_GE(id, 1);
+        ASSERT_LE(id, NUM_THREADS);
+        for (size_t i = 2; i < 6; i++) {
+            ASSERT_EQ(data[offset + i], id);
+        }
+        ASSERT_EQ(data[offset], 0xc0);
+        ASSERT_EQ(data[offset + 7], 0xc0);
+        count[id - 1]++;
+    }
+    for (size_t idx = 0; idx < NUM_THREADS; idx++) {
+        EXPECT_EQ(count[idx], NUM_PACKETS);
+    }
+}
+
+//! Bus which writes a packet from writeByte, like a bus which logs to itself would.
+class ReentrantBus : public TestBus {
+ public:
+    using TestBus::TestBus;
+
+    void writeByte(uint8_t byte) override {
+        TestBus::writeByte(byte);
+        this->writePacket(this->m_rspPacket);
+    }
+};
+
+TEST(BusDeathTest, ReentrantWritePacketTest) {
+    uint8_t data[4];
+    Packet packet{LEN(data), data};
+    packet.setCommand(0x01);
+    ReentrantBus bus{&packet, &packet};
+
+    // Rather than waiting for itself forever, the nested write asserts.
+    ASSERT_DEATH({ bus.writePacket(&packet); }, "Assertion `g_encodingBus != this'");
+}
+
 TEST(BusTest, HandlerWithResponseTest) {
     auto test = BusTest();
     auto testHandler = TestHandler();
@@ -157,6 +352,78 @@ TEST(BusTest, HandlerWithResponseTest) {
     EXPECT_EQ(test.m_rspPacket.getCrc(), 0x1b);
 }
 
+TEST(BusTest, HandlerInPlaceResponseTest) {
+    auto test = BusTest();
+    auto testHandler = TestHandler();
+    test.m_bus.add(testHandler);
+    test.m_bus.setInPlaceResponses(true);
+    test.processBytes("c0 01 02 1b c0", Error::NONE);
+    EXPECT_EQ(test.m_bus.handlePacket(), true);
+    EXPECT_EQ(test.m_rspPacket.getCommand(), 1);
+    EXPECT_EQ(test.m_rspPacket.getDataLength(), 1);
+    EXPECT_EQ(test.m_rspPacket.getData()[0], 3);
+    EXPECT_EQ(test.m_rspPacket.getData(), test.m_cmdPacketData);
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 01 03 1c c0"));
+
+    // The command packet now uses the response storage, and should still decode.
+    test.m_bus.m_decodeIdx = 0;
+    test.processBytes("c0 02 03 23 c0", Error::NONE);
+    EXPECT_EQ(test.m_cmdPacket.getData(), test.m_rspPacketData);
+    EXPECT_EQ(test.m_bus.handlePacket(), true);
+}
+
+TEST(BusTest, HandlerInPlaceSizeTest) {
+    auto test = BusTest();
+    auto testHandler = TestHandler();
+
+    // The buffers can't be swapped when the packets are different sizes, so the handler
+    // responds normally, and the command packet keeps its own buffer.
+    uint8_t rspData[8];
+    Packet rsp{LEN(rspData), rspData};
+    TestBus bus{&test.m_cmdPacket, &rsp};
+    bus.add(testHandler);
+    bus.setInPlaceResponses(true);
+    bus.m_dataToDecode = AsciiHexToBinary("c0 01 02 1b c0 c0 02 03 23 c0");
+    for (size_t i = 0; i < 4; i++) {
+        EXPECT_EQ(bus.processByte(), Error::NOT_DONE);
+    }
+    EXPECT_EQ(bus.processByte(), Error::NONE);
+    EXPECT_TRUE(bus.handlePacket());
+    EXPECT_EQ(rsp.getData(), rspData);
+    EXPECT_EQ(bus.m_encodedData, AsciiHexToBinary("c0 01 02 1b c0"));
+
+    // The next command is still decoded into the command packet's own buffer.
+    for (size_t i = 0; i < 4; i++) {
+        EXPECT_EQ(bus.processByte(), Error::NOT_DONE);
+    }
+    EXPECT_EQ(bus.processByte(), Error::NONE);
+    EXPECT_EQ(test.m_cmdPacket.getData(), test.m_cmdPacketData);
+    EXPECT_EQ(test.m_cmdPacket.getMaxDataLength(), LEN(test.m_cmdPacketData));
+    EXPECT_TRUE(bus.handlePacket());
+}
+
+TEST(BusTest, HandlerAddressedResponseTest) {
+    auto test = BusTest();
+    auto testHandler = TestHandler();
+    test.m_bus.add(testHandler);
+
+    test.m_bus.setNodeAddress(0x05);
+    test.processBytes("c0 01 05 02 24 c0", Error::NONE);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 01 05 02 24 c0"));
+}
+
+TEST(BusTest, HandlerBroadcastTest) {
+    auto test = BusTest();
+    auto testHandler = TestHandler();
+    test.m_bus.add(testHandler);
+
+    test.m_bus.setNodeAddress(0x05);
+    test.processBytes("c0 01 ff 02 b2 c0", Error::NONE);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 0);
+}
+
 TEST(BusTest, HandlerNoResponseTest) {
     auto test = BusTest();
     auto testHandler = TestHandler();
@@ -173,3 +440,370 @@ TEST(BusTest, HandlerUnhandledTest) {
     test.processBytes("c0 03 04 23 c0", Error::NONE);
     EXPECT_EQ(test.m_bus.handlePacket(), false);
 }
+
+TEST(BusTest, HandlerLatencyTest) {
+    auto test = BusTest();
+    auto testHandler = TestHandler();
+    test.m_bus.add(testHandler);
+    IBus::CommandLatency latency[2];
+    test.m_bus.setLatencyTable(LEN(latency), latency);
+
+    // The latency includes writing the response, which takes 10 usec per byte.
+    test.processBytes("c0 01 02 1b c0", Error::NONE);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    test.m_bus.m_decodeIdx = 0;
+    test.processBytes("c0 02 03 23 c0", Error::NONE);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    test.m_bus.m_decodeIdx = 0;
+    test.processBytes("c0 03 04 23 c0", Error::NONE);
+    EXPECT_FALSE(test.m_bus.handlePacket());
+
+    LatencyHistogram* histogram = test.m_bus.getLatency(0x01);
+    ASSERT_NE(histogram, nullptr);
+    EXPECT_EQ(histogram->getCount(), 1);
+    EXPECT_EQ(histogram->getMax(), 50);
+    EXPECT_EQ(histogram->getBucket(LatencyHistogram::bucketIndex(50)), 1);
+    histogram = test.m_bus.getLatency(0x02);
+    ASSERT_NE(histogram, nullptr);
+    EXPECT_EQ(histogram->getMax(), 0);
+
+    // Unhandled commands aren't recorded.
+    EXPECT_EQ(test.m_bus.getLatency(0x03), nullptr);
+}
+
+TEST(BusTest, ChannelLatencyTest) {
+    auto test = BusTest();
+    auto bulkHandler = TestHandler();
+    IBus::CommandLatency latency[2];
+    test.m_bus.setLatencyTable(LEN(latency), latency);
+
+    BulkChannel bulk{&test.m_bus, bulkHandler};
+
+    // The latency isn't recorded until the queued response has been written, so it
+    // includes the time spent in the queue.
+    test.processBytes("c0 01 01 02 70 c0", Error::NONE);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    EXPECT_EQ(test.m_bus.getLatency(0x01), nullptr);
+    test.m_bus.m_micros += 100;
+    EXPECT_TRUE(test.m_bus.serviceTx());
+    LatencyHistogram* histogram = test.m_bus.getLatency(0x01);
+    ASSERT_NE(histogram, nullptr);
+    EXPECT_EQ(histogram->getCount(), 1);
+    EXPECT_EQ(histogram->getMax(), 160);
+}
+
+TEST(BusTest, ChannelHandlerTest) {
+    auto test = BusTest();
+    auto controlHandler = TestHandler();
+    auto bulkHandler = TestHandler();
+    test.m_bus.add(controlHandler);
+
+    BulkChannel bulk{&test.m_bus, bulkHandler};
+    EXPECT_EQ(test.m_bus.getChannel(BusChannel::BULK), &bulk.m_channel);
+    EXPECT_EQ(test.m_bus.getChannel(BusChannel::LOG), nullptr);
+
+    // The response is queued, rather than being written immediately.
+    test.processBytes("c0 01 01 02 70 c0", Error::NONE);
+    EXPECT_EQ(bulk.m_cmdPacket.getDataLength(), 1);
+    EXPECT_EQ(test.m_cmdPacket.getDataLength(), 0);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 0);
+    EXPECT_TRUE(bulk.m_channel.isQueued(&bulk.m_rspPacket));
+    EXPECT_TRUE(test.m_bus.serviceTx());
+    EXPECT_FALSE(test.m_bus.serviceTx());
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 01 01 02 70 c0"));
+
+    // Commands on the control channel still use the packets passed to the bus.
+    test.m_bus.m_encodedData.clear();
+    test.m_bus.m_decodeIdx = 0;
+    test.processBytes("c0 01 00 02 65 c0", Error::NONE);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    test.m_bus.flushTx();
+    EXPECT_EQ(test.m_rspPacket.getChannel(), BusChannel::CONTROL);
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 01 00 02 65 c0"));
+}
+
+TEST(BusTest, ChannelPendingResponseTest) {
+    auto test = BusTest();
+    auto bulkHandler = TestHandler();
+
+    BulkChannel bulk{&test.m_bus, bulkHandler};
+
+    // The previous response is sent before the response packet is reused.
+    test.processBytes("c0 01 01 02 70 c0", Error::NONE);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    test.m_bus.m_decodeIdx = 0;
+    test.processBytes("c0 01 01 03 77 c0", Error::NONE);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 01 01 02 70 c0"));
+    test.m_bus.flushTx();
+    EXPECT_EQ(
+        test.m_bus.m_encodedData, AsciiHexToBinary("c0 01 01 02 70 c0 c0 01 01 03 77 c0"));
+}
+
+TEST(BusTest, ChannelSchedulerTest) {
+    auto test = BusTest();
+
+    uint8_t data[4][2];
+    Packet packets[4] = {
+        {LEN(data[0]), data[0]},
+        {LEN(data[1]), data[1]},
+        {LEN(data[2]), data[2]},
+        {LEN(data[3]), data[3]},
+    };
+    Command::Type commands[] = {0x11, 0x12, 0x13, 0x21};
+    uint8_t byte = 0x55;
+    for (size_t i = 0; i < LEN(packets); i++) {
+        packets[i].setCommand(commands[i]);
+        packets[i].setData(1, &byte);
+    }
+
+    // Each bulk packet costs 2 bytes of credit, so the bulk channel can send 2 packets
+    // per round.
+    Packet* bulkQueue[3];
+    BusChannel bulk{BusChannel::BULK, nullptr, nullptr, LEN(bulkQueue), bulkQueue, 4};
+    test.m_bus.addChannel(bulk);
+    EXPECT_TRUE(bulk.queuePacket(&packets[0]));
+    EXPECT_TRUE(bulk.queuePacket(&packets[1]));
+    EXPECT_TRUE(bulk.queuePacket(&packets[2]));
+    EXPECT_FALSE(bulk.queuePacket(&packets[3]));
+
+    ByteBuffer sent;
+    EXPECT_TRUE(test.m_bus.serviceTx());
+    sent.push_back(test.m_bus.m_encodedData[1]);
+
+    // Even though the bulk channel has a backlog, the control packet gets sent once the
+    // bulk channel has used up its credit.
+    EXPECT_TRUE(test.m_bus.getChannel(BusChannel::CONTROL)->queuePacket(&packets[3]));
+    for (int i = 0; i < 3; i++) {
+        test.m_bus.m_encodedData.clear();
+        EXPECT_TRUE(test.m_bus.serviceTx());
+        sent.push_back(test.m_bus.m_encodedData[1]);
+    }
+    EXPECT_FALSE(test.m_bus.serviceTx());
+    EXPECT_EQ(sent, AsciiHexToBinary("11 12 21 13"));
+}
+
+TEST(BusTest, QueuePacketTest) {
+    auto test = BusTest();
+
+    uint8_t data[1] = {0x55};
+    Packet packet{LEN(data), data};
+    packet.setCommand(0x21);
+    packet.setData(1, data);
+
+    // Without logical channels, queued packets are written immediately.
+    EXPECT_TRUE(test.m_bus.canQueuePacket(BusChannel::LOG, &packet));
+    EXPECT_TRUE(test.m_bus.queuePacket(BusChannel::LOG, &packet));
+    EXPECT_FALSE(test.m_bus.isQueued(&packet));
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 5);
+
+    Packet* logQueue[1];
+    BusChannel log{BusChannel::LOG, nullptr, nullptr, LEN(logQueue), logQueue};
+    test.m_bus.addChannel(log);
+    test.m_bus.m_encodedData.clear();
+    packet.setChannel(BusChannel::LOG);
+    EXPECT_TRUE(test.m_bus.queuePacket(BusChannel::LOG, &packet));
+    EXPECT_TRUE(log.isQueued(&packet));
+    EXPECT_TRUE(test.m_bus.isQueued(&packet));
+    EXPECT_FALSE(test.m_bus.canQueuePacket(BusChannel::LOG, &packet));
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 0);
+
+    // Packets for channels that the bus doesn't have go on the control channel.
+    uint8_t evtData[1] = {0x66};
+    Packet evt{LEN(evtData), evtData};
+    evt.setCommand(0x22);
+    evt.setData(1, evtData);
+    EXPECT_TRUE(test.m_bus.canQueuePacket(BusChannel::EVENT, &evt));
+    EXPECT_TRUE(test.m_bus.queuePacket(BusChannel::EVENT, &evt));
+    EXPECT_TRUE(test.m_bus.getChannel(BusChannel::CONTROL)->isQueued(&evt));
+
+    test.m_bus.flushTx();
+    EXPECT_FALSE(test.m_bus.isQueued(&packet));
+    EXPECT_FALSE(test.m_bus.isQueued(&evt));
+    EXPECT_TRUE(test.m_bus.canQueuePacket(BusChannel::LOG, &packet));
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 12);
+}
+
+TEST(BusTest, BatchTest) {
+    auto test = BusTest();
+    auto testHandler = TestHandler();
+    auto coreHandler = CorePacketHandler();
+    test.m_bus.add(testHandler);
+    test.m_bus.add(coreHandler);
+
+    // An echo, a command with no response, an unhandled command, and a nested BATCH.
+    ByteBuffer batch = AsciiHexToBinary("01 02 aa bb 02 00 03 01 cc 06 00");
+    test.m_cmdPacket.setCommand(CorePacketHandler::Command::BATCH);
+    test.m_cmdPacket.setData(batch.size(), batch.data());
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    EXPECT_EQ(test.m_rspPacket.getCommand(), CorePacketHandler::Command::BATCH);
+    ByteBuffer rsp(
+        test.m_rspPacket.getData(),
+        test.m_rspPacket.getData() + test.m_rspPacket.getDataLength());
+    EXPECT_EQ(rsp, AsciiHexToBinary("01 02 aa bb 00 00 00 00 00 00"));
+}
+
+TEST(BusTest, BatchTruncatedTest) {
+    auto test = BusTest();
+    auto coreHandler = CorePacketHandler();
+    test.m_bus.add(coreHandler);
+
+    // The second sub-command claims to have more data than the BATCH contains.
+    ByteBuffer batch = AsciiHexToBinary("01 00 01 05 aa");
+    test.m_cmdPacket.setCommand(CorePacketHandler::Command::BATCH);
+    test.m_cmdPacket.setData(batch.size(), batch.data());
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    ByteBuffer rsp(
+        test.m_rspPacket.getData(),
+        test.m_rspPacket.getData() + test.m_rspPacket.getDataLength());
+    EXPECT_EQ(rsp, AsciiHexToBinary("01 00"));
+}
+
+TEST(BusTest, BatchOverflowTest) {
+    auto test = BusTest();
+    auto testHandler = TestHandler();
+    auto coreHandler = CorePacketHandler();
+    test.m_bus.add(testHandler);
+    test.m_bus.add(coreHandler);
+
+    // The HEAP_INFO response doesn't fit in what's left of the BATCH response, so it's
+    // replaced by an empty record, and the last echo isn't run.
+    ByteBuffer batch = AsciiHexToBinary("01 01 aa 05 00 01 01 bb");
+    test.m_cmdPacket.setCommand(CorePacketHandler::Command::BATCH);
+    test.m_cmdPacket.setData(batch.size(), batch.data());
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    ByteBuffer rsp(
+        test.m_rspPacket.getData(),
+        test.m_rspPacket.getData() + test.m_rspPacket.getDataLength());
+    EXPECT_EQ(rsp, AsciiHexToBinary("01 01 aa 00 00"));
+}
+
+TEST(BusTest, StreamTest) {
+    auto test = BusTest();
+    auto streamHandler = StreamHandler();
+    test.m_bus.add(streamHandler);
+
+    // The first packet is sent by handlePacket, and the rest by serviceTx.
+    test.processBytes("c0 10 03 5e c0", Error::NONE);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 10 00 57 c0"));
+    EXPECT_TRUE(test.m_bus.getChannel(BusChannel::CONTROL)->isStreaming());
+
+    // Nothing is produced while the bus is full.
+    test.m_bus.m_encodedData.clear();
+    test.m_bus.m_spaceAvailable = false;
+    EXPECT_FALSE(test.m_bus.serviceTx());
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 0);
+
+    // There needs to be room for the largest packet that the response packet can hold
+    // (a SLIP frame of 17 bytes, with every byte escaped, is 36 bytes).
+    test.m_bus.m_spaceAvailable = true;
+    test.m_bus.m_txSpace = 35;
+    EXPECT_FALSE(test.m_bus.serviceTx());
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 0);
+
+    test.m_bus.m_txSpace = 36;
+    EXPECT_TRUE(test.m_bus.serviceTx());
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 10 01 50 c0"));
+    test.m_bus.flushTx();
+    EXPECT_FALSE(test.m_bus.getChannel(BusChannel::CONTROL)->isStreaming());
+
+    // The stream ends with a STREAM_END packet containing the command and the count.
+    test.m_bus.m_encodedData.clear();
+    test.m_bus.m_decodeIdx = 0;
+    test.processBytes("c0 10 03 5e c0", Error::NONE);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    test.m_bus.flushTx();
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 10 00 57 c0 c0 10 01 50 c0 c0 10 02 59 c0 "
+                         "c0 07 10 03 00 00 00 d7 c0"));
+}
+
+TEST(BusTest, ChannelStreamTest) {
+    auto test = BusTest();
+    auto streamHandler = StreamHandler();
+
+    BulkChannel bulk{&test.m_bus, streamHandler};
+
+    // Streamed packets are queued on the channel that the command arrived on.
+    test.processBytes("c0 10 01 02 b9 c0", Error::NONE);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    EXPECT_TRUE(bulk.m_channel.isStreaming());
+    EXPECT_FALSE(test.m_bus.getChannel(BusChannel::CONTROL)->isStreaming());
+    test.m_bus.flushTx();
+    EXPECT_FALSE(bulk.m_channel.isStreaming());
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 10 01 00 b7 c0 c0 10 01 01 b0 c0 c0 07 01 10 02 00 00 00 24 c0"));
+}
+
+TEST(BusTest, DeferTest) {
+    auto test = BusTest();
+    auto deferHandler = DeferHandler();
+    auto testHandler = TestHandler();
+    test.m_bus.add(deferHandler);
+    test.m_bus.add(testHandler);
+
+    // Without a pending table, responses can't be deferred.
+    test.processBytes("c0 11 77 c0", Error::NONE);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    EXPECT_EQ(deferHandler.m_token, IBus::INVALID_PENDING_TOKEN);
+
+    IBus::PendingResponse pending[1];
+    test.m_bus.setPendingTable(LEN(pending), pending);
+    test.m_bus.m_decodeIdx = 0;
+    test.processBytes("c0 11 77 c0", Error::NONE);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    EXPECT_NE(deferHandler.m_token, IBus::INVALID_PENDING_TOKEN);
+    EXPECT_EQ(test.m_bus.getNumPending(), 1);
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 0);
+    IBus::PendingToken token = deferHandler.m_token;
+
+    // Other commands are handled while the response is pending.
+    test.m_bus.m_decodeIdx = 0;
+    test.processBytes("c0 01 07 c0", Error::NONE);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 01 07 c0"));
+
+    // The table is full.
+    test.m_bus.m_decodeIdx = 0;
+    test.processBytes("c0 11 77 c0", Error::NONE);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    EXPECT_EQ(deferHandler.m_token, IBus::INVALID_PENDING_TOKEN);
+
+    // The response is sent with the deferred command.
+    test.m_bus.m_encodedData.clear();
+    uint8_t rspData[4];
+    Packet rsp{LEN(rspData), rspData};
+    rsp.appendByte(0x42);
+    EXPECT_TRUE(test.m_bus.completeResponse(token, &rsp));
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 11 42 8b c0"));
+    EXPECT_EQ(test.m_bus.getNumPending(), 0);
+    EXPECT_FALSE(test.m_bus.completeResponse(token, &rsp));
+}
+
+TEST(BusTest, DeferLatencyTest) {
+    auto test = BusTest();
+    auto deferHandler = DeferHandler();
+    test.m_bus.add(deferHandler);
+    IBus::PendingResponse pending[1];
+    test.m_bus.setPendingTable(LEN(pending), pending);
+    IBus::CommandLatency latency[2];
+    test.m_bus.setLatencyTable(LEN(latency), latency);
+
+    // Deferred responses are timed until the response has been written.
+    test.processBytes("c0 11 77 c0", Error::NONE);
+    EXPECT_TRUE(test.m_bus.handlePacket());
+    EXPECT_EQ(test.m_bus.getLatency(0x11), nullptr);
+    test.m_bus.m_micros += 1000;
+    uint8_t rspData[4];
+    Packet rsp{LEN(rspData), rspData};
+    rsp.appendByte(0x42);
+    EXPECT_TRUE(test.m_bus.completeResponse(deferHandler.m_token, &rsp));
+    LatencyHistogram* histogram = test.m_bus.getLatency(0x11);
+    ASSERT_NE(histogram, nullptr);
+    EXPECT_EQ(histogram->getCount(), 1);
+    EXPECT_EQ(histogram->getMax(), 1050);
+}
@@ -16,8 +16,11 @@
 
 #include <gtest/gtest.h>
 
+#include "duino_bus/Bus.h"
 #include "duino_bus/CorePacketHandler.h"
 #include "duino_bus/Packet.h"
+#include "duino_bus/Unpacker.h"
+#include "duino_util/Util.h"
 
 using Command = Packet::Command;  //!< Convenience alias
 using Error = Packet::Error;      //!< Convenience alias
@@ -34,6 +37,53 @@ struct TestData {
     CorePacketHandler m_handler;  //!< Packet handler.
 };
 
+//! Bus which event packets are sent on. The tests look at the event packet directly, so
+//! nothing is recorded.
+class TelemetryTestBus : public IBus {
+ public:
+    //! Constructor.
+    TelemetryTestBus(
+        Packet* cmdPacket,  //!< [in] Place to store incoming packet.
+        Packet* rspPacket,  //!< [in] Place to store response packet.
+        Packet* evtPacket   //!< [in] Place to store event packet.
+        )
+        : IBus{cmdPacket, rspPacket, nullptr, evtPacket} {}
+
+    bool isDataAvailable() const override { return false; }
+    bool readByte(uint8_t*) override { return false; }
+    bool isSpaceAvailable() const override { return true; }
+    void writeByte(uint8_t) override {}
+    uint32_t getMillis() const override { return this->m_millis; }
+
+    uint32_t m_millis = 1000;  //!< Simulated millisecond counter.
+};
+
+//! Checks the header of a TELEMETRY record, and unpacks its values.
+static void unpackTelemetry(
+    Packet const& evt,      //!< [in] TELEMETRY record.
+    uint8_t expectedFlags,  //!< [in] Flags expected in the record.
+    int32_t* values         //!< [out] Values from the record.
+) {
+    EXPECT_EQ(evt.getCommand(), CorePacketHandler::Command::TELEMETRY);
+    Unpacker unpacker(evt);
+    uint8_t flags;
+    uint8_t numValues;
+    EXPECT_TRUE(unpacker.unpackAll(&flags, &numValues));
+    EXPECT_EQ(flags, expectedFlags);
+    EXPECT_EQ(numValues, CorePacketHandler::NUM_TELEMETRY_VALUES);
+    for (size_t idx = 0; idx < CorePacketHandler::NUM_TELEMETRY_VALUES; idx++) {
+        if (expectedFlags & CorePacketHandler::TELEMETRY_KEYFRAME) {
+            uint32_t value;
+            EXPECT_TRUE(unpacker.unpackVarint(&value));
+            values[idx] = static_cast<int32_t>(value);
+        } else {
+            EXPECT_TRUE(unpacker.unpackSignedVarint(&values[idx]));
+        }
+    }
+    uint8_t extra;
+    EXPECT_FALSE(unpacker.unpack(&extra));
+}
+
 TEST(CorePacketHandlerTest, PingTest) {
     TestData test;
     test.m_cmdPacket.setCommand(CorePacketHandler::Command::PING);
@@ -42,6 +92,46 @@ TEST(CorePacketHandlerTest, PingTest) {
     EXPECT_EQ(test.m_rspPacket.getDataLength(), 0);
 }
 
+TEST(CorePacketHandlerTest, PingInPlaceTest) {
+    TestData test;
+    uint8_t data[] = {0x11, 0x22, 0x33};
+    test.m_cmdPacket.setCommand(CorePacketHandler::Command::PING);
+    test.m_cmdPacket.setData(LEN(data), data);
+    EXPECT_EQ(test.m_handler.handlePacketInPlace(&test.m_cmdPacket, &test.m_rspPacket), true);
+    EXPECT_EQ(test.m_rspPacket.getCommand(), CorePacketHandler::Command::PING);
+    EXPECT_EQ(test.m_rspPacket.getDataLength(), LEN(data));
+    // The response should be using the command packet's storage.
+    EXPECT_EQ(test.m_rspPacket.getData(), test.m_cmdData);
+    EXPECT_EQ(test.m_cmdPacket.getData(), test.m_rspData);
+}
+
+TEST(CorePacketHandlerTest, HeapInfoTest) {
+    uint8_t rspData[32];
+    TestData test;
+    Packet rsp(LEN(rspData), rspData);
+    test.m_cmdPacket.setCommand(CorePacketHandler::Command::HEAP_INFO);
+    EXPECT_EQ(test.m_handler.handlePacket(test.m_cmdPacket, &rsp), true);
+    EXPECT_EQ(rsp.getCommand(), CorePacketHandler::Command::HEAP_INFO);
+    EXPECT_EQ(rsp.getDataLength(), CorePacketHandler::NUM_HEAP_INFO_VALUES * sizeof(uint32_t));
+
+    // The allocator is always in use by the time the test runs, and the high water mark
+    // can't be less than what's allocated now. The largest free block is reported as the
+    // number of free bytes.
+    uint32_t info[CorePacketHandler::NUM_HEAP_INFO_VALUES];
+    memcpy(info, rsp.getData(), sizeof(info));
+    EXPECT_GT(info[0], 0);
+    EXPECT_EQ(info[3], info[2]);
+    EXPECT_GE(info[5], info[1]);
+}
+
+TEST(CorePacketHandlerTest, StackInfoTest) {
+    TestData test;
+    test.m_cmdPacket.setCommand(CorePacketHandler::Command::STACK_INFO);
+    EXPECT_EQ(test.m_handler.handlePacket(test.m_cmdPacket, &test.m_rspPacket), true);
+    EXPECT_EQ(test.m_rspPacket.getCommand(), CorePacketHandler::Command::STACK_INFO);
+    EXPECT_EQ(test.m_rspPacket.getDataLength(), 3 * sizeof(uint32_t));
+}
+
 TEST(CorePacketHandlerTest, UnhandledTest) {
     TestData test;
     test.m_cmdPacket.setCommand(0xff);
@@ -54,3 +144,221 @@ TEST(CorePacketHandlerTest, as_strTest) {
     EXPECT_STREQ(handler.as_str(CorePacketHandler::Command::PING), "PING");
     EXPECT_STREQ(handler.as_str(0), "???");
 }
+
+
+TEST(CorePacketHandlerTest, TelemetryTest) {
+    TestData test;
+    uint8_t evtData[128];
+    Packet evt{LEN(evtData), evtData};
+    TelemetryTestBus bus{&test.m_cmdPacket, &test.m_rspPacket, &evt};
+    bus.add(test.m_handler);
+    Packet* evtQueue[1];
+    BusChannel events{BusChannel::EVENT, nullptr, nullptr, LEN(evtQueue), evtQueue};
+    bus.addChannel(events);
+    int32_t values[CorePacketHandler::NUM_TELEMETRY_VALUES];
+    // The BusStats counters in the record (stats[10] is the unhandled counter).
+    int32_t* stats =
+        &values[CorePacketHandler::NUM_HEAP_INFO_VALUES + CorePacketHandler::NUM_STACK_INFO_VALUES];
+
+    // Nothing is sent until the host subscribes.
+    EXPECT_FALSE(test.m_handler.service());
+
+    uint16_t intervalMs = 100;
+    test.m_cmdPacket.setCommand(CorePacketHandler::Command::TELEMETRY_SUBSCRIBE);
+    test.m_cmdPacket.setData(sizeof(intervalMs), &intervalMs);
+    EXPECT_TRUE(test.m_handler.handlePacket(test.m_cmdPacket, &test.m_rspPacket));
+    EXPECT_EQ(test.m_rspPacket.getCommand(), CorePacketHandler::Command::TELEMETRY_SUBSCRIBE);
+    EXPECT_EQ(test.m_rspPacket.getDataLength(), 3);
+    EXPECT_EQ(test.m_rspPacket.getData()[2], CorePacketHandler::NUM_TELEMETRY_VALUES);
+
+    // The first record is a keyframe, and is sent right away.
+    EXPECT_TRUE(test.m_handler.service());
+    EXPECT_EQ(evt.getChannel(), BusChannel::EVENT);
+    unpackTelemetry(evt, CorePacketHandler::TELEMETRY_KEYFRAME, values);
+    EXPECT_EQ(stats[10], 0);
+    EXPECT_FALSE(test.m_handler.service());
+
+    // Nothing is sent while the previous record is still queued.
+    bus.m_millis += intervalMs;
+    EXPECT_FALSE(test.m_handler.service());
+    bus.m_millis -= intervalMs;
+
+    // The bus counters are sent as changes, like the other values.
+    bus.getStats().unhandled.add(2);
+
+    // The records which follow are deltas. The stack values are always 0 on the host.
+    for (size_t count = 1; count < CorePacketHandler::TELEMETRY_KEYFRAME_INTERVAL; count++) {
+        bus.flushTx();
+        bus.m_millis += intervalMs;
+        EXPECT_TRUE(test.m_handler.service());
+        unpackTelemetry(evt, 0, values);
+        EXPECT_EQ(values[CorePacketHandler::NUM_HEAP_INFO_VALUES], 0);
+        EXPECT_EQ(stats[10], count == 1 ? 2 : 0);
+    }
+    bus.flushTx();
+    bus.m_millis += intervalMs;
+    EXPECT_TRUE(test.m_handler.service());
+    unpackTelemetry(evt, CorePacketHandler::TELEMETRY_KEYFRAME, values);
+    EXPECT_EQ(stats[10], 2);
+
+    // An interval of 0 stops the records.
+    intervalMs = 0;
+    test.m_cmdPacket.setData(sizeof(intervalMs), &intervalMs);
+    EXPECT_TRUE(test.m_handler.handlePacket(test.m_cmdPacket, &test.m_rspPacket));
+    bus.m_millis += 1000;
+    EXPECT_FALSE(test.m_handler.service());
+}
+
+TEST(CorePacketHandlerTest, TelemetryNoEventChannelTest) {
+    TestData test;
+    uint8_t evtData[128];
+    Packet evt{LEN(evtData), evtData};
+    TelemetryTestBus bus{&test.m_cmdPacket, &test.m_rspPacket, &evt};
+    bus.add(test.m_handler);
+
+    uint16_t intervalMs = 100;
+    test.m_cmdPacket.setCommand(CorePacketHandler::Command::TELEMETRY_SUBSCRIBE);
+    test.m_cmdPacket.setData(sizeof(intervalMs), &intervalMs);
+    EXPECT_TRUE(test.m_handler.handlePacket(test.m_cmdPacket, &test.m_rspPacket));
+
+    // Without an EVENT channel, records are skipped rather than written synchronously.
+    EXPECT_FALSE(test.m_handler.service());
+    EXPECT_EQ(evt.getDataLength(), 0);
+    EXPECT_EQ(bus.getStats().txFrames.get(), 0);
+}
+
+TEST(CorePacketHandlerTest, StatsTest) {
+    TestData test;
+    TelemetryTestBus bus{&test.m_cmdPacket, &test.m_rspPacket, nullptr};
+    bus.add(test.m_handler);
+    bus.getStats().rxFrames.add(3);
+    bus.getStats().txBytes.add(300);
+    bus.getStats().unhandled.add();
+
+    uint8_t flags = CorePacketHandler::STATS_RESET;
+    test.m_cmdPacket.setCommand(CorePacketHandler::Command::STATS);
+    test.m_cmdPacket.setData(sizeof(flags), &flags);
+    EXPECT_TRUE(test.m_handler.handlePacket(test.m_cmdPacket, &test.m_rspPacket));
+    EXPECT_EQ(test.m_rspPacket.getCommand(), CorePacketHandler::Command::STATS);
+
+    Unpacker unpacker(test.m_rspPacket);
+    uint8_t numCounters;
+    EXPECT_TRUE(unpacker.unpack(&numCounters));
+    EXPECT_EQ(numCounters, BusStats::NUM_COUNTERS);
+    uint32_t values[BusStats::NUM_COUNTERS];
+    for (auto& value : values) {
+        EXPECT_TRUE(unpacker.unpackVarint(&value));
+    }
+    EXPECT_EQ(values[0], 3);
+    EXPECT_EQ(values[8], 300);
+    EXPECT_EQ(values[10], 1);
+    EXPECT_EQ(test.m_rspPacket.getDataLength(), 1 + BusStats::NUM_COUNTERS + 1);
+
+    // The counters were reset after they were read.
+    EXPECT_EQ(bus.getStats().rxFrames.get(), 0);
+    EXPECT_EQ(bus.getStats().txBytes.get(), 0);
+}
+
+TEST(CorePacketHandlerTest, StatsSmallResponseTest) {
+    TestData test;
+    TelemetryTestBus bus{&test.m_cmdPacket, &test.m_rspPacket, nullptr};
+    bus.add(test.m_handler);
+    bus.getStats().rxFrames.add(3);
+    bus.getStats().rxBytes.add(300);
+    bus.getStats().rxCrcErrors.add(4);
+
+    // Only the counters which fit are sent and reset, and the count says how many.
+    uint8_t flags = CorePacketHandler::STATS_RESET;
+    test.m_cmdPacket.setCommand(CorePacketHandler::Command::STATS);
+    test.m_cmdPacket.setData(sizeof(flags), &flags);
+    uint8_t rspData[4];
+    Packet rsp{LEN(rspData), rspData};
+    EXPECT_TRUE(test.m_handler.handlePacket(test.m_cmdPacket, &rsp));
+    EXPECT_EQ(rsp.getCommand(), CorePacketHandler::Command::STATS);
+    ASSERT_EQ(rsp.getDataLength(), 4);
+    EXPECT_EQ(rsp.getData()[0], 2);
+    EXPECT_EQ(bus.getStats().rxFrames.get(), 0);
+    EXPECT_EQ(bus.getStats().rxBytes.get(), 0);
+    EXPECT_EQ(bus.getStats().rxCrcErrors.get(), 4);
+}
+
+TEST(CorePacketHandlerTest, LatencyTest) {
+    TestData test;
+    TelemetryTestBus bus{&test.m_cmdPacket, &test.m_rspPacket, nullptr};
+    bus.add(test.m_handler);
+    IBus::CommandLatency latency[2];
+    bus.setLatencyTable(LEN(latency), latency);
+    latency[0].command = CorePacketHandler::Command::PING;
+    latency[0].inUse = true;
+    latency[0].histogram.record(3);
+    latency[0].histogram.record(1000);
+    latency[0].histogram.record(1010);
+
+    // Without any data, the commands which have latencies are listed.
+    test.m_cmdPacket.setCommand(CorePacketHandler::Command::LATENCY);
+    test.m_cmdPacket.setData(0, nullptr);
+    EXPECT_TRUE(test.m_handler.handlePacket(test.m_cmdPacket, &test.m_rspPacket));
+    EXPECT_EQ(test.m_rspPacket.getCommand(), CorePacketHandler::Command::LATENCY);
+    EXPECT_EQ(test.m_rspPacket.getDataLength(), 1);
+    EXPECT_EQ(test.m_rspPacket.getData()[0], CorePacketHandler::Command::PING);
+
+    uint8_t data[] = {CorePacketHandler::Command::PING, CorePacketHandler::LATENCY_RESET};
+    test.m_cmdPacket.setData(LEN(data), data);
+    test.m_rspPacket.setData(0, nullptr);
+    EXPECT_TRUE(test.m_handler.handlePacket(test.m_cmdPacket, &test.m_rspPacket));
+    Unpacker unpacker(test.m_rspPacket);
+    uint8_t command;
+    uint32_t count;
+    uint32_t maxUs;
+    EXPECT_TRUE(unpacker.unpack(&command));
+    EXPECT_TRUE(unpacker.unpackVarint(&count));
+    EXPECT_TRUE(unpacker.unpackVarint(&maxUs));
+    EXPECT_EQ(command, CorePacketHandler::Command::PING);
+    EXPECT_EQ(count, 3);
+    EXPECT_EQ(maxUs, 1010);
+
+    // Only the buckets which aren't empty are sent.
+    uint8_t numBuckets;
+    EXPECT_TRUE(unpacker.unpack(&numBuckets));
+    EXPECT_EQ(numBuckets, 2);
+    uint8_t bucket;
+    EXPECT_TRUE(unpacker.unpack(&bucket));
+    EXPECT_TRUE(unpacker.unpackVarint(&count));
+    EXPECT_EQ(bucket, 3);
+    EXPECT_EQ(count, 1);
+    EXPECT_TRUE(unpacker.unpack(&bucket));
+    EXPECT_TRUE(unpacker.unpackVarint(&count));
+    EXPECT_EQ(bucket, LatencyHistogram::bucketIndex(1000));
+    EXPECT_EQ(count, 2);
+    EXPECT_FALSE(unpacker.unpack(&bucket));
+
+    // The histogram was reset after it was read.
+    EXPECT_EQ(latency[0].histogram.getCount(), 0);
+}
+
+TEST(CorePacketHandlerTest, LatencySmallResponseTest) {
+    TestData test;
+    TelemetryTestBus bus{&test.m_cmdPacket, &test.m_rspPacket, nullptr};
+    bus.add(test.m_handler);
+    IBus::CommandLatency latency[1];
+    bus.setLatencyTable(LEN(latency), latency);
+    latency[0].command = CorePacketHandler::Command::PING;
+    latency[0].inUse = true;
+    latency[0].histogram.record(3);
+    latency[0].histogram.record(1000);
+
+    // The second bucket doesn't fit, so only the first one is sent, and the histogram
+    // isn't reset.
+    uint8_t data[] = {CorePacketHandler::Command::PING, CorePacketHandler::LATENCY_RESET};
+    test.m_cmdPacket.setCommand(CorePacketHandler::Command::LATENCY);
+    test.m_cmdPacket.setData(LEN(data), data);
+    uint8_t rspData[8];
+    Packet rsp{LEN(rspData), rspData};
+    EXPECT_TRUE(test.m_handler.handlePacket(test.m_cmdPacket, &rsp));
+    EXPECT_EQ(rsp.getCommand(), CorePacketHandler::Command::LATENCY);
+    ASSERT_EQ(rsp.getDataLength(), 7);
+    EXPECT_EQ(rsp.getData()[4], 1);
+    EXPECT_EQ(rsp.getData()[5], 3);
+    EXPECT_EQ(rsp.getData()[6], 1);
+    EXPECT_EQ(latency[0].histogram.getCount(), 2);
+}
@@ -0,0 +1,65 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   CrcTest.cpp
+ *
+ *   @brief  Tests for the wider CRC functions.
+ *
+ ****************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+#include "duino_bus/Crc.h"
+
+//! Data used for the standard CRC check values.
+static char const CHECK_DATA[] = "123456789";
+
+TEST(CrcTest, Crc16CheckTest) {
+    EXPECT_EQ(Crc16Ccitt(CRC16_CCITT_INIT, strlen(CHECK_DATA), CHECK_DATA), 0x29b1);
+}
+
+TEST(CrcTest, Crc32cCheckTest) {
+    EXPECT_EQ(Crc32c(0, strlen(CHECK_DATA), CHECK_DATA), 0xe3069283);
+}
+
+TEST(CrcTest, Crc32cIncrementalTest) {
+    // Calculating the CRC in pieces should give the same result as all at once,
+    // regardless of how the pieces line up with the 8 byte blocks.
+    uint8_t data[37];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = static_cast<uint8_t>(i * 7 + 3);
+    }
+    uint32_t expected = Crc32c(0, sizeof(data), data);
+    for (size_t split = 0; split <= sizeof(data); split++) {
+        uint32_t crc = Crc32c(0, split, data);
+        crc = Crc32c(crc, sizeof(data) - split, &data[split]);
+        EXPECT_EQ(crc, expected);
+    }
+}
+
+TEST(CrcTest, Crc32cReferenceTest) {
+    // Whichever implementation was picked for this CPU should match a bit at a time CRC.
+    uint8_t data[37];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = static_cast<uint8_t>(i * 13 + 5);
+    }
+    for (size_t len = 0; len <= sizeof(data); len++) {
+        uint32_t expected = 0xffffffff;
+        for (size_t i = 0; i < len; i++) {
+            expected ^= data[i];
+            for (int bit = 0; bit < 8; bit++) {
+                expected = (expected & 1) ? (expected >> 1) ^ 0x82F63B78 : (expected >> 1);
+            }
+        }
+        EXPECT_EQ(Crc32c(0, len, data), ~expected);
+    }
+}
@@ -0,0 +1,217 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   EventPacketHandlerTest.cpp
+ *
+ *   @brief  Tests for the EventPacketHandler class.
+ *
+ ****************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "duino_bus/Bus.h"
+#include "duino_bus/CorePacketHandler.h"
+#include "duino_bus/EventPacketHandler.h"
+#include "duino_bus/Packer.h"
+#include "duino_util/AsciiHex.h"
+#include "duino_util/Util.h"
+
+using Command = CorePacketHandler::Command;  //!< Convenience alias
+using Status = EventPacketHandler::Status;   //!< Convenience alias
+
+//! Bus which records the bytes written to it.
+class EventTestBus : public IBus {
+ public:
+    //! Constructor.
+    EventTestBus(
+        Packet* cmdPacket,  //!< [in] Place to store incoming packet.
+        Packet* rspPacket,  //!< [in] Place to store response packet.
+        Packet* evtPacket   //!< [in] Place to store event packet.
+        )
+        : IBus{cmdPacket, rspPacket, nullptr, evtPacket} {
+        // Leaving out the CRC makes the expected output easier to read.
+        this->setCrcType(Packet::CrcType::NONE);
+    }
+
+    bool isDataAvailable() const override { return false; }
+    bool readByte(uint8_t*) override { return false; }
+    bool isSpaceAvailable() const override { return this->m_spaceAvailable; }
+    void writeByte(uint8_t byte) override { this->m_encodedData.push_back(byte); }
+    uint32_t getMillis() const override { return this->m_millis; }
+
+    ByteBuffer m_encodedData;      //!< Place to store outgoing data.
+    uint32_t m_millis = 1000;      //!< Simulated millisecond counter.
+    bool m_spaceAvailable = true;  //!< Simulated transmit space.
+};
+
+//! Test data used by individual tests.
+struct EventTestData {
+    //! Constructor.
+    EventTestData()
+        : m_cmdPacket{LEN(m_cmdData), m_cmdData},
+          m_rspPacket{LEN(m_rspData), m_rspData},
+          m_evtPacket{LEN(m_evtData), m_evtData},
+          m_bus{&m_cmdPacket, &m_rspPacket, &m_evtPacket} {
+        this->m_handler.setSubscriptionTable(LEN(this->m_subscriptions), this->m_subscriptions);
+        this->m_bus.add(this->m_handler);
+    }
+
+    //! Sends an EVENT_SUBSCRIBE command for a single event.
+    //! @returns the status from the response.
+    Status subscribe(
+        EventPacketHandler::EventId id,  //!< [in] Event to subscribe to.
+        uint16_t intervalMs              //!< [in] Minimum time between events.
+    ) {
+        this->m_cmdPacket.setCommand(Command::EVENT_SUBSCRIBE);
+        this->m_cmdPacket.setData(0, nullptr);
+        Packer packer(&this->m_cmdPacket);
+        packer.packAll(id, intervalMs);
+        this->m_rspPacket.setData(0, nullptr);
+        EXPECT_TRUE(this->m_handler.handlePacket(this->m_cmdPacket, &this->m_rspPacket));
+        EXPECT_EQ(this->m_rspPacket.getCommand(), Command::EVENT_SUBSCRIBE);
+        EXPECT_EQ(this->m_rspPacket.getDataLength(), 1);
+        return static_cast<Status>(this->m_rspPacket.getData()[0]);
+    }
+
+    uint8_t m_cmdData[16];                                //!< Storage for command packet data.
+    uint8_t m_rspData[16];                                //!< Storage for response packet data.
+    uint8_t m_evtData[16];                                //!< Storage for event packet data.
+    Packet m_cmdPacket;                                   //!< Command packet.
+    Packet m_rspPacket;                                   //!< Response packet.
+    Packet m_evtPacket;                                   //!< Event packet.
+    EventTestBus m_bus;                                   //!< Bus that events are sent on.
+    EventPacketHandler::Subscription m_subscriptions[2];  //!< Subscription table.
+    EventPacketHandler m_handler;                         //!< Handler being tested.
+};
+
+TEST(EventPacketHandlerTest, PublishTest) {
+    EventTestData test;
+
+    // Events which haven't been subscribed to are ignored.
+    EXPECT_FALSE(test.m_handler.publish<uint16_t>(0x0102, 7));
+    EXPECT_FALSE(test.m_handler.service());
+
+    EXPECT_EQ(test.subscribe(0x0102, 100), Status::OK);
+    EXPECT_EQ(test.m_handler.getNumSubscribed(), 1);
+    EXPECT_FALSE(test.m_handler.service());
+
+    // A new subscription is sent as soon as it's published.
+    EXPECT_TRUE(test.m_handler.publish<uint16_t>(0x0102, 7));
+    EXPECT_TRUE(test.m_handler.service());
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 0d 02 01 02 07 00 c0"));
+    EXPECT_FALSE(test.m_handler.service());
+}
+
+TEST(EventPacketHandlerTest, ChannelTest) {
+    EventTestData test;
+    Packet* evtQueue[1];
+    BusChannel events{BusChannel::EVENT, nullptr, nullptr, LEN(evtQueue), evtQueue};
+    test.m_bus.addChannel(events);
+    EXPECT_EQ(test.subscribe(1, 0), Status::OK);
+
+    // Events are queued on the event channel, and aren't sent again until they've been
+    // written.
+    EXPECT_TRUE(test.m_handler.publish<uint8_t>(1, 10));
+    EXPECT_TRUE(test.m_handler.service());
+    EXPECT_TRUE(events.isQueued(&test.m_evtPacket));
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 0);
+    EXPECT_TRUE(test.m_handler.publish<uint8_t>(1, 11));
+    EXPECT_FALSE(test.m_handler.service());
+    EXPECT_TRUE(test.m_bus.serviceTx());
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 0d 03 01 00 01 0a c0"));
+
+    test.m_bus.m_encodedData.clear();
+    EXPECT_TRUE(test.m_handler.service());
+    test.m_bus.flushTx();
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 0d 03 01 00 01 0b c0"));
+}
+
+TEST(EventPacketHandlerTest, CoalesceTest) {
+    EventTestData test;
+    EXPECT_EQ(test.subscribe(1, 100), Status::OK);
+    EXPECT_EQ(test.subscribe(2, 0), Status::OK);
+
+    EXPECT_TRUE(test.m_handler.publish<uint8_t>(1, 10));
+    EXPECT_TRUE(test.m_handler.publish<uint8_t>(2, 20));
+    EXPECT_TRUE(test.m_handler.service());
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 0d 01 00 01 0a "
+                         "02 00 01 14 c0"));
+    test.m_bus.m_encodedData.clear();
+
+    // Event 1 is held back until its interval has passed, and only its latest value is
+    // sent. Event 2 has no interval, so it's sent right away.
+    test.m_bus.m_millis += 50;
+    EXPECT_TRUE(test.m_handler.publish<uint8_t>(1, 11));
+    EXPECT_TRUE(test.m_handler.publish<uint8_t>(1, 12));
+    EXPECT_TRUE(test.m_handler.publish<uint8_t>(2, 21));
+    EXPECT_TRUE(test.m_handler.service());
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 0d 02 00 01 15 c0"));
+    test.m_bus.m_encodedData.clear();
+    EXPECT_FALSE(test.m_handler.service());
+
+    test.m_bus.m_millis += 50;
+    EXPECT_TRUE(test.m_handler.service());
+    EXPECT_EQ(test.m_bus.m_encodedData, AsciiHexToBinary("c0 0d 01 00 01 0c c0"));
+}
+
+TEST(EventPacketHandlerTest, FullPacketTest) {
+    EventTestData test;
+    EXPECT_EQ(test.subscribe(1, 0), Status::OK);
+    EXPECT_EQ(test.subscribe(2, 0), Status::OK);
+
+    // Each event takes 11 bytes, so only one fits in the packet. The other one is sent in
+    // the next packet.
+    EXPECT_TRUE(test.m_handler.publish<uint64_t>(1, 0x11));
+    EXPECT_TRUE(test.m_handler.publish<uint64_t>(2, 0x22));
+    EXPECT_TRUE(test.m_handler.service());
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 0d 01 00 08 11 00 00 00 00 00 00 00 c0"));
+    test.m_bus.m_encodedData.clear();
+
+    // Event 1 is published again, but event 2 has been waiting, so it goes first.
+    EXPECT_TRUE(test.m_handler.publish<uint64_t>(1, 0x12));
+    EXPECT_TRUE(test.m_handler.service());
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 0d 02 00 08 22 00 00 00 00 00 00 00 c0"));
+    test.m_bus.m_encodedData.clear();
+
+    // Nothing is sent while there's no room to send it.
+    test.m_bus.m_spaceAvailable = false;
+    EXPECT_FALSE(test.m_handler.service());
+    test.m_bus.m_spaceAvailable = true;
+    EXPECT_TRUE(test.m_handler.service());
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 0d 01 00 08 12 00 00 00 00 00 00 00 c0"));
+}
+
+TEST(EventPacketHandlerTest, SubscribeTest) {
+    EventTestData test;
+    EXPECT_EQ(test.subscribe(1, 100), Status::OK);
+    EXPECT_EQ(test.subscribe(2, 100), Status::OK);
+    EXPECT_EQ(test.subscribe(3, 100), Status::FULL);
+
+    // Subscribing again just changes the interval.
+    EXPECT_EQ(test.subscribe(1, 0), Status::OK);
+    EXPECT_EQ(test.m_handler.getNumSubscribed(), 2);
+
+    EXPECT_EQ(test.subscribe(1, EventPacketHandler::UNSUBSCRIBE), Status::OK);
+    EXPECT_EQ(test.m_handler.getNumSubscribed(), 1);
+    EXPECT_FALSE(test.m_handler.publish<uint8_t>(1, 0));
+    EXPECT_EQ(test.subscribe(3, 100), Status::OK);
+
+    // Values which are too big are rejected.
+    uint8_t big[EventPacketHandler::MAX_VALUE_LEN + 1] = {};
+    EXPECT_FALSE(test.m_handler.publish(3, sizeof(big), big));
+}
@@ -0,0 +1,72 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   HeapHooksTest.cpp
+ *
+ *   @brief  Tests the HeapStats allocation hooks.
+ *
+ *   This is built into its own executable, with DUINO_BUS_HEAP_HOOKS defined and
+ *   malloc and friends wrapped (see test-heap-hooks in the Makefile).
+ *
+ ****************************************************************************/
+
+#include <gtest/gtest.h>
+#include <malloc.h>
+
+#include <cstdlib>
+
+#include "duino_bus/HeapStats.h"
+
+static_assert(HeapStats::isEnabled());
+
+//! @returns the number of bytes allocated, according to the hooks.
+static uint32_t allocated() {
+    HeapStats::Info info;
+    HeapStats::getInfo(&info);
+    return info.allocated;
+}
+
+TEST(HeapHooksTest, MallocFreeTest) {
+    uint32_t before = allocated();
+    void* ptr = malloc(100);
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_EQ(allocated() - before, malloc_usable_size(ptr));
+
+    HeapStats::Info info;
+    HeapStats::getInfo(&info);
+    EXPECT_GE(info.highWater, info.allocated);
+
+    free(ptr);
+    EXPECT_EQ(allocated(), before);
+}
+
+TEST(HeapHooksTest, CallocTest) {
+    uint32_t before = allocated();
+    void* ptr = calloc(10, 20);
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_EQ(allocated() - before, malloc_usable_size(ptr));
+    free(ptr);
+    EXPECT_EQ(allocated(), before);
+}
+
+TEST(HeapHooksTest, ReallocTest) {
+    uint32_t before = allocated();
+
+    // realloc of nullptr allocates, and growing the block replaces its size.
+    void* ptr = realloc(nullptr, 16);
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_EQ(allocated() - before, malloc_usable_size(ptr));
+    ptr = realloc(ptr, 4096);
+    ASSERT_NE(ptr, nullptr);
+    EXPECT_EQ(allocated() - before, malloc_usable_size(ptr));
+
+    free(ptr);
+    EXPECT_EQ(allocated(), before);
+}
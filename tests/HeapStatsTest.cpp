@@ -0,0 +1,50 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   HeapStatsTest.cpp
+ *
+ *   @brief  Tests for the HeapStats class.
+ *
+ ****************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "duino_bus/HeapStats.h"
+
+TEST(HeapStatsTest, CountersTest) {
+    HeapStats::reset();
+    HeapStats::Info info;
+
+    HeapStats::recordArena(1024);
+    HeapStats::recordAlloc(100);
+    HeapStats::recordAlloc(200);
+    HeapStats::recordFree(100);
+    HeapStats::getInfo(&info);
+    EXPECT_EQ(info.arena, 1024);
+    EXPECT_EQ(info.allocated, 200);
+    EXPECT_EQ(info.free, 824);
+    EXPECT_EQ(info.largestFree, 824);
+    EXPECT_EQ(info.highWater, 300);
+
+    // The arena can shrink, and the high water mark stays where it was.
+    HeapStats::recordArena(-512);
+    HeapStats::recordFree(200);
+    HeapStats::getInfo(&info);
+    EXPECT_EQ(info.arena, 512);
+    EXPECT_EQ(info.allocated, 0);
+    EXPECT_EQ(info.free, 512);
+    EXPECT_EQ(info.highWater, 300);
+
+    HeapStats::updateHighWater(400);
+    HeapStats::updateHighWater(350);
+    HeapStats::getInfo(&info);
+    EXPECT_EQ(info.highWater, 400);
+    HeapStats::reset();
+}
@@ -0,0 +1,60 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   LatencyHistogramTest.cpp
+ *
+ *   @brief  Tests for the LatencyHistogram class.
+ *
+ ****************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "duino_bus/LatencyHistogram.h"
+
+TEST(LatencyHistogramTest, BucketIndexTest) {
+    EXPECT_EQ(LatencyHistogram::bucketIndex(0), 0);
+    EXPECT_EQ(LatencyHistogram::bucketIndex(3), 3);
+    EXPECT_EQ(LatencyHistogram::bucketIndex(4), 4);
+    EXPECT_EQ(LatencyHistogram::bucketIndex(7), 7);
+    EXPECT_EQ(LatencyHistogram::bucketIndex(8), 8);
+    EXPECT_EQ(LatencyHistogram::bucketIndex(9), 8);
+    EXPECT_EQ(LatencyHistogram::bucketIndex(10), 9);
+    EXPECT_EQ(LatencyHistogram::bucketIndex(1000), 35);
+    EXPECT_EQ(LatencyHistogram::bucketIndex(UINT32_MAX), LatencyHistogram::NUM_BUCKETS - 1);
+
+    // Each bucket starts where the previous one ends.
+    for (size_t idx = 0; idx < LatencyHistogram::NUM_BUCKETS; idx++) {
+        uint32_t lowerBound = LatencyHistogram::bucketLowerBound(idx);
+        EXPECT_EQ(LatencyHistogram::bucketIndex(lowerBound), idx);
+        if (idx > 0) {
+            EXPECT_EQ(LatencyHistogram::bucketIndex(lowerBound - 1), idx - 1);
+        }
+    }
+    EXPECT_EQ(LatencyHistogram::bucketLowerBound(LatencyHistogram::NUM_BUCKETS - 1), 114688);
+}
+
+TEST(LatencyHistogramTest, RecordTest) {
+    LatencyHistogram histogram;
+
+    histogram.record(2);
+    histogram.record(1000);
+    histogram.record(1010);
+    histogram.record(1000000);
+    EXPECT_EQ(histogram.getCount(), 4);
+    EXPECT_EQ(histogram.getMax(), 1000000);
+    EXPECT_EQ(histogram.getBucket(2), 1);
+    EXPECT_EQ(histogram.getBucket(35), 2);
+    EXPECT_EQ(histogram.getBucket(LatencyHistogram::NUM_BUCKETS - 1), 1);
+
+    histogram.reset();
+    EXPECT_EQ(histogram.getCount(), 0);
+    EXPECT_EQ(histogram.getMax(), 0);
+    EXPECT_EQ(histogram.getBucket(35), 0);
+}
@@ -0,0 +1,144 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   LogRingTest.cpp
+ *
+ *   @brief  Tests for the LogRing class.
+ *
+ ****************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+#include "duino_bus/LogRing.h"
+#include "duino_util/AsciiHex.h"
+#include "duino_util/Util.h"
+
+//! Reads the oldest message from a ring.
+//! @returns the data from the message.
+static ByteBuffer readMessage(
+    LogRing& ring,         //!< [mod] Ring to read from.
+    LogRing::Entry* entry  //!< [out] Information about the message.
+) {
+    uint8_t data[64];
+    Packet packet{LEN(data), data};
+    EXPECT_TRUE(ring.peek(entry));
+    EXPECT_TRUE(ring.pop(&packet));
+    return ByteBuffer(packet.getData(), packet.getData() + packet.getDataLength());
+}
+
+TEST(LogRingTest, WriteReadTest) {
+    uint32_t buffer[32];
+    LogRing ring{LEN(buffer), buffer};
+    LogRing::Entry entry;
+
+    EXPECT_FALSE(ring.peek(&entry));
+
+    uint8_t data1[] = {1, 2, 3};
+    uint8_t data2[] = {4, 5, 6, 7, 8};
+    char const* format = "%d";
+    EXPECT_TRUE(ring.write(10, 0x03, nullptr, LEN(data1), data1));
+    EXPECT_TRUE(ring.write(11, 0x09, format, LEN(data2), data2));
+
+    EXPECT_EQ(readMessage(ring, &entry), AsciiHexToBinary("01 02 03"));
+    EXPECT_EQ(entry.timestamp, 10);
+    EXPECT_EQ(entry.command, 0x03);
+    EXPECT_EQ(entry.format, nullptr);
+    EXPECT_EQ(entry.length, 3);
+
+    EXPECT_EQ(readMessage(ring, &entry), AsciiHexToBinary("04 05 06 07 08"));
+    EXPECT_EQ(entry.timestamp, 11);
+    EXPECT_EQ(entry.command, 0x09);
+    EXPECT_EQ(entry.format, format);
+
+    EXPECT_FALSE(ring.peek(&entry));
+    EXPECT_EQ(ring.getNumDropped(), 0);
+}
+
+TEST(LogRingTest, FullTest) {
+    uint32_t buffer[16];
+    LogRing ring{LEN(buffer), buffer};
+    LogRing::Entry entry;
+    uint8_t data[20] = {};
+
+    // Each message takes 9 or 10 words (depending on the size of a pointer), so only
+    // one fits.
+    EXPECT_TRUE(ring.write(1, 0x03, nullptr, LEN(data), data));
+    EXPECT_FALSE(ring.write(2, 0x03, nullptr, LEN(data), data));
+    EXPECT_EQ(ring.getNumDropped(), 1);
+
+    // Once it's read, the next message skips the space at the end of the buffer.
+    readMessage(ring, &entry);
+    EXPECT_EQ(entry.timestamp, 1);
+    EXPECT_TRUE(ring.write(3, 0x03, nullptr, LEN(data), data));
+    readMessage(ring, &entry);
+    EXPECT_EQ(entry.timestamp, 3);
+    EXPECT_FALSE(ring.peek(&entry));
+
+    // Messages which are bigger than the ring are dropped.
+    uint8_t bigData[64] = {};
+    EXPECT_FALSE(ring.write(4, 0x03, nullptr, LEN(bigData), bigData));
+    EXPECT_EQ(ring.getNumDropped(), 2);
+}
+
+TEST(LogRingTest, ConcurrentWriteTest) {
+    constexpr size_t NUM_THREADS = 8;
+    constexpr uint32_t NUM_MESSAGES = 2000;
+    uint32_t buffer[256];
+    LogRing ring{LEN(buffer), buffer};
+
+    // Each thread writes a sequence of messages, with its own id and a sequence number
+    // in the timestamp. The messages from each thread need to come out in order.
+    auto writer = [&ring](uint8_t id) {
+        for (uint32_t seq = 0; seq < NUM_MESSAGES; seq++) {
+            uint8_t data[8];
+            memset(data, id, sizeof(data));
+            while (!ring.write(seq, id, nullptr, 1 + (seq % 8), data)) {
+                std::this_thread::yield();
+            }
+        }
+    };
+    std::thread threads[NUM_THREADS];
+    for (size_t idx = 0; idx < NUM_THREADS; idx++) {
+        threads[idx] = std::thread{writer, static_cast<uint8_t>(idx)};
+    }
+
+    uint32_t nextSeq[NUM_THREADS] = {};
+    size_t numRead = 0;
+    while (numRead < NUM_THREADS * NUM_MESSAGES) {
+        LogRing::Entry entry;
+        if (!ring.peek(&entry)) {
+            std::this_thread::yield();
+            continue;
+        }
+        uint8_t data[16];
+        Packet packet{LEN(data), data};
+        EXPECT_TRUE(ring.pop(&packet));
+        numRead++;
+
+        // The writers are still running, so failures can't return early.
+        if (entry.command >= NUM_THREADS) {
+            ADD_FAILURE() << "Bad id " << entry.command;
+            continue;
+        }
+        EXPECT_EQ(entry.timestamp, nextSeq[entry.command]);
+        EXPECT_EQ(packet.getDataLength(), 1 + (entry.timestamp % 8));
+        for (size_t i = 0; i < packet.getDataLength(); i++) {
+            EXPECT_EQ(data[i], entry.command);
+        }
+        nextSeq[entry.command] = entry.timestamp + 1;
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    LogRing::Entry entry;
+    EXPECT_FALSE(ring.peek(&entry));
+}
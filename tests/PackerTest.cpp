@@ -145,3 +145,113 @@ TEST(PackerTest, PackData4TooLongTest) {
     EXPECT_TRUE(test.m_packer.pack("123456789 1234"));
     EXPECT_FALSE(test.m_packer.pack(data));
 }
+
+TEST(PackerTest, PackAllTest) {
+    PackerTest test;
+
+    uint8_t data8 = 0x11;
+    uint16_t data16 = 0x3322;
+    uint32_t data32 = 0x77665544;
+
+    EXPECT_TRUE(test.m_packer.packAll(data8, data16, data32));
+    EXPECT_TRUE(test.matches("11 22 33 44 55 66 77"));
+}
+
+TEST(PackerTest, PackAllTooLongTest) {
+    PackerTest test;
+
+    uint32_t data32 = 0x44332211;
+
+    EXPECT_TRUE(test.m_packer.packAll(data32, data32, data32));
+
+    // Only 4 bytes remain, so nothing should get packed.
+    uint8_t data8 = 0x55;
+    EXPECT_FALSE(test.m_packer.packAll(data32, data8));
+    EXPECT_TRUE(test.matches("11 22 33 44 11 22 33 44 11 22 33 44"));
+}
+
+TEST(PackerTest, PackArrayTest) {
+    PackerTest test;
+
+    int16_t samples[] = {0x2211, 0x4433, -2};
+
+    EXPECT_TRUE(test.m_packer.packArray(LEN(samples), samples));
+    EXPECT_TRUE(test.matches("03 00 11 22 33 44 fe ff"));
+}
+
+TEST(PackerTest, PackArrayTooLongTest) {
+    PackerTest test;
+
+    uint32_t samples[4] = {};
+
+    // 2 byte count + 16 bytes of data won't fit, so nothing should be packed.
+    EXPECT_FALSE(test.m_packer.packArray(LEN(samples), samples));
+    EXPECT_TRUE(test.matches(""));
+}
+
+TEST(PackerTest, PackVarintTest) {
+    PackerTest test;
+
+    EXPECT_TRUE(test.m_packer.packVarint(1));
+    EXPECT_TRUE(test.m_packer.packVarint(300));
+    EXPECT_TRUE(test.m_packer.packVarint(UINT32_MAX));
+    EXPECT_TRUE(test.m_packer.packSignedVarint(-2));
+    EXPECT_TRUE(test.m_packer.packSignedVarint(1));
+    EXPECT_TRUE(test.m_packer.packSignedVarint(INT32_MIN));
+    EXPECT_TRUE(test.matches("01 ac 02 ff ff ff ff 0f 03 02 ff ff ff ff 0f"));
+
+    // There's only room for a 1 byte varint.
+    EXPECT_FALSE(test.m_packer.packVarint(0x80));
+    EXPECT_TRUE(test.m_packer.packVarint(0x7f));
+}
+
+TEST(PackerTest, ReserveCommitTest) {
+    PackerTest test;
+
+    uint8_t data8 = 0x11;
+    EXPECT_TRUE(test.m_packer.pack(data8));
+
+    auto reservation = test.m_packer.reserve(8);
+    EXPECT_TRUE(reservation.isValid());
+    EXPECT_EQ(reservation.size(), 8);
+    EXPECT_EQ(reservation.data(), &test.m_packetData[1]);
+    reservation.data()[0] = 0x22;
+    reservation.data()[1] = 0x33;
+
+    // Nothing is added until the reservation is committed.
+    EXPECT_TRUE(test.matches("11"));
+    EXPECT_TRUE(reservation.commit(2));
+    EXPECT_TRUE(test.matches("11 22 33"));
+
+    // A reservation can only be committed once.
+    EXPECT_FALSE(reservation.commit(2));
+    EXPECT_TRUE(test.matches("11 22 33"));
+}
+
+TEST(PackerTest, ReserveTooLongTest) {
+    PackerTest test;
+
+    auto reservation = test.m_packer.reserve(17);
+    EXPECT_FALSE(reservation.isValid());
+    EXPECT_FALSE(reservation.commit(0));
+}
+
+TEST(PackerTest, ReserveCommitTooLongTest) {
+    PackerTest test;
+
+    auto reservation = test.m_packer.reserve(4);
+    EXPECT_FALSE(reservation.commit(5));
+    EXPECT_TRUE(test.matches(""));
+}
+
+TEST(PackerTest, ReserveStaleTest) {
+    PackerTest test;
+
+    auto reservation = test.m_packer.reserve(4);
+    uint8_t data8 = 0x11;
+    EXPECT_TRUE(test.m_packer.pack(data8));
+
+    // The packet was modified after the reservation was made.
+    EXPECT_FALSE(reservation.commit(4));
+    EXPECT_TRUE(test.matches("11"));
+}
@@ -34,19 +34,26 @@ class PacketDecoderTest {
  public:
     //! Constructor.
     explicit PacketDecoderTest(
-        char const* str  //!< [in] ASCII Hex string representing data to decode.
+        char const* str,  //!< [in] ASCII Hex string representing data to decode.
+        Packet::Framing framing = Packet::Framing::SLIP,  //!< [in] Framing to use.
+        Packet::CrcType crcType = Packet::CrcType::CRC8   //!< [in] Type of CRC to use.
         )
         : m_data(AsciiHexToBinary(str)),
           m_packet{LEN(this->m_packetData), this->m_packetData},
-          m_decoder(nullptr, &this->m_packet) {}
+          m_decoder(nullptr, &this->m_packet) {
+        this->m_decoder.setFraming(framing);
+        this->m_decoder.setCrcType(crcType);
+    }
 
     //! Parses all of the bytes from m_dataStream using the packet parser.
     //! @returns Error::NONE if a packet was parsed successfully.
     //! @returns Error::NOT_DONE if more bytes are needed to complete parsing the packet.
     //! @returns Error::TOO_MUCH_DATA if the packet has more parameters than we have storage for.
     //! @returns Error::CHECKSUM if a checksum error was encountered while parsing.
+    //! Subsequent calls continue parsing where the previous call left off.
     Error decodeData() {
-        for (uint8_t byte : this->m_data) {
+        while (this->m_decodeIdx < this->m_data.size()) {
+            uint8_t byte = this->m_data[this->m_decodeIdx++];
             if (auto err = this->m_decoder.decodeByte(byte); err != Error::NOT_DONE) {
                 return err;
             }
@@ -55,6 +62,7 @@ class PacketDecoderTest {
     }
 
     ByteBuffer m_data;         //!< Data to decode.
+    size_t m_decodeIdx = 0;    //!< Index of the next byte to decode.
     uint8_t m_packetData[15];  //!< Storage for packet data.
     Packet m_packet;           //!< Packet being decoded.
     PacketDecoder m_decoder;   //!< Packet Decoder.
@@ -193,6 +201,372 @@ TEST(PacketDecoderTest, TooMuchDataDebugTest) {
     EXPECT_EQ(test.decodeData(), Error::TOO_MUCH_DATA);
 }
 
+TEST(PacketDecoderTest, TooMuchDataResyncTest) {
+    auto test =
+        PacketDecoderTest("c0 00 01 02 03 04 05 06 07 08 09 0a 0b 0c 0d 0e 0f e0 c0 01 07 c0");
+
+    // The rest of the oversized packet is discarded without producing more errors.
+    EXPECT_EQ(test.decodeData(), Error::TOO_MUCH_DATA);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_packet.getCommand(), Command::PING);
+    EXPECT_EQ(test.m_decoder.getDiscardedBytes(), 17);
+}
+
+TEST(PacketDecoderTest, CrcErrorResyncTest) {
+    auto test = PacketDecoderTest("c0 01 08 c0 01 07 c0");
+
+    // The END which terminates the bad packet also starts the next one.
+    EXPECT_EQ(test.decodeData(), Error::CRC);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_packet.getCommand(), Command::PING);
+    EXPECT_EQ(test.m_decoder.getDiscardedBytes(), 2);
+}
+
+TEST(PacketDecoderTest, DiscardNoiseTest) {
+    auto test = PacketDecoderTest("aa bb c0 01 07 c0");
+
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_decoder.getDiscardedBytes(), 2);
+    test.m_decoder.resetDiscardedBytes();
+    EXPECT_EQ(test.m_decoder.getDiscardedBytes(), 0);
+}
+
+TEST(PacketDecoderTest, TimeoutTest) {
+    auto test = PacketDecoderTest("");
+
+    test.m_decoder.setTimeout(10);
+    EXPECT_EQ(test.m_decoder.checkTimeout(100), Error::NOT_DONE);
+    EXPECT_EQ(test.m_decoder.decodeByte(0xc0, 100), Error::NOT_DONE);
+    EXPECT_EQ(test.m_decoder.checkTimeout(200), Error::NOT_DONE);
+    EXPECT_EQ(test.m_decoder.decodeByte(0x01, 200), Error::NOT_DONE);
+    EXPECT_EQ(test.m_decoder.checkTimeout(209), Error::NOT_DONE);
+    EXPECT_EQ(test.m_decoder.checkTimeout(210), Error::TIMEOUT);
+    EXPECT_EQ(test.m_decoder.checkTimeout(300), Error::NOT_DONE);
+    EXPECT_EQ(test.m_decoder.getDiscardedBytes(), 1);
+}
+
+TEST(PacketDecoderTest, TimeoutOnByteTest) {
+    auto test = PacketDecoderTest("");
+
+    // The millisecond counter wraps around while the packet is being received.
+    test.m_decoder.setTimeout(10);
+    EXPECT_EQ(test.m_decoder.decodeByte(0xc0, 0xfffffff0), Error::NOT_DONE);
+    EXPECT_EQ(test.m_decoder.decodeByte(0x01, 0xfffffff8), Error::NOT_DONE);
+    EXPECT_EQ(test.m_decoder.decodeByte(0xc0, 0x00000010), Error::TIMEOUT);
+    EXPECT_EQ(test.m_decoder.decodeByte(0x01, 0x00000011), Error::NOT_DONE);
+    EXPECT_EQ(test.m_decoder.decodeByte(0x07, 0x00000012), Error::NOT_DONE);
+    EXPECT_EQ(test.m_decoder.decodeByte(0xc0, 0x00000013), Error::NONE);
+    EXPECT_EQ(test.m_packet.getCommand(), Command::PING);
+}
+
+TEST(PacketDecoderTest, StatsTest) {
+    auto test = PacketDecoderTest("aa bb c0 01 08 c0 01 07 c0 c0 01 c0");
+    BusStats stats;
+    test.m_decoder.setStats(&stats);
+
+    EXPECT_EQ(test.decodeData(), Error::CRC);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.decodeData(), Error::TOO_SMALL);
+    test.m_decoder.setTimeout(10);
+    EXPECT_EQ(test.m_decoder.decodeByte(0x01, 100), Error::NOT_DONE);
+    EXPECT_EQ(test.m_decoder.checkTimeout(110), Error::TIMEOUT);
+
+    uint32_t values[BusStats::NUM_COUNTERS];
+    stats.get(values);
+    EXPECT_EQ(stats.rxFrames.get(), 1);
+    EXPECT_EQ(stats.rxBytes.get(), 13);
+    EXPECT_EQ(stats.rxCrcErrors.get(), 1);
+    EXPECT_EQ(stats.rxTooMuchData.get(), 0);
+    EXPECT_EQ(stats.rxTooSmall.get(), 1);
+    EXPECT_EQ(stats.rxTimeouts.get(), 1);
+    EXPECT_EQ(stats.rxDiscarded.get(), test.m_decoder.getDiscardedBytes());
+    EXPECT_EQ(values[0], 1);
+    EXPECT_EQ(values[1], 13);
+
+    stats.reset();
+    EXPECT_EQ(stats.rxBytes.get(), 0);
+    EXPECT_EQ(stats.rxDiscarded.get(), 0);
+}
+
+TEST(PacketDecoderTest, CobsNoDataTest) {
+    auto test = PacketDecoderTest("00 03 01 07 00", Packet::Framing::COBS);
+
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_packet.getCommand(), Command::PING);
+    EXPECT_EQ(test.m_packet.getDataLength(), 0);
+}
+
+TEST(PacketDecoderTest, CobsZeroDataTest) {
+    auto test = PacketDecoderTest("00 00 02 01 03 02 65 00", Packet::Framing::COBS);
+
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_packet.getCommand(), Command::PING);
+    EXPECT_EQ(test.m_packet.getDataLength(), 2);
+    EXPECT_EQ(test.m_packet.getData()[0], 0x00);
+    EXPECT_EQ(test.m_packet.getData()[1], 0x02);
+}
+
+TEST(PacketDecoderTest, CobsZeroCommandTest) {
+    auto test = PacketDecoderTest("00 01 04 c0 db e2 00", Packet::Framing::COBS);
+
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_packet.getCommand(), 0x00);
+    EXPECT_EQ(test.m_packet.getDataLength(), 2);
+    EXPECT_EQ(test.m_packet.getData()[0], 0xc0);
+    EXPECT_EQ(test.m_packet.getData()[1], 0xdb);
+}
+
+TEST(PacketDecoderTest, CobsBackToBackTest) {
+    // The trailing delimiter of one packet is the leading delimiter of the next.
+    auto test = PacketDecoderTest("00 03 01 07 00 03 01 07 00", Packet::Framing::COBS);
+
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+}
+
+TEST(PacketDecoderTest, CobsTruncatedTest) {
+    auto test = PacketDecoderTest("00 04 01 07 00 03 01 07 00", Packet::Framing::COBS);
+
+    EXPECT_EQ(test.decodeData(), Error::CRC);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+}
+
+TEST(PacketDecoderTest, CobsTooSmallTest) {
+    auto test = PacketDecoderTest("00 02 01 00", Packet::Framing::COBS);
+
+    EXPECT_EQ(test.decodeData(), Error::TOO_SMALL);
+}
+
+TEST(PacketDecoderTest, CobsTooMuchDataTest) {
+    auto test = PacketDecoderTest(
+        "00 12 01 01 02 03 04 05 06 07 08 09 0a 0b 0c 0d 0e 0f 10 00 03 01 07 00",
+        Packet::Framing::COBS);
+
+    EXPECT_EQ(test.decodeData(), Error::TOO_MUCH_DATA);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+}
+
+TEST(PacketDecoderTest, LengthNoDataTest) {
+    auto test = PacketDecoderTest("02 00 01 07", Packet::Framing::LENGTH);
+
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_packet.getCommand(), Command::PING);
+    EXPECT_EQ(test.m_packet.getDataLength(), 0);
+}
+
+TEST(PacketDecoderTest, LengthDataTest) {
+    auto test = PacketDecoderTest("04 00 00 c0 db e2", Packet::Framing::LENGTH);
+
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_packet.getCommand(), 0x00);
+    EXPECT_EQ(test.m_packet.getDataLength(), 2);
+    EXPECT_EQ(test.m_packet.getData()[0], 0xc0);
+    EXPECT_EQ(test.m_packet.getData()[1], 0xdb);
+}
+
+TEST(PacketDecoderTest, LengthTooSmallTest) {
+    auto test = PacketDecoderTest("01 00 01 02 00 01 07", Packet::Framing::LENGTH);
+
+    EXPECT_EQ(test.decodeData(), Error::TOO_SMALL);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+}
+
+TEST(PacketDecoderTest, LengthTooMuchDataTest) {
+    auto test = PacketDecoderTest(
+        "11 00 01 01 02 03 04 05 06 07 08 09 0a 0b 0c 0d 0e 0f 10 02 00 01 07",
+        Packet::Framing::LENGTH);
+
+    // The oversized packet is skipped, and the following packet is decoded.
+    EXPECT_EQ(test.decodeData(), Error::TOO_MUCH_DATA);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_packet.getCommand(), Command::PING);
+}
+
+TEST(PacketDecoderTest, LengthTimeoutTest) {
+    auto test = PacketDecoderTest("", Packet::Framing::LENGTH);
+
+    // Without a timeout, a lost byte would leave the decoder out of sync forever.
+    test.m_decoder.setTimeout(10);
+    EXPECT_EQ(test.m_decoder.decodeByte(0x03, 0), Error::NOT_DONE);
+    EXPECT_EQ(test.m_decoder.decodeByte(0x00, 1), Error::NOT_DONE);
+    EXPECT_EQ(test.m_decoder.decodeByte(0x01, 2), Error::NOT_DONE);
+    EXPECT_EQ(test.m_decoder.decodeByte(0x02, 20), Error::TIMEOUT);
+    EXPECT_EQ(test.m_decoder.decodeByte(0x00, 21), Error::NOT_DONE);
+    EXPECT_EQ(test.m_decoder.decodeByte(0x01, 22), Error::NOT_DONE);
+    EXPECT_EQ(test.m_decoder.decodeByte(0x07, 23), Error::NONE);
+    EXPECT_EQ(test.m_packet.getCommand(), Command::PING);
+}
+
+TEST(PacketDecoderTest, Crc16Test) {
+    auto test =
+        PacketDecoderTest("c0 01 d1 f1 c0", Packet::Framing::SLIP, Packet::CrcType::CRC16);
+
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_packet.getCommand(), Command::PING);
+    EXPECT_EQ(test.m_packet.getDataLength(), 0);
+    EXPECT_EQ(test.m_packet.getCrc(), 0xf1d1);
+}
+
+TEST(PacketDecoderTest, Crc16ErrorTest) {
+    auto test =
+        PacketDecoderTest("c0 01 d1 f2 c0", Packet::Framing::SLIP, Packet::CrcType::CRC16);
+
+    EXPECT_EQ(test.decodeData(), Error::CRC);
+}
+
+TEST(PacketDecoderTest, Crc32cTest) {
+    auto test = PacketDecoderTest(
+        "c0 01 02 03 1e f2 30 f1 c0", Packet::Framing::SLIP, Packet::CrcType::CRC32C);
+
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_packet.getCommand(), Command::PING);
+    EXPECT_EQ(test.m_packet.getDataLength(), 2);
+    EXPECT_EQ(test.m_packet.getCrc(), 0xf130f21e);
+}
+
+TEST(PacketDecoderTest, Crc32cTooSmallTest) {
+    auto test =
+        PacketDecoderTest("c0 01 1e f2 c0", Packet::Framing::SLIP, Packet::CrcType::CRC32C);
+
+    EXPECT_EQ(test.decodeData(), Error::TOO_SMALL);
+}
+
+TEST(PacketDecoderTest, CrcNoneTest) {
+    auto test = PacketDecoderTest("c0 01 c0", Packet::Framing::SLIP, Packet::CrcType::NONE);
+
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_packet.getCommand(), Command::PING);
+    EXPECT_EQ(test.m_packet.getDataLength(), 0);
+}
+
+TEST(PacketDecoderTest, CrcNoneLengthTest) {
+    auto test =
+        PacketDecoderTest("00 00 01 00 01", Packet::Framing::LENGTH, Packet::CrcType::NONE);
+
+    EXPECT_EQ(test.decodeData(), Error::TOO_SMALL);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_packet.getCommand(), Command::PING);
+}
+
+TEST(PacketDecoderTest, AddressMatchTest) {
+    auto test = PacketDecoderTest("c0 01 05 02 24 c0");
+
+    test.m_decoder.setAddressing(true, 0x05);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_packet.getCommand(), Command::PING);
+    EXPECT_TRUE(test.m_packet.hasAddress());
+    EXPECT_EQ(test.m_packet.getAddress(), 0x05);
+    EXPECT_EQ(test.m_packet.getDataLength(), 1);
+    EXPECT_EQ(test.m_packet.getData()[0], 0x02);
+}
+
+TEST(PacketDecoderTest, AddressBroadcastTest) {
+    auto test = PacketDecoderTest("c0 01 ff e6 c0");
+
+    test.m_decoder.setAddressing(true, 0x05);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_packet.getAddress(), Packet::BROADCAST_ADDRESS);
+}
+
+TEST(PacketDecoderTest, AddressOtherNodeTest) {
+    // The first packet is bigger than the packet storage, but since it's for another
+    // node it's ignored without being buffered.
+    auto test = PacketDecoderTest(
+        "c0 01 06 10 11 12 13 14 15 16 17 18 19 1a 1b 1c 1d 1e 1f 20 21 22 23 26 c0 "
+        "c0 01 05 0e c0");
+
+    test.m_decoder.setAddressing(true, 0x05);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_decodeIdx, test.m_data.size());
+    EXPECT_EQ(test.m_packet.getAddress(), 0x05);
+    EXPECT_EQ(test.m_packet.getDataLength(), 0);
+    EXPECT_EQ(test.m_decoder.getDiscardedBytes(), 0);
+}
+
+TEST(PacketDecoderTest, AddressAnyTest) {
+    auto test = PacketDecoderTest("c0 01 06 07 c0");
+
+    test.m_decoder.setAddressing(true);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_packet.getAddress(), 0x06);
+}
+
+TEST(PacketDecoderTest, AddressMissingTest) {
+    auto test = PacketDecoderTest("c0 01 c0");
+
+    test.m_decoder.setAddressing(true, 0x05);
+    EXPECT_EQ(test.decodeData(), Error::TOO_SMALL);
+}
+
+TEST(PacketDecoderTest, CobsAddressTest) {
+    auto test = PacketDecoderTest("00 04 01 06 07 00 04 01 05 0e 00", Packet::Framing::COBS);
+
+    test.m_decoder.setAddressing(true, 0x05);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_decodeIdx, test.m_data.size());
+    EXPECT_EQ(test.m_packet.getAddress(), 0x05);
+}
+
+TEST(PacketDecoderTest, LengthAddressTest) {
+    auto test = PacketDecoderTest("03 00 01 06 07 03 00 01 05 0e", Packet::Framing::LENGTH);
+
+    test.m_decoder.setAddressing(true, 0x05);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_decodeIdx, test.m_data.size());
+    EXPECT_EQ(test.m_packet.getAddress(), 0x05);
+}
+
+TEST(PacketDecoderTest, ChannelTest) {
+    auto test = PacketDecoderTest("c0 01 01 02 70 c0 c0 01 00 02 65 c0");
+    uint8_t bulkData[15];
+    Packet bulk{LEN(bulkData), bulkData};
+    Packet* packets[] = {&test.m_packet, &bulk};
+
+    // Each channel's frames are decoded into that channel's packet.
+    test.m_decoder.setChannels(LEN(packets), packets);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_decoder.getPacket(), &bulk);
+    EXPECT_EQ(bulk.getCommand(), Command::PING);
+    EXPECT_TRUE(bulk.hasChannel());
+    EXPECT_EQ(bulk.getChannel(), 1);
+    EXPECT_EQ(bulk.getDataLength(), 1);
+    EXPECT_EQ(bulk.getData()[0], 0x02);
+    EXPECT_EQ(test.m_packet.getCommand(), 0);
+
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_decoder.getPacket(), &test.m_packet);
+    EXPECT_EQ(test.m_packet.getChannel(), 0);
+    EXPECT_EQ(test.m_packet.getDataLength(), 1);
+}
+
+TEST(PacketDecoderTest, ChannelUnknownTest) {
+    auto test = PacketDecoderTest("c0 01 02 55 ed c0 c0 01 00 02 65 c0");
+    Packet* packets[] = {&test.m_packet, nullptr};
+
+    // Frames for channels without a packet are ignored.
+    test.m_decoder.setChannels(LEN(packets), packets);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_decodeIdx, test.m_data.size());
+    EXPECT_EQ(test.m_packet.getChannel(), 0);
+    EXPECT_EQ(test.m_decoder.getDiscardedBytes(), 0);
+}
+
+TEST(PacketDecoderTest, LengthChannelTooMuchDataTest) {
+    auto test = PacketDecoderTest("05 00 01 01 10 11 5d 03 00 01 01 12", Packet::Framing::LENGTH);
+    uint8_t bulkData[2];
+    Packet bulk{LEN(bulkData), bulkData};
+    Packet* packets[] = {&test.m_packet, &bulk};
+
+    // The first frame fits in the control packet, but not the bulk packet.
+    test.m_decoder.setChannels(LEN(packets), packets);
+    EXPECT_EQ(test.decodeData(), Error::TOO_MUCH_DATA);
+    EXPECT_EQ(test.decodeData(), Error::NONE);
+    EXPECT_EQ(test.m_decodeIdx, test.m_data.size());
+    EXPECT_EQ(test.m_decoder.getPacket(), &bulk);
+    EXPECT_EQ(bulk.getDataLength(), 0);
+    EXPECT_EQ(test.m_decoder.getDiscardedBytes(), 5);
+}
+
 TEST(PacketDecoderTest, BadStateTest) {
     auto test = PacketDecoderTest("c0 00 01 07 c0");
     test.m_decoder.m_state = static_cast<PacketDecoder::State>(0x80);
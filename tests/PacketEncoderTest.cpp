@@ -34,7 +34,9 @@ class PacketEncoderTest {
     PacketEncoderTest(
         Command::Type cmd,  //!< [in] Command to include in the packet.
         char const* str,    //!< [in] ASCII Hex version of packet data.
-        bool debug = false  //!< [in] Enable debug?
+        bool debug = false,  //!< [in] Enable debug?
+        Packet::Framing framing = Packet::Framing::SLIP,  //!< [in] Framing to use.
+        Packet::CrcType crcType = Packet::CrcType::CRC8   //!< [in] Type of CRC to use.
         )
         : m_data(AsciiHexToBinary(str)),
           m_packet{LEN(this->m_packetData), this->m_packetData},
@@ -43,6 +45,8 @@ class PacketEncoderTest {
         this->m_packet.setData(this->m_data.size(), this->m_data.data());
         this->m_encodedData.clear();
         this->m_encoder.setDebug(debug);
+        this->m_encoder.setFraming(framing);
+        this->m_encoder.setCrcType(crcType);
         this->m_encoder.encodeStart(&this->m_packet);
         uint8_t nextByte;
         while (this->m_encoder.encodeByte(&nextByte) == Error::NOT_DONE) {
@@ -102,6 +106,230 @@ TEST(PacketEncoderTest, EscapeEscTest) {
     EXPECT_TRUE(test.matches("c0 db dd 02 03 e0 c0"));
 }
 
+TEST(PacketEncoderTest, SegmentsTest) {
+    uint8_t packetData[8];
+    Packet packet(LEN(packetData), packetData);
+    Packet::Segment segments[3];
+    packet.setSegmentStorage(LEN(segments), segments);
+
+    uint8_t seg1[] = {0x03, 0xc0};
+    uint8_t seg2[] = {0xdb, 0x04};
+
+    packet.setCommand(Command::PING);
+    packet.appendByte(0x02);
+    EXPECT_TRUE(packet.appendSegment(LEN(seg1), seg1));
+    EXPECT_TRUE(packet.appendSegment(0, nullptr));
+    EXPECT_TRUE(packet.appendSegment(LEN(seg2), seg2));
+    EXPECT_EQ(packet.getNumSegments(), 2);
+    EXPECT_EQ(packet.getTotalDataLength(), 5);
+
+    PacketEncoder encoder;
+    ByteBuffer encodedData;
+    encoder.encodeStart(&packet);
+    uint8_t nextByte;
+    while (encoder.encodeByte(&nextByte) == Error::NOT_DONE) {
+        encodedData.push_back(nextByte);
+    }
+    encodedData.push_back(nextByte);
+
+    // The encoded packet should be identical to one with contiguous data.
+    auto test = PacketEncoderTest(Command::PING, "02 03 c0 db 04");
+    EXPECT_EQ(encodedData, test.m_encodedData);
+}
+
+TEST(PacketEncoderTest, StatsTest) {
+    auto test = PacketEncoderTest(0xc0, "02 03");
+    BusStats stats;
+    test.m_encoder.setStats(&stats);
+
+    // The packet is encoded twice, to check that the byte count starts over.
+    for (int count = 0; count < 2; count++) {
+        test.m_encoder.encodeStart(&test.m_packet);
+        uint8_t nextByte;
+        while (test.m_encoder.encodeByte(&nextByte) == Error::NOT_DONE) {
+        }
+    }
+
+    // Each frame is "c0 db dc 02 03 ae c0", which adds 3 bytes of framing.
+    EXPECT_EQ(stats.txFrames.get(), 2);
+    EXPECT_EQ(stats.txBytes.get(), 14);
+    EXPECT_EQ(stats.txOverhead.get(), 6);
+}
+
+TEST(PacketEncoderTest, CobsNoDataTest) {
+    auto test = PacketEncoderTest(Command::PING, "", false, Packet::Framing::COBS);
+    EXPECT_TRUE(test.matches("00 03 01 07 00"));
+}
+
+TEST(PacketEncoderTest, CobsZeroDataTest) {
+    auto test = PacketEncoderTest(Command::PING, "00 02", false, Packet::Framing::COBS);
+    EXPECT_TRUE(test.matches("00 02 01 03 02 65 00"));
+}
+
+TEST(PacketEncoderTest, CobsZeroCommandTest) {
+    // SLIP special characters don't need escaping with COBS.
+    auto test = PacketEncoderTest(0x00, "c0 db", false, Packet::Framing::COBS);
+    EXPECT_TRUE(test.matches("00 01 04 c0 db e2 00"));
+}
+
+TEST(PacketEncoderTest, CobsLongRunTest) {
+    // A run of more than 254 non-zero bytes needs an extra code byte.
+    uint8_t packetData[300];
+    Packet packet(LEN(packetData), packetData);
+    packet.setCommand(Command::PING);
+    for (size_t i = 0; i < LEN(packetData); i++) {
+        packet.appendByte(0x55);
+    }
+
+    PacketEncoder encoder;
+    encoder.setFraming(Packet::Framing::COBS);
+    encoder.encodeStart(&packet);
+    ByteBuffer encodedData;
+    uint8_t nextByte;
+    while (encoder.encodeByte(&nextByte) == Error::NOT_DONE) {
+        encodedData.push_back(nextByte);
+    }
+    encodedData.push_back(nextByte);
+
+    // Delimiters + 302 frame bytes + 2 code bytes.
+    ASSERT_EQ(encodedData.size(), 2 + 302 + 2);
+    EXPECT_EQ(encodedData[0], 0x00);
+    EXPECT_EQ(encodedData[1], 0xff);
+    EXPECT_EQ(encodedData[2], Command::PING);
+    EXPECT_EQ(encodedData[256], 302 - 254 + 1);
+    EXPECT_EQ(encodedData[305], 0x00);
+}
+
+TEST(PacketEncoderTest, LengthNoDataTest) {
+    auto test = PacketEncoderTest(Command::PING, "", false, Packet::Framing::LENGTH);
+    EXPECT_TRUE(test.matches("02 00 01 07"));
+}
+
+TEST(PacketEncoderTest, LengthDataTest) {
+    auto test = PacketEncoderTest(0x00, "c0 db", false, Packet::Framing::LENGTH);
+    EXPECT_TRUE(test.matches("04 00 00 c0 db e2"));
+}
+
+TEST(PacketEncoderTest, Crc16NoDataTest) {
+    auto test = PacketEncoderTest(
+        Command::PING, "", false, Packet::Framing::SLIP, Packet::CrcType::CRC16);
+    EXPECT_TRUE(test.matches("c0 01 d1 f1 c0"));
+}
+
+TEST(PacketEncoderTest, Crc32cDataTest) {
+    auto test = PacketEncoderTest(
+        Command::PING, "02 03", false, Packet::Framing::SLIP, Packet::CrcType::CRC32C);
+    EXPECT_TRUE(test.matches("c0 01 02 03 1e f2 30 f1 c0"));
+}
+
+TEST(PacketEncoderTest, CrcNoneTest) {
+    auto test = PacketEncoderTest(
+        Command::PING, "02 03", false, Packet::Framing::SLIP, Packet::CrcType::NONE);
+    EXPECT_TRUE(test.matches("c0 01 02 03 c0"));
+}
+
+TEST(PacketEncoderTest, CrcNoneLengthTest) {
+    auto test = PacketEncoderTest(
+        Command::PING, "", false, Packet::Framing::LENGTH, Packet::CrcType::NONE);
+    EXPECT_TRUE(test.matches("01 00 01"));
+}
+
+TEST(PacketEncoderTest, AddressedTest) {
+    auto test = PacketEncoderTest(Command::PING, "");
+
+    // Packets without an address get the default address.
+    test.m_encodedData.clear();
+    test.m_encoder.setAddressing(true, 0x05);
+    test.m_encoder.encodeStart(&test.m_packet);
+    uint8_t nextByte;
+    while (test.m_encoder.encodeByte(&nextByte) == Error::NOT_DONE) {
+        test.m_encodedData.push_back(nextByte);
+    }
+    test.m_encodedData.push_back(nextByte);
+    EXPECT_TRUE(test.matches("c0 01 05 0e c0"));
+}
+
+TEST(PacketEncoderTest, AddressedPacketTest) {
+    auto test = PacketEncoderTest(Command::PING, "");
+
+    test.m_encodedData.clear();
+    test.m_packet.setAddress(0x07);
+    test.m_encoder.setAddressing(true, 0x05);
+    test.m_encoder.setFraming(Packet::Framing::LENGTH);
+    test.m_encoder.encodeStart(&test.m_packet);
+    uint8_t nextByte;
+    while (test.m_encoder.encodeByte(&nextByte) == Error::NOT_DONE) {
+        test.m_encodedData.push_back(nextByte);
+    }
+    test.m_encodedData.push_back(nextByte);
+    EXPECT_TRUE(test.matches("03 00 01 07 00"));
+}
+
+TEST(PacketEncoderTest, ChannelTest) {
+    auto test = PacketEncoderTest(Command::PING, "");
+
+    // Packets without a channel are sent on channel 0.
+    test.m_encodedData.clear();
+    test.m_encoder.setChannels(true);
+    test.m_encoder.encodeStart(&test.m_packet);
+    uint8_t nextByte;
+    while (test.m_encoder.encodeByte(&nextByte) == Error::NOT_DONE) {
+        test.m_encodedData.push_back(nextByte);
+    }
+    test.m_encodedData.push_back(nextByte);
+    EXPECT_TRUE(test.matches("c0 01 00 15 c0"));
+
+    test.m_encodedData.clear();
+    test.m_packet.setChannel(1);
+    test.m_encoder.setFraming(Packet::Framing::LENGTH);
+    test.m_encoder.encodeStart(&test.m_packet);
+    while (test.m_encoder.encodeByte(&nextByte) == Error::NOT_DONE) {
+        test.m_encodedData.push_back(nextByte);
+    }
+    test.m_encodedData.push_back(nextByte);
+    EXPECT_TRUE(test.matches("03 00 01 01 12"));
+}
+
+TEST(PacketEncoderTest, FramingOverheadTest) {
+    // A payload containing every byte value, so SLIP has to escape END and ESC, and COBS
+    // has a zero to encode.
+    uint8_t packetData[256];
+    Packet packet(LEN(packetData), packetData);
+    packet.setCommand(Command::PING);
+    for (size_t idx = 0; idx < LEN(packetData); idx++) {
+        packet.appendByte(static_cast<uint8_t>(idx));
+    }
+
+    struct {
+        Packet::Framing framing;  //!< Framing to measure.
+        size_t maxOverhead;       //!< Maximum number of bytes added by the framing.
+    } framings[] = {
+        // SLIP: 2 ENDs, 2 escapes, and possibly an escaped CRC.
+        {Packet::Framing::SLIP, 5},
+        // COBS: 2 delimiters and a code byte every 254 bytes.
+        {Packet::Framing::COBS, 4},
+        // LENGTH: a 16-bit length.
+        {Packet::Framing::LENGTH, 2},
+    };
+    size_t frameLen = 1 + packet.getDataLength() + Packet::crcSize(Packet::CrcType::CRC8);
+
+    // How fast each framing is, with a more realistic mix of payloads, is measured by
+    // BusBenchmark.cpp.
+    for (auto const& entry : framings) {
+        PacketEncoder encoder;
+        encoder.setFraming(entry.framing);
+        encoder.encodeStart(&packet);
+        uint8_t nextByte;
+        size_t encodedLen = 1;
+        while (encoder.encodeByte(&nextByte) == Error::NOT_DONE) {
+            encodedLen++;
+        }
+        EXPECT_GT(encodedLen, frameLen);
+        EXPECT_LE(encodedLen - frameLen, entry.maxOverhead);
+        EXPECT_LE(encodedLen, encoder.maxEncodedLength(packet.getDataLength()));
+    }
+}
+
 TEST(PacketEncoderTest, BadStateTest) {
     auto test = PacketEncoderTest(Command::PING, "");
 
@@ -61,6 +61,64 @@ TEST(PacketTest, UnrecognizedCommandTest) {
     pkt.dump("Test");
 }
 
+TEST(PacketTest, SegmentCrcTest) {
+    uint8_t pktData[16];
+    Packet pkt(LEN(pktData), pktData);
+    Packet::Segment segments[2];
+    pkt.setSegmentStorage(LEN(segments), segments);
+
+    uint8_t data[] = {0x11, 0x22, 0x33, 0x44, 0x55};
+    pkt.setCommand(Command::PING);
+    pkt.appendData(2, data);
+    pkt.appendSegment(3, &data[2]);
+    EXPECT_EQ(pkt.getDataLength(), 2);
+    EXPECT_EQ(pkt.getTotalDataLength(), 5);
+    pkt.dump("Test");
+
+    uint8_t contiguousData[16];
+    Packet contiguous(LEN(contiguousData), contiguousData);
+    contiguous.setCommand(Command::PING);
+    contiguous.setData(LEN(data), data);
+    EXPECT_EQ(pkt.calcCrc(), contiguous.calcCrc());
+
+    // Clearing the data also clears the segments.
+    pkt.setData(0, nullptr);
+    EXPECT_EQ(pkt.getNumSegments(), 0);
+    EXPECT_EQ(pkt.getTotalDataLength(), 0);
+}
+
+TEST(PacketTest, SegmentTooBigTest) {
+    uint8_t pktData[4];
+    Packet pkt(LEN(pktData), pktData);
+    Packet::Segment segments[2];
+    pkt.setSegmentStorage(LEN(segments), segments);
+
+    uint8_t data[] = {0x11, 0x22, 0x33, 0x44, 0x55};
+    pkt.appendByte(0x01);
+    EXPECT_FALSE(pkt.appendSegment(4, &data[0]));
+    EXPECT_EQ(pkt.getNumSegments(), 0);
+    EXPECT_EQ(pkt.getSpaceRemaining(), 3);
+    EXPECT_TRUE(pkt.appendSegment(3, &data[0]));
+    EXPECT_FALSE(pkt.appendSegment(1, &data[3]));
+    EXPECT_EQ(pkt.getTotalDataLength(), 4);
+
+    // Data can't be appended after a segment, so Packer sees no space.
+    EXPECT_EQ(pkt.getSpaceRemaining(), 0);
+}
+
+TEST(PacketDeathTest, AppendTooManySegmentsTest) {
+    uint8_t pktData[4];
+    Packet pkt(LEN(pktData), pktData);
+    Packet::Segment segments[1];
+    pkt.setSegmentStorage(LEN(segments), segments);
+
+    uint8_t data[] = {0x11, 0x22};
+    pkt.appendSegment(1, &data[0]);
+    ASSERT_DEATH(
+        { pkt.appendSegment(1, &data[1]); },
+        "Assertion `this->m_numSegments < this->m_maxSegments'");
+}
+
 TEST(PacketDeathTest, AppendTooManyBytesTest) {
     uint8_t pktData[4];
     Packet pkt(LEN(pktData), pktData);
@@ -96,3 +154,41 @@ TEST(PacketTest, AppendStrTest) {
 
     EXPECT_EQ(strVec, pktDataVec);
 }
+
+TEST(PacketTest, SwapTest) {
+    uint8_t pktData1[16];
+    uint8_t pktData2[16];
+    Packet pkt1(LEN(pktData1), pktData1);
+    Packet pkt2(LEN(pktData2), pktData2);
+    Packet::Segment segments[2];
+    pkt2.setSegmentStorage(LEN(segments), segments);
+
+    uint8_t data[] = {0x11, 0x22, 0x33};
+    pkt1.setCommand(Command::PING);
+    pkt1.setData(LEN(data), data);
+
+    pkt2.swap(pkt1);
+
+    EXPECT_EQ(pkt2.getCommand(), Command::PING);
+    EXPECT_EQ(pkt2.getDataLength(), LEN(data));
+    EXPECT_EQ(pkt2.getMaxDataLength(), LEN(pktData1));
+    EXPECT_EQ(pkt2.getData(), pktData1);
+
+    EXPECT_EQ(pkt1.getCommand(), 0);
+    EXPECT_EQ(pkt1.getDataLength(), 0);
+    EXPECT_EQ(pkt1.getMaxDataLength(), LEN(pktData2));
+    EXPECT_EQ(pkt1.getData(), pktData2);
+
+    // The segment storage stays with the packet it was given to.
+    uint8_t segmentData[] = {0x44};
+    EXPECT_TRUE(pkt2.appendSegment(LEN(segmentData), segmentData));
+    EXPECT_EQ(pkt2.getTotalDataLength(), LEN(data) + LEN(segmentData));
+}
+
+TEST(PacketDeathTest, SwapSizeTest) {
+    uint8_t pktData1[16];
+    uint8_t pktData2[8];
+    Packet pkt1(LEN(pktData1), pktData1);
+    Packet pkt2(LEN(pktData2), pktData2);
+    ASSERT_DEATH(pkt2.swap(pkt1), "Assertion `this->m_maxDataLen == other.m_maxDataLen'");
+}
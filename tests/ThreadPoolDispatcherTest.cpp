@@ -0,0 +1,195 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   ThreadPoolDispatcherTest.cpp
+ *
+ *   @brief  Tests for the ThreadPoolDispatcher class.
+ *
+ ****************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+#include "duino_bus/Bus.h"
+#include "duino_bus/PacketHandler.h"
+#include "duino_bus/ThreadPoolDispatcher.h"
+#include "duino_util/AsciiHex.h"
+#include "duino_util/Util.h"
+
+using Ordering = ThreadPoolDispatcher::Ordering;  //!< Convenience alias
+
+//! Bus which records the bytes written to it.
+class DispatchTestBus : public IBus {
+ public:
+    //! Constructor.
+    DispatchTestBus(
+        Packet* cmdPacket,  //!< [in] Place to store incoming packet.
+        Packet* rspPacket   //!< [in] Place to store response packet.
+        )
+        : IBus{cmdPacket, rspPacket} {
+        // Leaving out the CRC makes the expected output easier to read.
+        this->setCrcType(Packet::CrcType::NONE);
+    }
+
+    bool isDataAvailable() const override { return false; }
+    bool readByte(uint8_t*) override { return false; }
+    bool isSpaceAvailable() const override { return true; }
+    void writeByte(uint8_t byte) override { this->m_encodedData.push_back(byte); }
+
+    ByteBuffer m_encodedData;  //!< Place to store outgoing data.
+};
+
+//! Handler which echoes data[0] back, after sleeping for data[1] milliseconds.
+class SlowHandler : public IPacketHandler {
+ public:
+    bool handlePacket(Packet const& cmd, Packet* rsp) override {
+        if (cmd.getCommand() != 0x01) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(cmd.getData()[1]));
+        rsp->setCommand(0x01);
+        rsp->appendByte(cmd.getData()[0]);
+        return true;
+    }
+
+    char const* as_str(Packet::Command::Type cmd) const override {
+        (void)cmd;
+        return "???";
+    }
+};
+
+//! Test data used by individual tests.
+struct DispatchTestData {
+    //! Constructor.
+    explicit DispatchTestData(
+        size_t numThreads,  //!< [in] Number of worker threads.
+        Ordering ordering   //!< [in] Which commands need to be in order.
+        )
+        : m_cmdPacket{LEN(m_cmdData), m_cmdData},
+          m_rspPacket{LEN(m_rspData), m_rspData},
+          m_bus{&m_cmdPacket, &m_rspPacket},
+          m_dispatcher{m_bus, LEN(m_cmdData), numThreads, ordering} {
+        this->m_bus.add(this->m_handler);
+        this->m_bus.setDispatcher(&this->m_dispatcher);
+    }
+
+    //! Receives a command which is handled by SlowHandler.
+    void receive(
+        uint8_t value,   //!< [in] Value to echo back.
+        uint8_t delayMs  //!< [in] Time the handler takes.
+    ) {
+        uint8_t data[] = {value, delayMs};
+        this->m_cmdPacket.setCommand(0x01);
+        this->m_cmdPacket.setData(LEN(data), data);
+        EXPECT_TRUE(this->m_bus.handlePacket());
+    }
+
+    //! Services the bus until the expected number of responses have been written.
+    void waitForResponses(
+        size_t numResponses  //!< [in] Number of responses to wait for.
+    ) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (this->m_bus.m_encodedData.size() < numResponses * 4 &&
+               std::chrono::steady_clock::now() < deadline) {
+            if (!this->m_bus.serviceTx()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    }
+
+    uint8_t m_cmdData[16];              //!< Storage for command packet data.
+    uint8_t m_rspData[16];              //!< Storage for response packet data.
+    Packet m_cmdPacket;                 //!< Command packet.
+    Packet m_rspPacket;                 //!< Response packet.
+    DispatchTestBus m_bus;              //!< Bus that commands are received on.
+    SlowHandler m_handler;              //!< Packet handler.
+    ThreadPoolDispatcher m_dispatcher;  //!< Dispatcher being tested.
+};
+
+TEST(ThreadPoolDispatcherTest, BusOrderingTest) {
+    DispatchTestData test{4, Ordering::BUS};
+    test.receive(1, 20);
+    test.receive(2, 0);
+    test.receive(3, 10);
+    test.receive(4, 0);
+
+    // Nothing is written by handlePacket.
+    EXPECT_EQ(test.m_bus.m_encodedData.size(), 0);
+    test.waitForResponses(4);
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 01 01 c0 c0 01 02 c0 c0 01 03 c0 c0 01 04 c0"));
+}
+
+TEST(ThreadPoolDispatcherTest, StealTest) {
+    DispatchTestData test{2, Ordering::NONE};
+
+    // The commands are spread across both workers, so whichever command ends up queued
+    // behind the slow first command gets stolen by the other worker, rather than waiting.
+    test.receive(1, 200);
+    test.receive(2, 0);
+    test.receive(3, 0);
+    test.waitForResponses(3);
+    ASSERT_EQ(test.m_bus.m_encodedData.size(), 12);
+    ByteBuffer last(test.m_bus.m_encodedData.end() - 4, test.m_bus.m_encodedData.end());
+    EXPECT_EQ(last, AsciiHexToBinary("c0 01 01 c0"));
+}
+
+TEST(ThreadPoolDispatcherTest, LatencyTest) {
+    DispatchTestData test{1, Ordering::BUS};
+    IBus::CommandLatency latency[1];
+    test.m_bus.setLatencyTable(LEN(latency), latency);
+
+    // Dispatched commands are timed until their response is written, so the latency
+    // includes the time the handler took.
+    test.receive(1, 20);
+    EXPECT_EQ(test.m_bus.getLatency(0x01), nullptr);
+    test.waitForResponses(1);
+    LatencyHistogram* histogram = test.m_bus.getLatency(0x01);
+    ASSERT_NE(histogram, nullptr);
+    EXPECT_EQ(histogram->getCount(), 1);
+    EXPECT_GE(histogram->getMax(), 20000);
+}
+
+TEST(ThreadPoolDispatcherTest, TooBigTest) {
+    DispatchTestData test{1, Ordering::BUS};
+
+    // Commands which don't fit in the dispatcher's packets are handled inline.
+    uint8_t cmdData[32] = {5, 0};
+    Packet cmd{LEN(cmdData), cmdData};
+    cmd.setCommand(0x01);
+    cmd.getWriteData(LEN(cmdData));
+    EXPECT_FALSE(test.m_dispatcher.submit(*test.m_bus.getChannel(BusChannel::CONTROL), cmd));
+}
+
+TEST(ThreadPoolDispatcherTest, ChannelTest) {
+    DispatchTestData test{4, Ordering::BUS};
+    Packet* bulkQueue[1];
+    BusChannel bulk{BusChannel::BULK, nullptr, nullptr, LEN(bulkQueue), bulkQueue};
+    test.m_bus.addChannel(bulk);
+
+    // The responses are queued on the control channel, which only holds 2 of them, so
+    // the rest wait in the dispatcher until there's room.
+    for (uint8_t value = 1; value <= 4; value++) {
+        test.receive(value, 0);
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (test.m_bus.m_encodedData.size() < 4 * 5 &&
+           std::chrono::steady_clock::now() < deadline) {
+        if (!test.m_bus.serviceTx()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    EXPECT_EQ(
+        test.m_bus.m_encodedData,
+        AsciiHexToBinary("c0 01 00 01 c0 c0 01 00 02 c0 c0 01 00 03 c0 c0 01 00 04 c0"));
+}
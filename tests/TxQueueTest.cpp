@@ -0,0 +1,46 @@
+/****************************************************************************
+ *
+ *   @copyright Copyright (c) 2025 Dave Hylands     <dhylands@gmail.com>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the MIT License version as described in the
+ *   LICENSE file in the root of this repository.
+ *
+ ****************************************************************************/
+/**
+ *   @file   TxQueueTest.cpp
+ *
+ *   @brief  Tests for the TxQueue class.
+ *
+ ****************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include "duino_bus/TxQueue.h"
+
+TEST(TxQueueTest, OrderTest) {
+    TxQueue queue;
+    TxRequest request[4];
+
+    EXPECT_EQ(queue.pop(), nullptr);
+    EXPECT_FALSE(queue.hasIncoming());
+
+    EXPECT_TRUE(queue.push(&request[0]));
+    EXPECT_TRUE(queue.push(&request[1]));
+    EXPECT_TRUE(queue.hasIncoming());
+    EXPECT_FALSE(request[0].isSent());
+
+    // A request can't be queued twice.
+    EXPECT_FALSE(queue.push(&request[0]));
+
+    EXPECT_EQ(queue.pop(), &request[0]);
+    EXPECT_FALSE(queue.hasIncoming());
+
+    // Requests pushed while others have been taken by pop come out after them.
+    EXPECT_TRUE(queue.push(&request[2]));
+    EXPECT_TRUE(queue.push(&request[3]));
+    EXPECT_EQ(queue.pop(), &request[1]);
+    EXPECT_EQ(queue.pop(), &request[2]);
+    EXPECT_EQ(queue.pop(), &request[3]);
+    EXPECT_EQ(queue.pop(), nullptr);
+}
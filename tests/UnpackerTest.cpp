@@ -33,10 +33,10 @@ class UnpackerTest {
         this->m_unpacker.setData(this->m_packet);
     }
 
-    ByteBuffer m_hexData;      //!< ASCII Hex version of packet data.
-    uint8_t m_packetData[64];  //!< Storage for the packet data.
-    Packet m_packet;           //!< Packet we're unpacking data from.
-    Unpacker m_unpacker;       //!< Unpacket which unpacks the data.
+    ByteBuffer m_hexData;                 //!< ASCII Hex version of packet data.
+    alignas(8) uint8_t m_packetData[64];  //!< Storage for the packet data.
+    Packet m_packet;                      //!< Packet we're unpacking data from.
+    Unpacker m_unpacker;                  //!< Unpacket which unpacks the data.
 };
 
 TEST(UnpackerTest, Unpack1Test) {
@@ -160,3 +160,129 @@ TEST(UnpackerTest, UnpackNoDataTest) {
     EXPECT_FALSE(test.m_unpacker.unpack(&data16));
     EXPECT_FALSE(test.m_unpacker.unpack(&data32));
 }
+
+TEST(UnpackerTest, UnpackAllTest) {
+    UnpackerTest test("11 22 33 44 55 66 77");
+
+    uint8_t data8;
+    uint16_t data16;
+    uint32_t data32;
+
+    EXPECT_TRUE(test.m_unpacker.unpackAll(&data8, &data16, &data32));
+    EXPECT_EQ(data8, 0x11);
+    EXPECT_EQ(data16, 0x3322);
+    EXPECT_EQ(data32, 0x77665544);
+    EXPECT_FALSE(test.m_unpacker.unpack(&data8));
+}
+
+TEST(UnpackerTest, UnpackAllNoDataTest) {
+    UnpackerTest test("11 22 33 44 55 66");
+
+    uint8_t data8 = 0;
+    uint16_t data16 = 0;
+    uint32_t data32 = 0;
+
+    // Not enough data, so nothing should be unpacked.
+    EXPECT_FALSE(test.m_unpacker.unpackAll(&data8, &data16, &data32));
+    EXPECT_EQ(data8, 0);
+    EXPECT_EQ(data16, 0);
+    EXPECT_EQ(data32, 0);
+
+    EXPECT_TRUE(test.m_unpacker.unpackAll(&data16, &data32));
+    EXPECT_EQ(data16, 0x2211);
+    EXPECT_EQ(data32, 0x66554433);
+}
+
+TEST(UnpackerTest, UnpackArrayTest) {
+    UnpackerTest test("03 00 11 22 33 44 fe ff 55");
+
+    int16_t samples[4];
+    size_t count;
+
+    EXPECT_TRUE(test.m_unpacker.unpackArray(LEN(samples), samples, &count));
+    EXPECT_EQ(count, 3);
+    EXPECT_EQ(samples[0], 0x2211);
+    EXPECT_EQ(samples[1], 0x4433);
+    EXPECT_EQ(samples[2], -2);
+
+    uint8_t data8;
+    EXPECT_TRUE(test.m_unpacker.unpack(&data8));
+    EXPECT_EQ(data8, 0x55);
+}
+
+TEST(UnpackerTest, UnpackArrayTooSmallTest) {
+    UnpackerTest test("03 00 11 22 33 44 55 66");
+
+    int16_t samples[2];
+    size_t count;
+
+    // Array doesn't fit in samples, so nothing should be unpacked.
+    EXPECT_FALSE(test.m_unpacker.unpackArray(LEN(samples), samples, &count));
+
+    uint16_t data16;
+    EXPECT_TRUE(test.m_unpacker.unpack(&data16));
+    EXPECT_EQ(data16, 3);
+}
+
+TEST(UnpackerTest, UnpackArrayTruncatedTest) {
+    UnpackerTest test("03 00 11 22 33 44");
+
+    int16_t samples[4];
+    size_t count;
+
+    EXPECT_FALSE(test.m_unpacker.unpackArray(LEN(samples), samples, &count));
+}
+
+TEST(UnpackerTest, UnpackViewTest) {
+    UnpackerTest test("02 00 11 22 33 44");
+
+    uint16_t const* samples;
+    size_t count;
+
+    // The packet data is aligned, so the 16-bit samples which follow the count are too.
+    EXPECT_TRUE(test.m_unpacker.unpackView(&samples, &count));
+    EXPECT_EQ(count, 2);
+    EXPECT_EQ(samples, reinterpret_cast<uint16_t const*>(&test.m_packetData[2]));
+    EXPECT_EQ(samples[0], 0x2211);
+    EXPECT_EQ(samples[1], 0x4433);
+}
+
+TEST(UnpackerTest, UnpackViewUnalignedTest) {
+    UnpackerTest test("11 02 00 11 22 33 44");
+
+    uint8_t data8;
+    uint16_t const* samples;
+    size_t count;
+
+    EXPECT_TRUE(test.m_unpacker.unpack(&data8));
+
+    // The samples start at an odd offset, so a view can't be used.
+    EXPECT_FALSE(test.m_unpacker.unpackView(&samples, &count));
+
+    uint16_t copy[2];
+    EXPECT_TRUE(test.m_unpacker.unpackArray(LEN(copy), copy, &count));
+    EXPECT_EQ(copy[1], 0x4433);
+}
+
+TEST(UnpackerTest, UnpackVarintTest) {
+    UnpackerTest test("01 ac 02 ff ff ff ff 0f 03 02 ff ff ff ff 0f 80");
+
+    uint32_t value;
+    int32_t signedValue;
+
+    EXPECT_TRUE(test.m_unpacker.unpackVarint(&value));
+    EXPECT_EQ(value, 1);
+    EXPECT_TRUE(test.m_unpacker.unpackVarint(&value));
+    EXPECT_EQ(value, 300);
+    EXPECT_TRUE(test.m_unpacker.unpackVarint(&value));
+    EXPECT_EQ(value, UINT32_MAX);
+    EXPECT_TRUE(test.m_unpacker.unpackSignedVarint(&signedValue));
+    EXPECT_EQ(signedValue, -2);
+    EXPECT_TRUE(test.m_unpacker.unpackSignedVarint(&signedValue));
+    EXPECT_EQ(signedValue, 1);
+    EXPECT_TRUE(test.m_unpacker.unpackSignedVarint(&signedValue));
+    EXPECT_EQ(signedValue, INT32_MIN);
+
+    // The last varint is truncated.
+    EXPECT_FALSE(test.m_unpacker.unpackVarint(&value));
+}
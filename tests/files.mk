@@ -1,11 +1,22 @@
 # NOTE: DeathTest.cpp comes from duino_util
+# NOTE: HeapHooksTest.cpp is built by the test-heap-hooks target in the top level Makefile
+# NOTE: BusBenchmark.cpp is built by the bench target in the top level Makefile
 
 TEST_SOURCES_CPP += \
+	BulkPacketHandlerTest.cpp \
+	BusLogTest.cpp \
 	BusTest.cpp \
 	CorePacketHandlerTest.cpp \
+	CrcTest.cpp \
 	DeathTest.cpp \
+	EventPacketHandlerTest.cpp \
+	HeapStatsTest.cpp \
+	LatencyHistogramTest.cpp \
+	LogRingTest.cpp \
 	PackerTest.cpp \
 	PacketDecoderTest.cpp \
 	PacketEncoderTest.cpp \
 	PacketTest.cpp \
+	ThreadPoolDispatcherTest.cpp \
+	TxQueueTest.cpp \
 	UnpackerTest.cpp
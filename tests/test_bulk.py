@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+"""
+Tests for bulk.py
+"""
+
+from typing import List, Union
+import unittest
+
+from duino_bus.bulk import ACK_NAK, BULK_ACK, BULK_DATA, BULK_READ, BULK_WRITE, BulkTransfer
+from duino_bus.bus import IBus, STREAM_END
+from duino_bus.packer import Packer
+from duino_bus.packet import ErrorCode, Packet
+from duino_bus.unpacker import Unpacker
+
+
+# Note: If the class name starts with Test then pytest thinks it's a test class
+#       which is why we use `TstBus` instead.
+class TstBus(IBus):
+    """Test Bus - records the packets written, and replies with queued packets."""
+
+    def __init__(self, rsp_pkts: List[Packet]) -> None:
+        super().__init__()
+        self.written = []
+        for rsp_pkt in rsp_pkts:
+            self.recv_queue.put(rsp_pkt)
+
+    def is_open(self) -> bool:
+        """Returns True if the bus has been opened."""
+        return True
+
+    def write_packet(self, pkt: Packet) -> int:
+        """Records a packet which was written to the bus."""
+        self.written.append(pkt)
+        return ErrorCode.NONE
+
+
+def make_start_rsp(cmd: int, offset: int, end_offset: int, chunk_size: int) -> Packet:
+    """Creates a response to a BULK_READ or BULK_WRITE command."""
+    pkt = Packet(cmd)
+    packer = Packer(pkt)
+    packer.pack_u8(0)
+    packer.pack_u32(offset)
+    packer.pack_u32(end_offset)
+    packer.pack_u16(chunk_size)
+    return pkt
+
+
+def make_data(offset: int, data: Union[bytes, bytearray]) -> Packet:
+    """Creates a BULK_DATA packet."""
+    pkt = Packet(BULK_DATA)
+    packer = Packer(pkt)
+    packer.pack_u32(offset)
+    packer.pack_data(data)
+    return pkt
+
+
+def make_ack(offset: int, flags: int) -> Packet:
+    """Creates a BULK_ACK packet."""
+    pkt = Packet(BULK_ACK)
+    packer = Packer(pkt)
+    packer.pack_u32(offset)
+    packer.pack_u8(flags)
+    return pkt
+
+
+def unpack_ack(pkt: Packet) -> List[int]:
+    """Returns the offset and flags from a BULK_ACK packet."""
+    unpacker = Unpacker(pkt.get_data())
+    return [unpacker.unpack_u32(), unpacker.unpack_u8()]
+
+
+class TestBulk(unittest.TestCase):
+
+    def test_read(self):
+        blob = bytes(range(30))
+        bus = TstBus([
+            make_start_rsp(BULK_READ, 0, 30, 12),
+            make_data(0, blob[0:12]),
+            make_data(24, blob[24:30]),  # Out of order
+            make_data(12, blob[12:24]),
+            make_data(24, blob[24:30]),
+            Packet(STREAM_END, b'\x40\x05\x00\x00\x00'),
+        ])
+        bulk = BulkTransfer(bus, window=2, timeout=0.01)
+        err, data = bulk.read(1)
+        self.assertEqual(err, ErrorCode.NONE)
+        self.assertEqual(data, blob)
+        self.assertEqual(bus.written[0].get_command(), BULK_READ)
+        acks = [unpack_ack(pkt) for pkt in bus.written[1:]]
+        self.assertEqual(acks, [[12, 0], [12, ACK_NAK], [24, 0], [30, 0]])
+
+    def test_read_sink(self):
+        bus = TstBus([
+            make_start_rsp(BULK_READ, 4, 8, 12),
+            make_data(4, b'\x04\x05\x06\x07'),
+            Packet(STREAM_END, b'\x40\x02\x00\x00\x00'),
+        ])
+        chunks = []
+        bulk = BulkTransfer(bus, timeout=0.01)
+        err, data = bulk.read(1,
+                              offset=4,
+                              sink=lambda offset, chunk: chunks.append((offset, chunk)))
+        self.assertEqual(err, ErrorCode.NONE)
+        self.assertEqual(len(data), 0)
+        self.assertEqual(chunks, [(4, b'\x04\x05\x06\x07')])
+
+    def test_read_truncated(self):
+        bus = TstBus([
+            make_start_rsp(BULK_READ, 0, 30, 12),
+            make_data(0, bytes(12)),
+            Packet(STREAM_END, b'\x40\x02\x00\x00\x00'),
+        ])
+        bulk = BulkTransfer(bus, timeout=0.01)
+        err, data = bulk.read(1)
+        self.assertEqual(err, ErrorCode.TOO_SMALL)
+        self.assertEqual(len(data), 12)
+
+    def test_write(self):
+        blob = bytes(range(30))
+        bus = TstBus([
+            make_start_rsp(BULK_WRITE, 0, 30, 12),
+            make_ack(12, ACK_NAK),
+            make_ack(24, 0),
+            make_ack(30, 0),
+        ])
+        bulk = BulkTransfer(bus, window=2, timeout=0.01)
+        self.assertEqual(bulk.write(1, blob), ErrorCode.NONE)
+        self.assertEqual(bus.written[0].get_command(), BULK_WRITE)
+        offsets = [Unpacker(pkt.get_data()).unpack_u32() for pkt in bus.written[1:]]
+        # The NAK causes the second chunk to be resent.
+        self.assertEqual(offsets, [0, 12, 12, 24])
+        self.assertEqual(bus.written[-1].get_data()[4:], blob[24:30])
+
+    def test_write_timeout(self):
+        bus = TstBus([make_start_rsp(BULK_WRITE, 0, 30, 12)])
+        bulk = BulkTransfer(bus, window=2, timeout=0.01)
+        self.assertEqual(bulk.write(1, bytes(30)), ErrorCode.TIMEOUT)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -7,7 +7,12 @@ import binascii
 from typing import Union
 import unittest
 
-from duino_bus.bus import IBus
+from duino_bus.bus import (BATCH, EVENT, EVENT_STATUS_FULL, EVENT_STATUS_OK, EVENT_SUBSCRIBE,
+                           EVENT_UNSUBSCRIBE, LATENCY, LATENCY_RESET, LOG_ALL_MODULES, LOG_BATCH,
+                           LOG_BINARY, LOG_CONFIG, LOG_FORMAT, LOG_LEVEL_INFO, LOG_LEVEL_NONE,
+                           LOG_TIMED, STATS, STATS_RESET, STREAM_END, TELEMETRY,
+                           TELEMETRY_FIELDS, TELEMETRY_KEYFRAME, TELEMETRY_SUBSCRIBE, IBus,
+                           latency_bucket_lower_bound, log_level_mask)
 from duino_bus.packet import ErrorCode, Packet
 
 
@@ -127,4 +132,181 @@ class TestBus(unittest.TestCase):
         err, pkt = bus.send_command_get_response(packet)
         print('----- End debug -----')
         self.assertEqual(err, ErrorCode.TIMEOUT)
-        self.assertEqual(pkt, None)
\ No newline at end of file
+        self.assertEqual(pkt, None)
+
+    def test_make_batch(self):
+        pkt = IBus.make_batch([Packet(1, b'\xaa\xbb'), Packet(5)])
+        self.assertEqual(pkt.get_command(), BATCH)
+        self.assertEqual(pkt.get_data(), bytearray(b'\x01\x02\xaa\xbb\x05\x00'))
+
+    def test_make_batch_too_big(self):
+        with self.assertRaises(ValueError):
+            IBus.make_batch([Packet(1, bytearray(256))])
+
+    def test_split_batch(self):
+        rsps = IBus.split_batch(Packet(BATCH, b'\x01\x02\xaa\xbb\x00\x00'))
+        self.assertEqual(len(rsps), 2)
+        self.assertEqual(rsps[0].get_command(), 1)
+        self.assertEqual(rsps[0].get_data(), bytearray(b'\xaa\xbb'))
+        self.assertEqual(rsps[1].get_command(), 0)
+        self.assertEqual(rsps[1].get_data_len(), 0)
+
+    def test_send_command_get_stream(self):
+        bus = TstBus('')
+        bus.recv_queue.put(Packet(0x10, b'\x00'))
+        bus.recv_queue.put(Packet(0x10, b'\x01'))
+        bus.recv_queue.put(Packet(STREAM_END, b'\x10\x02\x00\x00\x00'))
+        err, rsps = bus.send_command_get_stream(Packet(0x10, b'\x02'))
+        self.assertEqual(err, ErrorCode.NONE)
+        self.assertEqual([rsp.get_data() for rsp in rsps], [b'\x00', b'\x01'])
+
+    def test_send_command_get_stream_lost_packet(self):
+        bus = TstBus('')
+        bus.recv_queue.put(Packet(0x10, b'\x00'))
+        bus.recv_queue.put(Packet(STREAM_END, b'\x10\x02\x00\x00\x00'))
+        err, rsps = bus.send_command_get_stream(Packet(0x10, b'\x02'))
+        self.assertEqual(err, ErrorCode.TOO_SMALL)
+        self.assertEqual(len(rsps), 1)
+
+    def test_process_binary_log(self):
+        bus = TstBus('')
+        bus.process_packet(Packet(LOG_FORMAT, b'\x00\x00\x0ax=%d s=%s\x00'))
+        with self.assertLogs('duino_bus.bus', level='INFO') as logs:
+            bus.process_packet(Packet(LOG_BINARY, b'\x04\x00\x00\xfe\xff\xff\xff\x03ab\x00'))
+            bus.process_packet(Packet(LOG_BINARY, b'\x02\x01\x00'))
+        self.assertEqual(logs.output, [
+            'INFO:duino_bus.bus:x=-2 s=ab',
+            'ERROR:duino_bus.bus:Binary log message with unknown format ID 1',
+        ])
+
+    def test_process_log_batch(self):
+        bus = TstBus('')
+        with self.assertLogs('duino_bus.bus', level='INFO') as logs:
+            bus.process_packet(
+                    Packet(LOG_BATCH, b'\x02\x00\x00\x00'
+                           b'\x03\x04\x04\x02a\x00\x03\x04\x02\x02b\x00'))
+            bus.process_packet(Packet(LOG_BATCH, b'\x02\x00\x00\x00\x03\x04\x04\x02c\x00'))
+        self.assertEqual(logs.output, [
+            'WARNING:duino_bus.bus:Device dropped 2 log messages',
+            'INFO:duino_bus.bus:a',
+            'ERROR:duino_bus.bus:b',
+            'INFO:duino_bus.bus:c',
+        ])
+
+    def test_process_log_batch_reset(self):
+        bus = TstBus('')
+        bus.log_dropped = 5
+        with self.assertLogs('duino_bus.bus', level='INFO') as logs:
+            # The device was reset, so it's counting from zero again.
+            bus.process_packet(Packet(LOG_BATCH, b'\x02\x00\x00\x00\x03\x04\x04\x02a\x00'))
+            bus.process_packet(Packet(LOG_BATCH, b'\x00\x00\x00\x00\x03\x04\x04\x02b\x00'))
+        self.assertEqual(logs.output, [
+            'WARNING:duino_bus.bus:Device dropped 2 log messages',
+            'INFO:duino_bus.bus:a',
+            'INFO:duino_bus.bus:b',
+        ])
+        self.assertEqual(bus.log_dropped, 0)
+
+    def test_process_log_timed(self):
+        bus = TstBus('')
+        with self.assertLogs('duino_bus.bus', level='INFO') as logs:
+            bus.process_packet(Packet(LOG_TIMED, b'\x39\x30\x00\x00\x03\x04\x02a\x00'))
+        self.assertEqual(logs.output, ['INFO:duino_bus.bus:[12.345] a'])
+
+    def test_log_level_mask(self):
+        self.assertEqual(log_level_mask(LOG_LEVEL_NONE), 0x00)
+        self.assertEqual(log_level_mask(LOG_LEVEL_INFO), 0x1e)
+
+    def test_send_log_config(self):
+        bus = TstBus('')
+        bus.recv_queue.put(Packet(LOG_CONFIG, b'\x00\x00\x1e\x00'))
+        err, masks = bus.send_log_config([(LOG_ALL_MODULES, 0), (2, 0x1e)])
+        self.assertEqual(err, ErrorCode.NONE)
+        self.assertEqual(masks, [0, 0, 0x1e, 0])
+        self.assertEqual(bus.rsp_data[:6], b'\xc0\x0c\xff\x00\x02\x1e')
+
+    def test_send_event_subscribe(self):
+        bus = TstBus('')
+        bus.recv_queue.put(Packet(EVENT_SUBSCRIBE, bytes([EVENT_STATUS_OK, EVENT_STATUS_FULL])))
+        err, statuses = bus.send_event_subscribe([(0x0102, 100), (3, EVENT_UNSUBSCRIBE)])
+        self.assertEqual(err, ErrorCode.NONE)
+        self.assertEqual(statuses, [EVENT_STATUS_OK, EVENT_STATUS_FULL])
+        self.assertEqual(bus.rsp_data[:10], b'\xc0\x0e\x02\x01\x64\x00\x03\x00\xff\xff')
+
+    def test_send_telemetry_subscribe(self):
+        bus = TstBus('')
+        bus.recv_queue.put(Packet(TELEMETRY_SUBSCRIBE, b'\xe8\x03\x14'))
+        err, num_values = bus.send_telemetry_subscribe(1000)
+        self.assertEqual(err, ErrorCode.NONE)
+        self.assertEqual(num_values, len(TELEMETRY_FIELDS))
+        self.assertEqual(TELEMETRY_FIELDS[-1], 'unhandled')
+        self.assertEqual(bus.rsp_data[:4], b'\xc0\x0f\xe8\x03')
+
+    def test_send_stats(self):
+        bus = TstBus('')
+        bus.recv_queue.put(Packet(STATS, b'\x0c\x03\xac\x02' + bytes(9) + b'\x07'))
+        err, stats = bus.send_stats(reset=True)
+        self.assertEqual(err, ErrorCode.NONE)
+        self.assertEqual(stats['rx_frames'], 3)
+        self.assertEqual(stats['rx_bytes'], 300)
+        self.assertEqual(stats['unhandled'], 0)
+        self.assertEqual(stats['11'], 7)
+        self.assertEqual(bus.rsp_data[:3], bytes([0xc0, STATS, STATS_RESET]))
+
+    def test_latency_bucket_lower_bound(self):
+        self.assertEqual(latency_bucket_lower_bound(3), 3)
+        self.assertEqual(latency_bucket_lower_bound(8), 8)
+        self.assertEqual(latency_bucket_lower_bound(9), 10)
+        self.assertEqual(latency_bucket_lower_bound(35), 896)
+        self.assertEqual(latency_bucket_lower_bound(63), 114688)
+
+    def test_send_latency_commands(self):
+        bus = TstBus('')
+        bus.recv_queue.put(Packet(LATENCY, b'\x01\x05'))
+        err, commands = bus.send_latency_commands()
+        self.assertEqual(err, ErrorCode.NONE)
+        self.assertEqual(commands, [0x01, 0x05])
+        self.assertEqual(bus.rsp_data[:2], bytes([0xc0, LATENCY]))
+
+    def test_send_latency(self):
+        bus = TstBus('')
+        bus.recv_queue.put(Packet(LATENCY, b'\x01\x03\xf2\x07\x02\x03\x01\x23\x02'))
+        err, latency = bus.send_latency(0x01, reset=True)
+        self.assertEqual(err, ErrorCode.NONE)
+        self.assertEqual(latency, {
+            'count': 3,
+            'max_us': 1010,
+            'buckets': {3: 1, 896: 2},
+            'truncated': False
+        })
+        self.assertEqual(bus.rsp_data[:4], bytes([0xc0, LATENCY, 0x01, LATENCY_RESET]))
+
+    def test_send_latency_truncated(self):
+        bus = TstBus('')
+        bus.recv_queue.put(Packet(LATENCY, b'\x01\x03\xf2\x07\x01\x03\x01'))
+        err, latency = bus.send_latency(0x01)
+        self.assertEqual(err, ErrorCode.NONE)
+        self.assertEqual(latency['buckets'], {3: 1})
+        self.assertTrue(latency['truncated'])
+
+    def test_telemetry(self):
+        bus = TstBus('')
+        records = []
+        bus.telemetry_callback = records.append
+
+        # Deltas are ignored until a keyframe arrives.
+        bus.process_packet(Packet(TELEMETRY, b'\x00\x02\x02\x01'))
+        self.assertIsNone(bus.telemetry)
+        bus.process_packet(Packet(TELEMETRY, bytes([TELEMETRY_KEYFRAME]) + b'\x02\xac\x02\x05'))
+        bus.process_packet(Packet(TELEMETRY, b'\x00\x02\x02\x01'))
+        self.assertEqual(records, [[300, 5], [301, 4]])
+        self.assertEqual(bus.telemetry, [301, 4])
+
+    def test_event(self):
+        bus = TstBus('')
+        events = []
+        bus.event_callback = lambda event_id, value: events.append((event_id, value))
+        bus.process_packet(Packet(EVENT, b'\x01\x00\x01\x0a\x02\x00\x02\x14\x00'))
+        self.assertEqual(events, [(1, b'\x0a'), (2, b'\x14\x00')])
+        self.assertEqual(bus.event_values, {1: b'\x0a', 2: b'\x14\x00'})
+        self.assertTrue(bus.recv_queue.empty())
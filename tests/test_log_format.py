@@ -0,0 +1,37 @@
+#!/usr/bin/env python3
+"""
+Tests for log_format.py
+"""
+
+import binascii
+import unittest
+
+from duino_bus.log_format import format_log
+from duino_bus.unpacker import Unpacker
+
+
+def format_hex(fmt: str, data_str: str) -> str:
+    """Formats a binary log message whose arguments are given as ASCII hex."""
+    return format_log(fmt, Unpacker(binascii.unhexlify(data_str.replace(' ', ''))))
+
+
+class TestLogFormat(unittest.TestCase):
+
+    def test_ints(self):
+        self.assertEqual(format_hex('%d %u', 'fe ff ff ff fe ff ff ff'), '-2 4294967294')
+        self.assertEqual(format_hex('%04x|%-3X|', '2a 00 00 00 0b 00 00 00'), '002a|B  |')
+        self.assertEqual(format_hex('%lld', 'ff ff ff ff ff ff ff ff'), '-1')
+        self.assertEqual(format_hex('%hhx %hd', 'ff ff ff ff ff ff ff ff'), 'ff -1')
+
+    def test_star(self):
+        self.assertEqual(format_hex('%*d', '03 00 00 00 05 00 00 00'), '  5')
+        self.assertEqual(format_hex('%.*s', '02 00 00 00 03 61 62 00'), 'ab')
+
+    def test_other(self):
+        self.assertEqual(format_hex('%c%s%%', '41 03 78 79 00'), 'Axy%')
+        self.assertEqual(format_hex('%.2f', '00 00 00 00 00 00 f8 3f'), '1.50')
+        self.assertEqual(format_hex('%p', '34 12 00 00 00 00 00 00'), '0x1234')
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -35,6 +35,22 @@ class TestPacker(unittest.TestCase):
         packer.pack_data(b'ABC')
         self.assertEqual(packer.data, b'ABC')
 
+    def test_pack_array(self):
+        packer = Packer()
+        packer.pack_array('h', [0x2211, 0x4433, -2])
+        self.assertEqual(packer.data, b'\x03\x00\x11\x22\x33\x44\xfe\xff')
+
+    def test_pack_varint(self):
+        packer = Packer()
+        packer.pack_varint(1)
+        packer.pack_varint(300)
+        packer.pack_varint(0xffffffff)
+        packer.pack_signed_varint(-2)
+        packer.pack_signed_varint(1)
+        packer.pack_signed_varint(-0x80000000)
+        self.assertEqual(packer.data,
+                         b'\x01\xac\x02\xff\xff\xff\xff\x0f\x03\x02\xff\xff\xff\xff\x0f')
+
     def test_pack_multiple(self):
         packer = Packer()
         packer.pack_u8(0x11)
@@ -68,7 +68,8 @@ class TestPacketDecoder(unittest.TestCase):
         pkt = self.parse_packet('c0 01 08 c0', ErrorCode.CRC)
         self.assertEqual(pkt.cmd, 1)
         self.assertEqual(len(pkt.data), 0)
-        self.assertEqual(self.decoder.state, PacketDecoder.STATE_IDLE)
+        # The END which terminates the bad packet also starts the next one.
+        self.assertEqual(self.decoder.state, PacketDecoder.STATE_COMMAND)
 
     def test_pkt_no_data_esc_end(self):
         pkt = self.parse_packet('c0 db dc 4e c0', ErrorCode.NONE)
@@ -111,6 +112,128 @@ class TestPacketDecoder(unittest.TestCase):
         pkt = self.parse_packet('c0 aa 02 03 48', ErrorCode.TOO_MUCH_DATA)
         Packet.MAX_DATA_LEN = save_max_data
 
+    def test_cobs_no_data(self):
+        self.decoder.set_framing(Packet.FRAMING_COBS)
+        pkt = self.parse_packet('00 03 01 07 00', ErrorCode.NONE)
+        self.assertEqual(pkt.cmd, 1)
+        self.assertEqual(len(pkt.data), 0)
+
+    def test_cobs_zero_data(self):
+        self.decoder.set_framing(Packet.FRAMING_COBS)
+        pkt = self.parse_packet('00 00 02 01 03 02 65 00', ErrorCode.NONE)
+        self.assertEqual(pkt.cmd, 1)
+        self.assertEqual(pkt.data, bytearray([0, 2]))
+
+    def test_cobs_zero_cmd(self):
+        self.decoder.set_framing(Packet.FRAMING_COBS)
+        pkt = self.parse_packet('00 01 04 c0 db e2 00', ErrorCode.NONE)
+        self.assertEqual(pkt.cmd, 0)
+        self.assertEqual(pkt.data, bytearray([0xc0, 0xdb]))
+
+    def test_cobs_truncated(self):
+        self.decoder.set_framing(Packet.FRAMING_COBS)
+        self.parse_packet('00 04 01 07 00', ErrorCode.CRC)
+        self.parse_packet('03 01 07 00', ErrorCode.NONE)
+
+    def test_cobs_too_small(self):
+        self.decoder.set_framing(Packet.FRAMING_COBS)
+        self.parse_packet('00 02 01 00', ErrorCode.TOO_SMALL)
+
+    def test_length_data(self):
+        self.decoder.set_framing(Packet.FRAMING_LENGTH)
+        pkt = self.parse_packet('04 00 00 c0 db e2', ErrorCode.NONE)
+        self.assertEqual(pkt.cmd, 0)
+        self.assertEqual(pkt.data, bytearray([0xc0, 0xdb]))
+
+    def test_length_too_small(self):
+        self.decoder.set_framing(Packet.FRAMING_LENGTH)
+        self.parse_packet('01 00', ErrorCode.TOO_SMALL)
+        self.parse_packet('02 02 00 01 07', ErrorCode.NONE)
+
+    def test_length_too_much_data(self):
+        self.decoder.set_framing(Packet.FRAMING_LENGTH)
+        save_max_data = Packet.MAX_DATA_LEN
+        Packet.MAX_DATA_LEN = 2
+        self.parse_packet('04 00', ErrorCode.TOO_MUCH_DATA)
+        Packet.MAX_DATA_LEN = save_max_data
+        # The oversized packet is skipped, and the following packet is decoded.
+        pkt = self.parse_packet('01 02 03 04 02 00 01 07', ErrorCode.NONE)
+        self.assertEqual(pkt.cmd, 1)
+
+    def test_crc_16(self):
+        self.decoder.set_crc_type(Packet.CRC_16)
+        pkt = self.parse_packet('c0 01 d1 f1 c0', ErrorCode.NONE)
+        self.assertEqual(pkt.cmd, 1)
+        self.assertEqual(pkt.get_crc(), 0xf1d1)
+        self.parse_packet('c0 01 d1 f2 c0', ErrorCode.CRC)
+
+    def test_crc_32c(self):
+        self.decoder.set_crc_type(Packet.CRC_32C)
+        pkt = self.parse_packet('c0 01 02 03 1e f2 30 f1 c0', ErrorCode.NONE)
+        self.assertEqual(pkt.data, bytearray([2, 3]))
+        self.assertEqual(pkt.get_crc(), 0xf130f21e)
+
+    def test_crc_none(self):
+        self.decoder.set_framing(Packet.FRAMING_COBS)
+        self.decoder.set_crc_type(Packet.CRC_NONE)
+        pkt = self.parse_packet('00 02 01 00', ErrorCode.NONE)
+        self.assertEqual(pkt.cmd, 1)
+        self.assertEqual(len(pkt.data), 0)
+
+    def test_too_much_data_resync(self):
+        data = ' '.join(['55'] * (Packet.MAX_DATA_LEN + 1))
+        self.parse_packet(f'c0 01 {data}', ErrorCode.TOO_MUCH_DATA)
+        pkt = self.parse_packet('aa c0 01 07 c0', ErrorCode.NONE)
+        self.assertEqual(pkt.cmd, 1)
+        self.assertEqual(self.decoder.discarded_bytes, Packet.MAX_DATA_LEN + 3)
+
+    def test_crc_error_resync(self):
+        self.parse_packet('c0 01 08 c0', ErrorCode.CRC)
+        pkt = self.parse_packet('01 07 c0', ErrorCode.NONE)
+        self.assertEqual(pkt.cmd, 1)
+        self.assertEqual(self.decoder.discarded_bytes, 2)
+
+    def test_address_match(self):
+        self.decoder.set_addressing(True, 0x05)
+        pkt = self.parse_packet('c0 01 05 02 24 c0', ErrorCode.NONE)
+        self.assertEqual(pkt.get_address(), 0x05)
+        self.assertEqual(pkt.data, bytearray([2]))
+
+    def test_address_other_node(self):
+        self.decoder.set_addressing(True, 0x05)
+        self.parse_packet('c0 01 06 07 c0', ErrorCode.NOT_DONE)
+        pkt = self.parse_packet('c0 01 ff e6 c0', ErrorCode.NONE)
+        self.assertEqual(pkt.get_address(), Packet.BROADCAST_ADDRESS)
+        self.assertEqual(self.decoder.discarded_bytes, 0)
+
+    def test_cobs_address_other_node(self):
+        self.decoder.set_framing(Packet.FRAMING_COBS)
+        self.decoder.set_addressing(True, 0x05)
+        self.parse_packet('00 04 01 06 07 00', ErrorCode.NOT_DONE)
+        pkt = self.parse_packet('04 01 05 0e 00', ErrorCode.NONE)
+        self.assertEqual(pkt.get_address(), 0x05)
+
+    def test_channel(self):
+        self.decoder.set_channels(True)
+        pkt = self.parse_packet('c0 01 01 02 70 c0', ErrorCode.NONE)
+        self.assertEqual(pkt.get_channel(), Packet.CHANNEL_BULK)
+        self.assertEqual(pkt.data, bytearray([2]))
+
+    def test_address_channel(self):
+        self.decoder.set_addressing(True, 0x05)
+        self.decoder.set_channels(True)
+        pkt = self.parse_packet('c0 01 05 01 02 cd c0', ErrorCode.NONE)
+        self.assertEqual(pkt.get_address(), 0x05)
+        self.assertEqual(pkt.get_channel(), Packet.CHANNEL_BULK)
+        self.assertEqual(pkt.data, bytearray([2]))
+
+    def test_length_channel(self):
+        self.decoder.set_framing(Packet.FRAMING_LENGTH)
+        self.decoder.set_channels(True)
+        pkt = self.parse_packet('04 00 01 00 02 65', ErrorCode.NONE)
+        self.assertEqual(pkt.get_channel(), Packet.CHANNEL_CONTROL)
+        self.assertEqual(pkt.data, bytearray([2]))
+
     def test_bad_state(self):
         self.decoder.state = 255
         pkt = self.parse_packet('c0', ErrorCode.BAD_STATE)
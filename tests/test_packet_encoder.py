@@ -75,6 +75,82 @@ class TestPacket(unittest.TestCase):
         err, _ = self.encoder.encode_byte()
         self.assertEqual(err, ErrorCode.BAD_STATE)
 
+    def test_cobs_zero_data(self):
+        self.encoder.set_framing(Packet.FRAMING_COBS)
+        pkt = Packet(1, b'\x00\x02')
+        self.write_packet(pkt)
+        self.assertEqual(self.as_str(), '00 02 01 03 02 65 00')
+
+    def test_cobs_long_run(self):
+        self.encoder.set_framing(Packet.FRAMING_COBS)
+        pkt = Packet(1, b'\x55' * 300)
+        self.write_packet(pkt)
+        self.assertEqual(len(self.data), 2 + 302 + 2)
+        self.assertEqual(self.data[1], 0xff)
+        self.assertEqual(self.data[256], 302 - 254 + 1)
+
+    def test_length_data(self):
+        self.encoder.set_framing(Packet.FRAMING_LENGTH)
+        pkt = Packet(0, b'\xc0\xdb')
+        self.write_packet(pkt)
+        self.assertEqual(self.as_str(), '04 00 00 c0 db e2')
+
+    def test_crc_16(self):
+        self.encoder.set_crc_type(Packet.CRC_16)
+        pkt = Packet(1)
+        self.write_packet(pkt)
+        self.assertEqual(self.as_str(), 'c0 01 d1 f1 c0')
+
+    def test_crc_32c(self):
+        self.encoder.set_crc_type(Packet.CRC_32C)
+        pkt = Packet(1, b'\x02\x03')
+        self.write_packet(pkt)
+        self.assertEqual(self.as_str(), 'c0 01 02 03 1e f2 30 f1 c0')
+
+    def test_crc_none(self):
+        self.encoder.set_framing(Packet.FRAMING_LENGTH)
+        self.encoder.set_crc_type(Packet.CRC_NONE)
+        pkt = Packet(1)
+        self.write_packet(pkt)
+        self.assertEqual(self.as_str(), '01 00 01')
+
+    def test_addressed(self):
+        self.encoder.set_addressing(True, 0x05)
+        pkt = Packet(1)
+        self.write_packet(pkt)
+        self.assertEqual(self.as_str(), 'c0 01 05 0e c0')
+
+    def test_addressed_packet(self):
+        self.encoder.set_addressing(True, 0x05)
+        self.encoder.set_framing(Packet.FRAMING_LENGTH)
+        pkt = Packet(1)
+        pkt.set_address(0x07)
+        self.write_packet(pkt)
+        self.assertEqual(self.as_str(), '03 00 01 07 00')
+
+
+    def test_channel(self):
+        self.encoder.set_channels(True)
+        pkt = Packet(1)
+        self.write_packet(pkt)
+        self.assertEqual(self.as_str(), 'c0 01 00 15 c0')
+
+    def test_channel_packet(self):
+        self.encoder.set_channels(True)
+        self.encoder.set_framing(Packet.FRAMING_LENGTH)
+        pkt = Packet(1)
+        pkt.set_channel(Packet.CHANNEL_BULK)
+        self.write_packet(pkt)
+        self.assertEqual(self.as_str(), '03 00 01 01 12')
+
+    def test_address_channel(self):
+        self.encoder.set_addressing(True, 0x05)
+        self.encoder.set_channels(True)
+        pkt = Packet(1, bytearray([2]))
+        pkt.set_channel(Packet.CHANNEL_BULK)
+        self.write_packet(pkt)
+        self.assertEqual(self.as_str(), 'c0 01 05 01 02 cd c0')
+
 
 if __name__ == '__main__':
     unittest.main()
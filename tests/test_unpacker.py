@@ -24,6 +24,19 @@ class TestUnPacker(unittest.TestCase):
         unpacker = Unpacker(b'ABC')
         self.assertEqual(unpacker.unpack_data(3), b'ABC')
 
+    def test_unpack_varint(self):
+        unpacker = Unpacker(b'\x01\xac\x02\xff\xff\xff\xff\x0f\x03\x02')
+        self.assertEqual(unpacker.unpack_varint(), 1)
+        self.assertEqual(unpacker.unpack_varint(), 300)
+        self.assertEqual(unpacker.unpack_varint(), 0xffffffff)
+        self.assertEqual(unpacker.unpack_signed_varint(), -2)
+        self.assertEqual(unpacker.unpack_signed_varint(), 1)
+
+    def test_unpack_array(self):
+        unpacker = Unpacker(b'\x03\x00\x11\x22\x33\x44\xfe\xff\x55')
+        self.assertEqual(unpacker.unpack_array('h'), [0x2211, 0x4433, -2])
+        self.assertEqual(unpacker.unpack_u8(), 0x55)
+
     def test_unpack_multiple(self):
         unpacker = Unpacker(b'\x11\x22\x11\x44\x33\x22\x11\x04ABC\x00')
         self.assertEqual(unpacker.unpack_u8(), 0x11)